@@ -1,9 +1,33 @@
 #include <iostream>             // cout, cerr
 #include <cstdlib>              // EXIT_FAILURE
+#include <cstring>              // strcmp
+#include <cstdio>               // fopen, remove
+#include <string>               // string
+#include <thread>               // this_thread::sleep_for, hardware_concurrency
+#include <chrono>               // duration, steady_clock
+#include <vector>               // vector
+#include <algorithm>            // max, copy
+#include <atomic>               // atomic
+#include <functional>           // function
+#include <random>               // mt19937, uniform_real_distribution
+#include <limits>               // numeric_limits
+#include <iterator>             // begin, end
 #include <GL/glew.h>            // GLEW library
 #include <GLFW/glfw3.h>         // GLFW library
 #include "camera.h" // Camera class
 #include "meshes.h" // Basic shape meshes
+#include "renderer.h" // Multi-draw-indirect scene submission
+#include "scene.h" // Scene objects and materials
+#include "scenegen.h" // Seeded procedural scenes
+#include "scenefile.h" // Scene description files
+#include "scenestream.h" // Streaming of scene cells around the camera
+#include "shaders.h" // Shader program variants
+#include "assetwatcher.h" // Hot reload of changed shader and texture files
+#include "framepipeline.h" // Render packets built on a worker thread
+#include "jobs.h" // Work-stealing job system
+#include "allocators.h" // Frame arena, pool allocator and heap allocation count
+#include "gpumemory.h" // GPU memory accounting and texture residency
+#include "texturestream.h" // Texture levels streamed by on-screen size
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -14,37 +38,62 @@
 
 using namespace std; // Standard namespace
 
-/*Shader program Macro*/
-#ifndef GLSL
-#define GLSL(Version, Source) "#version " #Version " core \n" #Source
-#endif
-
 // Unnamed namespace
 namespace
 {
     const char* const WINDOW_TITLE = "Vincent Snow - CS 330 Project"; // Macro for window title
     bool gOrtho = false;
+    bool gPackedVertices = false; // Use the compressed 16 byte vertex layout (--packed-vertices)
+    bool gBenchNormals = false; // Time the vertex stage with both normal matrix paths, then exit (--bench-normals)
+    bool gBenchJobs = false; // Time the job system's workloads from 1 to all threads, then exit (--bench-jobs)
+    bool gBenchTransforms = false; // Time the SIMD transform update against glm products, then exit (--bench-transforms)
+    bool gBenchBvh = false; // Time the scene hierarchy's build, refit, culling and picking against linear scans, then exit (--bench-bvh)
+    bool gBenchOcclusion = false; // Time the draw list build with and without the CPU occlusion test, then exit (--bench-occlusion)
+    unsigned gThreadCount = 0; // Threads running jobs, 0 for one per hardware thread (--threads N)
+    bool gCheckAllocations = false; // Count the heap allocations of steady-state frames, then exit (--check-allocations)
+    bool gShaderCache = true; // Reuse program binaries from earlier launches (--no-shader-cache disables)
+    bool gReportGpuMemory = false; // Print the GPU memory of every buffer and texture each second (--gpu-memory)
 
     // Variables for window width and height
     const int WINDOW_WIDTH = 800;
     const int WINDOW_HEIGHT = 800;
 
-    // Stores the GL data relative to a given mesh
-    struct GLMesh
-    {
-        GLuint vao;         // Handle for the vertex array object
-        GLuint vbo[2];         // Handles for the vertex buffer object
-        GLuint nVertices;    // Number of indices of the mesh
-        GLuint nIndices;
-    };
-
     // Main GLFW window
     GLFWwindow* gWindow = nullptr;
     // Use meshes from the included Meshes.cpp file
     Meshes meshes;
-    // Shader programs
-    GLuint gProgramId;
-    GLuint gLightProgramId;
+    // Objects of the desk scene and the renderer that submits them
+    Scene gScene;
+    // Replaces the desk scene with a procedural one of --generate N objects
+    SceneGenerator gSceneGenerator;
+    bool gGenerateScene = false;
+    // Scene description files: loaded instead of the desk scene (--scene), written after the scene is placed (--save-scene)
+    const char* gSceneFile = nullptr;
+    const char* gSaveSceneFile = nullptr;
+    bool gSaveBinaryScene = false;
+    // Splits the scene into cells and keeps only those around the camera resident (--stream-cells SIZE)
+    SceneStreamer gSceneStreamer;
+    bool gStreamScene = false;
+    Renderer gRenderer;
+    // Runs the CPU work of loading and of building frames across cores
+    JobSystem gJobs;
+    // Builds the next frame's render packet on a worker while the current one is drawn
+    FramePipeline gFramePipeline;
+    // Shader programs: variants of the Phong program and the light program
+    ShaderLibrary gShaders;
+    ShaderLibrary gLightShaders;
+    // Shader files (relative to exe file's directory, like the textures)
+    const char* const PHONG_VERTEX_SHADER = "../resources/shaders/phong.vert";
+    const char* const PHONG_FRAGMENT_SHADER = "../resources/shaders/phong.frag";
+    const char* const LIGHT_VERTEX_SHADER = "../resources/shaders/light.vert";
+    const char* const LIGHT_FRAGMENT_SHADER = "../resources/shaders/light.frag";
+    // Uniforms of each program, indexing the locations the libraries look up once per program
+    enum PhongUniform { PHONG_VIEW, PHONG_PROJECTION, PHONG_AMBIENT_STRENGTH, PHONG_AMBIENT_COLOR, PHONG_LIGHT1_COLOR,
+        PHONG_LIGHT1_POSITION, PHONG_LIGHT2_COLOR, PHONG_LIGHT2_POSITION, PHONG_TEXTURE, PHONG_UV_SCALE, PHONG_SELECTED_OBJECT };
+    const char* const PHONG_UNIFORMS[] = { "view", "projection", "ambientStrength", "ambientColor", "light1Color",
+        "light1Position", "light2Color", "light2Position", "uTexture", "uvScale", "selectedObject" };
+    enum LightUniform { LIGHT_MODEL, LIGHT_VIEW, LIGHT_PROJECTION };
+    const char* const LIGHT_UNIFORMS[] = { "model", "view", "projection" };
     // Textures
     GLuint gTextureIdTwine;
     GLuint gTextureIdWoodtable;
@@ -54,6 +103,45 @@ namespace
     GLuint gTextureIdCandle;
     GLuint gTextureIdMetal;
     GLuint gTextureIdGlass;
+    // Texture files (relative to exe file's directory) and the textures they are loaded into
+    struct TextureFile
+    {
+        const char* path;
+        GLuint* textureId;
+    };
+    // Pixels of an image file decoded on the CPU, before they are uploaded to a texture
+    struct DecodedImage
+    {
+        unsigned char* pixels = nullptr;
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        const char* path = nullptr; // File it was decoded from
+    };
+    const TextureFile TEXTURE_FILES[] =
+    {
+        { "../resources/textures/twine_tex.jpg", &gTextureIdTwine },
+        { "../resources/textures/woodtable.jpg", &gTextureIdWoodtable },
+        { "../resources/textures/woodsticks.jpg", &gTextureIdWoodsticks },
+        { "../resources/textures/amethyst_tex.jpg", &gTextureIdAmethyst },
+        { "../resources/textures/red_tex.jpg", &gTextureIdRedMarble },
+        { "../resources/textures/candle_tex.png", &gTextureIdCandle },
+        { "../resources/textures/metal_tex.jpg", &gTextureIdMetal },
+        { "../resources/textures/glass_tex.jpg", &gTextureIdGlass },
+    };
+    // Texture files reduced over the GPU memory budget and drawn again: a background job decodes the file, then it is uploaded whole
+    struct TextureRestore
+    {
+        bool decoding = false;
+        DecodedImage image; // Written by the job
+        JobCounter decoded;
+    };
+    TextureRestore gTextureRestores[sizeof(TEXTURE_FILES) / sizeof(TEXTURE_FILES[0])];
+    // Streams the texture files' mip levels as their objects grow on screen (--no-texture-streaming loads them whole before the first frame)
+    TextureStreamer gTextureStreamer;
+    bool gStreamTextures = true;
+    // Reports shader and texture files changed on disk
+    AssetWatcher gAssetWatcher;
     glm::vec2 gUVScale(1.0f, 1.0f); // Scale of the textures
     GLint gTexWrapMode = GL_REPEAT; // Tile the textures
     // camera
@@ -61,10 +149,22 @@ namespace
     float gLastX = WINDOW_WIDTH / 2.0f;
     float gLastY = WINDOW_HEIGHT / 2.0f;
     bool gFirstMouse = true;
-
-    // timing
-    float gDeltaTime = 0.0f; // time between current frame and last frame
-    float gLastFrame = 0.0f;
+    // Scene object picked with the left mouse button, Bvh::NO_HIT for none
+    std::uint32_t gSelectedObject = Bvh::NO_HIT;
+
+    // timing: the simulation advances in fixed steps, rendering interpolates between the last two
+    const double SIMULATION_STEP = 1.0 / 120.0; // seconds simulated by one update
+    const double MAX_FRAME_TIME = 0.25; // longer frames are clamped so the updates can catch up
+    glm::vec3 gPreviousCameraPosition; // camera position before the last update
+    // frame pacing
+    bool gVsync = true; // Wait for the vertical blank on swap (--no-vsync disables)
+    double gFrameCap = 0.0; // Maximum frames per second, 0 for uncapped (--frame-cap N)
+    bool gBusyWait = false; // Spin instead of sleeping until the frame cap's deadline (--busy-wait)
+    // allocation check: frames that size every buffer and arena, then frames that must not allocate
+    const int ALLOCATION_WARMUP_FRAMES = 120;
+    const int ALLOCATION_CHECK_FRAMES = 600;
+    size_t gAllocationCount = 0; // Heap allocations made up to the end of the last frame
+    bool gAllocationCheckFailed = false;
 
 }
 
@@ -77,143 +177,40 @@ int main(int argc, char* argv[]);
  */
 bool UInitialize(int, char* [], GLFWwindow** window);
 void UResizeWindow(GLFWwindow* window, int width, int height);
-void UProcessInput(GLFWwindow* window);
+void UProcessInput(GLFWwindow* window, float deltaTime);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
-void URender();
-bool UCreateTexture(const char* filename, GLuint& textureId);
+void UCreateScene();
+SceneMaterial UTexturedMaterial(GLuint textureId);
+void UCameraMatrices(float alpha, glm::mat4& view, glm::mat4& projection);
+void URender(const Renderer::RenderPacket& packet);
+void UPaceFrame(double frameStart);
+void UCountAllocations(int frame);
+void UUpdateTextureResidency();
+void UDrawMesh(const Meshes::GLMesh& mesh);
+bool UDecodeImage(const char* filename, DecodedImage& image);
+void UFreeImage(DecodedImage& image);
+bool UCreateTexture(const DecodedImage& image, GLuint& textureId);
+bool UUploadImage(const DecodedImage& image, GLuint textureId);
+bool UUploadTexture(const char* filename, GLuint textureId);
+void UReloadChangedAssets();
 void UDestroyTexture(GLuint textureId);
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
-void UDestroyShaderProgram(GLuint programId);
+void USetSceneUniforms(GLuint programId, const glm::mat4& view, const glm::mat4& projection);
+bool UBenchmarkNormalMatrices();
+void UReplicateDeskScene(Scene& scene, int nCopies);
+double UTimeBest(int nRuns, const std::function<void()>& workload);
+void UStopJobClients();
+void UBenchmarkJobs();
+void UBenchmarkTransforms();
+void UBenchmarkBvh();
+void UBenchmarkOcclusion();
+bool UCheckSceneFiles();
+void UCursorRay(glm::vec3& origin, glm::vec3& direction);
+float URayObject(const SceneObject& object, const glm::vec3& origin, const glm::vec3& direction, float maxDistance);
+void UPickObject();
 
 
-/* Vertex Shader Source Code*/
-const GLchar* vertexShaderSource = GLSL(440,
-    layout(location = 0) in vec3 vertexPosition; // VAP position 0 for vertex position data
-layout(location = 1) in vec3 vertexNormal; // VAP position 1 for normals
-layout(location = 2) in vec2 textureCoordinate;
-layout(location = 3) in vec4 color;  // Color data from Vertex Attrib Pointer 1
-
-out vec2 vertexTextureCoordinate; // transfer texture data to fragment shader
-out vec4 vertexColor; // variable to transfer color data to the fragment shader
-out vec3 vertexFragmentNormal; // For outgoing normals to fragment shader
-out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
-
-//Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-void main()
-{
-    gl_Position = projection * view * model * vec4(vertexPosition, 1.0f); // transforms vertices to clip coordinates
-    vertexColor = color; // references incoming color data
-    vertexTextureCoordinate = textureCoordinate; // references texture data
-    vertexFragmentPos = vec3(model * vec4(vertexPosition, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
-    vertexFragmentNormal = mat3(transpose(inverse(model))) * vertexNormal; // get normal vectors in world space only and exclude normal translation properties
-}
-);
-
-
-/* Fragment Shader Source Code*/
-const GLchar* fragmentShaderSource = GLSL(440,
-    in vec4 vertexColor; // Variable to hold incoming color data from vertex shader
-    in vec3 vertexFragmentNormal; // For incoming normals
-in vec3 vertexFragmentPos; // For incoming fragment position
-in vec2 vertexTextureCoordinate; // Variable to hold texture data
-out vec4 fragmentColor;
-
-//Uniform variables
-uniform vec4 objectColor;
-uniform vec3 ambientColor;
-uniform vec3 light1Color;
-uniform vec3 light1Position;
-uniform vec3 light2Color;
-uniform vec3 light2Position;
-uniform vec3 viewPosition;
-uniform sampler2D uTexture; // Useful when working with multiple textures
-uniform vec2 uvScale;
-uniform bool ubHasTexture;
-uniform float ambientStrength = 1.0f; // Set ambient or global lighting strength
-uniform float specularIntensity1 = 1.0f; // Front light
-uniform float highlightSize1 = 16.0f;
-uniform float specularIntensity2 = 1.0f; // Back light
-uniform float highlightSize2 = 16.0f;
-
-void main()
-{
-    /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
-
-    //Calculate Ambient lighting
-    vec3 ambient = ambientStrength * ambientColor; // Generate ambient light color
-
-    //**Calculate Diffuse lighting**
-    vec3 norm = normalize(vertexFragmentNormal); // Normalize vectors to 1 unit
-    vec3 light1Direction = normalize(light1Position - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-    float impact1 = max(dot(norm, light1Direction), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-    vec3 diffuse1 = impact1 * light1Color; // Generate diffuse light color
-    vec3 light2Direction = normalize(light2Position - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
-    float impact2 = max(dot(norm, light2Direction), 0.0);// Calculate diffuse impact by generating dot product of normal and light
-    vec3 diffuse2 = impact2 * light2Color; // Generate diffuse light color
-
-    //**Calculate Specular lighting**
-    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
-    vec3 reflectDir1 = reflect(-light1Direction, norm);// Calculate reflection vector
-    //Calculate specular component
-    float specularComponent1 = pow(max(dot(viewDir, reflectDir1), 0.0), highlightSize1);
-    vec3 specular1 = specularIntensity1 * specularComponent1 * light1Color;
-    vec3 reflectDir2 = reflect(-light2Direction, norm);// Calculate reflection vector
-    //Calculate specular component
-    float specularComponent2 = pow(max(dot(viewDir, reflectDir2), 0.0), highlightSize2);
-    vec3 specular2 = specularIntensity2 * specularComponent2 * light2Color;
-
-    //**Calculate phong result**
-    //Texture holds the color to be used for all three components
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
-    vec3 phong1;
-    vec3 phong2;
-
-    if (ubHasTexture == true)
-    {
-        phong1 = (ambient + diffuse1 + specular1) * textureColor.xyz;
-        phong2 = (ambient + diffuse2 + specular2) * textureColor.xyz;
-    }
-    else
-    {
-        phong1 = (ambient + diffuse1 + specular1) * objectColor.xyz;
-        phong2 = (ambient + diffuse2 + specular2) * objectColor.xyz;
-    }
-
-    fragmentColor = vec4(phong1 + phong2, 1.0); // Send lighting results to GPU
-    //fragmentColor = texture(uTexture, vertexTextureCoordinate); // Sends texture to the GPU for rendering
-}
-);
-
-/* Light Object Shader Source Code*/
-const GLchar* lightVertexShaderSource = GLSL(330,
-    layout(location = 0) in vec3 aPos;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-void main()
-{
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-}
-);
-
-/* Light Object Shader Source Code*/
-const GLchar* lightFragmentShaderSource = GLSL(330,
-    out vec4 FragColor;
-
-void main()
-{
-    FragColor = vec4(1.0); // set all 4 vector values to 1.0
-}
-);
-
 // Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
 void flipImageVertically(unsigned char* image, int width, int height, int channels)
 {
@@ -236,74 +233,218 @@ void flipImageVertically(unsigned char* image, int width, int height, int channe
 // Main function for OpenGL Program
 int main(int argc, char* argv[])
 {
+    // Command line options
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--packed-vertices") == 0)
+            gPackedVertices = true;
+        else if (strcmp(argv[i], "--no-gpu-culling") == 0)
+            gRenderer.gpuCulling = false;
+        else if (strcmp(argv[i], "--bench-normals") == 0)
+            gBenchNormals = true;
+        else if (strcmp(argv[i], "--no-shader-cache") == 0)
+            gShaderCache = false;
+        else if (strcmp(argv[i], "--no-vsync") == 0)
+            gVsync = false;
+        else if (strcmp(argv[i], "--frame-cap") == 0 && i + 1 < argc)
+            gFrameCap = atof(argv[++i]);
+        else if (strcmp(argv[i], "--busy-wait") == 0)
+            gBusyWait = true;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            gThreadCount = (unsigned)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc)
+        {
+            gGenerateScene = true;
+            gSceneGenerator.objectCount = (size_t)atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            gSceneGenerator.seed = (std::uint64_t)strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--materials") == 0 && i + 1 < argc)
+            gSceneGenerator.materialCount = (size_t)atoll(argv[++i]);
+        else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+            gSceneGenerator.lightCount = (size_t)atoll(argv[++i]);
+        else if (strcmp(argv[i], "--bench-jobs") == 0)
+            gBenchJobs = true;
+        else if (strcmp(argv[i], "--check-allocations") == 0)
+            gCheckAllocations = true;
+        else if (strcmp(argv[i], "--bench-transforms") == 0)
+            gBenchTransforms = true;
+        else if (strcmp(argv[i], "--bench-bvh") == 0)
+            gBenchBvh = true;
+        else if (strcmp(argv[i], "--no-cpu-occlusion") == 0)
+            gRenderer.cpuOcclusion = false;
+        else if (strcmp(argv[i], "--bench-occlusion") == 0)
+            gBenchOcclusion = true;
+        else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+            gSceneFile = argv[++i];
+        else if ((strcmp(argv[i], "--save-scene") == 0 || strcmp(argv[i], "--save-binary-scene") == 0) && i + 1 < argc)
+        {
+            gSaveBinaryScene = strcmp(argv[i], "--save-binary-scene") == 0;
+            gSaveSceneFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stream-cells") == 0 && i + 1 < argc)
+        {
+            gStreamScene = true;
+            gSceneStreamer.cellSize = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stream-radius") == 0 && i + 1 < argc)
+            gSceneStreamer.loadRadius = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--stream-budget") == 0 && i + 1 < argc)
+            gSceneStreamer.budgetBytes = (size_t)atoll(argv[++i]) << 20;
+        else if (strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc)
+            UGpuMemory().budgetBytes = (size_t)atoll(argv[++i]) << 20;
+        else if (strcmp(argv[i], "--gpu-memory") == 0)
+            gReportGpuMemory = true;
+        else if (strcmp(argv[i], "--no-texture-streaming") == 0)
+            gStreamTextures = false;
+        else if (strcmp(argv[i], "--texels-per-pixel") == 0 && i + 1 < argc)
+            gTextureStreamer.texelsPerPixel = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--check-scene-files") == 0)
+            return UCheckSceneFiles() ? EXIT_SUCCESS : EXIT_FAILURE; // Needs no window either
+        else if (strcmp(argv[i], "--convert-scene") == 0 && i + 2 < argc)
+        {
+            // Needs no window: convert and exit
+            auto start = std::chrono::steady_clock::now();
+            if (!UConvertSceneFile(argv[i + 1], argv[i + 2]))
+                return EXIT_FAILURE;
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            cout << "Converted " << argv[i + 1] << " to " << argv[i + 2] << " in " << elapsed << " ms" << endl;
+            return EXIT_SUCCESS;
+        }
+    }
+
     if (!UInitialize(argc, argv, &gWindow))
         return EXIT_FAILURE;
 
+    // This thread runs jobs too while it waits for them
+    gJobs.Start(gThreadCount);
+    gRenderer.jobs = &gJobs;
+
     // Create the mesh
-    meshes.CreateMeshes(); // Calls the function to create the Vertex Buffer Object
+    meshes.CreateMeshes(gPackedVertices, &gJobs); // Generates the meshes in parallel, then creates the Vertex Buffer Object
 
-    // Create the shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
+    // Create the shader programs; the Phong variants are compiled once the scene's materials are known
+    gShaders.baseFeatures = (2 << SHADER_LIGHT_COUNT_SHIFT) | (gPackedVertices ? SHADER_PACKED_VERTICES : 0);
+    if (!gShaders.Create(PHONG_VERTEX_SHADER, PHONG_FRAGMENT_SHADER))
         return EXIT_FAILURE;
-
-    if (!UCreateShaderProgram(lightVertexShaderSource, lightFragmentShaderSource, gLightProgramId))
+    if (!gLightShaders.Create(LIGHT_VERTEX_SHADER, LIGHT_FRAGMENT_SHADER))
         return EXIT_FAILURE;
-
-    // Load textures (relative to exe file's directory)
-    const char* twine_tex = "../resources/textures/twine_tex.jpg";
-    if (!UCreateTexture(twine_tex, gTextureIdTwine))
+    if (gShaderCache)
     {
-        cout << "Failed to load texture " << twine_tex << endl;
-        return EXIT_FAILURE;
+        gShaders.cacheDirectory = "../shader_cache"; // relative to exe file's directory, like the textures
+        gLightShaders.cacheDirectory = "../shader_cache";
     }
-    const char* table_tex = "../resources/textures/woodtable.jpg";
-    if (!UCreateTexture(table_tex, gTextureIdWoodtable))
+    gShaders.uniformNames.assign(std::begin(PHONG_UNIFORMS), std::end(PHONG_UNIFORMS));
+    gLightShaders.uniformNames.assign(std::begin(LIGHT_UNIFORMS), std::end(LIGHT_UNIFORMS));
+
+    // Only submitted here: the driver compiles it while the textures load
+    gLightShaders.RequestProgram(0);
+
+    // Load textures: streamed, decoded by jobs while the frames start with placeholders,
+    // or the files are decoded in parallel, then uploaded from this thread
+    const size_t nTextures = sizeof(TEXTURE_FILES) / sizeof(TEXTURE_FILES[0]);
+    if (gStreamTextures)
     {
-        cout << "Failed to load texture " << table_tex << endl;
-        return EXIT_FAILURE;
+        for (const TextureFile& texture : TEXTURE_FILES)
+        {
+            glGenTextures(1, texture.textureId);
+            gTextureStreamer.Add(texture.path, *texture.textureId);
+        }
+        gTextureStreamer.Start(gJobs);
+        gRenderer.measureTextures = true;
     }
-    const char* sticks_tex = "../resources/textures/woodsticks.jpg";
-    if (!UCreateTexture(sticks_tex, gTextureIdWoodsticks))
+    else
     {
-        cout << "Failed to load texture " << sticks_tex << endl;
-        return EXIT_FAILURE;
+        DecodedImage images[nTextures];
+        gJobs.ParallelFor(nTextures, 1, [&images](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+                UDecodeImage(TEXTURE_FILES[i].path, images[i]);
+        });
+        bool texturesLoaded = true;
+        for (size_t i = 0; i < nTextures; ++i)
+        {
+            if (texturesLoaded && !UCreateTexture(images[i], *TEXTURE_FILES[i].textureId))
+            {
+                cout << "Failed to load texture " << TEXTURE_FILES[i].path << endl;
+                texturesLoaded = false;
+            }
+            UFreeImage(images[i]);
+        }
+        if (!texturesLoaded)
+            return EXIT_FAILURE;
     }
-    const char* pyramid_tex = "../resources/textures/amethyst_tex.jpg";
-    if (!UCreateTexture(pyramid_tex, gTextureIdAmethyst))
+
+    // Scene files name the textures by their paths
+    std::vector<const char*> textureNames;
+    std::vector<GLuint> textures;
+    for (const TextureFile& texture : TEXTURE_FILES)
     {
-        cout << "Failed to load texture " << pyramid_tex << endl;
-        return EXIT_FAILURE;
+        textureNames.push_back(texture.path);
+        textures.push_back(*texture.textureId);
     }
-    const char* marble_tex = "../resources/textures/red_tex.jpg";
-    if (!UCreateTexture(marble_tex, gTextureIdRedMarble))
+    const SceneFileBindings sceneFileBindings = { &meshes, textureNames.data(), textures.data(), textures.size() };
+
+    // Place the objects of the desk scene, or load or generate a scene
+    if (gSceneFile && gStreamScene)
     {
-        cout << "Failed to load texture " << marble_tex << endl;
-        return EXIT_FAILURE;
+        // Split straight from the file, so the whole scene is never resident
+        auto start = std::chrono::steady_clock::now();
+        if (!gSceneStreamer.Partition(gSceneFile, sceneFileBindings))
+            return EXIT_FAILURE;
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        cout << "Split " << gSceneFile << " into " << gSceneStreamer.GetStats().cells << " cells in " << elapsed << " ms" << endl;
     }
-    const char* candle_tex = "../resources/textures/candle_tex.png";
-    if (!UCreateTexture(candle_tex, gTextureIdCandle))
+    else if (gSceneFile)
     {
-        cout << "Failed to load texture " << candle_tex << endl;
-        return EXIT_FAILURE;
+        auto start = std::chrono::steady_clock::now();
+        if (!ULoadSceneFile(gSceneFile, gScene, sceneFileBindings))
+            return EXIT_FAILURE;
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        cout << "Loaded " << gScene.transforms.Size() << " nodes, " << gScene.objects.size() << " objects and " << gScene.lights.size() << " lights from " << gSceneFile << " in " << elapsed << " ms" << endl;
     }
-    const char* metal_tex = "../resources/textures/metal_tex.jpg";
-    if (!UCreateTexture(metal_tex, gTextureIdMetal))
+    else if (gGenerateScene)
     {
-        cout << "Failed to load texture " << metal_tex << endl;
-        return EXIT_FAILURE;
+        auto start = std::chrono::steady_clock::now();
+        gSceneGenerator.Generate(gScene, meshes, textures.data(), textures.size());
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        cout << "Generated " << gScene.objects.size() << " objects and " << gScene.lights.size() << " lights in " << elapsed << " ms" << endl;
     }
-    const char* glass_tex = "../resources/textures/glass_tex.jpg";
-    if (!UCreateTexture(glass_tex, gTextureIdGlass))
+    else
     {
-        cout << "Failed to load texture " << glass_tex << endl;
+        UCreateScene();
+    }
+    if (gSaveSceneFile && !USaveSceneFile(gSaveSceneFile, gScene, sceneFileBindings, gSaveBinaryScene))
         return EXIT_FAILURE;
+    if (gStreamScene)
+    {
+        if (!gSceneFile)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (!gSceneStreamer.Partition(gScene, sceneFileBindings))
+                return EXIT_FAILURE;
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            cout << "Split the scene into " << gSceneStreamer.GetStats().cells << " cells in " << elapsed << " ms" << endl;
+            gScene = Scene(); // Frees the whole scene; the cells come back as the camera nears them
+        }
+        gSceneStreamer.Begin(gScene);
     }
+    gScene.UpdateTransforms(&gJobs);
+    if (!gRenderer.Create(meshes, gShaders))
+        return EXIT_FAILURE;
+    gRenderer.RequestPrograms(gScene);
+    if (gStreamScene)
+        gRenderer.RequestPrograms(gSceneStreamer.Materials());
 
-    // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-    glUniform2f(glGetUniformLocation(gProgramId, "uvScale"), gUVScale.x, gUVScale.y);
+    // Wait for the light program and the Phong variants, compiled side by side
+    if (!gLightShaders.FinishPrograms() || !gShaders.FinishPrograms())
+        return EXIT_FAILURE;
+
+    // Reload shaders and textures when they change on disk
+    std::vector<std::string> watchedFiles = { PHONG_VERTEX_SHADER, PHONG_FRAGMENT_SHADER, LIGHT_VERTEX_SHADER, LIGHT_FRAGMENT_SHADER };
+    for (const TextureFile& texture : TEXTURE_FILES)
+        watchedFiles.push_back(texture.path);
+    gAssetWatcher.Start(watchedFiles);
 
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -313,44 +454,124 @@ int main(int argc, char* argv[])
     gCamera.Front = glm::vec3(0.0f, -1.0f, -2.0f);
     gCamera.Up = glm::vec3(0.0f, 1.0f, 0.0f);
 
+    if (gBenchJobs)
+    {
+        UBenchmarkJobs();
+        glfwSetWindowShouldClose(gWindow, true);
+    }
+
+    if (gBenchTransforms)
+    {
+        UBenchmarkTransforms();
+        glfwSetWindowShouldClose(gWindow, true);
+    }
+
+    if (gBenchBvh)
+    {
+        UBenchmarkBvh();
+        glfwSetWindowShouldClose(gWindow, true);
+    }
+
+    if (gBenchOcclusion)
+    {
+        UBenchmarkOcclusion();
+        glfwSetWindowShouldClose(gWindow, true);
+    }
+
+    if (gBenchNormals)
+    {
+        if (!UBenchmarkNormalMatrices())
+            return EXIT_FAILURE;
+        glfwSetWindowShouldClose(gWindow, true);
+    }
+
+    glfwSwapInterval(gVsync ? 1 : 0);
+
     // render loop
     // -----------
+    double previousTime = glfwGetTime();
+    double accumulator = 0.0;
+    gPreviousCameraPosition = gCamera.Position;
+
+    // The first frame's packet is built before the loop, each frame then builds the next one
+    glm::mat4 view;
+    glm::mat4 projection;
+    gFramePipeline.Start(gRenderer, gJobs);
+    UCameraMatrices(0.0f, view, projection);
+    gFramePipeline.Prepare(gScene, view, projection);
+    gFramePipeline.Wait();
+    int frame = 0;
     while (!glfwWindowShouldClose(gWindow))
     {
         // per-frame timing
         // --------------------
-        float currentFrame = glfwGetTime();
-        gDeltaTime = currentFrame - gLastFrame;
-        gLastFrame = currentFrame;
+        double frameStart = glfwGetTime();
+        accumulator += std::min(frameStart - previousTime, MAX_FRAME_TIME);
+        previousTime = frameStart;
 
-        // input
+        glfwPollEvents();
+
+        // input and simulation, in fixed steps so camera motion does not depend on the frame rate;
+        // the scene is only changed here, while no packet is being built from it
         // -----
-        UProcessInput(gWindow);
+        while (accumulator >= SIMULATION_STEP)
+        {
+            gPreviousCameraPosition = gCamera.Position;
+            UProcessInput(gWindow, (float)SIMULATION_STEP);
+            accumulator -= SIMULATION_STEP;
+        }
 
-        // Render this frame
-        URender();
+        // Place the scene cells loaded around the camera, evicting distant ones over the memory budget
+        if (gStreamScene && gSceneStreamer.Update(gScene, gCamera.Position, gJobs))
+            gSelectedObject = Bvh::NO_HIT; // The scene was rebuilt, its object indices changed
 
-        glfwPollEvents();
+        // World matrices and bounds of the objects that moved, composed from their local TRS
+        gScene.UpdateTransforms(&gJobs);
+
+        // Apply the shader and texture edits made since the last frame
+        UReloadChangedAssets();
+
+        // Restore the textures drawn again after losing levels, and drop levels of idle ones over the budget
+        UUpdateTextureResidency();
+
+        // Build the next frame's packet on the worker, between the last two simulation steps,
+        // while this thread draws the packet built during the previous frame
+        UCameraMatrices((float)(accumulator / SIMULATION_STEP), view, projection);
+        const Renderer::RenderPacket& packet = gFramePipeline.Current();
+        gFramePipeline.Prepare(gScene, view, projection);
+        if (gStreamTextures)
+        {
+            // Upload the texture levels the packet's objects are large enough on screen for
+            int width, height;
+            glfwGetFramebufferSize(gWindow, &width, &height);
+            gTextureStreamer.Update(packet.textureCoverage, height);
+        }
+        URender(packet);
+        gFramePipeline.Wait();
+
+        UPaceFrame(frameStart);
+
+        if (gCheckAllocations)
+            UCountAllocations(frame++);
     }
 
+    gAssetWatcher.Stop();
+    UStopJobClients();
+    gJobs.Stop();
+
     // Release mesh data
-    Meshes().DestroyMeshes();
+    gRenderer.Destroy();
+    meshes.DestroyMeshes();
 
     // Release texture
-    UDestroyTexture(gTextureIdTwine);
-    UDestroyTexture(gTextureIdWoodtable);
-    UDestroyTexture(gTextureIdWoodsticks);
-    UDestroyTexture(gTextureIdAmethyst);
-    UDestroyTexture(gTextureIdRedMarble);
-    UDestroyTexture(gTextureIdCandle);
-    UDestroyTexture(gTextureIdMetal);
-    UDestroyTexture(gTextureIdGlass);
+    for (const TextureFile& texture : TEXTURE_FILES)
+        UDestroyTexture(*texture.textureId);
 
     // Release shader program
-    UDestroyShaderProgram(gProgramId);
-    UDestroyShaderProgram(gLightProgramId);
+    gShaders.Destroy();
+    gLightShaders.Destroy();
 
-    exit(EXIT_SUCCESS); // Terminates the program successfully
+    exit(gAllocationCheckFailed ? EXIT_FAILURE : EXIT_SUCCESS); // Terminates the program successfully
 }
 
 
@@ -406,7 +627,7 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
-void UProcessInput(GLFWwindow* window)
+void UProcessInput(GLFWwindow* window, float deltaTime)
 {
     static const float cameraSpeed = 2.5f;
     // Exit program
@@ -414,17 +635,17 @@ void UProcessInput(GLFWwindow* window)
         glfwSetWindowShouldClose(window, true);
     // Movement
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(FORWARD, gDeltaTime);
+        gCamera.ProcessKeyboard(FORWARD, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(BACKWARD, gDeltaTime);
+        gCamera.ProcessKeyboard(BACKWARD, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(LEFT, gDeltaTime);
+        gCamera.ProcessKeyboard(LEFT, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
+        gCamera.ProcessKeyboard(RIGHT, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(UP, gDeltaTime);
+        gCamera.ProcessKeyboard(UP, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(DOWN, gDeltaTime);
+        gCamera.ProcessKeyboard(DOWN, deltaTime);
 
     // View toggles
     if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
@@ -492,9 +713,7 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
     case GLFW_MOUSE_BUTTON_LEFT:
     {
         if (action == GLFW_PRESS)
-            cout << "Left mouse button pressed" << endl;
-        else
-            cout << "Left mouse button released" << endl;
+            UPickObject();
     }
     break;
 
@@ -523,124 +742,99 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 }
 
 
-// Function called to render a frame
-void URender()
+// Computes the world space ray under the cursor; while the cursor is captured for mouse look,
+// the ray goes through the middle of the window
+void UCursorRay(glm::vec3& origin, glm::vec3& direction)
 {
-    //Declarations of varaibles
-    GLint modelLoc;
-    GLint viewLoc;
-    GLint projLoc;
-    GLint viewPosLoc;
-    GLint ambStrLoc;
-    GLint ambColLoc;
-    GLint light1ColLoc;
-    GLint light1PosLoc;
-    GLint light2ColLoc;
-    GLint light2PosLoc;
-    GLint objColLoc;
-    GLint specInt1Loc;
-    GLint highlghtSz1Loc;
-    GLint specInt2Loc;
-    GLint highlghtSz2Loc;
-    GLint uHasTextureLoc;
-    bool ubHasTextureVal;
-    glm::mat4 scale;
-    glm::mat4 rotation;
-    glm::mat4 translation;
-    glm::mat4 model;
+    int width;
+    int height;
+    glfwGetWindowSize(gWindow, &width, &height);
+    double x = width * 0.5;
+    double y = height * 0.5;
+    if (glfwGetInputMode(gWindow, GLFW_CURSOR) != GLFW_CURSOR_DISABLED)
+        glfwGetCursorPos(gWindow, &x, &y);
+
     glm::mat4 view;
     glm::mat4 projection;
+    UCameraMatrices(1.0f, view, projection);
+    glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+
+    // The cursor's points on the near and far planes, window y pointing down
+    float ndcX = (float)(2.0 * x / std::max(width, 1) - 1.0);
+    float ndcY = (float)(1.0 - 2.0 * y / std::max(height, 1));
+    glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    origin = glm::vec3(nearPoint) / nearPoint.w;
+    direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
 
-    const int nrows = 10;
-    const int ncols = 10;
-    const int nlevels = 10;
+// Returns the distance along a world space ray to the object's triangles, or a negative value for
+// a miss. The ray is moved into the mesh's space, where its unit direction scales with the model
+// matrix, so the distance along it is still measured in world units.
+float URayObject(const SceneObject& object, const glm::vec3& origin, const glm::vec3& direction, float maxDistance)
+{
+    // The bounding sphere rejects most objects before their triangles are tested
+    float sphereDistance = URaySphere(origin, direction, object.bounds);
+    if (sphereDistance < 0.0f || sphereDistance > maxDistance)
+        return -1.0f;
+
+    glm::mat4 inverseModel = glm::inverse(object.model);
+    glm::vec3 localOrigin = glm::vec3(inverseModel * glm::vec4(origin, 1.0f));
+    glm::vec3 localDirection = glm::vec3(inverseModel * glm::vec4(direction, 0.0f));
+    return object.mesh->triangles.Raycast(localOrigin, localDirection, maxDistance);
+}
 
-    const float xsize = 10.0f;
-    const float ysize = 10.0f;
-    const float zsize = 10.0f;
+// Selects the scene object under the cursor: the scene's hierarchy visits only the subtrees the
+// ray passes through, nearest first, and the triangles of the objects there are tested with SIMD
+void UPickObject()
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+    UCursorRay(origin, direction);
 
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
+    auto start = std::chrono::steady_clock::now();
+    float distance = 100.0f; // far plane
+    gSelectedObject = gScene.bvh.Raycast(origin, direction, distance, [&origin, &direction](std::uint32_t object, float maxDistance)
+    {
+        return URayObject(gScene.objects[object], origin, direction, maxDistance);
+    });
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-    // Clear the frame and z buffers
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (gSelectedObject == Bvh::NO_HIT)
+        cout << "Nothing selected (" << elapsed << " ms)" << endl;
+    else
+        cout << "Selected object " << gSelectedObject << " at distance " << distance << " (" << elapsed << " ms)" << endl;
+}
 
-    // camera/view transformation
-    view = gCamera.GetViewMatrix();
 
-    // Creates a perspective projection
-    if (gOrtho == false) {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    }
-    else {
-        projection = glm::ortho(-5.0f, 5.0f, -5.0f, 5.0f, 0.1f, 100.0f);
-    }
-
-    // Set the shader to be used
-    glUseProgram(gProgramId);
-
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gProgramId, "model");
-    viewLoc = glGetUniformLocation(gProgramId, "view");
-    projLoc = glGetUniformLocation(gProgramId, "projection");
-    viewPosLoc = glGetUniformLocation(gProgramId, "viewPosition");
-    ambStrLoc = glGetUniformLocation(gProgramId, "ambientStrength");
-    ambColLoc = glGetUniformLocation(gProgramId, "ambientColor");
-    light1ColLoc = glGetUniformLocation(gProgramId, "light1Color");
-    light1PosLoc = glGetUniformLocation(gProgramId, "light1Position");
-    light2ColLoc = glGetUniformLocation(gProgramId, "light2Color");
-    light2PosLoc = glGetUniformLocation(gProgramId, "light2Position");
-    objColLoc = glGetUniformLocation(gProgramId, "objectColor");
-    specInt1Loc = glGetUniformLocation(gProgramId, "specularIntensity1");
-    highlghtSz1Loc = glGetUniformLocation(gProgramId, "highlightSize1");
-    specInt2Loc = glGetUniformLocation(gProgramId, "specularIntensity2");
-    highlghtSz2Loc = glGetUniformLocation(gProgramId, "highlightSize2");
-    uHasTextureLoc = glGetUniformLocation(gProgramId, "ubHasTexture");
-
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+// Function called to render a frame
+// Places the objects of the desk scene
+void UCreateScene()
+{
+    glm::mat4 scale;
+    glm::mat4 rotationx;
+    glm::mat4 rotationy;
+    glm::mat4 rotationz;
+    glm::mat4 translation;
+    glm::mat4 model;
 
-    //set ambient lighting strength
-    glUniform1f(ambStrLoc, 0.5f);
-    //set ambient color
-    glUniform3f(ambColLoc, 1.0f, 0.9f, 0.8f); // Warm sunlight ambience
-    glUniform3f(light1ColLoc, 1.0f, 0.9f, 0.5f); // Front light - warm
-    glUniform3f(light1PosLoc, -3.0f, 7.0f, 5.0f);
-    glUniform3f(light2ColLoc, 1.0f, 0.9f, 0.5f); // Back light - warm
-    glUniform3f(light2PosLoc, 3.0f, 7.0f, -5.0f);
-    //set specular intensity
-    glUniform1f(specInt1Loc, 0.2f); // front light
-    glUniform1f(specInt2Loc, 0.2f); // back light
-    //set specular highlight size
-    glUniform1f(highlghtSz1Loc, 2.0f);
-    glUniform1f(highlghtSz2Loc, 2.0f);
-
-    ubHasTextureVal = true;
-    glUniform1i(uHasTextureLoc, ubHasTextureVal);
-
-    // Activate mesh for palo santo sticks
-    glBindVertexArray(meshes.gBoxMesh.vao);
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdWoodsticks);
+    gScene.Clear();
 
+    // Start creating palo santo sticks
     // Transformation for the bottom palo santo stick
     // 1. Scales the cubes into a thin rectangle.
     scale = glm::scale(glm::vec3(0.6f, 0.4f, 3.0f));
     // 2. Rotates shape 
-    glm::mat4 rotationy = glm::rotate(glm::radians(-90.0f), glm::vec3(0.0, 1.0f, 0.0f));
-    glm::mat4 rotationz = glm::rotate(glm::radians(30.0f), glm::vec3(0.0, 0.0f, 1.0f));
-    glm::mat4 rotationx = glm::rotate(glm::radians(-95.0f), glm::vec3(1.0, 0.0f, 0.0f));
+    rotationy = glm::rotate(glm::radians(-90.0f), glm::vec3(0.0, 1.0f, 0.0f));
+    rotationz = glm::rotate(glm::radians(30.0f), glm::vec3(0.0, 0.0f, 1.0f));
+    rotationx = glm::rotate(glm::radians(-95.0f), glm::vec3(1.0, 0.0f, 0.0f));
     // 3. Place object in lower right area
     translation = glm::translate(glm::vec3(1.2f, -3.2f, 2.9f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * rotationz * rotationy * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gBoxMesh, UTexturedMaterial(gTextureIdWoodsticks), model);
 
     // Transformations for top palo santo stick
     rotationy = glm::rotate(glm::radians(-90.0f), glm::vec3(0.0, 1.0f, 0.0f));
@@ -649,18 +843,11 @@ void URender()
     translation = glm::translate(glm::vec3(1.3f, -3.2f, 2.5f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * rotationz * rotationy * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
 
-    // Deactivate the Vertex Array Object and textures
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Bind and start creating torus (twine)
-    glBindVertexArray(meshes.gTorusMesh.vao);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gBoxMesh, UTexturedMaterial(gTextureIdWoodsticks), model);
 
+    // Start creating torus (twine)
     // Transformation for the torus mesh (twine)
     // 1. Scales into a thin torus
     scale = glm::scale(glm::vec3(0.6f, 0.5f, 1.3f));
@@ -672,21 +859,11 @@ void URender()
     translation = glm::translate(glm::vec3(1.1f, -3.25f, 2.8f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * rotationy * rotationz * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdTwine);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, meshes.gTorusMesh.nVertices);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
-    // Bind and start creating cylinder (twine ends)
-    glBindVertexArray(meshes.gCylinderMesh.vao);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gTorusMesh, UTexturedMaterial(gTextureIdTwine), model);
 
+    // Start creating cylinder (twine ends)
     // Transformation for the cylinder mesh (twine ends)
     // 1. Scales into a very thin cylinder
     scale = glm::scale(glm::vec3(0.05f, 1.5f, 0.05f));
@@ -697,24 +874,11 @@ void URender()
     translation = glm::translate(glm::vec3(1.2f, -2.7f, 3.6f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * rotationy * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdTwine);
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-    glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-    glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Bind and start creating Orgone Pyramid
-    glBindVertexArray(meshes.gPyramid4Mesh.vao);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gCylinderMesh, UTexturedMaterial(gTextureIdTwine), model);
 
+    // Start creating Orgone Pyramid
     // Transformations for pyramid
     // 1. Scale
     scale = glm::scale(glm::vec3(2.0f, 1.0f, 2.0f));
@@ -724,22 +888,11 @@ void URender()
     translation = glm::translate(glm::vec3(-2.0f, -3.0f, 3.0f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationy * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdAmethyst);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, meshes.gPyramid4Mesh.nVertices);
-
-    // Deactivate the Vertex Array Object and texture
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
 
-    // Bind and start creating Red Onyx Marble
-    glBindVertexArray(meshes.gSphereMesh.vao);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gPyramid4Mesh, UTexturedMaterial(gTextureIdAmethyst), model);
 
+    // Start creating Red Onyx Marble
     // Transformations for sphere
     // 1. Scale
     scale = glm::scale(glm::vec3(0.3f, 0.3f, 0.3f));
@@ -749,22 +902,11 @@ void URender()
     translation = glm::translate(glm::vec3(1.5f, -3.3f, 0.0f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdRedMarble);
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object and texture
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Bind and start creating metal tip
-    glBindVertexArray(meshes.gConeMesh.vao);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gSphereMesh, UTexturedMaterial(gTextureIdRedMarble), model);
 
+    // Start creating metal tip
     // Transformations for cone
     // 1. Scale
     scale = glm::scale(glm::vec3(0.1f, 0.1f, 0.1f));
@@ -774,27 +916,11 @@ void URender()
     translation = glm::translate(glm::vec3(1.5f, -3.3f, 0.25f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdMetal);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-    glDrawArrays(GL_TRIANGLE_STRIP, 36, 108);	//sides
 
-    // Deactivate the Vertex Array Object and texture
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Bind and start creating chain
-    glBindVertexArray(meshes.gCylinderMesh.vao);
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdMetal);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gConeMesh, UTexturedMaterial(gTextureIdMetal), model);
 
+    // Start creating chain
     // Transformations for chain cylinder
     // 1. Scale
     scale = glm::scale(glm::vec3(0.02f, 1.2f, 0.02f));
@@ -805,12 +931,9 @@ void URender()
     translation = glm::translate(glm::vec3(1.5f, -3.3f, -0.5f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * rotationz * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-    glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-    glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gCylinderMesh, UTexturedMaterial(gTextureIdMetal), model);
 
     //Draw the right part of chain
     // 1. Scale
@@ -822,12 +945,9 @@ void URender()
     translation = glm::translate(glm::vec3(2.86f, -3.53f, -0.35f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * rotationz * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-    glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-    glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gCylinderMesh, UTexturedMaterial(gTextureIdMetal), model);
 
     // Transformations for ring stump
     // 1. Scale
@@ -839,24 +959,11 @@ void URender()
     translation = glm::translate(glm::vec3(1.5f, -3.3f, -0.4f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * rotationz * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdMetal);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-    glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-    glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
-
-    // Deactivate the Vertex Array Object and texture
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
 
-    // Bind and start creating chain loop
-    glBindVertexArray(meshes.gTorusMesh.vao);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gCylinderMesh, UTexturedMaterial(gTextureIdMetal), model);
 
+    // Start creating chain loop
     // Transformations for torus
     // 1. Scale
     scale = glm::scale(glm::vec3(0.08f, 0.08f, 0.08f));
@@ -866,22 +973,11 @@ void URender()
     translation = glm::translate(glm::vec3(1.5f, -3.3f, -0.45f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdMetal);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, meshes.gTorusMesh.nVertices);
-
-    // Deactivate the Vertex Array Object and texture
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Bind and start creating Small Bead
-    glBindVertexArray(meshes.gSphereMesh.vao);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gTorusMesh, UTexturedMaterial(gTextureIdMetal), model);
 
+    // Start creating Small Bead
     // Transformations for sphere
     // 1. Scale
     scale = glm::scale(glm::vec3(0.1f, 0.1f, 0.1f));
@@ -891,22 +987,11 @@ void URender()
     translation = glm::translate(glm::vec3(2.9f, -3.5f, -0.3f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdGlass);
-
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-    // Deactivate the Vertex Array Object and texture
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Bind and start creating candle
-    glBindVertexArray(meshes.gCylinderMesh.vao);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gSphereMesh, UTexturedMaterial(gTextureIdGlass), model);
 
+    // Start creating candle
     // Transformations for cylinder
     // 1. Scale
     scale = glm::scale(glm::vec3(1.5f, 2.0f, 1.5f));
@@ -916,24 +1001,11 @@ void URender()
     translation = glm::translate(glm::vec3(-1.5f, -3.5f, -0.5f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdCandle);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-    glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-    glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
 
-    // Deactivate the Vertex Array Object and texture
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Bind and start creating plane (wood table)
-    glBindVertexArray(meshes.gPlaneMesh.vao);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gCylinderMesh, UTexturedMaterial(gTextureIdCandle), model);
 
+    // Start creating plane (wood table)
     // Transformations for plane
     // 1. Scale
     scale = glm::scale(glm::vec3(6.0f, 10.0f, 6.0f));
@@ -943,182 +1015,890 @@ void URender()
     translation = glm::translate(glm::vec3(0.0f, -3.6f, 0.0f));
     // Model matrix: transformations are applied right-to-left order
     model = translation * rotationx * scale;
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTextureIdWoodtable);
+    // Adds the object to the scene
+    gScene.AddObject(meshes.gPlaneMesh, UTexturedMaterial(gTextureIdWoodtable), model);
 
-    // Draws the triangles
-    glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+    // Front and back lights, both warm
+    gScene.lights.push_back({ glm::vec3(-3.0f, 7.0f, 5.0f), glm::vec3(1.0f, 0.9f, 0.5f) });
+    gScene.lights.push_back({ glm::vec3(3.0f, 7.0f, -5.0f), glm::vec3(1.0f, 0.9f, 0.5f) });
+}
 
-    // Deactivate the Vertex Array Object and texture
-    glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
+// Material of the desk scene objects: textured with a soft, wide highlight
+SceneMaterial UTexturedMaterial(GLuint textureId)
+{
+    SceneMaterial material;
+    material.textureId = textureId;
+    material.color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    material.specularIntensity = 0.2f;
+    material.highlightSize = 2.0f;
+    return material;
+}
 
-    /* CREATE LIGHT OBJECTS AND SOURCES */
-    // Set the shader to be used
-    glUseProgram(gLightProgramId);
-
-    // Retrieves and passes transform matrices to the Shader program
-    modelLoc = glGetUniformLocation(gLightProgramId, "model");
-    viewLoc = glGetUniformLocation(gLightProgramId, "view");
-    projLoc = glGetUniformLocation(gLightProgramId, "projection");
-
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    // Front light: Cool, low intensity
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(meshes.gTorusMesh.vao);
-
-    // 1. Scales the object 
-    scale = glm::scale(glm::vec3(1.0f, 1.0f, 1.0f));
-    // 2. Rotates shape over the x axis
-    rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
-    // 3. Place object
-    translation = glm::translate(glm::vec3(-3.0f, 7.0f, 5.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
+// Computes the view and projection matrices of the camera, alpha being how far into the next
+// simulation step the frame is; the position is interpolated, mouse look applies immediately
+void UCameraMatrices(float alpha, glm::mat4& view, glm::mat4& projection)
+{
+    int width;
+    int height;
+    glfwGetFramebufferSize(gWindow, &width, &height);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    glm::vec3 cameraPosition = glm::mix(gPreviousCameraPosition, gCamera.Position, alpha);
+    view = glm::lookAt(cameraPosition, cameraPosition + gCamera.Front, gCamera.Up);
 
-    glDrawArrays(GL_TRIANGLES, 0, meshes.gTorusMesh.nVertices);
+    // Creates a perspective projection
+    if (gOrtho == false) {
+        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)width / (GLfloat)std::max(height, 1), 0.1f, 100.0f);
+    }
+    else {
+        projection = glm::ortho(-5.0f, 5.0f, -5.0f, 5.0f, 0.1f, 100.0f);
+    }
+}
 
-    // Back Light: Neutral, High Intensity
-    // 1. Scales the object by 2
-    scale = glm::scale(glm::vec3(1.0f, 1.0f, 1.0f));
-    // 2. Rotates shape over the x axis
-    rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
-    // 3. Place object at the origin
-    translation = glm::translate(glm::vec3(3.0f, 7.0f, -5.0f));
-    // Model matrix: transformations are applied right-to-left order
-    model = translation * rotation * scale;
+// Draws a frame from a render packet; only GL calls are left for this thread
+void URender(const Renderer::RenderPacket& packet)
+{
+    //Declarations of varaibles
+    glm::mat4 scale;
+    glm::mat4 rotation;
+    glm::mat4 translation;
+    glm::mat4 model;
+    const glm::mat4& view = packet.view;
+    const glm::mat4& projection = packet.projection;
+    int width;
+    int height;
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    // Draw into the renderer's frame target (offscreen while GPU culling)
+    glfwGetFramebufferSize(gWindow, &width, &height);
+    gRenderer.BeginFrame(width, height);
 
-    glDrawArrays(GL_TRIANGLES, 0, meshes.gTorusMesh.nVertices);
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
 
-    glBindVertexArray(0);
+    // Clear the frame and z buffers
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Pass the transforms and lights to every Phong variant the scene is drawn with
+    for (const auto& entry : gShaders.programs)
+    {
+        if (entry.second != 0)
+            USetSceneUniforms(entry.second, view, projection);
+    }
+
+    // Cull and draw every scene object with multi-draw-indirect
+    gRenderer.Draw(packet);
+
+    /* CREATE LIGHT OBJECTS AND SOURCES */
+    // Set the shader to be used
+    GLuint lightProgramId = gLightShaders.GetProgram(0);
+    glUseProgram(lightProgramId);
+    glBindVertexArray(meshes.gArenaVao);
+
+    // Passes transform matrices to the Shader program
+    const GLint* lightUniforms = gLightShaders.GetUniforms(lightProgramId);
+    glUniformMatrix4fv(lightUniforms[LIGHT_VIEW], 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(lightUniforms[LIGHT_PROJECTION], 1, GL_FALSE, glm::value_ptr(projection));
 
+    // A torus marks each light of the scene
+    for (const SceneLight& light : gScene.lights)
+    {
+        // 1. Scales the object
+        scale = glm::scale(glm::vec3(1.0f, 1.0f, 1.0f));
+        // 2. Rotates shape over the x axis
+        rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0, 0.0f, 0.0f));
+        // 3. Place object at the light
+        translation = glm::translate(light.position);
+        // Model matrix: transformations are applied right-to-left order
+        model = translation * rotation * scale;
+
+        glUniformMatrix4fv(lightUniforms[LIGHT_MODEL], 1, GL_FALSE, glm::value_ptr(model));
+
+        UDrawMesh(meshes.gTorusMesh);
+    }
+
+    glBindVertexArray(0);
     glUseProgram(0);
 
+    // Build next frame's occlusion data and present the frame
+    gRenderer.EndFrame();
+
     // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
     glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
 }
 
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint& textureId)
+// Sets the transforms, lights and texture parameters of a Phong program variant
+void USetSceneUniforms(GLuint programId, const glm::mat4& view, const glm::mat4& projection)
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
+    // Locations looked up by gShaders when the variant was built; one still compiling is set up next frame
+    const GLint* uniforms = gShaders.GetUniforms(programId);
+    if (!uniforms)
+        return;
+
+    // Set the shader to be used
+    glUseProgram(programId);
+
+    // Passes transform matrices to the Shader program
+    glUniformMatrix4fv(uniforms[PHONG_VIEW], 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(uniforms[PHONG_PROJECTION], 1, GL_FALSE, glm::value_ptr(projection));
+
+    //set ambient lighting strength
+    glUniform1f(uniforms[PHONG_AMBIENT_STRENGTH], 0.5f);
+    //set ambient color
+    glUniform3f(uniforms[PHONG_AMBIENT_COLOR], 1.0f, 0.9f, 0.8f); // Warm sunlight ambience
+    // The shaders light with two of the scene's lights, the nearest to the camera; missing ones are black
+    SceneLight lights[2] = {};
+    float lightDistances[2] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    for (const SceneLight& light : gScene.lights)
     {
-        flipImageVertically(image, width, height, channels);
-
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
-
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
+        float distance = glm::length(light.position - gCamera.Position);
+        if (distance < lightDistances[0])
         {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
-            return false;
+            lights[1] = lights[0];
+            lightDistances[1] = lightDistances[0];
+            lights[0] = light;
+            lightDistances[0] = distance;
         }
+        else if (distance < lightDistances[1])
+        {
+            lights[1] = light;
+            lightDistances[1] = distance;
+        }
+    }
+    glUniform3fv(uniforms[PHONG_LIGHT1_COLOR], 1, glm::value_ptr(lights[0].color));
+    glUniform3fv(uniforms[PHONG_LIGHT1_POSITION], 1, glm::value_ptr(lights[0].position));
+    glUniform3fv(uniforms[PHONG_LIGHT2_COLOR], 1, glm::value_ptr(lights[1].color));
+    glUniform3fv(uniforms[PHONG_LIGHT2_POSITION], 1, glm::value_ptr(lights[1].position));
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+    // We set the texture as texture unit 0
+    glUniform1i(uniforms[PHONG_TEXTURE], 0);
+    glUniform2f(uniforms[PHONG_UV_SCALE], gUVScale.x, gUVScale.y);
+    // The picked object is drawn highlighted
+    glUniform1ui(uniforms[PHONG_SELECTED_OBJECT], gSelectedObject);
+}
 
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+// Times the vertex stage of the scene pass with the precomputed normal matrices and with
+// the per-vertex inverse they replace. Rasterization is discarded so only vertex work counts.
+bool UBenchmarkNormalMatrices()
+{
+    const int nFrames = 100;
+    const int nPassesPerFrame = 20; // The desk scene alone is too small to time reliably
+
+    int width;
+    int height;
+    glfwGetFramebufferSize(gWindow, &width, &height);
+    glm::mat4 view = gCamera.GetViewMatrix();
+    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)width / (GLfloat)std::max(height, 1), 0.1f, 100.0f);
+
+    // Every object is drawn in every pass
+    bool gpuCulling = gRenderer.gpuCulling;
+    gRenderer.gpuCulling = false;
+    gRenderer.BeginFrame(width, height);
+    glEnable(GL_RASTERIZER_DISCARD);
+
+    GLuint query;
+    glGenQueries(1, &query);
+
+    // The reference variants invert the model matrix per vertex, as the shader did before
+    const GLuint overrides[] = { SHADER_REFERENCE_NORMALS, 0 };
+    const char* const names[] = { "per-vertex inverse", "precomputed normal matrix" };
+    bool success = true;
+    for (int p = 0; p < 2 && success; ++p)
+    {
+        gRenderer.featureOverrides = overrides[p];
+        gRenderer.RequestPrograms(gScene);
+        success = gShaders.FinishPrograms();
+        for (const auto& entry : gShaders.programs)
+        {
+            if (entry.second != 0)
+                USetSceneUniforms(entry.second, view, projection);
+        }
 
-        return true;
+        GLuint64 totalTime = 0;
+        for (int frame = 0; frame < nFrames && success; ++frame)
+        {
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            for (int pass = 0; pass < nPassesPerFrame; ++pass)
+                gRenderer.Draw(gScene, view, projection);
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            totalTime += elapsed;
+        }
+
+        if (success)
+            cout << names[p] << ": " << totalTime / 1.0e6 / nFrames << " ms per frame ("
+                << nPassesPerFrame << " scene passes)" << endl;
     }
 
-    // Error loading the image
-    return false;
+    glDeleteQueries(1, &query);
+    glDisable(GL_RASTERIZER_DISCARD);
+    glUseProgram(0);
+    gRenderer.featureOverrides = 0;
+    gRenderer.gpuCulling = gpuCulling;
+
+    return success;
 }
 
+// Fills a scene with copies of the desk scene, 100 to a row, 20 units apart, and updates it once
+void UReplicateDeskScene(Scene& scene, int nCopies)
+{
+    for (int copy = 0; copy < nCopies; ++copy)
+    {
+        glm::mat4 offset = glm::translate(glm::vec3(20.0f * (copy % 100), 0.0f, -20.0f * (copy / 100)));
+        for (const SceneObject& object : gScene.objects)
+            scene.AddObject(*object.mesh, object.material, offset * object.model);
+    }
+    scene.UpdateTransforms(&gJobs);
+}
 
-void UDestroyTexture(GLuint textureId)
+// Runs a workload nRuns times and returns its fastest time in milliseconds
+double UTimeBest(int nRuns, const std::function<void()>& workload)
 {
-    glGenTextures(1, &textureId);
+    double best = 0.0;
+    for (int run = 0; run < nRuns; ++run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        workload();
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
 }
 
+// Waits for every job the frame pipeline, the streamers and the texture restores have queued, so
+// the job system can be stopped or restarted
+void UStopJobClients()
+{
+    gFramePipeline.Stop();
+    gSceneStreamer.Stop();
+    gTextureStreamer.Stop();
+    for (TextureRestore& restore : gTextureRestores)
+    {
+        gJobs.Wait(restore.decoded);
+        UFreeImage(restore.image);
+        restore.decoding = false;
+    }
+}
 
 
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+// Times the workloads the job system runs, with 1 thread up to one per hardware thread: mesh
+// generation, texture decoding, and the transform update, draw list building and hierarchy frustum
+// culling of a large copy of the scene
+void UBenchmarkJobs()
 {
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
-
-    // Create a Shader program object.
-    programId = glCreateProgram();
-
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
-
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+    // The job system is restarted with each thread count below: no client may have a job queued
+    UStopJobClients();
+
+    const int nRuns = 5; // The fastest run of each workload is reported
+    const int nCopies = 10000; // Copies of the desk scene, spread over a grid
+    const size_t nTextures = sizeof(TEXTURE_FILES) / sizeof(TEXTURE_FILES[0]);
+
+    // Every object is reported as changed, so each draw list build copies all the draw data
+    Scene scene;
+    UReplicateDeskScene(scene, nCopies);
+
+    glm::mat4 view = gCamera.GetViewMatrix();
+    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), 1.0f, 0.1f, 100.0f);
+    Renderer::RenderPacket packet;
+    std::vector<std::uint32_t> visible(scene.objects.size());
+
+    std::vector<unsigned> threadCounts;
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned n = 1; n < maxThreads; n *= 2)
+        threadCounts.push_back(n);
+    threadCounts.push_back(maxThreads);
+
+    cout << scene.objects.size() << " objects, " << nTextures << " textures; milliseconds (speedup over 1 thread)" << endl;
+    cout << "threads  mesh generation  texture decode  transform update  draw lists  frustum culling" << endl;
+
+    const int nWorkloads = 5;
+    double baseline[nWorkloads] = {};
+    for (unsigned nThreads : threadCounts)
     {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+        gJobs.Start(nThreads);
 
-        return false;
+        double times[nWorkloads];
+        times[0] = UTimeBest(nRuns, []()
+        {
+            Meshes generated;
+            generated.GenerateMeshes(&gJobs);
+        });
+        times[1] = UTimeBest(nRuns, []()
+        {
+            gJobs.ParallelFor(nTextures, 1, [](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    DecodedImage image;
+                    UDecodeImage(TEXTURE_FILES[i].path, image);
+                    UFreeImage(image);
+                }
+            });
+        });
+        times[2] = UTimeBest(nRuns, [&scene]()
+        {
+            scene.transforms.Invalidate();
+            scene.UpdateTransforms(&gJobs);
+        });
+        times[3] = UTimeBest(nRuns, [&scene, &view, &projection, &packet]()
+        {
+            gRenderer.BuildPacket(scene, view, projection, packet);
+        });
+        times[4] = UTimeBest(nRuns, [&scene, &packet, &visible]()
+        {
+            scene.bvh.CullFrustum(packet.frustumPlanes, visible.data(), &gJobs);
+        });
+
+        if (nThreads == 1)
+            std::copy(times, times + nWorkloads, baseline);
+
+        cout << nThreads;
+        for (int w = 0; w < nWorkloads; ++w)
+            cout << "  " << times[w] << " (" << baseline[w] / times[w] << "x)";
+        cout << endl;
     }
 
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+    gJobs.Start(gThreadCount);
+}
+
+// Times TransformSystem::Update() against the same hierarchy composed with glm matrix products,
+// from 10k to 1M nodes: random local TRS, each node a child of an earlier one (4 children per node).
+// The SIMD update is timed with every node dirty, then with one moved leaf and with nothing moved.
+void UBenchmarkTransforms()
+{
+    const int nRuns = 5; // The fastest run of each path is reported
+    const size_t nodeCounts[] = { 10000, 100000, 1000000 };
+
+    cout << "nodes  glm (ms)  SIMD (ms)  speedup  max difference  one moved (ms)  static (ms)" << endl;
+    for (size_t nNodes : nodeCounts)
     {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
 
-        return false;
+        TransformSystem transforms;
+        transforms.Reserve(nNodes);
+        for (size_t i = 0; i < nNodes; ++i)
+        {
+            glm::vec3 translation(unit(random), unit(random), unit(random));
+            glm::quat rotation(unit(random), unit(random), unit(random), unit(random));
+            glm::vec3 scale(1.0f + 0.1f * unit(random), 1.0f + 0.1f * unit(random), 1.0f + 0.1f * unit(random));
+            transforms.AddNode(translation, rotation, scale, i == 0 ? TransformSystem::NO_PARENT : (std::uint32_t)((i - 1) / 4));
+        }
+
+        double reference = UTimeBest(nRuns, [&transforms]() { transforms.UpdateReference(); });
+        std::vector<glm::mat4> expected(nNodes);
+        for (size_t i = 0; i < nNodes; ++i)
+            expected[i] = transforms.World((std::uint32_t)i);
+        double simd = UTimeBest(nRuns, [&transforms]() { transforms.Invalidate(); transforms.Update(); });
+
+        float difference = 0.0f;
+        for (size_t i = 0; i < nNodes; ++i)
+        {
+            for (int column = 0; column < 4; ++column)
+            {
+                glm::vec4 delta = glm::abs(transforms.World((std::uint32_t)i)[column] - expected[i][column]);
+                difference = std::max(difference, std::max(std::max(delta.x, delta.y), std::max(delta.z, delta.w)));
+            }
+        }
+
+        std::uint32_t leaf = (std::uint32_t)(nNodes - 1);
+        double oneMoved = UTimeBest(nRuns, [&transforms, leaf]()
+        {
+            transforms.SetLocal(leaf, glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+            transforms.Update();
+        });
+        double unchanged = UTimeBest(nRuns, [&transforms]() { transforms.Update(); });
+
+        cout << nNodes << "  " << reference << "  " << simd << "  " << reference / simd << "x  " << difference
+            << "  " << oneMoved << "  " << unchanged << endl;
+    }
+}
+
+// Times the scene hierarchy on 10000 copies of the desk scene: the SAH build, a refit of 1% of
+// the objects, then frustum culling and picking rays, each against a linear scan of every object
+void UBenchmarkBvh()
+{
+    const int nRuns = 5; // The fastest run of each workload is reported
+    const int nCopies = 10000; // Copies of the desk scene, spread over a grid
+    const int nRays = 1000;
+
+    Scene scene;
+    UReplicateDeskScene(scene, nCopies);
+    const size_t nObjects = scene.objects.size();
+
+    double build = UTimeBest(nRuns, [&scene]() { scene.bvh.Build(scene.objects.data(), scene.objects.size()); });
+
+    std::vector<SceneRange> moved;
+    for (std::uint32_t i = 0; i < nObjects; i += 100)
+        moved.push_back({ i, 1 });
+    double refit = UTimeBest(nRuns, [&scene, &moved]() { scene.bvh.Refit(scene.objects.data(), moved); });
+
+    // The planes of the camera's frustum, as the renderer computes them
+    Renderer::RenderPacket packet;
+    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), 1.0f, 0.1f, 100.0f);
+    gRenderer.BuildPacket(scene, gCamera.GetViewMatrix(), projection, packet);
+
+    std::vector<std::uint32_t> visible(nObjects);
+    size_t nVisible = 0;
+    double cull = UTimeBest(nRuns, [&scene, &packet, &visible, &nVisible]() { nVisible = scene.bvh.CullFrustum(packet.frustumPlanes, visible.data()); });
+    size_t nLinearVisible = 0;
+    double linearCull = UTimeBest(nRuns, [&scene, &packet, &nLinearVisible]()
+    {
+        nLinearVisible = 0;
+        for (const SceneObject& object : scene.objects)
+        {
+            bool inside = true;
+            for (const glm::vec4& plane : packet.frustumPlanes)
+                inside = inside && glm::dot(glm::vec3(plane), glm::vec3(object.bounds)) + plane.w >= -object.bounds.w;
+            nLinearVisible += inside ? 1 : 0;
+        }
+    });
+
+    // Rays from the camera in random directions inside a cone around its view direction
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> unit(-0.5f, 0.5f);
+    std::vector<glm::vec3> directions(nRays);
+    for (glm::vec3& direction : directions)
+        direction = glm::normalize(gCamera.Front + unit(random) * gCamera.Right + unit(random) * gCamera.Up);
+    std::vector<std::uint32_t> hits(nRays);
+    std::vector<std::uint32_t> linearHits(nRays);
+
+    double pick = UTimeBest(nRuns, [&scene, &directions, &hits]()
+    {
+        for (int ray = 0; ray < nRays; ++ray)
+        {
+            const glm::vec3& direction = directions[ray];
+            float distance = 1000.0f;
+            hits[ray] = scene.bvh.Raycast(gCamera.Position, direction, distance, [&scene, &direction](std::uint32_t object, float)
+            {
+                return URaySphere(gCamera.Position, direction, scene.objects[object].bounds);
+            });
+        }
+    });
+    double linearPick = UTimeBest(nRuns, [&scene, &directions, &linearHits]()
+    {
+        for (int ray = 0; ray < nRays; ++ray)
+        {
+            float distance = 1000.0f;
+            linearHits[ray] = Bvh::NO_HIT;
+            for (std::uint32_t object = 0; object < scene.objects.size(); ++object)
+            {
+                float hit = URaySphere(gCamera.Position, directions[ray], scene.objects[object].bounds);
+                if (hit >= 0.0f && hit < distance)
+                {
+                    distance = hit;
+                    linearHits[ray] = object;
+                }
+            }
+        }
+    });
+    int mismatches = 0;
+    for (int ray = 0; ray < nRays; ++ray)
+        mismatches += hits[ray] != linearHits[ray] ? 1 : 0;
+
+    // Picking as a click does: the triangles of the objects near each ray, with the SIMD
+    // kernel and with the one triangle at a time reference
+    std::vector<std::uint32_t> triangleHits(nRays);
+    std::vector<std::uint32_t> referenceHits(nRays);
+    auto pickTriangles = [&scene, &directions](std::vector<std::uint32_t>& results, bool reference)
+    {
+        for (int ray = 0; ray < nRays; ++ray)
+        {
+            const glm::vec3& direction = directions[ray];
+            float distance = 1000.0f;
+            results[ray] = scene.bvh.Raycast(gCamera.Position, direction, distance, [&scene, &direction, reference](std::uint32_t object, float maxDistance)
+            {
+                const SceneObject& sceneObject = scene.objects[object];
+                if (!reference)
+                    return URayObject(sceneObject, gCamera.Position, direction, maxDistance);
+
+                float sphereDistance = URaySphere(gCamera.Position, direction, sceneObject.bounds);
+                if (sphereDistance < 0.0f || sphereDistance > maxDistance)
+                    return -1.0f;
+                glm::mat4 inverseModel = glm::inverse(sceneObject.model);
+                return sceneObject.mesh->triangles.RaycastReference(glm::vec3(inverseModel * glm::vec4(gCamera.Position, 1.0f)),
+                    glm::vec3(inverseModel * glm::vec4(direction, 0.0f)), maxDistance);
+            });
+        }
+    };
+    double trianglePick = UTimeBest(nRuns, [&pickTriangles, &triangleHits]() { pickTriangles(triangleHits, false); });
+    double referencePick = UTimeBest(nRuns, [&pickTriangles, &referenceHits]() { pickTriangles(referenceHits, true); });
+    int triangleMismatches = 0;
+    for (int ray = 0; ray < nRays; ++ray)
+        triangleMismatches += triangleHits[ray] != referenceHits[ray] ? 1 : 0;
+
+    cout << nObjects << " objects, " << scene.bvh.Nodes().size() << " nodes; milliseconds" << endl;
+    cout << "build " << build << ", refit of " << moved.size() << " objects " << refit << endl;
+    cout << "frustum culling " << cull << " (linear " << linearCull << "), " << nVisible << " visible (linear " << nLinearVisible << ")" << endl;
+    cout << nRays << " picking rays " << pick << " (linear " << linearPick << "), " << pick * 1000.0 / nRays << " us per ray, "
+        << mismatches << " different hits" << endl;
+    cout << nRays << " triangle picking rays " << trianglePick << " (one triangle at a time " << referencePick << "), "
+        << trianglePick * 1000.0 / nRays << " us per ray, " << triangleMismatches << " different hits" << endl;
+}
+
+// Times the draw list build with and without the CPU occlusion test, for the desk scene from the
+// starting camera and for 10000 copies of it seen from eye level down a row, and prints how many
+// objects the occluders hid
+void UBenchmarkOcclusion()
+{
+    const int nRuns = 5; // The fastest run of each workload is reported
+    const int nCopies = 10000; // Copies of the desk scene, spread over a grid
+
+    Scene grid;
+    UReplicateDeskScene(grid, nCopies);
+
+    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), 1.0f, 0.1f, 100.0f);
+    glm::mat4 eyeLevel = glm::lookAt(glm::vec3(0.0f, 1.0f, 8.0f), glm::vec3(0.0f, 0.8f, -100.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    struct Workload
+    {
+        const char* name;
+        const Scene* scene;
+        glm::mat4 view;
+    };
+    const Workload workloads[] =
+    {
+        { "desk scene", &gScene, gCamera.GetViewMatrix() },
+        { "10000 desk scenes", &grid, eyeLevel },
+    };
+
+    bool cpuOcclusion = gRenderer.cpuOcclusion;
+    Renderer::RenderPacket packet;
+    cout << "milliseconds to build the draw lists" << endl;
+    for (const Workload& workload : workloads)
+    {
+        double times[2];
+        size_t drawn[2];
+        for (int occlusion = 0; occlusion < 2; ++occlusion)
+        {
+            gRenderer.cpuOcclusion = occlusion != 0;
+            times[occlusion] = UTimeBest(nRuns, [&workload, &projection, &packet]()
+            {
+                gRenderer.BuildPacket(*workload.scene, workload.view, projection, packet);
+            });
+            drawn[occlusion] = packet.order.size();
+        }
+        cout << workload.name << ": " << times[0] << " drawing " << drawn[0] << " objects, with occlusion " << times[1]
+            << " drawing " << drawn[1] << " (" << packet.occludedCount << " hidden)" << endl;
+    }
+    gRenderer.cpuOcclusion = cpuOcclusion;
+}
+
+// Reads malformed scene files that refer to records not read yet, and one correct file, and
+// returns whether the reader rejected exactly the malformed ones before any bad record reached
+// the handler
+bool UCheckSceneFiles()
+{
+    // Counts the records it is given and notes any index to a record it has not been given, which
+    // the scene builder would read out of bounds
+    class IndexCheck : public SceneFileHandler
+    {
+    public:
+        bool outOfBounds = false;
+
+        bool Begin(const SceneFileCounts&) override { return true; }
+        bool Texture(std::string_view) override { textures++; return true; }
+        bool Material(const SceneFileMaterial& material) override
+        {
+            outOfBounds = outOfBounds || (material.texture != SCENE_FILE_NONE && material.texture >= textures);
+            materials++;
+            return true;
+        }
+        bool Node(const SceneFileNode& node) override
+        {
+            outOfBounds = outOfBounds || (node.parent != SCENE_FILE_NONE && node.parent >= nodes);
+            nodes++;
+            return true;
+        }
+        bool Object(const SceneFileObject& object) override
+        {
+            outOfBounds = outOfBounds || object.node >= nodes || object.material >= materials;
+            return true;
+        }
+        bool Light(const SceneFileLight&) override { return true; }
+
+    private:
+        std::uint32_t textures = 0;
+        std::uint32_t materials = 0;
+        std::uint32_t nodes = 0;
+    };
+    struct SceneFileCase
+    {
+        const char* name;
+        const char* text;
+        bool valid;
+    };
+    const SceneFileCase cases[] =
+    {
+        { "object before the node it is placed at",
+            "scene 1 0 1 3 1 0\nnode -1 0 0 0 0 0 0 1 1 1 1\nobject 2 box 0\n", false },
+        { "object before its material",
+            "scene 1 0 1 1 1 0\nnode -1 0 0 0 0 0 0 1 1 1 1\nobject 0 box 0\n", false },
+        { "material before its texture",
+            "scene 1 1 1 0 0 0\nmaterial 0 1 1 1 1 0.5 16\n", false },
+        { "correct file",
+            "scene 1 1 1 1 1 0\ntexture wood\nmaterial 0 1 1 1 1 0.5 16\nnode -1 0 0 0 0 0 0 1 1 1 1\nobject 0 box 0\n", true },
+    };
+
+    const char* const path = "scene_check.txt";
+    bool passed = true;
+    for (const SceneFileCase& check : cases)
+    {
+        std::FILE* file = std::fopen(path, "wb");
+        if (file == nullptr || std::fputs(check.text, file) < 0)
+        {
+            cout << "Cannot write " << path << endl;
+            if (file)
+                std::fclose(file);
+            return false;
+        }
+        std::fclose(file);
+
+        IndexCheck handler;
+        bool read = UReadSceneFile(path, handler);
+        bool ok = read == check.valid && !handler.outOfBounds;
+        cout << (ok ? "ok: " : "FAILED: ") << check.name << (read ? " was read" : " was rejected")
+            << (handler.outOfBounds ? ", after a record referred to one not read yet" : "") << endl;
+        passed = passed && ok;
+    }
+    std::remove(path);
+    return passed;
+}
+
+// Checks that the render loop makes no heap allocation, on any thread, in each of ALLOCATION_CHECK_FRAMES
+// frames once the warm-up frames have sized every buffer and arena. The first frame that allocates
+// fails the check and closes the window; otherwise the window closes after the last frame checked.
+void UCountAllocations(int frame)
+{
+    size_t count = UHeapAllocationCount();
+    size_t allocations = count - gAllocationCount;
+    gAllocationCount = count;
+    if (frame <= ALLOCATION_WARMUP_FRAMES)
+        return;
+
+    int checked = frame - ALLOCATION_WARMUP_FRAMES;
+    if (allocations == 0 && checked < ALLOCATION_CHECK_FRAMES)
+        return;
+
+    FrameArena::Stats arena = gFramePipeline.Current().scratch.GetStats();
+    PoolAllocator::Stats pool = gJobs.GetPoolStats();
+
+    if (allocations > 0)
+        cout << "Steady-state frame " << checked << " of " << ALLOCATION_CHECK_FRAMES << " made " << allocations << " heap allocations" << endl;
+    else
+        cout << "No heap allocations in " << ALLOCATION_CHECK_FRAMES << " frames" << endl;
+    cout << "frame arena: " << arena.capacity << " bytes, " << arena.peakBytes << " peak bytes, "
+        << arena.allocations << " allocations avoided per frame" << endl;
+    cout << "job pool: " << pool.blocks << " blocks of " << pool.blockSize << " bytes, " << pool.peakBlocks << " peak blocks, "
+        << pool.allocations << " allocations avoided" << endl;
+
+    gAllocationCheckFailed = allocations > 0;
+    glfwSetWindowShouldClose(gWindow, true);
+}
+
+// Waits out the rest of the frame when a frame cap is set, either sleeping or spinning
+// (spinning wastes a core but does not overshoot by the OS scheduler's granularity)
+void UPaceFrame(double frameStart)
+{
+    if (gFrameCap <= 0.0)
+        return;
+
+    double deadline = frameStart + 1.0 / gFrameCap;
+    if (gBusyWait)
+    {
+        while (glfwGetTime() < deadline)
+        {
+        }
+    }
+    else
+    {
+        double remaining = deadline - glfwGetTime();
+        if (remaining > 0.0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(remaining));
+    }
+}
+
+// Decodes again, on background jobs, the textures drawn since they lost levels over the GPU memory
+// budget and uploads each whole once its file is decoded, then lets the tracker drop levels of the
+// textures left idle; prints the memory each second with --gpu-memory
+void UUpdateTextureResidency()
+{
+    GpuMemory& memory = UGpuMemory();
+    for (GLuint textureId : memory.TakeRestores())
+    {
+        for (size_t i = 0; i < sizeof(TEXTURE_FILES) / sizeof(TEXTURE_FILES[0]); ++i)
+        {
+            TextureRestore& restore = gTextureRestores[i];
+            if (*TEXTURE_FILES[i].textureId != textureId || restore.decoding)
+                continue;
+            restore.decoding = true;
+            gJobs.RunBackground([i]() { UDecodeImage(TEXTURE_FILES[i].path, gTextureRestores[i].image); }, &restore.decoded);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(TEXTURE_FILES) / sizeof(TEXTURE_FILES[0]); ++i)
+    {
+        TextureRestore& restore = gTextureRestores[i];
+        if (!restore.decoding || !restore.decoded.Done())
+            continue;
+        if (UUploadImage(restore.image, *TEXTURE_FILES[i].textureId))
+            cout << "Restored texture " << TEXTURE_FILES[i].path << endl;
+        else
+            cout << "Failed to restore texture " << TEXTURE_FILES[i].path << endl;
+        UFreeImage(restore.image);
+        restore.decoding = false;
     }
+    memory.EndFrame();
 
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
+    static double lastReport = glfwGetTime();
+    if (gReportGpuMemory && glfwGetTime() - lastReport >= 1.0)
+    {
+        memory.PrintStats();
+        if (gStreamTextures)
+        {
+            TextureStreamer::Stats streamed = gTextureStreamer.GetStats();
+            cout << "Streamed textures: " << streamed.decoding << " decoding, " << streamed.pendingTextures << " of " << streamed.textures
+                << " missing levels, " << (streamed.residentBytes >> 10) << " KB resident of " << (streamed.wantedBytes >> 10) << " KB wanted" << endl;
+        }
+        lastReport = glfwGetTime();
+    }
+}
+
+// Reloads the shaders and textures the asset watcher saw change. A shader that fails to
+// compile keeps its previous program, a texture that fails to decode keeps its contents.
+void UReloadChangedAssets()
+{
+    bool reloadPhong = false;
+    bool reloadLight = false;
 
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
+    for (const std::string& path : gAssetWatcher.TakeChanged())
     {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        if (path == PHONG_VERTEX_SHADER || path == PHONG_FRAGMENT_SHADER)
+            reloadPhong = true;
+        else if (path == LIGHT_VERTEX_SHADER || path == LIGHT_FRAGMENT_SHADER)
+            reloadLight = true;
 
+        for (const TextureFile& texture : TEXTURE_FILES)
+        {
+            if (path == texture.path && gStreamTextures)
+            {
+                gTextureStreamer.Reload(texture.path);
+                cout << "Reloading texture " << texture.path << endl;
+            }
+            else if (path == texture.path)
+            {
+                if (UUploadTexture(texture.path, *texture.textureId))
+                    cout << "Reloaded texture " << texture.path << endl;
+                else
+                    cout << "Failed to reload texture " << texture.path << endl;
+            }
+        }
+    }
+
+    if (reloadPhong && gShaders.Reload())
+        cout << "Reloaded " << PHONG_VERTEX_SHADER << " and " << PHONG_FRAGMENT_SHADER << endl;
+    if (reloadLight && gLightShaders.Reload())
+        cout << "Reloaded " << LIGHT_VERTEX_SHADER << " and " << LIGHT_FRAGMENT_SHADER << endl;
+}
+
+// Draws a mesh from the mesh arena; the arena VAO must be bound
+void UDrawMesh(const Meshes::GLMesh& mesh)
+{
+    glDrawElementsBaseVertex(GL_TRIANGLES, mesh.nIndices, GL_UNSIGNED_INT, (void*)(sizeof(GLuint) * mesh.firstIndex), mesh.baseVertex);
+}
+
+/*Generate and load the texture*/
+bool UCreateTexture(const DecodedImage& image, GLuint& textureId)
+{
+    glGenTextures(1, &textureId);
+    if (UUploadImage(image, textureId))
+        return true;
+
+    glDeleteTextures(1, &textureId);
+    return false;
+}
+
+
+// Decodes an image file and flips it to OpenGL's row order; makes no GL calls, so any thread can decode
+bool UDecodeImage(const char* filename, DecodedImage& image)
+{
+    image.path = filename;
+    image.pixels = stbi_load(filename, &image.width, &image.height, &image.channels, 0);
+    if (!image.pixels)
+        return false;
+
+    flipImageVertically(image.pixels, image.width, image.height, image.channels);
+    return true;
+}
+
+
+// Releases the pixels of a decoded image
+void UFreeImage(DecodedImage& image)
+{
+    if (image.pixels)
+        stbi_image_free(image.pixels);
+    image.pixels = nullptr;
+}
+
+
+// Uploads a decoded image into an existing texture, replacing its contents; the texture is untouched if the image is empty
+bool UUploadImage(const DecodedImage& image, GLuint textureId)
+{
+    if (!image.pixels)
+        return false;
+
+    if (image.channels != 3 && image.channels != 4)
+    {
+        cout << "Not implemented to handle image with " << image.channels << " channels" << endl;
         return false;
     }
 
-    glUseProgram(programId);    // Uses the shader program
+    glBindTexture(GL_TEXTURE_2D, textureId);
+
+    // set the texture wrapping parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // set texture filtering parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    if (image.channels == 3)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.pixels);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels);
+
+    // A texture reduced over the GPU memory budget had its last levels capped
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+
+    int levels = 1;
+    while ((image.width >> levels) > 0 || (image.height >> levels) > 0)
+        ++levels;
+    UGpuMemory().TrackTexture(textureId, image.channels == 3 ? GL_RGB8 : GL_RGBA8, image.width, image.height, levels, image.path, image.path != nullptr);
 
     return true;
 }
 
 
-void UDestroyShaderProgram(GLuint programId)
+// Decodes an image file into an existing texture, replacing its contents; the texture is untouched if the file cannot be decoded
+bool UUploadTexture(const char* filename, GLuint textureId)
+{
+    DecodedImage image;
+    if (!UDecodeImage(filename, image))
+        return false;
+
+    bool success = UUploadImage(image, textureId);
+    UFreeImage(image);
+    return success;
+}
+
+
+void UDestroyTexture(GLuint textureId)
 {
-    glDeleteProgram(programId);
+    UGpuMemory().UntrackTexture(textureId);
+    glDeleteTextures(1, &textureId);
 }
\ No newline at end of file
@@ -0,0 +1,292 @@
+///////////////////////////////////////////////////////////////////////////////
+// allocators.cpp
+// ========
+// scratch memory that avoids the heap in steady state: a linear arena for
+// per-frame and per-load data, reset all at once, and a pool of fixed size
+// blocks for objects allocated and freed individually. Global operator new
+// is counted so the render loop can be checked for heap allocations.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "allocators.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	// Number of times global operator new has been called, on any thread
+	std::atomic<size_t> gHeapAllocations{ 0 };
+}
+
+// The replaced global allocation functions only count the calls; the
+// array and aligned forms are left to the library, which calls these
+void *operator new(size_t size)
+{
+	gHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *block = std::malloc(size != 0 ? size : 1))
+		return block;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *block) noexcept
+{
+	std::free(block);
+}
+
+void operator delete(void *block, size_t) noexcept
+{
+	std::free(block);
+}
+
+///////////////////////////////////////////////////
+//	UHeapAllocationCount()
+//
+//	Return the number of global operator new calls so far, on any thread
+///////////////////////////////////////////////////
+size_t UHeapAllocationCount()
+{
+	return gHeapAllocations.load(std::memory_order_relaxed);
+}
+
+FrameArena::~FrameArena()
+{
+	Destroy();
+}
+
+///////////////////////////////////////////////////
+//	Create(size_t)
+//
+//	capacity: size of the block in bytes
+//
+//	Allocate the arena's block. An arena that is never created starts
+//	empty and sizes itself on its first reset.
+///////////////////////////////////////////////////
+void FrameArena::Create(size_t capacity)
+{
+	Destroy();
+
+	memory = (unsigned char*)::operator new(capacity);
+	this->capacity = capacity;
+}
+
+///////////////////////////////////////////////////
+//	Destroy()
+//
+//	Release the block and any overflow
+///////////////////////////////////////////////////
+void FrameArena::Destroy()
+{
+	Reset();
+
+	::operator delete(memory);
+	memory = nullptr;
+	capacity = 0;
+	peakBytes = 0;
+}
+
+///////////////////////////////////////////////////
+//	Allocate(size_t, size_t)
+//
+//	bytes: size of the allocation
+//	alignment: power of two the address must be a multiple of
+//
+//	Return memory valid until the next Reset()
+///////////////////////////////////////////////////
+void *FrameArena::Allocate(size_t bytes, size_t alignment)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	uintptr_t base = (uintptr_t)memory;
+	size_t current = offset.load(std::memory_order_relaxed);
+	size_t start;
+	do
+	{
+		start = ((base + current + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+		if (memory == nullptr || start + bytes > capacity)
+			return UAllocateOverflow(bytes, alignment);
+	} while (!offset.compare_exchange_weak(current, start + bytes, std::memory_order_relaxed));
+
+	return memory + start;
+}
+
+///////////////////////////////////////////////////
+//	Reset()
+//
+//	Release every allocation at once. If some did not fit since the last
+//	reset, the block is reallocated to hold them all.
+///////////////////////////////////////////////////
+void FrameArena::Reset()
+{
+	std::lock_guard<std::mutex> lock(overflowMutex);
+
+	size_t used = offset.load(std::memory_order_relaxed) + overflowBytes;
+	peakBytes = std::max(peakBytes, used);
+
+	for (void *block : overflowBlocks)
+		::operator delete(block);
+	overflowBlocks.clear();
+
+	// Grow to the peak (plus room for the alignment padding) so the next frames fit
+	if (overflowBytes > 0)
+	{
+		::operator delete(memory);
+		capacity = peakBytes + peakBytes / 4;
+		memory = (unsigned char*)::operator new(capacity);
+	}
+
+	overflowBytes = 0;
+	offset.store(0, std::memory_order_relaxed);
+	allocations.store(0, std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////
+//	GetStats()
+//
+//	Return the arena's size and use
+///////////////////////////////////////////////////
+FrameArena::Stats FrameArena::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(overflowMutex);
+
+	Stats stats;
+	stats.capacity = capacity;
+	stats.peakBytes = std::max(peakBytes, offset.load(std::memory_order_relaxed) + overflowBytes);
+	stats.allocations = allocations.load(std::memory_order_relaxed);
+	stats.overflows = overflowBlocks.size();
+	return stats;
+}
+
+///////////////////////////////////////////////////
+//	UAllocateOverflow(size_t, size_t)
+//
+//	bytes: size of the allocation
+//	alignment: power of two the address must be a multiple of
+//
+//	Allocate from the heap what does not fit in the block
+///////////////////////////////////////////////////
+void *FrameArena::UAllocateOverflow(size_t bytes, size_t alignment)
+{
+	std::lock_guard<std::mutex> lock(overflowMutex);
+
+	// Blocks from operator new are aligned for any fundamental type; larger alignments are padded
+	size_t padding = alignment > alignof(std::max_align_t) ? alignment : 0;
+	unsigned char *block = (unsigned char*)::operator new(bytes + padding);
+	overflowBlocks.push_back(block);
+	overflowBytes += bytes + padding;
+
+	uintptr_t address = ((uintptr_t)block + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	return (void*)address;
+}
+
+PoolAllocator::~PoolAllocator()
+{
+	Destroy();
+}
+
+///////////////////////////////////////////////////
+//	Create(size_t, size_t)
+//
+//	blockSize: size of each block in bytes
+//	blocksPerChunk: blocks carved from each chunk taken from the heap
+///////////////////////////////////////////////////
+void PoolAllocator::Create(size_t blockSize, size_t blocksPerChunk)
+{
+	Destroy();
+
+	// Every block must hold the free list link and stay aligned
+	size_t alignment = alignof(std::max_align_t);
+	this->blockSize = (std::max(blockSize, sizeof(void*)) + alignment - 1) / alignment * alignment;
+	this->blocksPerChunk = std::max<size_t>(1, blocksPerChunk);
+}
+
+///////////////////////////////////////////////////
+//	Destroy()
+//
+//	Return every chunk to the heap; blocks still allocated become invalid
+///////////////////////////////////////////////////
+void PoolAllocator::Destroy()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (unsigned char *chunk : chunks)
+		::operator delete(chunk);
+	chunks.clear();
+	freeList = nullptr;
+	liveBlocks = 0;
+	peakBlocks = 0;
+	allocations = 0;
+}
+
+///////////////////////////////////////////////////
+//	Allocate()
+//
+//	Return a block, carving a new chunk when none is free
+///////////////////////////////////////////////////
+void *PoolAllocator::Allocate()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (freeList == nullptr)
+		UAddChunk();
+
+	void *block = freeList;
+	freeList = *(void**)block;
+
+	allocations++;
+	liveBlocks++;
+	peakBlocks = std::max(peakBlocks, liveBlocks);
+	return block;
+}
+
+///////////////////////////////////////////////////
+//	Free(void*)
+//
+//	block: block returned by Allocate()
+///////////////////////////////////////////////////
+void PoolAllocator::Free(void *block)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	*(void**)block = freeList;
+	freeList = block;
+	liveBlocks--;
+}
+
+///////////////////////////////////////////////////
+//	GetStats()
+//
+//	Return the pool's size and use
+///////////////////////////////////////////////////
+PoolAllocator::Stats PoolAllocator::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Stats stats;
+	stats.blockSize = blockSize;
+	stats.blocks = chunks.size() * blocksPerChunk;
+	stats.liveBlocks = liveBlocks;
+	stats.peakBlocks = peakBlocks;
+	stats.allocations = allocations;
+	return stats;
+}
+
+///////////////////////////////////////////////////
+//	UAddChunk()
+//
+//	Take a chunk from the heap and put its blocks on the free list; the
+//	mutex must be held
+///////////////////////////////////////////////////
+void PoolAllocator::UAddChunk()
+{
+	unsigned char *chunk = (unsigned char*)::operator new(blockSize * blocksPerChunk);
+	chunks.push_back(chunk);
+
+	for (size_t i = blocksPerChunk; i-- > 0; )
+	{
+		void *block = chunk + i * blockSize;
+		*(void**)block = freeList;
+		freeList = block;
+	}
+}
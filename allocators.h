@@ -0,0 +1,120 @@
+///////////////////////////////////////////////////////////////////////////////
+// allocators.h
+// ========
+// scratch memory that avoids the heap in steady state: a linear arena for
+// per-frame and per-load data, reset all at once, and a pool of fixed size
+// blocks for objects allocated and freed individually. Global operator new
+// is counted so the render loop can be checked for heap allocations.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Linear allocator: allocations bump an offset into one block and are all
+// released by Reset(). Safe to allocate from several threads at once.
+// Allocations that do not fit go to the heap, and the next Reset() grows
+// the block to the peak so later frames fit.
+class FrameArena
+{
+public:
+	struct Stats
+	{
+		size_t capacity;		// Size of the block
+		size_t peakBytes;		// Most bytes in use between two resets, overflow included
+		size_t allocations;		// Allocations served since the last reset (heap allocations avoided)
+		size_t overflows;		// Allocations since the last reset that did not fit and went to the heap
+	};
+
+public:
+	FrameArena() = default;
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+	~FrameArena();
+
+	void Create(size_t capacity);
+	void Destroy();
+	void *Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+	template <typename T> T *Allocate(size_t count) { return (T*)Allocate(sizeof(T) * count, alignof(T)); }
+	void Reset();
+	Stats GetStats() const;
+
+private:
+	void *UAllocateOverflow(size_t bytes, size_t alignment);
+
+	unsigned char *memory = nullptr;
+	size_t capacity = 0;
+	std::atomic<size_t> offset{ 0 };		// First free byte of the block
+	std::atomic<size_t> allocations{ 0 };
+	size_t peakBytes = 0;
+
+	mutable std::mutex overflowMutex;		// Guards the overflow fields
+	std::vector<void*> overflowBlocks;		// Heap blocks freed by the next Reset()
+	size_t overflowBytes = 0;
+};
+
+// STL allocator drawing from a FrameArena; deallocation is a no-op, the
+// memory returns to the arena when it is reset
+template <typename T>
+struct ArenaAllocator
+{
+	typedef T value_type;
+
+	FrameArena *arena;
+
+	ArenaAllocator(FrameArena &arena) : arena(&arena) {}
+	template <typename U> ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+	T *allocate(size_t count) { return arena->Allocate<T>(count); }
+	void deallocate(T*, size_t) {}
+
+	template <typename U> bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+	template <typename U> bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Fixed size blocks kept on a free list. Blocks are carved from chunks
+// that are only returned to the heap by Destroy(). Thread safe.
+class PoolAllocator
+{
+public:
+	struct Stats
+	{
+		size_t blockSize;
+		size_t blocks;			// Blocks carved from the chunks
+		size_t liveBlocks;		// Blocks allocated and not freed
+		size_t peakBlocks;		// Most blocks live at once
+		size_t allocations;		// Blocks handed out in total (heap allocations avoided)
+	};
+
+public:
+	PoolAllocator() = default;
+	PoolAllocator(const PoolAllocator&) = delete;
+	PoolAllocator& operator=(const PoolAllocator&) = delete;
+	~PoolAllocator();
+
+	void Create(size_t blockSize, size_t blocksPerChunk);
+	void Destroy();
+	void *Allocate();
+	void Free(void *block);
+	Stats GetStats() const;
+
+private:
+	void UAddChunk();
+
+	size_t blockSize = 0;
+	size_t blocksPerChunk = 0;
+	std::vector<unsigned char*> chunks;
+	void *freeList = nullptr;		// Each free block starts with a pointer to the next one
+	mutable std::mutex mutex;		// Guards every field but the sizes
+	size_t liveBlocks = 0;
+	size_t peakBlocks = 0;
+	size_t allocations = 0;
+};
+
+size_t UHeapAllocationCount();
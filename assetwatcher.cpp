@@ -0,0 +1,180 @@
+///////////////////////////////////////////////////////////////////////////////
+// assetwatcher.cpp
+// ========
+// watch asset files (shaders, textures) on a background thread and queue
+// the ones that change on disk, for the GL thread to reload between frames
+///////////////////////////////////////////////////////////////////////////////
+
+#include "assetwatcher.h"
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// How long the watcher thread waits before checking whether it must stop
+	const int WAKE_INTERVAL_MS = 100;
+	// How often file times are compared when inotify is not available
+	const int POLL_INTERVAL_MS = 250;
+}
+
+AssetWatcher::~AssetWatcher()
+{
+	Stop();
+}
+
+///////////////////////////////////////////////////
+//	Start(const std::vector<std::string>&)
+//
+//	paths: files to watch
+//
+//	Start watching the files on a background thread: with inotify on
+//	Linux, by polling their modification times elsewhere
+///////////////////////////////////////////////////
+void AssetWatcher::Start(const std::vector<std::string> &paths)
+{
+	Stop();
+
+	this->paths = paths;
+	running = true;
+#ifdef __linux__
+	thread = std::thread(&AssetWatcher::UWatchNotify, this);
+#else
+	thread = std::thread(&AssetWatcher::UWatchPoll, this);
+#endif
+}
+
+///////////////////////////////////////////////////
+//	Stop()
+//
+//	Stop the watcher thread and wait for it to exit
+///////////////////////////////////////////////////
+void AssetWatcher::Stop()
+{
+	running = false;
+	if (thread.joinable())
+		thread.join();
+}
+
+///////////////////////////////////////////////////
+//	TakeChanged()
+//
+//	Return the files changed since the last call, each listed once, and
+//	empty the queue
+///////////////////////////////////////////////////
+std::vector<std::string> AssetWatcher::TakeChanged()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<std::string> result(changed.begin(), changed.end());
+	changed.clear();
+	return result;
+}
+
+///////////////////////////////////////////////////
+//	UWatchNotify()
+//
+//	Watcher thread using inotify. The directories holding the files are
+//	watched rather than the files, since editors often save by writing a
+//	new file and renaming it over the old one.
+///////////////////////////////////////////////////
+void AssetWatcher::UWatchNotify()
+{
+#ifdef __linux__
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+	{
+		UWatchPoll();
+		return;
+	}
+
+	// Watch descriptor of each directory, then the watched files by directory and name
+	std::map<std::string, int> directories;
+	std::map<std::pair<int, std::string>, std::string> files;
+	for (const std::string &path : paths)
+	{
+		std::filesystem::path file(path);
+		std::string directory = file.has_parent_path() ? file.parent_path().string() : ".";
+
+		if (directories.find(directory) == directories.end())
+			directories[directory] = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (directories[directory] >= 0)
+			files[{ directories[directory], file.filename().string() }] = path;
+	}
+
+	alignas(inotify_event) char buffer[4096];
+	while (running)
+	{
+		pollfd descriptor = { fd, POLLIN, 0 };
+		if (poll(&descriptor, 1, WAKE_INTERVAL_MS) <= 0)
+			continue;
+
+		ssize_t length;
+		while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+		{
+			for (char *p = buffer; p < buffer + length; )
+			{
+				const inotify_event *event = (const inotify_event*)p;
+				if (event->len > 0)
+				{
+					auto found = files.find({ event->wd, event->name });
+					if (found != files.end())
+						UQueue(found->second);
+				}
+				p += sizeof(inotify_event) + event->len;
+			}
+		}
+	}
+
+	close(fd);
+#endif
+}
+
+///////////////////////////////////////////////////
+//	UWatchPoll()
+//
+//	Watcher thread comparing the files' modification times
+///////////////////////////////////////////////////
+void AssetWatcher::UWatchPoll()
+{
+	// Converted once, so polling does not allocate
+	std::vector<std::filesystem::path> files(paths.begin(), paths.end());
+	std::vector<std::filesystem::file_time_type> times(paths.size());
+	std::error_code error;
+	for (size_t i = 0; i < files.size(); i++)
+		times[i] = std::filesystem::last_write_time(files[i], error);
+
+	while (running)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(POLL_INTERVAL_MS));
+
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			std::filesystem::file_time_type time = std::filesystem::last_write_time(files[i], error);
+			if (!error && time != times[i])
+			{
+				times[i] = time;
+				UQueue(paths[i]);
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////
+//	UQueue(const std::string&)
+//
+//	path: changed file
+//
+//	Add a changed file to the queue read by TakeChanged()
+///////////////////////////////////////////////////
+void AssetWatcher::UQueue(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	changed.insert(path);
+}
@@ -0,0 +1,36 @@
+///////////////////////////////////////////////////////////////////////////////
+// assetwatcher.h
+// ========
+// watch asset files (shaders, textures) on a background thread and queue
+// the ones that change on disk, for the GL thread to reload between frames
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class AssetWatcher
+{
+public:
+	~AssetWatcher();
+
+	void Start(const std::vector<std::string> &paths);
+	void Stop();
+	std::vector<std::string> TakeChanged();
+
+private:
+	void UWatchNotify();
+	void UWatchPoll();
+	void UQueue(const std::string &path);
+
+	std::vector<std::string> paths;		// Files being watched, as given to Start()
+	std::thread thread;
+	std::atomic<bool> running{ false };
+	std::mutex mutex;					// Guards changed
+	std::set<std::string> changed;		// Files changed since the last TakeChanged()
+};
@@ -0,0 +1,463 @@
+///////////////////////////////////////////////////////////////////////////////
+// bvh.cpp
+// ========
+// bounding volume hierarchy over the scene objects, built with the surface
+// area heuristic and refit when objects move. Culls the objects against the
+// view frustum a subtree at a time and finds the nearest object on a ray.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "bvh.h"
+
+#include <algorithm>
+
+#include "scene.h"
+
+namespace
+{
+	// Bins the centroids are sorted into when looking for the cheapest split
+	const int SAH_BINS = 16;
+	// Cost of visiting an inner node, relative to testing one object
+	const float TRAVERSAL_COST = 1.0f;
+
+	// Half the surface area of a box, enough to compare costs
+	inline float UHalfArea(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+	{
+		glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(0.0f));
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	// Grow a box to enclose a sphere
+	inline void UGrow(glm::vec3 &boundsMin, glm::vec3 &boundsMax, const glm::vec4 &sphere)
+	{
+		glm::vec3 center(sphere);
+		boundsMin = glm::min(boundsMin, center - glm::vec3(sphere.w));
+		boundsMax = glm::max(boundsMax, center + glm::vec3(sphere.w));
+	}
+}
+
+///////////////////////////////////////////////////
+//	Build(const SceneObject*, size_t)
+//
+//	objects: scene objects, placed by their world bounding spheres
+//	nObjects: number of objects
+//
+//	Build the hierarchy from scratch. Each node is split where the surface
+//	area heuristic, evaluated at SAH_BINS positions along the widest axis
+//	of the centroids, predicts the cheapest traversal.
+///////////////////////////////////////////////////
+void Bvh::Build(const SceneObject *objects, size_t nObjects)
+{
+	Clear();
+	if (nObjects == 0)
+		return;
+
+	spheres.resize(nObjects);
+	objectIndices.resize(nObjects);
+	objectLeaves.resize(nObjects);
+	for (size_t i = 0; i < nObjects; i++)
+	{
+		spheres[i] = objects[i].bounds;
+		objectIndices[i] = (std::uint32_t)i;
+	}
+
+	// A binary tree with at least one object per leaf has fewer than 2n nodes
+	nodes.reserve(2 * nObjects);
+	parents.reserve(2 * nObjects);
+	nodes.push_back({});
+	parents.push_back(0);
+	UBuildNode(0, 0, (std::uint32_t)nObjects, 0);
+}
+
+///////////////////////////////////////////////////
+//	Refit(const SceneObject*, const std::vector<SceneRange>&)
+//
+//	objects: scene objects, as given to Build()
+//	changed: objects whose bounds changed
+//
+//	Update the boxes of the leaves holding the changed objects and of their
+//	ancestors, keeping the tree's structure. When many objects changed, every
+//	node is refit in one pass from the leaves up instead.
+///////////////////////////////////////////////////
+void Bvh::Refit(const SceneObject *objects, const std::vector<SceneRange> &changed)
+{
+	size_t nChanged = 0;
+	for (const SceneRange &range : changed)
+	{
+		for (std::uint32_t i = range.first; i < range.first + range.count; i++)
+			spheres[i] = objects[i].bounds;
+		nChanged += range.count;
+	}
+	if (nChanged == 0)
+		return;
+
+	// Children come after their parents, so a reverse pass refits bottom up
+	if (nChanged * 4 > objectIndices.size())
+	{
+		for (size_t node = nodes.size(); node-- > 0; )
+		{
+			if (nodes[node].count > 0)
+				URefitLeaf((std::uint32_t)node);
+			else
+				URefitInner((std::uint32_t)node);
+		}
+		return;
+	}
+
+	for (const SceneRange &range : changed)
+	{
+		for (std::uint32_t i = range.first; i < range.first + range.count; i++)
+		{
+			std::uint32_t node = objectLeaves[i];
+			URefitLeaf(node);
+			while (node != 0)
+			{
+				node = parents[node];
+				URefitInner(node);
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////
+//	Clear()
+//
+//	Remove every node and object
+///////////////////////////////////////////////////
+void Bvh::Clear()
+{
+	nodes.clear();
+	objectIndices.clear();
+	parents.clear();
+	objectLeaves.clear();
+	spheres.clear();
+}
+
+///////////////////////////////////////////////////
+//	CullFrustum(const glm::vec4[6], std::uint32_t*, JobSystem*)
+//
+//	planes: normalized frustum planes pointing inside
+//	visible: receives the indices of the objects in the frustum, room for
+//	         ObjectCount() of them
+//	jobs: job system the subtrees are culled on, may be null
+//
+//	Return the number of objects whose bounding sphere touches the frustum.
+//	Subtrees outside a plane are skipped whole, and planes a box is fully
+//	inside are not tested again below it. With jobs, the top of the tree
+//	is split into up to MAX_CULL_JOBS subtrees culled in parallel, each
+//	into the part of visible matching its objects, then packed together.
+///////////////////////////////////////////////////
+size_t Bvh::CullFrustum(const glm::vec4 planes[6], std::uint32_t *visible, JobSystem *jobs) const
+{
+	if (nodes.empty())
+		return 0;
+	if (!jobs || jobs->ThreadCount() < 2 || objectIndices.size() < PARALLEL_CULL_OBJECTS)
+		return UCullSubtree(planes, 0, visible);
+
+	// Split the widest level that fits, left to right, so the subtrees'
+	// objects follow each other in the object index list
+	const size_t nWanted = std::min<size_t>(MAX_CULL_JOBS, jobs->ThreadCount() * JobSystem::CHUNKS_PER_THREAD);
+	std::uint32_t roots[MAX_CULL_JOBS];
+	std::uint32_t split[MAX_CULL_JOBS];
+	size_t nRoots = 1;
+	roots[0] = 0;
+	for (bool grown = true; grown && nRoots < nWanted; )
+	{
+		grown = false;
+		size_t nSplit = 0;
+		for (size_t i = 0; i < nRoots; i++)
+		{
+			const Node &node = nodes[roots[i]];
+			if (node.count == 0 && nSplit + 2 + (nRoots - i - 1) <= nWanted)
+			{
+				split[nSplit++] = node.first;
+				split[nSplit++] = node.first + 1;
+				grown = true;
+			}
+			else
+				split[nSplit++] = roots[i];
+		}
+		std::copy(split, split + nSplit, roots);
+		nRoots = nSplit;
+	}
+
+	std::uint32_t firsts[MAX_CULL_JOBS + 1];
+	size_t counts[MAX_CULL_JOBS];
+	for (size_t i = 0; i < nRoots; i++)
+		firsts[i] = UFirstObject(roots[i]);
+	firsts[nRoots] = (std::uint32_t)objectIndices.size();
+
+	jobs->ParallelFor(nRoots, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			counts[i] = UCullSubtree(planes, roots[i], visible + firsts[i]);
+	});
+
+	size_t nVisible = 0;
+	for (size_t i = 0; i < nRoots; i++)
+	{
+		if (nVisible != firsts[i])
+			std::copy(visible + firsts[i], visible + firsts[i] + counts[i], visible + nVisible);
+		nVisible += counts[i];
+	}
+	return nVisible;
+}
+
+///////////////////////////////////////////////////
+//	UCullSubtree(const glm::vec4[6], std::uint32_t, std::uint32_t*)
+//
+//	planes: normalized frustum planes pointing inside
+//	root: node the subtree starts at
+//	visible: receives the indices of the subtree's objects in the frustum
+//
+//	Return the number of the subtree's objects in the frustum
+///////////////////////////////////////////////////
+size_t Bvh::UCullSubtree(const glm::vec4 planes[6], std::uint32_t root, std::uint32_t *visible) const
+{
+	const unsigned ALL_PLANES = (1u << 6) - 1;
+	size_t nVisible = 0;
+
+	// Nodes to visit with the planes they still straddle
+	std::pair<std::uint32_t, unsigned> stack[MAX_DEPTH + 2];
+	int size = 0;
+	stack[size++] = { root, ALL_PLANES };
+
+	while (size > 0)
+	{
+		std::uint32_t index = stack[size - 1].first;
+		unsigned mask = stack[--size].second;
+		const Node &node = nodes[index];
+
+		glm::vec3 center = (node.boundsMin + node.boundsMax) * 0.5f;
+		glm::vec3 extent = (node.boundsMax - node.boundsMin) * 0.5f;
+		bool outside = false;
+		for (int p = 0; p < 6 && !outside; p++)
+		{
+			if (!(mask & (1u << p)))
+				continue;
+			glm::vec3 normal(planes[p]);
+			float distance = glm::dot(normal, center) + planes[p].w;
+			float radius = glm::dot(glm::abs(normal), extent);
+			if (distance + radius < 0.0f)
+				outside = true;
+			else if (distance - radius >= 0.0f)
+				mask &= ~(1u << p);
+		}
+		if (outside)
+			continue;
+
+		if (node.count == 0)
+		{
+			stack[size++] = { node.first, mask };
+			stack[size++] = { node.first + 1, mask };
+			continue;
+		}
+
+		for (std::uint32_t i = node.first; i < node.first + node.count; i++)
+		{
+			std::uint32_t object = objectIndices[i];
+			const glm::vec4 &sphere = spheres[object];
+			bool inside = true;
+			for (int p = 0; p < 6 && inside; p++)
+			{
+				if (mask & (1u << p))
+					inside = glm::dot(glm::vec3(planes[p]), glm::vec3(sphere)) + planes[p].w >= -sphere.w;
+			}
+			if (inside)
+				visible[nVisible++] = object;
+		}
+	}
+
+	return nVisible;
+}
+
+///////////////////////////////////////////////////
+//	UFirstObject(std::uint32_t)
+//
+//	node: root of a subtree
+//
+//	Return where the subtree's objects start in the object index list: a
+//	node's first child holds the objects before its second child's
+///////////////////////////////////////////////////
+std::uint32_t Bvh::UFirstObject(std::uint32_t node) const
+{
+	while (nodes[node].count == 0)
+		node = nodes[node].first;
+	return nodes[node].first;
+}
+
+///////////////////////////////////////////////////
+//	UBuildNode(std::uint32_t, std::uint32_t, std::uint32_t, int)
+//
+//	node: node to fill
+//	begin: first of the node's objects in the object index list
+//	end: object after the last one
+//	depth: depth of the node, 0 for the root
+//
+//	Bound the objects, then either make the node a leaf or split the
+//	objects at the cheapest bin boundary and build both children
+///////////////////////////////////////////////////
+void Bvh::UBuildNode(std::uint32_t node, std::uint32_t begin, std::uint32_t end, int depth)
+{
+	std::uint32_t count = end - begin;
+	glm::vec3 boundsMin(INFINITY), boundsMax(-INFINITY);
+	glm::vec3 centroidMin(INFINITY), centroidMax(-INFINITY);
+	for (std::uint32_t i = begin; i < end; i++)
+	{
+		const glm::vec4 &sphere = spheres[objectIndices[i]];
+		UGrow(boundsMin, boundsMax, sphere);
+		centroidMin = glm::min(centroidMin, glm::vec3(sphere));
+		centroidMax = glm::max(centroidMax, glm::vec3(sphere));
+	}
+	nodes[node].boundsMin = boundsMin;
+	nodes[node].boundsMax = boundsMax;
+
+	int axis = 0;
+	glm::vec3 centroidExtent = centroidMax - centroidMin;
+	if (centroidExtent.y > centroidExtent[axis])
+		axis = 1;
+	if (centroidExtent.z > centroidExtent[axis])
+		axis = 2;
+
+	std::uint32_t middle = begin;
+	if (count > 1 && depth < MAX_DEPTH && centroidExtent[axis] > 0.0f)
+	{
+		struct Bin
+		{
+			glm::vec3 boundsMin = glm::vec3(INFINITY);
+			glm::vec3 boundsMax = glm::vec3(-INFINITY);
+			std::uint32_t count = 0;
+		};
+		Bin bins[SAH_BINS];
+		float binScale = SAH_BINS / centroidExtent[axis];
+		auto binOf = [&](std::uint32_t object)
+		{
+			int bin = (int)((spheres[object][axis] - centroidMin[axis]) * binScale);
+			return std::min(bin, SAH_BINS - 1);
+		};
+		for (std::uint32_t i = begin; i < end; i++)
+		{
+			Bin &bin = bins[binOf(objectIndices[i])];
+			UGrow(bin.boundsMin, bin.boundsMax, spheres[objectIndices[i]]);
+			bin.count++;
+		}
+
+		// Cost of each split from sweeps in both directions: area times objects on each side
+		float rightCost[SAH_BINS];
+		glm::vec3 sweepMin(INFINITY), sweepMax(-INFINITY);
+		std::uint32_t sweepCount = 0;
+		for (int b = SAH_BINS - 1; b > 0; b--)
+		{
+			sweepMin = glm::min(sweepMin, bins[b].boundsMin);
+			sweepMax = glm::max(sweepMax, bins[b].boundsMax);
+			sweepCount += bins[b].count;
+			rightCost[b] = sweepCount > 0 ? UHalfArea(sweepMin, sweepMax) * sweepCount : 0.0f;
+		}
+
+		int bestSplit = -1;
+		float bestCost = INFINITY;
+		sweepMin = glm::vec3(INFINITY);
+		sweepMax = glm::vec3(-INFINITY);
+		sweepCount = 0;
+		for (int b = 1; b < SAH_BINS; b++)
+		{
+			sweepMin = glm::min(sweepMin, bins[b - 1].boundsMin);
+			sweepMax = glm::max(sweepMax, bins[b - 1].boundsMax);
+			sweepCount += bins[b - 1].count;
+			if (sweepCount == 0 || sweepCount == count)
+				continue;
+			float cost = UHalfArea(sweepMin, sweepMax) * sweepCount + rightCost[b];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+
+		// Split when it beats testing every object, or when the leaf would be too large
+		float leafCost = (float)count;
+		float splitCost = TRAVERSAL_COST + bestCost / std::max(UHalfArea(boundsMin, boundsMax), 1e-12f);
+		if (bestSplit > 0 && (count > MAX_LEAF_OBJECTS || splitCost < leafCost))
+		{
+			middle = (std::uint32_t)(std::partition(objectIndices.begin() + begin, objectIndices.begin() + end,
+				[&](std::uint32_t object) { return binOf(object) < bestSplit; }) - objectIndices.begin());
+		}
+	}
+	else if (count > MAX_LEAF_OBJECTS && depth < MAX_DEPTH)
+	{
+		// Every centroid in the same place: halve the list
+		middle = begin + count / 2;
+	}
+
+	if (middle == begin || middle == end)
+	{
+		nodes[node].first = begin;
+		nodes[node].count = count;
+		for (std::uint32_t i = begin; i < end; i++)
+			objectLeaves[objectIndices[i]] = node;
+		return;
+	}
+
+	std::uint32_t left = (std::uint32_t)nodes.size();
+	nodes[node].first = left;
+	nodes[node].count = 0;
+	nodes.push_back({});
+	nodes.push_back({});
+	parents.push_back(node);
+	parents.push_back(node);
+	UBuildNode(left, begin, middle, depth + 1);
+	UBuildNode(left + 1, middle, end, depth + 1);
+}
+
+///////////////////////////////////////////////////
+//	URefitLeaf(std::uint32_t)
+//
+//	node: leaf to refit
+//
+//	Bound the leaf's objects again
+///////////////////////////////////////////////////
+void Bvh::URefitLeaf(std::uint32_t node)
+{
+	Node &leaf = nodes[node];
+	leaf.boundsMin = glm::vec3(INFINITY);
+	leaf.boundsMax = glm::vec3(-INFINITY);
+	for (std::uint32_t i = leaf.first; i < leaf.first + leaf.count; i++)
+		UGrow(leaf.boundsMin, leaf.boundsMax, spheres[objectIndices[i]]);
+}
+
+///////////////////////////////////////////////////
+//	URefitInner(std::uint32_t)
+//
+//	node: inner node to refit
+//
+//	Bound the node's two children again
+///////////////////////////////////////////////////
+void Bvh::URefitInner(std::uint32_t node)
+{
+	Node &inner = nodes[node];
+	const Node &left = nodes[inner.first];
+	const Node &right = nodes[inner.first + 1];
+	inner.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+	inner.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+}
+
+///////////////////////////////////////////////////
+//	URayBox(const Node&, const glm::vec3&, const glm::vec3&, float)
+//
+//	node: node whose box to test
+//	origin: start of the ray
+//	inverseDirection: 1 / direction of the ray, per axis
+//	maxDistance: farthest distance of interest
+//
+//	Return the distance where the ray enters the box (0 when it starts
+//	inside), or a negative value when it misses it within maxDistance
+///////////////////////////////////////////////////
+float Bvh::URayBox(const Node &node, const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance) const
+{
+	glm::vec3 t0 = (node.boundsMin - origin) * inverseDirection;
+	glm::vec3 t1 = (node.boundsMax - origin) * inverseDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+	return enter <= exit ? enter : -1.0f;
+}
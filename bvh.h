@@ -0,0 +1,167 @@
+///////////////////////////////////////////////////////////////////////////////
+// bvh.h
+// ========
+// bounding volume hierarchy over the scene objects, built with the surface
+// area heuristic and refit when objects move. Culls the objects against the
+// view frustum a subtree at a time and finds the nearest object on a ray.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "jobs.h"
+
+struct SceneObject;
+struct SceneRange;
+
+///////////////////////////////////////////////////
+//	URaySphere(const glm::vec3&, const glm::vec3&, const glm::vec4&)
+//
+//	origin: start of the ray
+//	direction: unit direction of the ray
+//	sphere: center, radius
+//
+//	Return the distance along the ray to where it enters the sphere (0 when
+//	it starts inside), or a negative value when it misses
+///////////////////////////////////////////////////
+inline float URaySphere(const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec4 &sphere)
+{
+	glm::vec3 offset = origin - glm::vec3(sphere);
+	float b = glm::dot(offset, direction);
+	float c = glm::dot(offset, offset) - sphere.w * sphere.w;
+	if (c <= 0.0f)
+		return 0.0f;
+	float discriminant = b * b - c;
+	if (b > 0.0f || discriminant < 0.0f)
+		return -1.0f;
+	return -b - std::sqrt(discriminant);
+}
+
+class Bvh
+{
+public:
+	// Axis-aligned box around a subtree. An inner node's children are at
+	// first and first + 1; a leaf holds count objects from first on in the
+	// object index list.
+	struct Node
+	{
+		glm::vec3 boundsMin;
+		std::uint32_t first;
+		glm::vec3 boundsMax;
+		std::uint32_t count;	// 0 for an inner node
+	};
+
+	// Returned by Raycast() when the ray hits nothing
+	static constexpr std::uint32_t NO_HIT = 0xFFFFFFFFu;
+	// Objects a leaf holds before the build considers splitting it
+	static constexpr std::uint32_t MAX_LEAF_OBJECTS = 4;
+	// Deeper nodes become leaves whatever their size
+	static constexpr int MAX_DEPTH = 48;
+	// Hierarchies of fewer objects are culled on the calling thread alone
+	static constexpr size_t PARALLEL_CULL_OBJECTS = 4096;
+	// Most subtrees culled as separate jobs
+	static constexpr size_t MAX_CULL_JOBS = 64;
+
+public:
+	void Build(const SceneObject *objects, size_t nObjects);
+	void Refit(const SceneObject *objects, const std::vector<SceneRange> &changed);
+	void Clear();
+	size_t CullFrustum(const glm::vec4 planes[6], std::uint32_t *visible, JobSystem *jobs = nullptr) const;
+	template <typename HitTest>
+	std::uint32_t Raycast(const glm::vec3 &origin, const glm::vec3 &direction, float &distance, const HitTest &hitTest) const;
+
+	size_t ObjectCount() const { return objectIndices.size(); }
+	const std::vector<Node> &Nodes() const { return nodes; }
+
+private:
+	void UBuildNode(std::uint32_t node, std::uint32_t begin, std::uint32_t end, int depth);
+	void URefitLeaf(std::uint32_t node);
+	void URefitInner(std::uint32_t node);
+	size_t UCullSubtree(const glm::vec4 planes[6], std::uint32_t root, std::uint32_t *visible) const;
+	std::uint32_t UFirstObject(std::uint32_t node) const;
+	float URayBox(const Node &node, const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance) const;
+
+	std::vector<Node> nodes;					// Root first, each parent before its children
+	std::vector<std::uint32_t> objectIndices;	// Scene objects in leaf order
+	std::vector<std::uint32_t> parents;			// Parent of each node (the root's is itself)
+	std::vector<std::uint32_t> objectLeaves;	// Leaf holding each scene object
+	std::vector<glm::vec4> spheres;				// World bounding sphere of each object, as last built or refit
+};
+
+///////////////////////////////////////////////////
+//	Raycast(const glm::vec3&, const glm::vec3&, float&, const HitTest&)
+//
+//	origin: start of the ray
+//	direction: unit direction of the ray
+//	distance: farthest distance to search; receives the nearest hit
+//	hitTest: called as hitTest(object, distance) for each object whose
+//	         bounds the ray reaches within distance; returns where the ray
+//	         hits the object, or a negative value for a miss
+//
+//	Return the index of the nearest object hit, or NO_HIT. Children are
+//	visited nearest first and skipped once a closer hit is known, so only
+//	the objects near the ray are tested.
+///////////////////////////////////////////////////
+template <typename HitTest>
+std::uint32_t Bvh::Raycast(const glm::vec3 &origin, const glm::vec3 &direction, float &distance, const HitTest &hitTest) const
+{
+	if (nodes.empty())
+		return NO_HIT;
+
+	glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	std::uint32_t hit = NO_HIT;
+
+	// Nodes to visit with the distance the ray enters them. The build
+	// limits the depth, so the stack cannot overflow.
+	std::pair<std::uint32_t, float> stack[MAX_DEPTH + 2];
+	int size = 0;
+	float rootDistance = URayBox(nodes[0], origin, inverseDirection, distance);
+	if (rootDistance >= 0.0f)
+		stack[size++] = { 0, rootDistance };
+
+	while (size > 0)
+	{
+		--size;
+		if (stack[size].second > distance)
+			continue;
+
+		const Node &node = nodes[stack[size].first];
+		if (node.count > 0)
+		{
+			for (std::uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				std::uint32_t object = objectIndices[i];
+				float objectDistance = hitTest(object, distance);
+				if (objectDistance >= 0.0f && objectDistance < distance)
+				{
+					distance = objectDistance;
+					hit = object;
+				}
+			}
+			continue;
+		}
+
+		// Push the farther child first so the nearer one is visited next
+		float nearDistance = URayBox(nodes[node.first], origin, inverseDirection, distance);
+		float farDistance = URayBox(nodes[node.first + 1], origin, inverseDirection, distance);
+		std::uint32_t nearChild = node.first;
+		std::uint32_t farChild = node.first + 1;
+		if (farDistance >= 0.0f && (nearDistance < 0.0f || farDistance < nearDistance))
+		{
+			std::swap(nearDistance, farDistance);
+			std::swap(nearChild, farChild);
+		}
+		if (farDistance >= 0.0f)
+			stack[size++] = { farChild, farDistance };
+		if (nearDistance >= 0.0f)
+			stack[size++] = { nearChild, nearDistance };
+	}
+
+	return hit;
+}
@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////////
+// framepipeline.cpp
+// ========
+// build the render packet of the next frame as a job while the GL thread
+// submits the current one, so the GL thread only issues GL calls
+///////////////////////////////////////////////////////////////////////////////
+
+#include "framepipeline.h"
+
+FramePipeline::~FramePipeline()
+{
+	Stop();
+}
+
+///////////////////////////////////////////////////
+//	Start(const Renderer&, JobSystem&)
+//
+//	renderer: renderer whose BuildPacket() fills the packets
+//	jobs: job system the packets are built on
+///////////////////////////////////////////////////
+void FramePipeline::Start(const Renderer &renderer, JobSystem &jobs)
+{
+	Stop();
+
+	this->renderer = &renderer;
+	this->jobs = &jobs;
+}
+
+///////////////////////////////////////////////////
+//	Stop()
+//
+//	Wait for the packet being built, if any
+///////////////////////////////////////////////////
+void FramePipeline::Stop()
+{
+	Wait();
+	jobs = nullptr;
+}
+
+///////////////////////////////////////////////////
+//	Prepare(const Scene&, const glm::mat4&, const glm::mat4&)
+//
+//	scene: objects to draw
+//	view: camera view matrix
+//	projection: camera projection matrix
+//
+//	Start building the next packet as a job. The scene must not change
+//	until Wait() returns; the current packet stays valid meanwhile.
+///////////////////////////////////////////////////
+void FramePipeline::Prepare(const Scene &scene, const glm::mat4 &view, const glm::mat4 &projection)
+{
+	Wait();
+
+	this->scene = &scene;
+	this->view = view;
+	this->projection = projection;
+	pending = true;
+	jobs->Run([this]()
+	{
+		renderer->BuildPacket(*this->scene, this->view, this->projection, packets[1 - current]);
+	}, &building);
+}
+
+///////////////////////////////////////////////////
+//	Wait()
+//
+//	Wait for the packet started by Prepare(), which then becomes the
+//	current packet, running other jobs meanwhile. Does nothing when no
+//	packet is being built.
+///////////////////////////////////////////////////
+void FramePipeline::Wait()
+{
+	if (!pending)
+		return;
+
+	jobs->Wait(building);
+	current = 1 - current;
+	pending = false;
+}
+
+///////////////////////////////////////////////////
+//	Current()
+//
+//	Return the last packet Wait() received
+///////////////////////////////////////////////////
+const Renderer::RenderPacket &FramePipeline::Current() const
+{
+	return packets[current];
+}
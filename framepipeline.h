@@ -0,0 +1,39 @@
+///////////////////////////////////////////////////////////////////////////////
+// framepipeline.h
+// ========
+// build the render packet of the next frame as a job while the GL thread
+// submits the current one, so the GL thread only issues GL calls
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "jobs.h"
+#include "renderer.h"
+#include "scene.h"
+
+class FramePipeline
+{
+public:
+	~FramePipeline();
+
+	void Start(const Renderer &renderer, JobSystem &jobs);
+	void Stop();
+	void Prepare(const Scene &scene, const glm::mat4 &view, const glm::mat4 &projection);
+	void Wait();
+	const Renderer::RenderPacket &Current() const;
+
+private:
+	const Renderer *renderer = nullptr;
+	JobSystem *jobs = nullptr;
+	Renderer::RenderPacket packets[2];	// The current packet and the one being built
+	int current = 0;					// Index of the packet the GL thread draws
+	bool pending = false;				// A packet was prepared and not waited for yet
+	JobCounter building;				// The job building the next packet
+
+	// Input of the packet being built, set by Prepare()
+	const Scene *scene = nullptr;
+	glm::mat4 view;
+	glm::mat4 projection;
+};
@@ -0,0 +1,447 @@
+///////////////////////////////////////////////////////////////////////////////
+// gpumemory.cpp
+// ========
+// accounting of the GL context's memory and the mip levels dropped from idle
+// textures over the budget. GL does not report how much memory it holds, so
+// the sizes are computed from the formats and dimensions given at creation;
+// drivers align and pad allocations, so the totals are a lower bound.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "gpumemory.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+	// Bytes of a texel of the formats the program creates; others count as 4
+	size_t UTexelBytes(GLenum internalFormat)
+	{
+		switch (internalFormat)
+		{
+		case GL_R8:
+			return 1;
+		case GL_RG8:
+		case GL_R16F:
+		case GL_DEPTH_COMPONENT16:
+			return 2;
+		case GL_RGBA16F:
+		case GL_RG32F:
+			return 8;
+		case GL_RGBA32F:
+			return 16;
+		default:
+			// GL_RGB8 included: drivers pad its texels to 4 bytes
+			return 4;
+		}
+	}
+
+	double UMegabytes(size_t bytes)
+	{
+		return bytes / (1024.0 * 1024.0);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UGpuMemory()
+//
+//	The tracker every module records its GL objects with, like the heap
+//	counter of the allocators
+///////////////////////////////////////////////////
+GpuMemory &UGpuMemory()
+{
+	static GpuMemory memory;
+	return memory;
+}
+
+///////////////////////////////////////////////////
+//	TrackBuffer(GLuint, size_t, const char*)
+//
+//	buffer: buffer object whose storage was just specified
+//	bytes: size of the storage
+//	label: name printed with the statistics, must outlive the record
+//
+//	Record a buffer's storage, replacing its previous record
+///////////////////////////////////////////////////
+void GpuMemory::TrackBuffer(GLuint buffer, size_t bytes, const char *label)
+{
+	Resource resource = {};
+	resource.kind = KIND_BUFFER;
+	resource.name = buffer;
+	resource.label = label;
+	resource.bytes = bytes;
+	UTrack(resource);
+}
+
+///////////////////////////////////////////////////
+//	TrackRenderbuffer(GLuint, GLenum, int, int, const char*)
+//
+//	renderbuffer: renderbuffer whose storage was just specified
+//	internalFormat: format of the storage
+//	width, height: size of the storage
+//	label: name printed with the statistics, must outlive the record
+//
+//	Record a renderbuffer's storage, replacing its previous record
+///////////////////////////////////////////////////
+void GpuMemory::TrackRenderbuffer(GLuint renderbuffer, GLenum internalFormat, int width, int height, const char *label)
+{
+	Resource resource = {};
+	resource.kind = KIND_RENDERBUFFER;
+	resource.name = renderbuffer;
+	resource.label = label;
+	resource.internalFormat = internalFormat;
+	resource.width = width;
+	resource.height = height;
+	resource.levels = 1;
+	resource.bytes = ULevelBytes(resource, 0);
+	UTrack(resource);
+}
+
+///////////////////////////////////////////////////
+//	TrackTexture(GLuint, GLenum, int, int, int, const char*, bool, int)
+//
+//	texture: 2D texture whose levels were just specified
+//	internalFormat: format of the levels
+//	width, height: size of level 0 of the full mip chain
+//	levels: levels of the full chain
+//	label: name printed with the statistics, must outlive the record
+//	reducible: the texture's mutable storage may lose its largest levels
+//		over the budget; they are restored by uploading its file again
+//	firstLevel: largest level of the chain specified, as the texture's
+//		level 0; the levels after it are all specified
+//
+//	Record a texture's levels, replacing its previous record; a reduced
+//	texture specified again whole counts as whole
+///////////////////////////////////////////////////
+void GpuMemory::TrackTexture(GLuint texture, GLenum internalFormat, int width, int height, int levels, const char *label, bool reducible, int firstLevel)
+{
+	Resource resource = {};
+	resource.kind = KIND_TEXTURE;
+	resource.name = texture;
+	resource.label = label;
+	resource.internalFormat = internalFormat;
+	resource.width = width;
+	resource.height = height;
+	resource.levels = levels;
+	resource.reducible = reducible;
+	resource.firstLevel = firstLevel;
+	resource.lastUsed = frame;
+	for (int level = firstLevel; level < levels; level++)
+		resource.bytes += ULevelBytes(resource, level);
+	UTrack(resource);
+}
+
+void GpuMemory::UntrackBuffer(GLuint buffer)
+{
+	UUntrack(KIND_BUFFER, buffer);
+}
+
+void GpuMemory::UntrackRenderbuffer(GLuint renderbuffer)
+{
+	UUntrack(KIND_RENDERBUFFER, renderbuffer);
+}
+
+void GpuMemory::UntrackTexture(GLuint texture)
+{
+	UUntrack(KIND_TEXTURE, texture);
+}
+
+///////////////////////////////////////////////////
+//	TouchTexture(GLuint)
+//
+//	texture: texture a draw samples
+//
+//	Mark a texture as used this frame. A reducible texture drawn while
+//	missing levels is queued for TakeRestores(), once.
+///////////////////////////////////////////////////
+void GpuMemory::TouchTexture(GLuint texture)
+{
+	auto it = resources.find(UKey(KIND_TEXTURE, texture));
+	if (it == resources.end())
+		return;
+
+	Resource &resource = it->second;
+	resource.lastUsed = frame;
+	if (resource.reducible && resource.firstLevel > 0 && !resource.restoreQueued)
+	{
+		resource.restoreQueued = true;
+		restores.push_back(texture);
+	}
+}
+
+///////////////////////////////////////////////////
+//	DropLevels(GLuint, int)
+//
+//	texture: tracked texture with mutable storage
+//	count: largest levels to drop; at least one level is kept
+//
+//	Free a texture's largest levels now, whether it is reducible or not;
+//	for the owners of textures that manage their levels themselves
+///////////////////////////////////////////////////
+void GpuMemory::DropLevels(GLuint texture, int count)
+{
+	auto it = resources.find(UKey(KIND_TEXTURE, texture));
+	if (it == resources.end())
+		return;
+
+	Resource &resource = it->second;
+	count = std::min(count, resource.levels - resource.firstLevel - 1);
+	if (count > 0)
+		UDropLevels(resource, count);
+}
+
+///////////////////////////////////////////////////
+//	EndFrame()
+//
+//	Count the frame and, over the budget, drop the largest levels of the
+//	textures idle for at least IDLE_FRAMES, the longest idle first, a level
+//	at a time from each until the total fits. Textures are kept at least
+//	MIN_LEVEL_SIZE wide and high; when nothing idle is left to drop, the
+//	total stays over the budget.
+///////////////////////////////////////////////////
+void GpuMemory::EndFrame()
+{
+	frame++;
+
+	size_t total = kindBytes[KIND_BUFFER] + kindBytes[KIND_RENDERBUFFER] + kindBytes[KIND_TEXTURE];
+	if (budgetBytes == 0 || total <= budgetBytes)
+		return;
+
+	candidates.clear();
+	for (auto &entry : resources)
+	{
+		Resource &resource = entry.second;
+		if (resource.kind == KIND_TEXTURE && resource.reducible && !resource.restoreQueued
+			&& frame - resource.lastUsed >= IDLE_FRAMES)
+			candidates.push_back(&resource);
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const Resource *a, const Resource *b)
+	{
+		return a->lastUsed != b->lastUsed ? a->lastUsed < b->lastUsed : a->name < b->name;
+	});
+
+	for (Resource *texture : candidates)
+	{
+		int count = 0;
+		size_t freed = 0;
+		while (total - freed > budgetBytes && texture->firstLevel + count + 1 < texture->levels)
+		{
+			int next = texture->firstLevel + count + 1;
+			if (std::max(texture->width >> next, 1) < MIN_LEVEL_SIZE || std::max(texture->height >> next, 1) < MIN_LEVEL_SIZE)
+				break;
+			freed += ULevelBytes(*texture, texture->firstLevel + count);
+			count++;
+		}
+		if (count == 0)
+			continue;
+
+		UDropLevels(*texture, count);
+		total -= freed;
+		if (total <= budgetBytes)
+			break;
+	}
+}
+
+///////////////////////////////////////////////////
+//	TakeRestores()
+//
+//	Returns the reduced textures drawn since the last call; the caller
+//	specifies them again whole, which tracks them again
+///////////////////////////////////////////////////
+std::vector<GLuint> GpuMemory::TakeRestores()
+{
+	std::vector<GLuint> taken;
+	taken.swap(restores);
+	return taken;
+}
+
+///////////////////////////////////////////////////
+//	GetStats()
+//
+//	Returns the memory of the tracked objects
+///////////////////////////////////////////////////
+GpuMemory::Stats GpuMemory::GetStats() const
+{
+	Stats stats = {};
+	stats.bufferBytes = kindBytes[KIND_BUFFER];
+	stats.renderbufferBytes = kindBytes[KIND_RENDERBUFFER];
+	stats.textureBytes = kindBytes[KIND_TEXTURE];
+	stats.totalBytes = stats.bufferBytes + stats.renderbufferBytes + stats.textureBytes;
+	stats.peakBytes = peakBytes;
+	stats.budgetBytes = budgetBytes;
+	for (const auto &entry : resources)
+	{
+		const Resource &resource = entry.second;
+		if (resource.kind == KIND_BUFFER)
+			stats.buffers++;
+		else if (resource.kind == KIND_RENDERBUFFER)
+			stats.renderbuffers++;
+		else
+			stats.textures++;
+
+		if (resource.firstLevel > 0)
+		{
+			stats.reducedTextures++;
+			for (int level = 0; level < resource.firstLevel; level++)
+				stats.droppedBytes += ULevelBytes(resource, level);
+		}
+	}
+	return stats;
+}
+
+///////////////////////////////////////////////////
+//	PrintStats()
+//
+//	Print the totals, then each object from the largest
+///////////////////////////////////////////////////
+void GpuMemory::PrintStats() const
+{
+	Stats stats = GetStats();
+	std::cout << "GPU memory: " << UMegabytes(stats.totalBytes) << " MB (peak " << UMegabytes(stats.peakBytes) << " MB";
+	if (stats.budgetBytes > 0)
+		std::cout << ", budget " << UMegabytes(stats.budgetBytes) << " MB";
+	std::cout << "), " << stats.buffers << " buffers " << UMegabytes(stats.bufferBytes) << " MB, "
+		<< stats.renderbuffers << " renderbuffers " << UMegabytes(stats.renderbufferBytes) << " MB, "
+		<< stats.textures << " textures " << UMegabytes(stats.textureBytes) << " MB";
+	if (stats.reducedTextures > 0)
+		std::cout << ", " << stats.reducedTextures << " reduced by " << UMegabytes(stats.droppedBytes) << " MB";
+	std::cout << std::endl;
+
+	std::vector<const Resource*> sorted;
+	for (const auto &entry : resources)
+		sorted.push_back(&entry.second);
+	std::sort(sorted.begin(), sorted.end(), [](const Resource *a, const Resource *b)
+	{
+		return a->bytes != b->bytes ? a->bytes > b->bytes : UKey(a->kind, a->name) < UKey(b->kind, b->name);
+	});
+	for (const Resource *resource : sorted)
+	{
+		std::cout << "  " << UMegabytes(resource->bytes) << " MB " << (resource->label ? resource->label : "unnamed");
+		if (resource->kind != KIND_BUFFER)
+		{
+			int width = std::max(resource->width >> resource->firstLevel, 1);
+			int height = std::max(resource->height >> resource->firstLevel, 1);
+			std::cout << " " << width << "x" << height;
+			if (resource->kind == KIND_TEXTURE)
+				std::cout << ", " << resource->levels - resource->firstLevel << " levels";
+		}
+		std::cout << std::endl;
+	}
+}
+
+///////////////////////////////////////////////////
+//	ULevelBytes(const Resource&, int)
+//
+//	resource: renderbuffer or texture
+//	level: level of the full mip chain
+//
+//	Returns the memory of one level
+///////////////////////////////////////////////////
+size_t GpuMemory::ULevelBytes(const Resource &resource, int level)
+{
+	size_t width = (size_t)std::max(resource.width >> level, 1);
+	size_t height = (size_t)std::max(resource.height >> level, 1);
+	return width * height * UTexelBytes(resource.internalFormat);
+}
+
+///////////////////////////////////////////////////
+//	UTrack(const Resource&)
+//
+//	resource: the new record
+//
+//	Replace an object's record and update the totals
+///////////////////////////////////////////////////
+void GpuMemory::UTrack(const Resource &resource)
+{
+	UUntrack(resource.kind, resource.name);
+	if (resource.name == 0)
+		return;
+
+	resources[UKey(resource.kind, resource.name)] = resource;
+	kindBytes[resource.kind] += resource.bytes;
+
+	size_t total = kindBytes[KIND_BUFFER] + kindBytes[KIND_RENDERBUFFER] + kindBytes[KIND_TEXTURE];
+	peakBytes = std::max(peakBytes, total);
+}
+
+///////////////////////////////////////////////////
+//	UUntrack(Kind, GLuint)
+//
+//	kind: kind of the object
+//	name: the object, ignored when it is not tracked
+//
+//	Remove an object's record, as it is deleted
+///////////////////////////////////////////////////
+void GpuMemory::UUntrack(Kind kind, GLuint name)
+{
+	auto it = resources.find(UKey(kind, name));
+	if (it == resources.end())
+		return;
+
+	kindBytes[kind] -= it->second.bytes;
+	if (it->second.restoreQueued)
+		restores.erase(std::remove(restores.begin(), restores.end(), name), restores.end());
+	resources.erase(it);
+}
+
+///////////////////////////////////////////////////
+//	UDropLevels(Resource&, int)
+//
+//	texture: reducible texture
+//	count: largest levels to drop, leaving at least one
+//
+//	Free a texture's largest levels. The levels kept are copied to a
+//	scratch texture, the texture's levels are specified again at the
+//	smaller sizes, which releases the old storage, and the levels are
+//	copied back; the pixels never leave the GPU.
+///////////////////////////////////////////////////
+void GpuMemory::UDropLevels(Resource &texture, int count)
+{
+	const int firstLevel = texture.firstLevel + count;
+	const int kept = texture.levels - firstLevel;
+	const GLsizei width = std::max(texture.width >> firstLevel, 1);
+	const GLsizei height = std::max(texture.height >> firstLevel, 1);
+	const GLenum format = texture.internalFormat == GL_RGB8 ? GL_RGB : GL_RGBA;
+
+	GLuint scratch;
+	glGenTextures(1, &scratch);
+	glBindTexture(GL_TEXTURE_2D, scratch);
+	glTexStorage2D(GL_TEXTURE_2D, kept, texture.internalFormat, width, height);
+	for (int level = 0; level < kept; level++)
+	{
+		GLsizei levelWidth = std::max(width >> level, 1);
+		GLsizei levelHeight = std::max(height >> level, 1);
+		glCopyImageSubData(texture.name, GL_TEXTURE_2D, count + level, 0, 0, 0,
+			scratch, GL_TEXTURE_2D, level, 0, 0, 0, levelWidth, levelHeight, 1);
+	}
+
+	// Levels past the new chain get no storage, so the driver frees them
+	glBindTexture(GL_TEXTURE_2D, texture.name);
+	for (int level = 0; level < texture.levels - texture.firstLevel; level++)
+	{
+		GLsizei levelWidth = level < kept ? std::max(width >> level, 1) : 0;
+		GLsizei levelHeight = level < kept ? std::max(height >> level, 1) : 0;
+		glTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, levelWidth, levelHeight, 0, format, GL_UNSIGNED_BYTE, nullptr);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, kept - 1);
+	for (int level = 0; level < kept; level++)
+	{
+		GLsizei levelWidth = std::max(width >> level, 1);
+		GLsizei levelHeight = std::max(height >> level, 1);
+		glCopyImageSubData(scratch, GL_TEXTURE_2D, level, 0, 0, 0,
+			texture.name, GL_TEXTURE_2D, level, 0, 0, 0, levelWidth, levelHeight, 1);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glDeleteTextures(1, &scratch);
+
+	size_t bytes = 0;
+	for (int level = firstLevel; level < texture.levels; level++)
+		bytes += ULevelBytes(texture, level);
+	kindBytes[KIND_TEXTURE] -= texture.bytes - bytes;
+	if (report)
+		std::cout << "Dropped " << count << " levels of " << (texture.label ? texture.label : "texture") << ", "
+			<< texture.width << "x" << texture.height << " to " << width << "x" << height
+			<< ", freeing " << UMegabytes(texture.bytes - bytes) << " MB" << std::endl;
+	texture.bytes = bytes;
+	texture.firstLevel = firstLevel;
+}
@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////////////
+// gpumemory.h
+// ========
+// accounting of the GL context's memory: the bytes of every buffer,
+// renderbuffer and texture mip level are recorded as they are created and
+// deleted. Over the budget, textures that have not been drawn for a while
+// lose their largest mip levels, copied down on the GPU so the memory is
+// freed, and get them back from their files once they are drawn again.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class GpuMemory
+{
+public:
+	struct Stats
+	{
+		size_t bufferBytes;
+		size_t renderbufferBytes;
+		size_t textureBytes;		// Resident mip levels only
+		size_t totalBytes;
+		size_t peakBytes;
+		size_t budgetBytes;
+		size_t buffers;
+		size_t renderbuffers;
+		size_t textures;
+		size_t reducedTextures;		// Textures missing their largest levels
+		size_t droppedBytes;		// Memory of those missing levels
+	};
+
+	// Textures not drawn for this many frames may lose levels
+	static constexpr std::uint64_t IDLE_FRAMES = 240;
+	// Levels are dropped while the largest level left is at least this wide and high
+	static constexpr int MIN_LEVEL_SIZE = 32;
+
+	size_t budgetBytes = 0;		// Memory over which idle textures lose levels, 0 for no budget
+	bool report = true;			// Print the levels dropped
+
+public:
+	void TrackBuffer(GLuint buffer, size_t bytes, const char *label);
+	void TrackRenderbuffer(GLuint renderbuffer, GLenum internalFormat, int width, int height, const char *label);
+	void TrackTexture(GLuint texture, GLenum internalFormat, int width, int height, int levels, const char *label, bool reducible = false, int firstLevel = 0);
+	void UntrackBuffer(GLuint buffer);
+	void UntrackRenderbuffer(GLuint renderbuffer);
+	void UntrackTexture(GLuint texture);
+	void TouchTexture(GLuint texture);
+	void DropLevels(GLuint texture, int count);
+	void EndFrame();
+	std::vector<GLuint> TakeRestores();
+	Stats GetStats() const;
+	void PrintStats() const;
+
+private:
+	enum Kind
+	{
+		KIND_BUFFER,
+		KIND_RENDERBUFFER,
+		KIND_TEXTURE,
+		KIND_COUNT
+	};
+
+	struct Resource
+	{
+		Kind kind;
+		GLuint name;
+		const char *label;
+		GLenum internalFormat;
+		int width;					// Size of level 0 of the full mip chain
+		int height;
+		int levels;					// Levels of the full chain
+		int firstLevel;				// Largest resident level; the GL texture's level 0 holds it
+		size_t bytes;				// Memory of the resident levels
+		bool reducible;				// Its levels can be dropped and uploaded again from its file
+		bool restoreQueued;			// Drawn while reduced, listed by TakeRestores()
+		std::uint64_t lastUsed;		// Frame it was last drawn in
+	};
+
+	static std::uint64_t UKey(Kind kind, GLuint name) { return (std::uint64_t)kind << 32 | name; }
+	static size_t ULevelBytes(const Resource &resource, int level);
+	void UTrack(const Resource &resource);
+	void UUntrack(Kind kind, GLuint name);
+	void UDropLevels(Resource &texture, int count);
+
+	std::unordered_map<std::uint64_t, Resource> resources;
+	size_t kindBytes[KIND_COUNT] = {};
+	size_t peakBytes = 0;
+	std::uint64_t frame = 0;
+	std::vector<GLuint> restores;			// Reduced textures drawn again
+	std::vector<Resource*> candidates;		// Scratch list of EndFrame()
+};
+
+// Tracker of the program's GL context; like GL, use it on the GL thread only
+GpuMemory &UGpuMemory();
@@ -0,0 +1,367 @@
+///////////////////////////////////////////////////////////////////////////////
+// jobs.cpp
+// ========
+// work-stealing job system: every thread owns a deque of jobs, runs its own
+// newest job first and steals the oldest job of another thread when its
+// deque is empty. Counters track groups of jobs; a thread waiting on one
+// runs other jobs meanwhile, which is also how a job waits for the jobs it
+// depends on. Background jobs, like file reads, wait in a queue of their own
+// that only idle workers take from, so they never delay a waiting thread.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "jobs.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Queue of the calling thread, for the job system that owns the thread
+	thread_local const JobSystem *tJobSystem = nullptr;
+	thread_local unsigned tQueueIndex = 0;
+
+	// Jobs each queue and the job pool first make room for
+	const size_t INITIAL_QUEUE_CAPACITY = 256;
+}
+
+JobSystem::~JobSystem()
+{
+	Stop();
+}
+
+///////////////////////////////////////////////////
+//	Start(unsigned)
+//
+//	nThreads: threads running jobs, counting the calling thread; 0 for one
+//		per hardware thread
+//
+//	Start the worker threads. The calling thread runs jobs only while it
+//	waits on a counter. With a single thread, a thread is started for the
+//	background jobs alone.
+///////////////////////////////////////////////////
+void JobSystem::Start(unsigned nThreads)
+{
+	Stop();
+
+	if (nThreads == 0)
+		nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned i = 0; i < nThreads; i++)
+	{
+		queues.push_back(std::make_unique<JobQueue>());
+		queues.back()->ring.resize(INITIAL_QUEUE_CAPACITY);
+	}
+	background.ring.resize(INITIAL_QUEUE_CAPACITY);
+	jobPool.Create(MAX_JOB_SIZE, INITIAL_QUEUE_CAPACITY);
+
+	tJobSystem = this;
+	tQueueIndex = 0;
+
+	running = true;
+	for (unsigned i = 1; i < nThreads; i++)
+		threads.emplace_back(&JobSystem::UWorkerLoop, this, i);
+	if (threads.empty())
+		backgroundThread = std::thread(&JobSystem::UBackgroundLoop, this);
+}
+
+///////////////////////////////////////////////////
+//	Stop()
+//
+//	Stop the worker threads and wait for them to exit. Jobs still queued,
+//	background ones included, are then run on the calling thread, so each
+//	finishes its counter and destroys what it captured.
+///////////////////////////////////////////////////
+void JobSystem::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		running = false;
+	}
+	wake.notify_all();
+
+	for (std::thread &thread : threads)
+		thread.join();
+	if (backgroundThread.joinable())
+		backgroundThread.join();
+
+	// Jobs run here may queue more; they land in the queues drained here
+	unsigned index = UThreadIndex();
+	while (URunOne(index) || URunBackground())
+	{
+	}
+
+	threads.clear();
+	queues.clear();
+	background.ring.clear();
+	background.front = 0;
+	background.size = 0;
+	jobPool.Destroy();
+	queued = 0;
+	backgroundQueued = 0;
+
+	if (tJobSystem == this)
+		tJobSystem = nullptr;
+}
+
+///////////////////////////////////////////////////
+//	ThreadCount()
+//
+//	Return the number of threads running jobs, counting the one that
+//	called Start()
+///////////////////////////////////////////////////
+unsigned JobSystem::ThreadCount() const
+{
+	return std::max<unsigned>(1, (unsigned)queues.size());
+}
+
+///////////////////////////////////////////////////
+//	GetPoolStats()
+//
+//	Return the use of the pool the queued jobs are stored in
+///////////////////////////////////////////////////
+PoolAllocator::Stats JobSystem::GetPoolStats() const
+{
+	return jobPool.GetStats();
+}
+
+///////////////////////////////////////////////////
+//	UPush(const QueuedJob&)
+//
+//	job: job to queue
+//
+//	Add a job at the back of the calling thread's queue and wake a worker
+///////////////////////////////////////////////////
+void JobSystem::UPush(const QueuedJob &job)
+{
+	UAppend(*queues[UThreadIndex()], job);
+	queued.fetch_add(1);
+
+	// Taking the lock makes sure a worker checking for jobs either sees this
+	// one or is already waiting when notified
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wake.notify_one();
+}
+
+///////////////////////////////////////////////////
+//	UPushBackground(const QueuedJob&)
+//
+//	job: job to queue
+//
+//	Add a job at the back of the background queue and wake a worker
+///////////////////////////////////////////////////
+void JobSystem::UPushBackground(const QueuedJob &job)
+{
+	UAppend(background, job);
+	backgroundQueued.fetch_add(1);
+
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wake.notify_one();
+}
+
+///////////////////////////////////////////////////
+//	UAppend(JobQueue&, const QueuedJob&)
+//
+//	queue: queue to add to
+//	job: job to add at its back
+//
+//	Add a job to a queue, growing its ring when full
+///////////////////////////////////////////////////
+void JobSystem::UAppend(JobQueue &queue, const QueuedJob &job)
+{
+	std::lock_guard<std::mutex> lock(queue.mutex);
+
+	// A full ring is unrolled into one twice as large
+	if (queue.size == queue.ring.size())
+	{
+		std::vector<QueuedJob> ring(queue.ring.size() * 2);
+		for (size_t i = 0; i < queue.size; i++)
+			ring[i] = queue.ring[(queue.front + i) % queue.ring.size()];
+		queue.ring.swap(ring);
+		queue.front = 0;
+	}
+
+	queue.ring[(queue.front + queue.size) % queue.ring.size()] = job;
+	queue.size++;
+}
+
+///////////////////////////////////////////////////
+//	Wait(JobCounter&)
+//
+//	counter: counter of the jobs to wait for
+//
+//	Run queued jobs until every job of the counter has finished; the
+//	background jobs are left to the workers, even when the counter is
+//	waiting for one
+///////////////////////////////////////////////////
+void JobSystem::Wait(JobCounter &counter)
+{
+	unsigned index = UThreadIndex();
+	while (!counter.Done())
+	{
+		if (!URunOne(index))
+			std::this_thread::yield();
+	}
+}
+
+///////////////////////////////////////////////////
+//	UThreadIndex()
+//
+//	Return the queue of the calling thread. Threads outside the job system
+//	share queue 0 with the thread that called Start().
+///////////////////////////////////////////////////
+unsigned JobSystem::UThreadIndex() const
+{
+	return tJobSystem == this ? tQueueIndex : 0;
+}
+
+///////////////////////////////////////////////////
+//	UPop(unsigned, QueuedJob&)
+//
+//	index: queue of the calling thread
+//	job: receives the job
+//
+//	Take the newest job of the thread's own queue, whose data is most
+//	likely still in cache
+///////////////////////////////////////////////////
+bool JobSystem::UPop(unsigned index, QueuedJob &job)
+{
+	JobQueue &queue = *queues[index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.size == 0)
+		return false;
+
+	queue.size--;
+	job = queue.ring[(queue.front + queue.size) % queue.ring.size()];
+	queued.fetch_sub(1);
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	USteal(unsigned, QueuedJob&)
+//
+//	index: queue of the calling thread
+//	job: receives the job
+//
+//	Take the oldest job of another thread's queue, starting with the next
+//	queue so thieves spread over their victims
+///////////////////////////////////////////////////
+bool JobSystem::USteal(unsigned index, QueuedJob &job)
+{
+	for (size_t i = 1; i < queues.size(); i++)
+	{
+		JobQueue &queue = *queues[(index + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.size == 0)
+			continue;
+
+		job = queue.ring[queue.front];
+		queue.front = (queue.front + 1) % queue.ring.size();
+		queue.size--;
+		queued.fetch_sub(1);
+		return true;
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////
+//	URunOne(unsigned)
+//
+//	index: queue of the calling thread
+//
+//	Run one job, the thread's own or a stolen one. Return false if every
+//	queue is empty.
+///////////////////////////////////////////////////
+bool JobSystem::URunOne(unsigned index)
+{
+	if (queues.empty())
+		return false;
+
+	QueuedJob job;
+	if (!UPop(index, job) && !USteal(index, job))
+		return false;
+
+	UInvokeJob(job);
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	URunBackground()
+//
+//	Run the oldest background job. Return false if there is none.
+///////////////////////////////////////////////////
+bool JobSystem::URunBackground()
+{
+	QueuedJob job;
+	{
+		std::lock_guard<std::mutex> lock(background.mutex);
+		if (background.size == 0)
+			return false;
+
+		job = background.ring[background.front];
+		background.front = (background.front + 1) % background.ring.size();
+		background.size--;
+	}
+	backgroundQueued.fetch_sub(1);
+
+	UInvokeJob(job);
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UInvokeJob(const QueuedJob&)
+//
+//	job: job taken from a queue
+//
+//	Run a job, free its block and count it as finished
+///////////////////////////////////////////////////
+void JobSystem::UInvokeJob(const QueuedJob &job)
+{
+	job.invoke(job.function);
+	jobPool.Free(job.function);
+	if (job.counter)
+		job.counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+///////////////////////////////////////////////////
+//	UWorkerLoop(unsigned)
+//
+//	index: queue owned by the worker
+//
+//	Worker thread: run jobs while there are any, background jobs when no
+//	other is left, sleep otherwise
+///////////////////////////////////////////////////
+void JobSystem::UWorkerLoop(unsigned index)
+{
+	tJobSystem = this;
+	tQueueIndex = index;
+
+	while (running)
+	{
+		if (URunOne(index) || URunBackground())
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this]() { return queued.load() > 0 || backgroundQueued.load() > 0 || !running; });
+	}
+}
+
+///////////////////////////////////////////////////
+//	UBackgroundLoop()
+//
+//	Thread of the background jobs when there are no workers: run them
+//	while there are any, sleep otherwise
+///////////////////////////////////////////////////
+void JobSystem::UBackgroundLoop()
+{
+	while (running)
+	{
+		if (URunBackground())
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this]() { return backgroundQueued.load() > 0 || !running; });
+	}
+}
@@ -0,0 +1,215 @@
+///////////////////////////////////////////////////////////////////////////////
+// jobs.h
+// ========
+// work-stealing job system: every thread owns a deque of jobs, runs its own
+// newest job first and steals the oldest job of another thread when its
+// deque is empty. Counters track groups of jobs; a thread waiting on one
+// runs other jobs meanwhile, which is also how a job waits for the jobs it
+// depends on. Background jobs, like file reads, wait in a queue of their own
+// that only idle workers take from, so they never delay a waiting thread.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "allocators.h"
+
+// Number of jobs of a group that have not finished
+struct JobCounter
+{
+	std::atomic<int> pending{ 0 };
+
+	bool Done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+class JobSystem
+{
+public:
+	// Largest function object a job can hold; jobs are stored in pooled blocks of this size
+	static const size_t MAX_JOB_SIZE = 128;
+	// ParallelFor() splits a range into about this many chunks per thread when no grain size is given
+	static const size_t CHUNKS_PER_THREAD = 4;
+
+public:
+	~JobSystem();
+
+	void Start(unsigned nThreads = 0);
+	void Stop();
+	unsigned ThreadCount() const;
+	template <typename Function> void Run(Function &&function, JobCounter *counter = nullptr);
+	template <typename Function> void RunBackground(Function &&function, JobCounter *counter = nullptr);
+	void Wait(JobCounter &counter);
+	template <typename Body> void ParallelFor(size_t count, size_t grainSize, const Body &body);
+	PoolAllocator::Stats GetPoolStats() const;
+
+private:
+	// A queued job: its function object lives in a block of the job pool
+	struct QueuedJob
+	{
+		void (*invoke)(void *function);	// Calls and destroys the function object
+		void *function;
+		JobCounter *counter;			// Decremented once the job has run, may be null
+	};
+
+	// Deque of one thread, a ring buffer: the owner pushes and pops at the
+	// back, thieves take from the front
+	struct JobQueue
+	{
+		std::mutex mutex;
+		std::vector<QueuedJob> ring;	// Grows only when full
+		size_t front = 0;				// Ring index of the oldest job
+		size_t size = 0;
+	};
+
+	template <typename Function> static void UInvoke(void *function);
+	template <typename Function> QueuedJob UQueue(Function &&function, JobCounter *counter);
+	void UPush(const QueuedJob &job);
+	void UPushBackground(const QueuedJob &job);
+	static void UAppend(JobQueue &queue, const QueuedJob &job);
+	unsigned UThreadIndex() const;
+	bool UPop(unsigned index, QueuedJob &job);
+	bool USteal(unsigned index, QueuedJob &job);
+	bool URunOne(unsigned index);
+	bool URunBackground();
+	void UInvokeJob(const QueuedJob &job);
+	void UWorkerLoop(unsigned index);
+	void UBackgroundLoop();
+
+	std::vector<std::unique_ptr<JobQueue>> queues;	// Queue 0 belongs to the thread that called Start()
+	std::vector<std::thread> threads;				// Worker i + 1 owns queue i + 1
+	JobQueue background;							// Background jobs, oldest first
+	std::thread backgroundThread;					// Runs the background jobs when there are no workers
+	PoolAllocator jobPool;							// Blocks holding the queued function objects
+	std::atomic<int> queued{ 0 };					// Jobs waiting in any thread's queue
+	std::atomic<int> backgroundQueued{ 0 };			// Jobs waiting in the background queue
+	std::atomic<bool> running{ false };
+	std::mutex sleepMutex;							// Orders a worker going to sleep with Run() waking it
+	std::condition_variable wake;					// Signals idle workers that jobs were queued
+};
+
+///////////////////////////////////////////////////
+//	Run(Function&&, JobCounter*)
+//
+//	function: function object to run on any thread, at most MAX_JOB_SIZE
+//		bytes
+//	counter: incremented now and decremented once the job has run, may be
+//		null
+//
+//	Queue a job on the calling thread's deque. The function object is
+//	moved into a pooled block, so queuing does not touch the heap. Before
+//	Start() the job runs right away on the calling thread.
+///////////////////////////////////////////////////
+template <typename Function>
+void JobSystem::Run(Function &&function, JobCounter *counter)
+{
+	if (queues.empty())
+	{
+		function();
+		return;
+	}
+
+	UPush(UQueue(std::forward<Function>(function), counter));
+}
+
+///////////////////////////////////////////////////
+//	RunBackground(Function&&, JobCounter*)
+//
+//	function: function object of a long job, such as reading a file, at
+//		most MAX_JOB_SIZE bytes
+//	counter: incremented now and decremented once the job has run, may be
+//		null
+//
+//	Queue a job that runs only on a worker with nothing else to do, in the
+//	order queued. Threads waiting on a counter never take it, so it cannot
+//	stall the thread that called Start() or a job waiting for others.
+//	Without workers, a thread of its own runs it. Before Start() the job
+//	runs right away on the calling thread.
+///////////////////////////////////////////////////
+template <typename Function>
+void JobSystem::RunBackground(Function &&function, JobCounter *counter)
+{
+	if (queues.empty())
+	{
+		function();
+		return;
+	}
+
+	UPushBackground(UQueue(std::forward<Function>(function), counter));
+}
+
+///////////////////////////////////////////////////
+//	UQueue(Function&&, JobCounter*)
+//
+//	function: function object of the job
+//	counter: counter of the job, may be null
+//
+//	Move a function object into a pooled block and count it on its counter
+///////////////////////////////////////////////////
+template <typename Function>
+JobSystem::QueuedJob JobSystem::UQueue(Function &&function, JobCounter *counter)
+{
+	typedef typename std::decay<Function>::type FunctionType;
+	static_assert(sizeof(FunctionType) <= MAX_JOB_SIZE && alignof(FunctionType) <= alignof(std::max_align_t),
+		"the job's function object does not fit in a job block");
+
+	if (counter)
+		counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+	void *block = jobPool.Allocate();
+	new (block) FunctionType(std::forward<Function>(function));
+	return { &UInvoke<FunctionType>, block, counter };
+}
+
+///////////////////////////////////////////////////
+//	ParallelFor(size_t, size_t, const Body&)
+//
+//	count: number of items
+//	grainSize: items per job, 0 to split the range evenly over the threads
+//	body: called with the [begin, end) range of items of each job
+//
+//	Process a range of items in parallel and return once all are done
+///////////////////////////////////////////////////
+template <typename Body>
+void JobSystem::ParallelFor(size_t count, size_t grainSize, const Body &body)
+{
+	if (count == 0)
+		return;
+	if (grainSize == 0)
+		grainSize = std::max<size_t>(1, count / (ThreadCount() * CHUNKS_PER_THREAD));
+
+	// The calling thread takes the first chunk itself
+	JobCounter counter;
+	for (size_t begin = grainSize; begin < count; begin += grainSize)
+	{
+		size_t end = std::min(count, begin + grainSize);
+		Run([&body, begin, end]() { body(begin, end); }, &counter);
+	}
+	body(0, std::min(count, grainSize));
+	Wait(counter);
+}
+
+///////////////////////////////////////////////////
+//	UInvoke(void*)
+//
+//	function: function object stored by Run()
+//
+//	Call a queued function object, then destroy it
+///////////////////////////////////////////////////
+template <typename Function>
+void JobSystem::UInvoke(void *function)
+{
+	Function &job = *(Function*)function;
+	job();
+	job.~Function();
+}
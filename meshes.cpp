@@ -9,64 +9,180 @@
 
 #include "meshes.h"
 
+#include "gpumemory.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <vector>
 
 namespace
 {
 	const double M_PI = 3.14159265358979323846f;
 	const double M_PI_2 = 1.571428571428571;
+
+	// Floats per interleaved vertex: position (3), normal (3), texture coords (2)
+	const GLuint FLOATS_PER_ENTRY = 8;
+
+	// Scratch memory the generated meshes' temporary buffers are taken from
+	const size_t LOAD_ARENA_SIZE = 1 << 20;
+
+	// Compressed vertex layout used when packed vertices are requested
+	// (16 bytes instead of the 32 bytes of 8 full floats)
+	struct PackedVertex
+	{
+		GLushort position[4];	// half float x, y, z (w is padding)
+		GLshort normal[2];		// octahedral encoded normal, snorm16
+		GLushort uv[2];			// texture coordinates, half floats
+	};
+
+	// Map a normal onto the octahedron and unfold it into the [-1, 1] square
+	glm::vec2 UEncodeOctahedral(glm::vec3 n)
+	{
+		float len = fabs(n.x) + fabs(n.y) + fabs(n.z);
+		if (len == 0.0f)
+			return glm::vec2(0.0f, 0.0f);
+
+		glm::vec2 p(n.x / len, n.y / len);
+		if (n.z < 0.0f)
+		{
+			float signX = p.x >= 0.0f ? 1.0f : -1.0f;
+			float signY = p.y >= 0.0f ? 1.0f : -1.0f;
+			p = glm::vec2((1.0f - fabs(p.y)) * signX, (1.0f - fabs(p.x)) * signY);
+		}
+		return p;
+	}
 }
 
 ///////////////////////////////////////////////////
-//	CreateMeshes()
+//	CreateMeshes(bool, JobSystem*)
+//
+//	bPackedVertices: store vertices in the compressed 16 byte layout
+//	jobs: job system the meshes are generated on, null for this thread
 //
 //	Create all the following 3D meshes:
 //		plane, pyramid, cube, cylinder, torus, sphere
 ///////////////////////////////////////////////////
-void Meshes::CreateMeshes()
+void Meshes::CreateMeshes(bool bPackedVertices, JobSystem *jobs)
 {
-	UCreatePlaneMesh(gPlaneMesh);
-	UCreatePrismMesh(gPrismMesh);
-	UCreateBoxMesh(gBoxMesh);
-	UCreateConeMesh(gConeMesh);
-	UCreateCylinderMesh(gCylinderMesh);
-	UCreateTaperedCylinderMesh(gTaperedCylinderMesh);
-	UCreatePyramid3Mesh(gPyramid3Mesh);
-	UCreatePyramid4Mesh(gPyramid4Mesh);
-	UCreateSphereMesh(gSphereMesh);
-	UCreateTorusMesh(gTorusMesh);
+	packedVertices = bPackedVertices;
+
+	GenerateMeshes(jobs);
+
+	// Send the combined mesh data to the GPU
+	UUploadArena();
+}
+
+///////////////////////////////////////////////////
+//	GenerateMeshes(JobSystem*)
+//
+//	jobs: job system the meshes are generated on, null for this thread
+//
+//	Generate every mesh's vertices and indices concurrently, one job per
+//	mesh, then place them one after another in the CPU staging of the
+//	arena. Makes no GL calls; UUploadArena() sends the result to the GPU.
+///////////////////////////////////////////////////
+void Meshes::GenerateMeshes(JobSystem *jobs)
+{
+	typedef void (Meshes::*CreateFunction)(GLMesh &mesh, MeshData &data);
+	struct MeshJob
+	{
+		CreateFunction create;
+		GLMesh *mesh;
+	};
+	const MeshJob meshJobs[] =
+	{
+		{ &Meshes::UCreatePlaneMesh, &gPlaneMesh },
+		{ &Meshes::UCreatePrismMesh, &gPrismMesh },
+		{ &Meshes::UCreateBoxMesh, &gBoxMesh },
+		{ &Meshes::UCreateConeMesh, &gConeMesh },
+		{ &Meshes::UCreateCylinderMesh, &gCylinderMesh },
+		{ &Meshes::UCreateTaperedCylinderMesh, &gTaperedCylinderMesh },
+		{ &Meshes::UCreatePyramid3Mesh, &gPyramid3Mesh },
+		{ &Meshes::UCreatePyramid4Mesh, &gPyramid4Mesh },
+		{ &Meshes::UCreateSphereMesh, &gSphereMesh },
+		{ &Meshes::UCreateTorusMesh, &gTorusMesh },
+	};
+	const size_t nMeshes = sizeof(meshJobs) / sizeof(meshJobs[0]);
+
+	// Each mesh is generated into its own buffers, so the jobs share only the scratch arena
+	FrameArena scratch;
+	scratch.Create(LOAD_ARENA_SIZE);
+	MeshData data[nMeshes];
+	for (MeshData &meshData : data)
+		meshData.scratch = &scratch;
+	auto generate = [this, &meshJobs, &data](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			(this->*meshJobs[i].create)(*meshJobs[i].mesh, data[i]);
+	};
+	if (jobs)
+		jobs->ParallelFor(nMeshes, 1, generate);
+	else
+		generate(0, nMeshes);
+
+	// Suballocate the meshes in order, then copy each into its range of the preallocated staging
+	size_t vertexBytes = 0;
+	size_t nIndices = 0;
+	std::vector<size_t> vertexOffsets(nMeshes);
+	for (size_t i = 0; i < nMeshes; i++)
+	{
+		GLMesh &mesh = *meshJobs[i].mesh;
+		mesh.baseVertex = (GLint)(vertexBytes / UVertexSize());
+		mesh.firstIndex = (GLuint)nIndices;
+		vertexOffsets[i] = vertexBytes;
+		vertexBytes += data[i].vertexData.size();
+		nIndices += data[i].indices.size();
+	}
+
+	arenaVertexData.resize(vertexBytes);
+	arenaIndices.resize(nIndices);
+	auto copy = [this, &meshJobs, &data, &vertexOffsets](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			std::copy(data[i].vertexData.begin(), data[i].vertexData.end(), arenaVertexData.begin() + vertexOffsets[i]);
+			std::copy(data[i].indices.begin(), data[i].indices.end(), arenaIndices.begin() + meshJobs[i].mesh->firstIndex);
+		}
+	};
+	if (jobs)
+		jobs->ParallelFor(nMeshes, 1, copy);
+	else
+		copy(0, nMeshes);
 }
 
 ///////////////////////////////////////////////////
 //	DestroyMeshes()
 //
-//	Destroy the created meshes
+//	Destroy the mesh arena holding all created meshes and their CPU triangles
 ///////////////////////////////////////////////////
 void Meshes::DestroyMeshes()
 {
-	UDestroyMesh(gBoxMesh);
-	UDestroyMesh(gConeMesh);
-	UDestroyMesh(gCylinderMesh);
-	UDestroyMesh(gPlaneMesh);
-	UDestroyMesh(gPyramid3Mesh);
-	UDestroyMesh(gPyramid4Mesh);
-	UDestroyMesh(gPrismMesh);
-	UDestroyMesh(gSphereMesh);
-	UDestroyMesh(gTorusMesh);
+	glDeleteVertexArrays(1, &gArenaVao);
+	UGpuMemory().UntrackBuffer(gArenaVbos[0]);
+	UGpuMemory().UntrackBuffer(gArenaVbos[1]);
+	glDeleteBuffers(2, gArenaVbos);
+
+	for (GLMesh *mesh : { &gBoxMesh, &gConeMesh, &gCylinderMesh, &gTaperedCylinderMesh, &gPlaneMesh, &gPrismMesh, &gSphereMesh, &gPyramid3Mesh, &gPyramid4Mesh, &gTorusMesh })
+		mesh->triangles.Clear();
 }
 
 ///////////////////////////////////////////////////
-//	UCreatePlaneMesh(GLMesh&)
+//	UCreatePlaneMesh(GLMesh&, MeshData&)
 //
 //	mesh: reference to mesh structure for storing data
+//	data: receives the vertex and index data of the mesh
 //
-//	Create a plane mesh and store it in a VAO/VBO
+//	Create a plane mesh and store its data for the mesh arena
 // 
 //  Correct triangle drawing command:
 //
-//	glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+//	glDrawElementsBaseVertex(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT,
+//		(void*)(sizeof(GLuint) * meshes.gPlaneMesh.firstIndex), meshes.gPlaneMesh.baseVertex);
 ///////////////////////////////////////////////////
-void Meshes::UCreatePlaneMesh(GLMesh &mesh)
+void Meshes::UCreatePlaneMesh(GLMesh &mesh, MeshData &data)
 {
 	// Vertex data
 	GLfloat verts[] = {
@@ -83,53 +199,24 @@ void Meshes::UCreatePlaneMesh(GLMesh &mesh)
 		0,3,2
 	};
 
-	// total float values per each type
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	// store vertex and index count
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-
-	// Generate the VAO for the mesh
-	glGenVertexArrays(1, &mesh.vao);
-	glBindVertexArray(mesh.vao);	// activate the VAO
-
-	// Create VBOs for the mesh
-	glGenBuffers(2, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends data to the GPU
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the buffer
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	// Send the vertex and index data to the GPU
+	UStoreMesh(mesh, data, verts, sizeof(verts) / sizeof(verts[0]), indices, sizeof(indices) / sizeof(indices[0]));
 }
 
 ///////////////////////////////////////////////////
-//	UCreatePyramid3Mesh(GLMesh&)
+//	UCreatePyramid3Mesh(GLMesh&, MeshData&)
 //
 //	mesh: reference to mesh structure for storing data
+//	data: receives the vertex and index data of the mesh
 //
-//	Create a pyramid mesh and store it in a VAO/VBO
+//	Create a pyramid mesh and store its data for the mesh arena
 //
 //  Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLE_STRIP, 0, meshes.gPyramid3Mesh.nVertices);
+//	glDrawElementsBaseVertex(GL_TRIANGLES, meshes.gPyramid3Mesh.nIndices, GL_UNSIGNED_INT,
+//		(void*)(sizeof(GLuint) * meshes.gPyramid3Mesh.firstIndex), meshes.gPyramid3Mesh.baseVertex);
 ///////////////////////////////////////////////////
-void Meshes::UCreatePyramid3Mesh(GLMesh &mesh)
+void Meshes::UCreatePyramid3Mesh(GLMesh &mesh, MeshData &data)
 {
 	// Vertex data
 	GLfloat verts[] = {
@@ -156,44 +243,28 @@ void Meshes::UCreatePyramid3Mesh(GLMesh &mesh)
 		-0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f,	0.0f, 1.0f,     //front bottom left
 	};
 
-	const GLuint floatsPerVertex = 3;	// Number of coordinates per vertex
-	const GLuint floatsPerColor = 3;	// Number of values per vertex color
-	const GLuint floatsPerUV = 2;		// Number of texture coordinate values
-
-	// Calculate total defined vertices
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao);			// Creates 1 VAO
-	glGenBuffers(1, mesh.vbos);					// Creates 1 VBO
-	glBindVertexArray(mesh.vao);				// Activates the VAO
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);	// Activates the VBO
-	// Sends vertex or coordinate data to the GPU
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
-
-	// Strides between sets of attribute data
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor + floatsPerUV);
-
-	// Creates the Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerColor)));
-	glEnableVertexAttribArray(2);
+	// Convert the draw ranges into a triangle list
+	std::vector<GLuint> indices;
+	UAppendTriangleIndices(GL_TRIANGLE_STRIP, 0, (sizeof(verts) / sizeof(verts[0])) / FLOATS_PER_ENTRY, indices);
+
+	// Send the vertex and index data to the GPU
+	UStoreMesh(mesh, data, verts, sizeof(verts) / sizeof(verts[0]), indices.data(), indices.size());
 }
 
 ///////////////////////////////////////////////////
-//	UCreatePyramid4Mesh(GLMesh&)
+//	UCreatePyramid4Mesh(GLMesh&, MeshData&)
 //
 //	mesh: reference to mesh structure for storing data
+//	data: receives the vertex and index data of the mesh
 //
-//	Create a pyramid mesh and store it in a VAO/VBO
+//	Create a pyramid mesh and store its data for the mesh arena
 //
 //  Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLE_STRIP, 0, meshes.gPyramid4Mesh.nVertices);
+//	glDrawElementsBaseVertex(GL_TRIANGLES, meshes.gPyramid4Mesh.nIndices, GL_UNSIGNED_INT,
+//		(void*)(sizeof(GLuint) * meshes.gPyramid4Mesh.firstIndex), meshes.gPyramid4Mesh.baseVertex);
 ///////////////////////////////////////////////////
-void Meshes::UCreatePyramid4Mesh(GLMesh &mesh)
+void Meshes::UCreatePyramid4Mesh(GLMesh &mesh, MeshData &data)
 {
 	// Vertex data
 	GLfloat verts[] = {
@@ -229,44 +300,28 @@ void Meshes::UCreatePyramid4Mesh(GLMesh &mesh)
 		0.0f, 0.5f, 0.0f,		0.0f, 0.0f, 1.0f,	0.5f, 1.0f,		//top point
 	};
 
-	const GLuint floatsPerVertex = 3;	// Number of coordinates per vertex
-	const GLuint floatsPerColor = 3;	// Number of values per vertex color
-	const GLuint floatsPerUV = 2;		// Number of texture coordinate values
-
-	// Calculate total defined vertices
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao);			// Creates 1 VAO
-	glGenBuffers(1, mesh.vbos);					// Creates 1 VBO
-	glBindVertexArray(mesh.vao);				// Activates the VAO
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);	// Activates the VBO
-	// Sends vertex or coordinate data to the GPU
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
-
-	// Strides between sets of attribute data
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor + floatsPerUV);
-
-	// Creates the Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerColor)));
-	glEnableVertexAttribArray(2);
+	// Convert the draw ranges into a triangle list
+	std::vector<GLuint> indices;
+	UAppendTriangleIndices(GL_TRIANGLE_STRIP, 0, (sizeof(verts) / sizeof(verts[0])) / FLOATS_PER_ENTRY, indices);
+
+	// Send the vertex and index data to the GPU
+	UStoreMesh(mesh, data, verts, sizeof(verts) / sizeof(verts[0]), indices.data(), indices.size());
 }
 
 ///////////////////////////////////////////////////
-//	UCreatePrismMesh(GLMesh&)
+//	UCreatePrismMesh(GLMesh&, MeshData&)
 //
 //	mesh: reference to mesh structure for storing data
+//	data: receives the vertex and index data of the mesh
 //
-//	Create a pyramid mesh and store it in a VAO/VBO
+//	Create a pyramid mesh and store its data for the mesh arena
 //
-//	Correct triangle drawing command:
+//  Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLE_STRIP, 0, meshes.gPrismMesh.nVertices);
+//	glDrawElementsBaseVertex(GL_TRIANGLES, meshes.gPrismMesh.nIndices, GL_UNSIGNED_INT,
+//		(void*)(sizeof(GLuint) * meshes.gPrismMesh.firstIndex), meshes.gPrismMesh.baseVertex);
 ///////////////////////////////////////////////////
-void Meshes::UCreatePrismMesh(GLMesh &mesh)
+void Meshes::UCreatePrismMesh(GLMesh &mesh, MeshData &data)
 {
 	// Vertex data
 	GLfloat verts[] = {
@@ -317,46 +372,28 @@ void Meshes::UCreatePrismMesh(GLMesh &mesh)
 		
 	};
 
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+	// Convert the draw ranges into a triangle list
+	std::vector<GLuint> indices;
+	UAppendTriangleIndices(GL_TRIANGLE_STRIP, 0, (sizeof(verts) / sizeof(verts[0])) / FLOATS_PER_ENTRY, indices);
 
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	// Send the vertex and index data to the GPU
+	UStoreMesh(mesh, data, verts, sizeof(verts) / sizeof(verts[0]), indices.data(), indices.size());
 }
 
 ///////////////////////////////////////////////////
-//	UCreateBoxMesh(GLMesh&)
+//	UCreateBoxMesh(GLMesh&, MeshData&)
 //
 //	mesh: reference to mesh structure for storing data
+//	data: receives the vertex and index data of the mesh
 //
-//	Create a cube mesh and store it in a VAO/VBO
+//	Create a cube mesh and store its data for the mesh arena
 //
-//	Correct triangle drawing command:
+//  Correct triangle drawing command:
 //
-//	glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+//	glDrawElementsBaseVertex(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT,
+//		(void*)(sizeof(GLuint) * meshes.gBoxMesh.firstIndex), meshes.gBoxMesh.baseVertex);
 ///////////////////////////////////////////////////
-void Meshes::UCreateBoxMesh(GLMesh &mesh)
+void Meshes::UCreateBoxMesh(GLMesh &mesh, MeshData &data)
 {
 	// Position and Color data
 	GLfloat verts[] = {
@@ -416,51 +453,24 @@ void Meshes::UCreateBoxMesh(GLMesh &mesh)
 		20,23,22
 	};
 
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	mesh.nIndices = sizeof(indices) / sizeof(indices[0]);
-
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(2, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the buffer
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
-	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	// Send the vertex and index data to the GPU
+	UStoreMesh(mesh, data, verts, sizeof(verts) / sizeof(verts[0]), indices, sizeof(indices) / sizeof(indices[0]));
 }
 
 ///////////////////////////////////////////////////
-//	UCreateConeMesh(GLMesh&)
+//	UCreateConeMesh(GLMesh&, MeshData&)
 //
 //	mesh: reference to mesh structure for storing data
+//	data: receives the vertex and index data of the mesh
 //
-//	Create a cylinder mesh and store it in a VAO/VBO
+//	Create a cylinder mesh and store its data for the mesh arena
 //
-//  Correct triangle drawing commands:
+//  Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-//	glDrawArrays(GL_TRIANGLE_STRIP, 36, 108);	//sides
+//	glDrawElementsBaseVertex(GL_TRIANGLES, meshes.gConeMesh.nIndices, GL_UNSIGNED_INT,
+//		(void*)(sizeof(GLuint) * meshes.gConeMesh.firstIndex), meshes.gConeMesh.baseVertex);
 ///////////////////////////////////////////////////
-void Meshes::UCreateConeMesh(GLMesh &mesh)
+void Meshes::UCreateConeMesh(GLMesh &mesh, MeshData &data)
 {
 	GLfloat verts[] = {
 		// cone bottom			// normals			// texture coords
@@ -612,36 +622,13 @@ void Meshes::UCreateConeMesh(GLMesh &mesh)
 		1.0f, 0.0f, 0.0f,		-0.993150651f, 0.0f, -0.116841137f, 	0.0f, 0.0f
 	};
 
-	// total float values per each type
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	// store vertex and index count
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	mesh.nIndices = 0;
-
-	// Create VAO
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create VBO
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, (void*)0);
-	glEnableVertexAttribArray(0);
+	// Convert the draw ranges into a triangle list
+	std::vector<GLuint> indices;
+	UAppendTriangleIndices(GL_TRIANGLE_FAN, 0, 36, indices);	//bottom
+	UAppendTriangleIndices(GL_TRIANGLE_STRIP, 36, 108, indices);	//sides
 
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex)));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	// Send the vertex and index data to the GPU
+	UStoreMesh(mesh, data, verts, sizeof(verts) / sizeof(verts[0]), indices.data(), indices.size());
 }
 
 void Meshes::CalculateTriangleNormal(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2)
@@ -671,19 +658,19 @@ void Meshes::CalculateTriangleNormal(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2)
 }
 
 ///////////////////////////////////////////////////
-//	UCreateCylinderMesh(GLMesh&)
+//	UCreateCylinderMesh(GLMesh&, MeshData&)
 //
 //	mesh: reference to mesh structure for storing data
+//	data: receives the vertex and index data of the mesh
 //
-//	Create a cylinder mesh and store it in a VAO/VBO
+//	Create a cylinder mesh and store its data for the mesh arena
 //
-//  Correct triangle drawing commands:
+//  Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-//	glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-//	glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+//	glDrawElementsBaseVertex(GL_TRIANGLES, meshes.gCylinderMesh.nIndices, GL_UNSIGNED_INT,
+//		(void*)(sizeof(GLuint) * meshes.gCylinderMesh.firstIndex), meshes.gCylinderMesh.baseVertex);
 ///////////////////////////////////////////////////
-void Meshes::UCreateCylinderMesh(GLMesh &mesh)
+void Meshes::UCreateCylinderMesh(GLMesh &mesh, MeshData &data)
 {
 	GLfloat verts[] = {
 		// cylinder bottom		// normals			// texture coords
@@ -911,52 +898,30 @@ void Meshes::UCreateCylinderMesh(GLMesh &mesh)
 		1.0f, 0.0f, 0.0f,		0.92f, 0.0f, 0.08f,		1.0, 0.0
 	};
 
-	// total float values per each type
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	// store vertex and index count
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	mesh.nIndices = 0;
+	// Convert the draw ranges into a triangle list
+	std::vector<GLuint> indices;
+	UAppendTriangleIndices(GL_TRIANGLE_FAN, 0, 36, indices);	//bottom
+	UAppendTriangleIndices(GL_TRIANGLE_FAN, 36, 36, indices);	//top
+	UAppendTriangleIndices(GL_TRIANGLE_STRIP, 72, 146, indices);	//sides
 
-	// Create VAO
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create VBO
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, (void*)0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex)));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	// Send the vertex and index data to the GPU
+	UStoreMesh(mesh, data, verts, sizeof(verts) / sizeof(verts[0]), indices.data(), indices.size());
 }
 
 ///////////////////////////////////////////////////
-//	UCreateTaperedCylinderMesh(GLMesh&)
+//	UCreateTaperedCylinderMesh(GLMesh&, MeshData&)
 //
 //	mesh: reference to mesh structure for storing data
+//	data: receives the vertex and index data of the mesh
 //
-//	Create a tapered cylinder mesh and store it in a VAO/VBO
+//	Create a tapered cylinder mesh and store its data for the mesh arena
 //
-//  Correct triangle drawing commands:
+//  Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-//	glDrawArrays(GL_TRIANGLE_FAN, 36, 72);		//top
-//	glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+//	glDrawElementsBaseVertex(GL_TRIANGLES, meshes.gTaperedCylinderMesh.nIndices, GL_UNSIGNED_INT,
+//		(void*)(sizeof(GLuint) * meshes.gTaperedCylinderMesh.firstIndex), meshes.gTaperedCylinderMesh.baseVertex);
 ///////////////////////////////////////////////////
-void Meshes::UCreateTaperedCylinderMesh(GLMesh &mesh)
+void Meshes::UCreateTaperedCylinderMesh(GLMesh &mesh, MeshData &data)
 {
 	GLfloat verts[] = {
 		// cylinder bottom		// normals			// texture coords
@@ -1184,50 +1149,30 @@ void Meshes::UCreateTaperedCylinderMesh(GLMesh &mesh)
 		1.0f, 0.0f, 0.0f,		0.92f, 0.0f, 0.08f,		1.0, 0.0
 	};
 
-	// total float values per each type
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	// store vertex and index count
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	mesh.nIndices = 0;
-
-	// Create VAO
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create VBO
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, (void*)0);
-	glEnableVertexAttribArray(0);
+	// Convert the draw ranges into a triangle list
+	std::vector<GLuint> indices;
+	UAppendTriangleIndices(GL_TRIANGLE_FAN, 0, 36, indices);	//bottom
+	UAppendTriangleIndices(GL_TRIANGLE_FAN, 36, 36, indices);	//top
+	UAppendTriangleIndices(GL_TRIANGLE_STRIP, 72, 146, indices);	//sides
 
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex)));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	// Send the vertex and index data to the GPU
+	UStoreMesh(mesh, data, verts, sizeof(verts) / sizeof(verts[0]), indices.data(), indices.size());
 }
 
 ///////////////////////////////////////////////////
-//	UCreateTorusMesh(GLMesh&)
+//	UCreateTorusMesh(GLMesh&, MeshData&)
 //
 //	mesh: reference to mesh structure for storing data
+//	data: receives the vertex and index data of the mesh
 //
-//	Create a torus mesh and store it in a VAO/VBO
+//	Create a torus mesh and store its data for the mesh arena
 //
-//	Correct triangle drawing command:
+//  Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLES, 0, meshes.gTorusMesh.nVertices);
+//	glDrawElementsBaseVertex(GL_TRIANGLES, meshes.gTorusMesh.nIndices, GL_UNSIGNED_INT,
+//		(void*)(sizeof(GLuint) * meshes.gTorusMesh.firstIndex), meshes.gTorusMesh.baseVertex);
 ///////////////////////////////////////////////////
-void Meshes::UCreateTorusMesh(GLMesh &mesh)
+void Meshes::UCreateTorusMesh(GLMesh &mesh, MeshData &data)
 {
 	int _mainSegments = 30;
 	int _tubeSegments = 30;
@@ -1237,10 +1182,15 @@ void Meshes::UCreateTorusMesh(GLMesh &mesh)
 	auto mainSegmentAngleStep = glm::radians(360.0f / float(_mainSegments));
 	auto tubeSegmentAngleStep = glm::radians(360.0f / float(_tubeSegments));
 
-	std::vector<glm::vec3> vertex_list;
+	// Two triangles, six vertices, per quad of the surface
+	size_t nVertices = 6 * _mainSegments * _tubeSegments;
+	ArenaVector<glm::vec3> vertex_list(*data.scratch);
 	std::vector<std::vector<glm::vec3>> segments_list;
-	std::vector<glm::vec3> normals_list;
-	std::vector<glm::vec2> texture_coords;
+	ArenaVector<glm::vec3> normals_list(*data.scratch);
+	ArenaVector<glm::vec2> texture_coords(*data.scratch);
+	vertex_list.reserve(nVertices);
+	normals_list.reserve(nVertices);
+	texture_coords.reserve(nVertices);
 	glm::vec3 center(0.0f, 0.0f, 0.0f);
 	glm::vec3 normal;
 	glm::vec3 vertex;
@@ -1315,11 +1265,7 @@ void Meshes::UCreateTorusMesh(GLMesh &mesh)
 				vertex_list.push_back(segments_list[i + 1][j + 1]);
 				normal = normalize(segments_list[i+1][j+1] - center);
 				normals_list.push_back(normal);
-				texture_coords.push_back(glm::vec2(u+horizontalStep, v-verticalStep));
-				vertex_list.push_back(segments_list[i][j]);
-				normal = normalize(segments_list[i][j] - center);
-				normals_list.push_back(normal);
-				texture_coords.push_back(glm::vec2(u, v));
+				texture_coords.push_back(glm::vec2(u+horizontalStep, v+verticalStep));
 			}
 			else
 			{
@@ -1349,10 +1295,6 @@ void Meshes::UCreateTorusMesh(GLMesh &mesh)
 					normal = normalize(segments_list[0][0] - center);
 					normals_list.push_back(normal);
 					texture_coords.push_back(glm::vec2(0, 0));
-					vertex_list.push_back(segments_list[i][j]);
-					normal = normalize(segments_list[i][j] - center);
-					normals_list.push_back(normal);
-					texture_coords.push_back(glm::vec2(u, v));
 				}
 				else if ((i + 1) == _mainSegments)
 				{
@@ -1380,10 +1322,6 @@ void Meshes::UCreateTorusMesh(GLMesh &mesh)
 					normal = normalize(segments_list[0][j+1] - center);
 					normals_list.push_back(normal);
 					texture_coords.push_back(glm::vec2(0, v+verticalStep));
-					vertex_list.push_back(segments_list[i][j]);
-					normal = normalize(segments_list[i][j] - center);
-					normals_list.push_back(normal);
-					texture_coords.push_back(glm::vec2(u, v));
 				}
 				else if ((j + 1) == _tubeSegments)
 				{
@@ -1411,10 +1349,6 @@ void Meshes::UCreateTorusMesh(GLMesh &mesh)
 					normal = normalize(segments_list[i+1][0] - center);
 					normals_list.push_back(normal);
 					texture_coords.push_back(glm::vec2(u+horizontalStep, 0));
-					vertex_list.push_back(segments_list[i][j]);
-					normal = normalize(segments_list[i][j] - center);
-					normals_list.push_back(normal);
-					texture_coords.push_back(glm::vec2(u, v));
 				}
 				
 			}
@@ -1424,10 +1358,11 @@ void Meshes::UCreateTorusMesh(GLMesh &mesh)
 		u += horizontalStep;
 	}
 
-	std::vector<GLfloat> combined_values;
+	ArenaVector<GLfloat> combined_values(*data.scratch);
+	combined_values.reserve(vertex_list.size() * FLOATS_PER_ENTRY);
 
 	// combine interleaved vertices, normals, and texture coords
-	for (int i = 0; i < vertex_list.size(); i++)
+	for (size_t i = 0; i < vertex_list.size(); i++)
 	{
 		vertex = vertex_list[i];
 		normal = normals_list[i];
@@ -1442,50 +1377,28 @@ void Meshes::UCreateTorusMesh(GLMesh &mesh)
 		combined_values.push_back(text_coord.y);
 	}
 
-	// total float values per each type
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	// store vertex and index count
-	mesh.nVertices = vertex_list.size();
-	mesh.nIndices = 0;
+	// Convert the draw ranges into a triangle list
+	std::vector<GLuint> indices;
+	UAppendTriangleIndices(GL_TRIANGLES, 0, combined_values.size() / FLOATS_PER_ENTRY, indices);
 
-	// Create VAO
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
-
-	// Create VBOs
-	glGenBuffers(1, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * combined_values.size(), combined_values.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
-
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
-
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+	// Send the vertex and index data to the GPU
+	UStoreMesh(mesh, data, combined_values.data(), combined_values.size(), indices.data(), indices.size());
 }
 
 ///////////////////////////////////////////////////
-//	UCreateSphereMesh(GLMesh&)
+//	UCreateSphereMesh(GLMesh&, MeshData&)
 //
 //	mesh: reference to mesh structure for storing data
+//	data: receives the vertex and index data of the mesh
 //
-//	Create a sphere mesh and store it in a VAO/VBO
+//	Create a sphere mesh and store its data for the mesh arena
 //
 //  Correct triangle drawing command:
 //
-//	glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+//	glDrawElementsBaseVertex(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT,
+//		(void*)(sizeof(GLuint) * meshes.gSphereMesh.firstIndex), meshes.gSphereMesh.baseVertex);
 ///////////////////////////////////////////////////
-void Meshes::UCreateSphereMesh(GLMesh &mesh)
+void Meshes::UCreateSphereMesh(GLMesh &mesh, MeshData &data)
 {
 	GLfloat verts[] = {
 		// vertex data					// index
@@ -2265,23 +2178,15 @@ void Meshes::UCreateSphereMesh(GLMesh &mesh)
 		240,225,241
 	};
 
-	// total float values per each type
-	const GLuint floatsPerVertex = 3;
-	const GLuint floatsPerNormal = 3;
-	const GLuint floatsPerUV = 2;
-
-	// store vertex and index count
-	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex));
-	mesh.nIndices = sizeof(indices) / (sizeof(indices[0]));
-
 	glm::vec3 normal;
 	glm::vec3 vert;
 	glm::vec3 center(0.0f, 0.0f, 0.0f);
 	float u, v;
-	std::vector<GLfloat> combined_values;
+	ArenaVector<GLfloat> combined_values(*data.scratch);
+	combined_values.reserve(sizeof(verts) / sizeof(verts[0]) / 3 * FLOATS_PER_ENTRY);
 
 	// combine interleaved vertices, normals, and texture coords
-	for (int i = 0; i < sizeof(verts) / (sizeof(verts[0])); i += 3)
+	for (size_t i = 0; i < sizeof(verts) / (sizeof(verts[0])); i += 3)
 	{
 		vert = glm::vec3(verts[i], verts[i + 1], verts[i + 2]);
 		normal = normalize(vert - center);
@@ -2297,34 +2202,202 @@ void Meshes::UCreateSphereMesh(GLMesh &mesh)
 		combined_values.push_back(v);
 	}
 
-	// Create VAO
-	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-	glBindVertexArray(mesh.vao);
+	// Send the vertex and index data to the GPU
+	UStoreMesh(mesh, data, combined_values.data(), combined_values.size(), indices, sizeof(indices) / sizeof(indices[0]));
+}
 
-	// Create VBOs
-	glGenBuffers(2, mesh.vbos);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the vertex buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * combined_values.size(), combined_values.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+///////////////////////////////////////////////////
+//	UAppendTriangleIndices(GLenum, GLuint, GLuint, std::vector<GLuint>&)
+//
+//	mode: GL_TRIANGLES, GL_TRIANGLE_STRIP or GL_TRIANGLE_FAN
+//	first: first vertex of the range
+//	count: number of vertices in the range
+//	indices: triangle list the range is appended to
+//
+//	Convert a glDrawArrays range into triangle list indices so every
+//	mesh in the arena can be drawn with a single indexed draw
+///////////////////////////////////////////////////
+void Meshes::UAppendTriangleIndices(GLenum mode, GLuint first, GLuint count, std::vector<GLuint> &indices)
+{
+	for (GLuint i = 2; i < count; i++)
+	{
+		if (mode == GL_TRIANGLES)
+		{
+			if (i % 3 != 2)
+				continue;
+			indices.push_back(first + i - 2);
+			indices.push_back(first + i - 1);
+			indices.push_back(first + i);
+		}
+		else if (mode == GL_TRIANGLE_STRIP)
+		{
+			// every other strip triangle is wound the opposite way
+			if (i % 2 == 0)
+			{
+				indices.push_back(first + i - 2);
+				indices.push_back(first + i - 1);
+			}
+			else
+			{
+				indices.push_back(first + i - 1);
+				indices.push_back(first + i - 2);
+			}
+			indices.push_back(first + i);
+		}
+		else if (mode == GL_TRIANGLE_FAN)
+		{
+			indices.push_back(first);
+			indices.push_back(first + i - 1);
+			indices.push_back(first + i);
+		}
+	}
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the index buffer
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+///////////////////////////////////////////////////
+//	UStoreMesh(GLMesh&, MeshData&, const GLfloat*, GLuint, const GLuint*, GLuint)
+//
+//	mesh: reference to mesh structure for storing data
+//	data: receives the vertex and index data of the mesh
+//	verts: interleaved position (3), normal (3) and texture coordinate (2) floats
+//	nFloats: number of floats in verts
+//	indices: triangle list indices, relative to the first vertex of the mesh
+//	nIndices: number of indices
+//
+//	Convert the mesh's data to the arena's vertex layout, compute its
+//	bounds and keep its triangles for picking. GenerateMeshes() places it
+//	in the arena and UUploadArena() sends every mesh to the GPU at once.
+//	When packed vertices are enabled, positions are stored as half floats,
+//	normals are octahedral encoded into two snorm16 values and texture
+//	coordinates as half floats, which keep the coordinates some meshes
+//	have outside [0, 1].
+///////////////////////////////////////////////////
+void Meshes::UStoreMesh(GLMesh &mesh, MeshData &data, const GLfloat *verts, GLuint nFloats, const GLuint *indices, GLuint nIndices)
+{
+	// store vertex and index count; where the mesh starts in the arena is set by GenerateMeshes()
+	mesh.nVertices = nFloats / FLOATS_PER_ENTRY;
+	mesh.nIndices = nIndices;
 
-	// Strides between vertex coordinates
-	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
+	data.vertexData.resize(mesh.nVertices * UVertexSize());
+	if (packedVertices)
+	{
+		PackedVertex *vertices = (PackedVertex*)data.vertexData.data();
+		for (GLuint i = 0; i < mesh.nVertices; i++)
+		{
+			const GLfloat *v = verts + i * FLOATS_PER_ENTRY;
+			glm::vec2 normal = UEncodeOctahedral(glm::vec3(v[3], v[4], v[5]));
+			PackedVertex packed;
+
+			packed.position[0] = glm::packHalf1x16(v[0]);
+			packed.position[1] = glm::packHalf1x16(v[1]);
+			packed.position[2] = glm::packHalf1x16(v[2]);
+			packed.position[3] = glm::packHalf1x16(1.0f);
+			packed.normal[0] = (GLshort)glm::packSnorm1x16(normal.x);
+			packed.normal[1] = (GLshort)glm::packSnorm1x16(normal.y);
+			packed.uv[0] = glm::packHalf1x16(v[6]);
+			packed.uv[1] = glm::packHalf1x16(v[7]);
+
+			vertices[i] = packed;
+		}
+	}
+	else
+	{
+		const unsigned char *bytes = (const unsigned char*)verts;
+		std::copy(bytes, bytes + data.vertexData.size(), data.vertexData.begin());
+	}
 
-	// Create Vertex Attribute Pointers
-	glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-	glEnableVertexAttribArray(0);
+	// Bounding box and sphere, used to cull the objects drawn with the mesh
+	mesh.boundsMin = glm::vec3(verts[0], verts[1], verts[2]);
+	mesh.boundsMax = mesh.boundsMin;
+	for (GLuint i = 1; i < mesh.nVertices; i++)
+	{
+		glm::vec3 position(verts[i * FLOATS_PER_ENTRY], verts[i * FLOATS_PER_ENTRY + 1], verts[i * FLOATS_PER_ENTRY + 2]);
+		mesh.boundsMin = glm::min(mesh.boundsMin, position);
+		mesh.boundsMax = glm::max(mesh.boundsMax, position);
+	}
+	mesh.boundsCenter = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+	mesh.boundsRadius = 0.0f;
+	for (GLuint i = 0; i < mesh.nVertices; i++)
+	{
+		glm::vec3 position(verts[i * FLOATS_PER_ENTRY], verts[i * FLOATS_PER_ENTRY + 1], verts[i * FLOATS_PER_ENTRY + 2]);
+		mesh.boundsRadius = glm::max(mesh.boundsRadius, glm::length(position - mesh.boundsCenter));
+	}
+
+	// Full precision copy of the triangles for ray queries
+	mesh.triangles.Assign(verts, FLOATS_PER_ENTRY, indices, nIndices);
 
-	glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-	glEnableVertexAttribArray(1);
+	data.indices.assign(indices, indices + nIndices);
+}
 
-	glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-	glEnableVertexAttribArray(2);
+///////////////////////////////////////////////////
+//	UVertexSize()
+//
+//	Return the size in bytes of one vertex in the arena's layout
+///////////////////////////////////////////////////
+GLuint Meshes::UVertexSize() const
+{
+	return packedVertices ? sizeof(PackedVertex) : sizeof(GLfloat) * FLOATS_PER_ENTRY;
 }
 
-void Meshes::UDestroyMesh(GLMesh &mesh)
+///////////////////////////////////////////////////
+//	UUploadArena()
+//
+//	Send the staged vertex and index data of every mesh to the GPU in one
+//	vertex buffer and one index buffer, and create the single VAO that
+//	describes the common vertex layout
+///////////////////////////////////////////////////
+void Meshes::UUploadArena()
 {
-	glDeleteVertexArrays(1, &mesh.vao);
-	glDeleteBuffers(2, mesh.vbos);
+	// total float values per each type
+	const GLuint floatsPerVertex = 3;
+	const GLuint floatsPerNormal = 3;
+	const GLuint floatsPerUV = 2;
+
+	// Create VAO
+	glGenVertexArrays(1, &gArenaVao);
+	glBindVertexArray(gArenaVao);
+
+	// Create 2 buffers: first one for the vertex data; second one for the indices
+	glGenBuffers(2, gArenaVbos);
+	glBindBuffer(GL_ARRAY_BUFFER, gArenaVbos[0]); // Activates the buffer
+	glBufferData(GL_ARRAY_BUFFER, arenaVertexData.size(), arenaVertexData.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gArenaVbos[1]); // Activates the buffer
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * arenaIndices.size(), arenaIndices.data(), GL_STATIC_DRAW);
+	UGpuMemory().TrackBuffer(gArenaVbos[0], arenaVertexData.size(), "mesh arena vertices");
+	UGpuMemory().TrackBuffer(gArenaVbos[1], sizeof(GLuint) * arenaIndices.size(), "mesh arena indices");
+
+	if (packedVertices)
+	{
+		// Create Vertex Attribute Pointers; the GPU converts the packed values back to floats
+		GLint stride = sizeof(PackedVertex);
+		glVertexAttribPointer(0, floatsPerVertex, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex, position));
+		glEnableVertexAttribArray(0);
+
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(PackedVertex, normal));
+		glEnableVertexAttribArray(1);
+
+		glVertexAttribPointer(2, floatsPerUV, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedVertex, uv));
+		glEnableVertexAttribArray(2);
+	}
+	else
+	{
+		// Strides between vertex coordinates
+		GLint stride = sizeof(float) * FLOATS_PER_ENTRY;
+
+		// Create Vertex Attribute Pointers
+		glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+		glEnableVertexAttribArray(0);
+
+		glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
+		glEnableVertexAttribArray(1);
+
+		glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
+		glEnableVertexAttribArray(2);
+	}
+
+	glBindVertexArray(0);
+
+	// The staging copies are no longer needed once the GPU has the data
+	std::vector<unsigned char>().swap(arenaVertexData);
+	std::vector<GLuint>().swap(arenaIndices);
 }
\ No newline at end of file
@@ -13,18 +13,34 @@
 
 #include <glm/glm.hpp>
 
+#include <vector>
+
+#include "allocators.h"
+#include "jobs.h"
+#include "triangles.h"
+
 class Meshes
 {
-	// Stores the GL data relative to a given mesh
+public:
+	// Stores where a given mesh lives inside the shared mesh arena
 	struct GLMesh
 	{
-		GLuint vao;         // Handle for the vertex array object
-		GLuint vbos[2];     // Handles for the vertex buffer objects
 		GLuint nVertices;	// Number of vertices for the mesh
-		GLuint nIndices;    // Number of indices for the mesh
+		GLuint nIndices;    // Number of indices for the mesh (triangle list)
+		GLint baseVertex;	// First vertex of the mesh in the arena vertex buffer
+		GLuint firstIndex;	// First index of the mesh in the arena index buffer
+		glm::vec3 boundsMin;	// Object space bounding box
+		glm::vec3 boundsMax;
+		glm::vec3 boundsCenter;	// Object space bounding sphere
+		float boundsRadius;
+		TriangleSet triangles;	// Object space triangles kept on the CPU for picking
 	};
 
-public:
+	// Mesh arena: every mesh is suballocated in one vertex and one index buffer
+	GLuint gArenaVao;		// Handle for the vertex array object of the common layout
+	GLuint gArenaVbos[2];	// Handles for the arena vertex and index buffers
+
+
 	GLMesh gBoxMesh;
 	GLMesh gConeMesh;
 	GLMesh gCylinderMesh;
@@ -37,22 +53,40 @@ public:
 	GLMesh gTorusMesh;
 
 public:
-	void CreateMeshes();
+	void CreateMeshes(bool bPackedVertices = false, JobSystem *jobs = nullptr);
+	void GenerateMeshes(JobSystem *jobs = nullptr);
 	void DestroyMeshes();
 
 private:
-	void UCreatePlaneMesh(GLMesh &mesh);
-	void UCreatePrismMesh(GLMesh &mesh);
-	void UCreateBoxMesh(GLMesh &mesh);
-	void UCreateConeMesh(GLMesh &mesh);
-	void UCreateCylinderMesh(GLMesh &mesh);
-	void UCreateTaperedCylinderMesh(GLMesh &mesh);
-	void UCreateTorusMesh(GLMesh &mesh);
-	void UCreatePyramid3Mesh(GLMesh &mesh);
-	void UCreatePyramid4Mesh(GLMesh &mesh);
-	void UCreateSphereMesh(GLMesh &mesh);
-
-	void UDestroyMesh(GLMesh &mesh);
+	// Vertex and index data of one mesh, generated on any thread before it is placed in the arena
+	struct MeshData
+	{
+		std::vector<unsigned char> vertexData;	// Vertices in the arena's layout
+		std::vector<GLuint> indices;			// Relative to the first vertex of the mesh
+		FrameArena *scratch;					// Temporary buffers of the generation, shared by the jobs
+	};
+
+	void UCreatePlaneMesh(GLMesh &mesh, MeshData &data);
+	void UCreatePrismMesh(GLMesh &mesh, MeshData &data);
+	void UCreateBoxMesh(GLMesh &mesh, MeshData &data);
+	void UCreateConeMesh(GLMesh &mesh, MeshData &data);
+	void UCreateCylinderMesh(GLMesh &mesh, MeshData &data);
+	void UCreateTaperedCylinderMesh(GLMesh &mesh, MeshData &data);
+	void UCreateTorusMesh(GLMesh &mesh, MeshData &data);
+	void UCreatePyramid3Mesh(GLMesh &mesh, MeshData &data);
+	void UCreatePyramid4Mesh(GLMesh &mesh, MeshData &data);
+	void UCreateSphereMesh(GLMesh &mesh, MeshData &data);
+
+	void UAppendTriangleIndices(GLenum mode, GLuint first, GLuint count, std::vector<GLuint> &indices);
+	void UStoreMesh(GLMesh &mesh, MeshData &data, const GLfloat *verts, GLuint nFloats, const GLuint *indices, GLuint nIndices);
+	GLuint UVertexSize() const;
+	void UUploadArena();
 
 	void CalculateTriangleNormal(glm::vec3 px, glm::vec3 py, glm::vec3 pz);
+
+	bool packedVertices = false;	// Store vertices in the compressed 16 byte layout
+
+	// CPU staging for the arena until UUploadArena() sends it to the GPU
+	std::vector<unsigned char> arenaVertexData;
+	std::vector<GLuint> arenaIndices;
 };
\ No newline at end of file
@@ -0,0 +1,442 @@
+///////////////////////////////////////////////////////////////////////////////
+// occlusion.cpp
+// ========
+// occlusion culling on the CPU: the largest objects on screen are drawn as
+// simplified occluders (boxes and cylinders inscribed in their meshes)
+// into a small software depth buffer, a band of rows per job and 4 pixels
+// at a time with SSE. Objects whose bounds are behind that depth everywhere
+// they cover are dropped before the draws are submitted. Needs no GPU
+// feature, so it also spares software GL drivers the hidden fragments.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "occlusion.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "scene.h"
+
+// SSE is always there on x86-64; other CPUs use the scalar path
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+namespace
+{
+	// Triangles of the largest hull, times two for those split by the near plane
+	const size_t MAX_HULL_TRIANGLES = 2 * (4 * OcclusionCuller::CYLINDER_SIDES - 4);
+	// Objects tested by one job
+	const size_t OBJECTS_PER_JOB = 256;
+	// Points nearer to the eye than this (in w) are treated as crossing it
+	const float MIN_W = 1e-5f;
+
+	// Faces of a box as quads of corner indices; bit 0 of an index selects +x, bit 1 +y, bit 2 +z
+	const int BOX_FACES[6][4] =
+	{
+		{ 0, 2, 6, 4 }, { 1, 3, 7, 5 },
+		{ 0, 1, 5, 4 }, { 2, 3, 7, 6 },
+		{ 0, 1, 3, 2 }, { 4, 5, 7, 6 },
+	};
+
+	// Occluder chosen for this frame, with its size on screen
+	struct Candidate
+	{
+		float size;
+		std::uint32_t object;
+	};
+}
+
+///////////////////////////////////////////////////
+//	AddOccluder(const Meshes::GLMesh&, Shape, const glm::vec3&, const glm::vec3&)
+//
+//	mesh: mesh whose objects occlude
+//	shape: geometry drawn for the objects of the mesh
+//	center: center of the shape in the mesh's space
+//	halfExtents: half of the shape's size along each axis
+//
+//	Let the objects drawn with the mesh hide others. The shape must fit
+//	inside the mesh, or objects it wrongly covers disappear.
+///////////////////////////////////////////////////
+void OcclusionCuller::AddOccluder(const Meshes::GLMesh &mesh, Shape shape, const glm::vec3 &center, const glm::vec3 &halfExtents)
+{
+	hulls.push_back({ &mesh, shape, center, halfExtents });
+}
+
+///////////////////////////////////////////////////
+//	Clear()
+//
+//	Forget every occluder mesh
+///////////////////////////////////////////////////
+void OcclusionCuller::Clear()
+{
+	hulls.clear();
+}
+
+///////////////////////////////////////////////////
+//	Cull(const SceneObject*, const glm::mat4&, std::uint32_t*, size_t, FrameArena&, JobSystem*)
+//
+//	objects: the scene's objects
+//	viewProjection: camera projection times view
+//	visible: indices of the objects to test; receives the ones not hidden
+//	nVisible: number of indices
+//	scratch: arena for the occluder triangles and the depth buffer
+//	jobs: job system rasterizing and testing, null for this thread
+//
+//	Draw the occluders into the depth buffer, then drop the objects whose
+//	bounding sphere is behind it over all the pixels it may cover. Return
+//	how many objects remain, in their original order.
+///////////////////////////////////////////////////
+size_t OcclusionCuller::Cull(const SceneObject *objects, const glm::mat4 &viewProjection, std::uint32_t *visible, size_t nVisible,
+	FrameArena &scratch, JobSystem *jobs) const
+{
+	if (hulls.empty() || nVisible == 0)
+		return nVisible;
+
+	// The objects with occluder geometry that cover the most of the screen
+	glm::vec3 wRow(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3]);
+	Candidate *candidates = scratch.Allocate<Candidate>(nVisible);
+	size_t nCandidates = 0;
+	for (size_t i = 0; i < nVisible; i++)
+	{
+		const SceneObject &object = objects[visible[i]];
+		if (!UFindHull(object.mesh))
+			continue;
+		float w = glm::dot(wRow, glm::vec3(object.bounds)) + viewProjection[3][3];
+		float size = object.bounds.w / std::max(w, MIN_W);
+		if (size >= MIN_OCCLUDER_SIZE)
+			candidates[nCandidates++] = { size, visible[i] };
+	}
+	size_t nOccluders = std::min(nCandidates, MAX_OCCLUDERS);
+	if (nOccluders == 0)
+		return nVisible;
+	std::partial_sort(candidates, candidates + nOccluders, candidates + nCandidates,
+		[](const Candidate &a, const Candidate &b) { return a.size > b.size; });
+
+	ScreenTriangle *triangles = scratch.Allocate<ScreenTriangle>(nOccluders * MAX_HULL_TRIANGLES);
+	size_t nTriangles = 0;
+	for (size_t i = 0; i < nOccluders; i++)
+	{
+		const SceneObject &object = objects[candidates[i].object];
+		nTriangles += UProjectHull(*UFindHull(object.mesh), viewProjection * object.model, triangles + nTriangles);
+	}
+
+	// Each job clears and draws its own rows, so no two jobs write the same pixel
+	float *depth = (float*)scratch.Allocate(sizeof(float) * WIDTH * HEIGHT, 16);
+	auto rasterize = [this, triangles, nTriangles, depth](size_t begin, size_t end)
+	{
+		for (size_t band = begin; band < end; band++)
+		{
+			int firstRow = (int)band * ROWS_PER_JOB;
+			std::fill(depth + firstRow * WIDTH, depth + (firstRow + ROWS_PER_JOB) * WIDTH, 0.0f);
+			URasterize(triangles, nTriangles, depth, firstRow, firstRow + ROWS_PER_JOB);
+		}
+	};
+	const size_t nBands = HEIGHT / ROWS_PER_JOB;
+	if (jobs)
+		jobs->ParallelFor(nBands, 1, rasterize);
+	else
+		rasterize(0, nBands);
+
+	std::uint8_t *occluded = scratch.Allocate<std::uint8_t>(nVisible);
+	auto test = [this, objects, &viewProjection, visible, depth, occluded](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+			occluded[i] = UOccluded(objects[visible[i]].bounds, viewProjection, depth) ? 1 : 0;
+	};
+	if (jobs)
+		jobs->ParallelFor(nVisible, OBJECTS_PER_JOB, test);
+	else
+		test(0, nVisible);
+
+	size_t nRemaining = 0;
+	for (size_t i = 0; i < nVisible; i++)
+	{
+		if (!occluded[i])
+			visible[nRemaining++] = visible[i];
+	}
+	return nRemaining;
+}
+
+///////////////////////////////////////////////////
+//	UFindHull(const Meshes::GLMesh*)
+//
+//	mesh: mesh of an object
+//
+//	Return the occluder geometry of the mesh, or null when it has none
+///////////////////////////////////////////////////
+const OcclusionCuller::Hull *OcclusionCuller::UFindHull(const Meshes::GLMesh *mesh) const
+{
+	for (const Hull &hull : hulls)
+	{
+		if (hull.mesh == mesh)
+			return &hull;
+	}
+	return nullptr;
+}
+
+///////////////////////////////////////////////////
+//	UProjectHull(const Hull&, const glm::mat4&, ScreenTriangle*)
+//
+//	hull: occluder geometry
+//	modelViewProjection: transform from the hull's space to clip space
+//	triangles: receives up to MAX_HULL_TRIANGLES triangles
+//
+//	Transform the hull's triangles to depth buffer pixels, clipping them
+//	against the near plane. Return the number of triangles written.
+///////////////////////////////////////////////////
+size_t OcclusionCuller::UProjectHull(const Hull &hull, const glm::mat4 &modelViewProjection, ScreenTriangle *triangles) const
+{
+	// Corners in clip space, and the triangles between them
+	glm::vec4 corners[2 * CYLINDER_SIDES];
+	int indices[3 * (4 * CYLINDER_SIDES - 4)];
+	int nIndices = 0;
+	if (hull.shape == SHAPE_BOX)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec3 sign((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+			corners[i] = modelViewProjection * glm::vec4(hull.center + sign * hull.halfExtents, 1.0f);
+		}
+		for (const int *face : BOX_FACES)
+		{
+			const int quad[6] = { face[0], face[1], face[2], face[0], face[2], face[3] };
+			std::copy(quad, quad + 6, indices + nIndices);
+			nIndices += 6;
+		}
+	}
+	else
+	{
+		// Bottom ring, then top ring
+		for (int i = 0; i < CYLINDER_SIDES; i++)
+		{
+			float angle = 6.2831853f * i / CYLINDER_SIDES;
+			glm::vec3 offset(std::cos(angle) * hull.halfExtents.x, -hull.halfExtents.y, std::sin(angle) * hull.halfExtents.z);
+			corners[i] = modelViewProjection * glm::vec4(hull.center + offset, 1.0f);
+			offset.y = hull.halfExtents.y;
+			corners[CYLINDER_SIDES + i] = modelViewProjection * glm::vec4(hull.center + offset, 1.0f);
+		}
+		for (int i = 0; i < CYLINDER_SIDES; i++)
+		{
+			int next = (i + 1) % CYLINDER_SIDES;
+			const int side[6] = { i, next, CYLINDER_SIDES + next, i, CYLINDER_SIDES + next, CYLINDER_SIDES + i };
+			std::copy(side, side + 6, indices + nIndices);
+			nIndices += 6;
+		}
+		for (int i = 1; i + 1 < CYLINDER_SIDES; i++)
+		{
+			const int caps[6] = { 0, i, i + 1, CYLINDER_SIDES, CYLINDER_SIDES + i, CYLINDER_SIDES + i + 1 };
+			std::copy(caps, caps + 6, indices + nIndices);
+			nIndices += 6;
+		}
+	}
+
+	size_t nTriangles = 0;
+	for (int i = 0; i < nIndices; i += 3)
+	{
+		// Keep the part in front of the near plane (z >= -w); a triangle becomes at most a quad
+		glm::vec4 polygon[4];
+		int nPoints = 0;
+		for (int j = 0; j < 3; j++)
+		{
+			const glm::vec4 &a = corners[indices[i + j]];
+			const glm::vec4 &b = corners[indices[i + (j + 1) % 3]];
+			float distanceA = a.z + a.w;
+			float distanceB = b.z + b.w;
+			if (distanceA >= 0.0f)
+				polygon[nPoints++] = a;
+			if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+				polygon[nPoints++] = a + (b - a) * (distanceA / (distanceA - distanceB));
+		}
+		if (nPoints < 3)
+			continue;
+
+		// Viewport transform to the depth buffer's pixels
+		float x[4];
+		float y[4];
+		float z[4];
+		bool valid = true;
+		for (int j = 0; j < nPoints; j++)
+		{
+			valid = valid && polygon[j].w > MIN_W;
+			float inverseW = 1.0f / polygon[j].w;
+			x[j] = (polygon[j].x * inverseW * 0.5f + 0.5f) * WIDTH;
+			y[j] = (polygon[j].y * inverseW * 0.5f + 0.5f) * HEIGHT;
+			z[j] = inverseW;
+		}
+		if (!valid)
+			continue;
+
+		for (int j = 1; j + 1 < nPoints; j++)
+			triangles[nTriangles++] = { { x[0], x[j], x[j + 1] }, { y[0], y[j], y[j + 1] }, { z[0], z[j], z[j + 1] } };
+	}
+	return nTriangles;
+}
+
+///////////////////////////////////////////////////
+//	URasterize(const ScreenTriangle*, size_t, float*, int, int)
+//
+//	triangles: occluder triangles in depth buffer pixels
+//	nTriangles: number of triangles
+//	depth: depth buffer, 1/w of the nearest occluder per pixel (0 for none)
+//	firstRow, endRow: rows to draw
+//
+//	Draw the triangles' depth into the rows, both sides, covering only the
+//	pixels entirely inside. Each pixel keeps the farthest depth of the
+//	triangle's plane over the pixel, so nothing is hidden by an occluder
+//	that covers part of a pixel or by a depth nearer than it really is.
+///////////////////////////////////////////////////
+void OcclusionCuller::URasterize(const ScreenTriangle *triangles, size_t nTriangles, float *depth, int firstRow, int endRow) const
+{
+	for (size_t t = 0; t < nTriangles; t++)
+	{
+		ScreenTriangle triangle = triangles[t];
+		float area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) - (triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+		if (!(std::abs(area) > 1e-8f))
+			continue;
+		// Counterclockwise, so the inside is on the positive side of every edge
+		if (area < 0.0f)
+		{
+			std::swap(triangle.x[1], triangle.x[2]);
+			std::swap(triangle.y[1], triangle.y[2]);
+			std::swap(triangle.z[1], triangle.z[2]);
+			area = -area;
+		}
+
+		// Pixels of the bounds in the rows; columns start on a multiple of 4 for the vector loop
+		float minX = std::min(triangle.x[0], std::min(triangle.x[1], triangle.x[2]));
+		float maxX = std::max(triangle.x[0], std::max(triangle.x[1], triangle.x[2]));
+		float minY = std::min(triangle.y[0], std::min(triangle.y[1], triangle.y[2]));
+		float maxY = std::max(triangle.y[0], std::max(triangle.y[1], triangle.y[2]));
+		int firstX = (int)std::max(std::floor(minX), 0.0f) & ~3;
+		int lastX = (int)std::min(std::ceil(maxX), (float)(WIDTH - 1));
+		int firstY = (int)std::max(std::floor(minY), (float)firstRow);
+		int lastY = (int)std::min(std::ceil(maxY), (float)(endRow - 1));
+		if (firstX > lastX || firstY > lastY)
+			continue;
+
+		// Edge functions a * x + b * y + c, from each vertex to the next,
+		// moved from a pixel's center to its corner farthest outside the edge
+		float edgeA[3];
+		float edgeB[3];
+		float edgeC[3];
+		for (int i = 0; i < 3; i++)
+		{
+			int next = (i + 1) % 3;
+			edgeA[i] = triangle.y[i] - triangle.y[next];
+			edgeB[i] = triangle.x[next] - triangle.x[i];
+			edgeC[i] = -(edgeA[i] * triangle.x[i] + edgeB[i] * triangle.y[i]) - 0.5f * (std::abs(edgeA[i]) + std::abs(edgeB[i]));
+		}
+
+		// Plane of 1/w, lowered to its farthest value over a pixel
+		float z1 = triangle.z[1] - triangle.z[0];
+		float z2 = triangle.z[2] - triangle.z[0];
+		float depthX = (z1 * (triangle.y[2] - triangle.y[0]) - z2 * (triangle.y[1] - triangle.y[0])) / area;
+		float depthY = (z2 * (triangle.x[1] - triangle.x[0]) - z1 * (triangle.x[2] - triangle.x[0])) / area;
+		float depthC = triangle.z[0] - depthX * triangle.x[0] - depthY * triangle.y[0] - 0.5f * (std::abs(depthX) + std::abs(depthY));
+
+		for (int y = firstY; y <= lastY; y++)
+		{
+			float centerY = y + 0.5f;
+			float *row = depth + y * WIDTH;
+#ifdef OCCLUSION_SSE
+			const __m128 laneX = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			const __m128 zero = _mm_setzero_ps();
+			for (int x = firstX; x <= lastX; x += 4)
+			{
+				__m128 centerX = _mm_add_ps(_mm_set1_ps((float)x), laneX);
+				__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[0]), centerX), _mm_set1_ps(edgeB[0] * centerY + edgeC[0])), zero);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[1]), centerX), _mm_set1_ps(edgeB[1] * centerY + edgeC[1])), zero));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[2]), centerX), _mm_set1_ps(edgeB[2] * centerY + edgeC[2])), zero));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+
+				__m128 pixelDepth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depthX), centerX), _mm_set1_ps(depthY * centerY + depthC));
+				__m128 stored = _mm_load_ps(row + x);
+				__m128 nearest = _mm_max_ps(stored, pixelDepth);
+				_mm_store_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, stored)));
+			}
+#else
+			for (int x = firstX; x <= lastX; x++)
+			{
+				float centerX = x + 0.5f;
+				bool inside = true;
+				for (int i = 0; i < 3; i++)
+					inside = inside && edgeA[i] * centerX + edgeB[i] * centerY + edgeC[i] >= 0.0f;
+				if (inside)
+					row[x] = std::max(row[x], depthX * centerX + depthY * centerY + depthC);
+			}
+#endif
+		}
+	}
+}
+
+///////////////////////////////////////////////////
+//	UOccluded(const glm::vec4&, const glm::mat4&, const float*)
+//
+//	sphere: world space bounding sphere: center, radius
+//	viewProjection: camera projection times view
+//	depth: the occluders' depth buffer
+//
+//	Return whether the occluders are nearer than the sphere's nearest point
+//	over every pixel its bounding box projects onto. Spheres crossing the
+//	eye plane are never hidden.
+///////////////////////////////////////////////////
+bool OcclusionCuller::UOccluded(const glm::vec4 &sphere, const glm::mat4 &viewProjection, const float *depth) const
+{
+	glm::vec3 center(sphere);
+	glm::vec3 wRow(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3]);
+	float nearestW = glm::dot(wRow, center) + viewProjection[3][3] - sphere.w * glm::length(wRow);
+	if (!(nearestW > MIN_W))
+		return false;
+
+	// Screen rectangle of the box around the sphere; its corners are the
+	// center plus or minus each of the matrix's first columns times the radius
+	glm::vec4 centerClip = viewProjection * glm::vec4(center, 1.0f);
+	glm::vec4 axisX = viewProjection[0] * sphere.w;
+	glm::vec4 axisY = viewProjection[1] * sphere.w;
+	glm::vec4 axisZ = viewProjection[2] * sphere.w;
+	float minX = (float)WIDTH;
+	float maxX = 0.0f;
+	float minY = (float)HEIGHT;
+	float maxY = 0.0f;
+	for (int i = 0; i < 8; i++)
+	{
+		glm::vec4 corner = centerClip + ((i & 1) ? axisX : -axisX) + ((i & 2) ? axisY : -axisY) + ((i & 4) ? axisZ : -axisZ);
+		if (!(corner.w > MIN_W))
+			return false;
+		float x = (corner.x / corner.w * 0.5f + 0.5f) * WIDTH;
+		float y = (corner.y / corner.w * 0.5f + 0.5f) * HEIGHT;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+	}
+	int firstX = (int)std::max(std::floor(minX), 0.0f) & ~3;
+	int lastX = (int)std::min(std::floor(maxX), (float)(WIDTH - 1));
+	int firstY = (int)std::max(std::floor(minY), 0.0f);
+	int lastY = (int)std::min(std::floor(maxY), (float)(HEIGHT - 1));
+	if (firstX > lastX || firstY > lastY)
+		return false;
+
+	float objectDepth = 1.0f / nearestW;
+	for (int y = firstY; y <= lastY; y++)
+	{
+		const float *row = depth + y * WIDTH;
+#ifdef OCCLUSION_SSE
+		const __m128 objectDepths = _mm_set1_ps(objectDepth);
+		for (int x = firstX; x <= lastX; x += 4)
+		{
+			if (_mm_movemask_ps(_mm_cmple_ps(_mm_load_ps(row + x), objectDepths)) != 0)
+				return false;
+		}
+#else
+		for (int x = firstX; x <= lastX; x++)
+		{
+			if (row[x] <= objectDepth)
+				return false;
+		}
+#endif
+	}
+	return true;
+}
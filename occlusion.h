@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////////////////////
+// occlusion.h
+// ========
+// occlusion culling on the CPU: the largest objects on screen are drawn as
+// simplified occluders (boxes and cylinders inscribed in their meshes)
+// into a small software depth buffer, a band of rows per job and 4 pixels
+// at a time with SSE. Objects whose bounds are behind that depth everywhere
+// they cover are dropped before the draws are submitted. Needs no GPU
+// feature, so it also spares software GL drivers the hidden fragments.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "allocators.h"
+#include "jobs.h"
+#include "meshes.h"
+
+struct SceneObject;
+
+class OcclusionCuller
+{
+public:
+	// Simplified geometry drawn for the objects of a mesh
+	enum Shape
+	{
+		SHAPE_BOX,		// Axis-aligned box
+		SHAPE_CYLINDER	// Prism around the y axis, its corners on the ellipse of the x and z half extents
+	};
+
+	// Size of the depth buffer; its pixels stretch over the whole viewport
+	static constexpr int WIDTH = 256;
+	static constexpr int HEIGHT = 128;
+	// Rows rasterized by one job
+	static constexpr int ROWS_PER_JOB = 16;
+	// Objects drawn as occluders per frame, the largest on screen first
+	static constexpr size_t MAX_OCCLUDERS = 32;
+	// Smaller objects (bounding radius over view distance) do not occlude
+	static constexpr float MIN_OCCLUDER_SIZE = 0.05f;
+	// Sides of the prism drawn for SHAPE_CYLINDER
+	static constexpr int CYLINDER_SIDES = 8;
+
+public:
+	void AddOccluder(const Meshes::GLMesh &mesh, Shape shape, const glm::vec3 &center, const glm::vec3 &halfExtents);
+	void Clear();
+	size_t Cull(const SceneObject *objects, const glm::mat4 &viewProjection, std::uint32_t *visible, size_t nVisible,
+		FrameArena &scratch, JobSystem *jobs) const;
+
+private:
+	// Occluder geometry of the objects drawn with a mesh, in object space
+	struct Hull
+	{
+		const Meshes::GLMesh *mesh;
+		Shape shape;
+		glm::vec3 center;
+		glm::vec3 halfExtents;
+	};
+
+	// Triangle in depth buffer pixels; z is 1/w, which is linear in screen space
+	struct ScreenTriangle
+	{
+		float x[3];
+		float y[3];
+		float z[3];
+	};
+
+	const Hull *UFindHull(const Meshes::GLMesh *mesh) const;
+	size_t UProjectHull(const Hull &hull, const glm::mat4 &modelViewProjection, ScreenTriangle *triangles) const;
+	void URasterize(const ScreenTriangle *triangles, size_t nTriangles, float *depth, int firstRow, int endRow) const;
+	bool UOccluded(const glm::vec4 &sphere, const glm::mat4 &viewProjection, const float *depth) const;
+
+	std::vector<Hull> hulls;
+};
@@ -0,0 +1,72 @@
+#version 440 core
+// Phong fragment shader: ambient, diffuse and specular light of up to two lights
+
+in vec4 vertexColor; // Variable to hold incoming color data from vertex shader
+in vec3 vertexFragmentNormal; // For incoming normals
+in vec3 vertexFragmentPos; // For incoming fragment position
+in vec2 vertexTextureCoordinate; // Variable to hold texture data
+flat in vec4 vertexObjectColor; // Object color of the draw
+flat in vec4 vertexMaterial; // x: has texture, y: specular intensity, z: highlight size
+flat in float vertexSelected; // 1 for the object picked with the mouse
+out vec4 fragmentColor;
+
+//Uniform variables
+uniform vec3 ambientColor;
+uniform vec3 light1Color;
+uniform vec3 light1Position;
+uniform vec3 light2Color;
+uniform vec3 light2Position;
+uniform vec3 viewPosition;
+uniform sampler2D uTexture; // Useful when working with multiple textures
+uniform vec2 uvScale;
+uniform float ambientStrength = 1.0f; // Set ambient or global lighting strength
+
+// Ambient, diffuse and specular light received from one light source
+vec3 phongLight(vec3 lightPosition, vec3 lightColor, vec3 ambient, vec3 norm, vec3 viewDir)
+{
+    //**Calculate Diffuse lighting**
+    vec3 lightDirection = normalize(lightPosition - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
+    float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
+    vec3 diffuse = impact * lightColor; // Generate diffuse light color
+
+    //**Calculate Specular lighting**
+    vec3 specular = vec3(0.0);
+    if (SPECULAR != 0)
+    {
+        float specularIntensity = vertexMaterial.y;
+        float highlightSize = vertexMaterial.z;
+        vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
+        //Calculate specular component
+        float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
+        specular = specularIntensity * specularComponent * lightColor;
+    }
+
+    return ambient + diffuse + specular;
+}
+
+void main()
+{
+    /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
+    //Calculate Ambient lighting
+    vec3 ambient = ambientStrength * ambientColor; // Generate ambient light color
+
+    vec3 norm = normalize(vertexFragmentNormal); // Normalize vectors to 1 unit
+    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
+
+    //Texture holds the color to be used for all three components; untextured variants never sample it
+    vec3 objectColor = vertexObjectColor.xyz;
+    if (TEXTURED != 0)
+        objectColor = texture(uTexture, vertexTextureCoordinate * uvScale).xyz;
+
+    //**Calculate phong result** (front light, then back light)
+    vec3 phong = vec3(0.0);
+    if (LIGHT_COUNT >= 1)
+        phong += phongLight(light1Position, light1Color, ambient, norm, viewDir) * objectColor;
+    if (LIGHT_COUNT >= 2)
+        phong += phongLight(light2Position, light2Color, ambient, norm, viewDir) * objectColor;
+
+    //Tint the picked object so the selection is visible
+    phong = mix(phong, vec3(1.0, 0.6, 0.1), 0.4 * vertexSelected);
+
+    fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
+}
@@ -0,0 +1,66 @@
+#version 440 core
+// Phong vertex shader: per-object transforms from the draw data buffer
+
+layout(location = 0) in vec3 vertexPosition; // VAP position 0 for vertex position data
+layout(location = 1) in vec3 vertexNormal; // VAP position 1 for normals
+layout(location = 2) in vec2 textureCoordinate;
+layout(location = 3) in vec4 color;  // Color data from Vertex Attrib Pointer 1
+layout(location = 4) in uint drawIndex; // Index of the object's draw data, selected by the command's baseInstance
+
+out vec2 vertexTextureCoordinate; // transfer texture data to fragment shader
+out vec4 vertexColor; // variable to transfer color data to the fragment shader
+out vec3 vertexFragmentNormal; // For outgoing normals to fragment shader
+out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
+flat out vec4 vertexObjectColor; // Object color of the draw
+flat out vec4 vertexMaterial; // x: has texture, y: specular intensity, z: highlight size
+flat out float vertexSelected; // 1 for the object picked with the mouse
+
+// Draw data the renderer keeps for every scene object
+struct DrawData
+{
+    mat4 model;
+    mat3 normalMatrix; // Precomputed on the CPU from the model matrix
+    vec4 color;
+    vec4 material;
+};
+
+layout(std430, binding = 0) readonly buffer DrawDataBuffer
+{
+    DrawData draws[];
+};
+
+//Global variables for the  transform matrices
+uniform mat4 view;
+uniform mat4 projection;
+uniform uint selectedObject = 0xFFFFFFFFu; // Scene object picked with the mouse
+
+// Unfold an octahedral encoded normal back onto the unit sphere
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += (n.x >= 0.0) ? -t : t;
+    n.y += (n.y >= 0.0) ? -t : t;
+    return normalize(n);
+}
+
+void main()
+{
+    mat4 model = draws[drawIndex].model;
+    vec3 normal = vertexNormal;
+    if (PACKED_VERTICES != 0)
+        normal = octahedralDecode(vertexNormal.xy); // Normals arrive octahedral encoded in vertexNormal.xy
+
+    gl_Position = projection * view * model * vec4(vertexPosition, 1.0f); // transforms vertices to clip coordinates
+    vertexColor = color; // references incoming color data
+    vertexTextureCoordinate = textureCoordinate; // references texture data
+    vertexFragmentPos = vec3(model * vec4(vertexPosition, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+    // get normal vectors in world space only and exclude normal translation properties
+    if (REFERENCE_NORMAL_MATRIX != 0)
+        vertexFragmentNormal = mat3(transpose(inverse(model))) * normal; // Per-vertex inverse, only used by --bench-normals
+    else
+        vertexFragmentNormal = draws[drawIndex].normalMatrix * normal;
+    vertexObjectColor = draws[drawIndex].color;
+    vertexMaterial = draws[drawIndex].material;
+    vertexSelected = drawIndex == selectedObject ? 1.0 : 0.0;
+}
@@ -0,0 +1,952 @@
+///////////////////////////////////////////////////////////////////////////////
+// renderer.cpp
+// ========
+// submit the scene with multi-draw-indirect: one indirect command per object,
+// per-object data in a shader storage buffer. A compute pass culls the commands
+// against the view frustum and a hierarchical-Z pyramid of last frame's depth.
+// The per-object data stays on the GPU; only the objects that changed are
+// uploaded again.
+// The draw lists are built into a render packet, which can be done on a
+// worker thread while the GL thread submits the previous packet. The
+// packet reaches the GPU through a persistent-mapped ring buffer.
+// Objects hidden behind the largest ones can be dropped on the CPU first,
+// with a software depth buffer of simplified occluders.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "renderer.h"
+
+#include "gpumemory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+
+/*Shader program Macro*/
+#ifndef GLSL
+#define GLSL(Version, Source) "#version " #Version " core \n" #Source
+#endif
+
+namespace
+{
+	// Number of draws the buffers are first created for
+	const GLuint INITIAL_CAPACITY = 64;
+	// Draws filled by one job of BuildPacket()
+	const size_t DRAWS_PER_JOB = 1024;
+	// Work group sizes of the compute shaders
+	const GLuint CULL_GROUP_SIZE = 64;
+	const GLuint HIZ_GROUP_SIZE = 8;
+	// Shader storage buffer binding points of the culling pass
+	const GLuint INPUT_COMMAND_BINDING = 1;
+	const GLuint CULL_DATA_BINDING = 2;
+	const GLuint OUTPUT_COMMAND_BINDING = 3;
+	const GLuint DRAW_COUNT_BINDING = 4;
+
+	/* Culling Compute Shader Source Code*/
+	const GLchar* cullShaderSource = GLSL(430,
+
+	layout(local_size_x = 64) in;
+
+	struct DrawCommand
+	{
+		uint count;
+		uint instanceCount;
+		uint firstIndex;
+		int baseVertex;
+		uint baseInstance;
+	};
+
+	struct CullData
+	{
+		vec4 sphere;            // World space bounding sphere: center, radius
+		uint batch;             // Batch the draw belongs to
+		uint firstCommand;      // First output command of that batch
+		uint padding0;
+		uint padding1;
+	};
+
+	layout(std430, binding = 1) readonly buffer InputCommandBuffer { DrawCommand inputCommands[]; };
+	layout(std430, binding = 2) readonly buffer CullDataBuffer { CullData cullData[]; };
+	layout(std430, binding = 3) writeonly buffer OutputCommandBuffer { DrawCommand outputCommands[]; };
+	layout(std430, binding = 4) buffer DrawCountBuffer { uint drawCounts[]; };
+
+	uniform uint drawCount;
+	uniform vec4 frustumPlanes[6];          // Normalized, pointing inside the frustum
+	uniform bool ubOcclusion;               // The Hi-Z pyramid is valid
+	uniform mat4 previousViewProjection;    // View projection the Hi-Z pyramid was drawn with
+	uniform sampler2D hiZ;                  // Max depth pyramid of last frame
+	uniform vec2 hiZSize;                   // Size of the pyramid's level 0
+	uniform int hiZLevels;
+
+	// Test the sphere's bounding box against last frame's depth pyramid
+	bool isOccluded(vec4 sphere)
+	{
+		vec2 uvMin = vec2(1.0f);
+		vec2 uvMax = vec2(0.0f);
+		float nearestDepth = 1.0f;
+
+		for (int i = 0; i < 8; i++)
+		{
+			vec3 corner = sphere.xyz + sphere.w * vec3((i & 1) != 0 ? 1.0f : -1.0f, (i & 2) != 0 ? 1.0f : -1.0f, (i & 4) != 0 ? 1.0f : -1.0f);
+			vec4 clip = previousViewProjection * vec4(corner, 1.0f);
+			// Crossing the near plane: the box cannot be projected, keep it
+			if (clip.w <= 0.0f)
+				return false;
+
+			vec3 ndc = clip.xyz / clip.w;
+			uvMin = min(uvMin, ndc.xy * 0.5f + 0.5f);
+			uvMax = max(uvMax, ndc.xy * 0.5f + 0.5f);
+			nearestDepth = min(nearestDepth, ndc.z * 0.5f + 0.5f);
+		}
+
+		uvMin = clamp(uvMin, 0.0f, 1.0f);
+		uvMax = clamp(uvMax, 0.0f, 1.0f);
+
+		// Pick the level where the box covers at most 2x2 texels
+		vec2 extent = (uvMax - uvMin) * hiZSize;
+		float level = ceil(log2(max(max(extent.x, extent.y), 1.0f)));
+		level = clamp(level, 0.0f, float(hiZLevels - 1));
+
+		float farthestDepth = textureLod(hiZ, uvMin, level).r;
+		farthestDepth = max(farthestDepth, textureLod(hiZ, vec2(uvMax.x, uvMin.y), level).r);
+		farthestDepth = max(farthestDepth, textureLod(hiZ, vec2(uvMin.x, uvMax.y), level).r);
+		farthestDepth = max(farthestDepth, textureLod(hiZ, uvMax, level).r);
+
+		return nearestDepth > farthestDepth;
+	}
+
+	void main()
+	{
+		uint id = gl_GlobalInvocationID.x;
+		if (id >= drawCount)
+			return;
+
+		vec4 sphere = cullData[id].sphere;
+
+		for (int i = 0; i < 6; i++)
+		{
+			if (dot(frustumPlanes[i].xyz, sphere.xyz) + frustumPlanes[i].w < -sphere.w)
+				return;
+		}
+
+		if (ubOcclusion && isOccluded(sphere))
+			return;
+
+		// Append the surviving draw to the commands of its batch
+		uint slot = atomicAdd(drawCounts[cullData[id].batch], 1u);
+		outputCommands[cullData[id].firstCommand + slot] = inputCommands[id];
+	}
+	);
+
+	/* Hi-Z Pyramid Compute Shader Source Code*/
+	const GLchar* hiZShaderSource = GLSL(430,
+
+	layout(local_size_x = 8, local_size_y = 8) in;
+
+	layout(r32f, binding = 0) uniform readonly image2D sourceLevel;
+	layout(r32f, binding = 1) uniform writeonly image2D destinationLevel;
+	uniform sampler2D depthTexture;
+	uniform bool ubCopyDepth;   // Level 0: copy the depth buffer
+
+	void main()
+	{
+		ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+		ivec2 size = imageSize(destinationLevel);
+		if (coord.x >= size.x || coord.y >= size.y)
+			return;
+
+		float farthestDepth = 0.0f;
+
+		if (ubCopyDepth)
+		{
+			farthestDepth = texelFetch(depthTexture, coord, 0).r;
+		}
+		else
+		{
+			// Max of the 2x2 source texels, 3 wide at the last row/column of an odd sized level
+			ivec2 sourceSize = imageSize(sourceLevel);
+			ivec2 footprint = ivec2(2);
+			if (coord.x == size.x - 1 && (sourceSize.x & 1) != 0)
+				footprint.x = 3;
+			if (coord.y == size.y - 1 && (sourceSize.y & 1) != 0)
+				footprint.y = 3;
+
+			for (int y = 0; y < footprint.y; y++)
+			{
+				for (int x = 0; x < footprint.x; x++)
+				{
+					ivec2 sourceCoord = min(coord * 2 + ivec2(x, y), sourceSize - 1);
+					farthestDepth = max(farthestDepth, imageLoad(sourceLevel, sourceCoord).r);
+				}
+			}
+		}
+
+		imageStore(destinationLevel, coord, vec4(farthestDepth));
+	}
+	);
+
+	///////////////////////////////////////////////////
+	//	UMaterialFeatures(const SceneMaterial&)
+	//
+	//	material: material of a scene object
+	//
+	//	Return the features of the cheapest Phong variant that draws the
+	//	material: no texture fetch when untextured, no specular term when
+	//	its intensity is zero
+	///////////////////////////////////////////////////
+	GLuint UMaterialFeatures(const SceneMaterial &material)
+	{
+		GLuint features = 0;
+		if (material.textureId != 0)
+			features |= SHADER_TEXTURED;
+		if (material.specularIntensity > 0.0f)
+			features |= SHADER_SPECULAR;
+		return features;
+	}
+
+	///////////////////////////////////////////////////
+	//	UCreateComputeProgram(const char*, GLuint&)
+	//
+	//	source: compute shader source code
+	//	programId: receives the linked program
+	//
+	//	Compile and link a compute shader program. On failure the program
+	//	and shader are deleted and programId is set to 0.
+	///////////////////////////////////////////////////
+	bool UCreateComputeProgram(const char* source, GLuint& programId)
+	{
+		int success = 0;
+		char infoLog[512];
+
+		programId = glCreateProgram();
+		GLuint shaderId = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(shaderId, 1, &source, NULL);
+
+		glCompileShader(shaderId);
+		glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(shaderId, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+			glDeleteShader(shaderId);
+			glDeleteProgram(programId);
+			programId = 0;
+			return false;
+		}
+
+		glAttachShader(programId, shaderId);
+		glLinkProgram(programId);
+		glDeleteShader(shaderId);
+		glGetProgramiv(programId, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+			glDeleteProgram(programId);
+			programId = 0;
+			return false;
+		}
+
+		return true;
+	}
+}
+
+///////////////////////////////////////////////////
+//	Create(Meshes&, ShaderLibrary&)
+//
+//	meshes: meshes whose arena the scene objects are drawn from
+//	shaders: library the Phong program variants are taken from
+//
+//	Create the stream, indirect, draw count, draw data and draw index buffers, add
+//	the per-instance draw index attribute to the arena VAO, compile the
+//	culling shaders and give the solid meshes their occluder shapes. Return
+//	false if a shader fails to build.
+///////////////////////////////////////////////////
+bool Renderer::Create(Meshes &meshes, ShaderLibrary &shaders)
+{
+	arenaVao = meshes.gArenaVao;
+	this->shaders = &shaders;
+
+	// Storage buffer offsets must be multiples of this
+	GLint alignment = 0;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	streamAlignment = std::max(alignment, 16);
+
+	glGenBuffers(1, &indirectBuffer);
+	glGenBuffers(1, &drawCountBuffer);
+	glGenBuffers(1, &drawIndexBuffer);
+
+	UReserve(INITIAL_CAPACITY);
+
+	// Occluders inscribed in the solid meshes: the box and plane as they are, the
+	// cylinder inside its 36 sides, and a short cylinder inside the sphere
+	const Meshes::GLMesh &box = meshes.gBoxMesh;
+	const Meshes::GLMesh &plane = meshes.gPlaneMesh;
+	const Meshes::GLMesh &cylinder = meshes.gCylinderMesh;
+	const Meshes::GLMesh &sphere = meshes.gSphereMesh;
+	occlusion.Clear();
+	occlusion.AddOccluder(box, OcclusionCuller::SHAPE_BOX, box.boundsCenter, (box.boundsMax - box.boundsMin) * 0.5f);
+	occlusion.AddOccluder(plane, OcclusionCuller::SHAPE_BOX, plane.boundsCenter, (plane.boundsMax - plane.boundsMin) * 0.5f);
+	occlusion.AddOccluder(cylinder, OcclusionCuller::SHAPE_CYLINDER, cylinder.boundsCenter,
+		(cylinder.boundsMax - cylinder.boundsMin) * 0.5f * glm::vec3(0.95f, 1.0f, 0.95f));
+	float sphereRadius = 0.95f * sphere.boundsRadius;
+	occlusion.AddOccluder(sphere, OcclusionCuller::SHAPE_CYLINDER, sphere.boundsCenter,
+		glm::vec3(0.8165f, 0.5774f, 0.8165f) * sphereRadius);
+
+	// Each command's baseInstance selects one entry of the draw index buffer,
+	// which gives the vertex shader the index of its object's draw data
+	glBindVertexArray(arenaVao);
+	glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+	glVertexAttribIPointer(DRAW_INDEX_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+	glVertexAttribDivisor(DRAW_INDEX_ATTRIBUTE, 1);
+	glEnableVertexAttribArray(DRAW_INDEX_ATTRIBUTE);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	if (!UCreateComputeProgram(cullShaderSource, cullProgramId))
+		return false;
+	if (!UCreateComputeProgram(hiZShaderSource, hiZProgramId))
+		return false;
+
+	drawCountLoc = glGetUniformLocation(cullProgramId, "drawCount");
+	frustumPlanesLoc = glGetUniformLocation(cullProgramId, "frustumPlanes");
+	occlusionLoc = glGetUniformLocation(cullProgramId, "ubOcclusion");
+	previousViewProjectionLoc = glGetUniformLocation(cullProgramId, "previousViewProjection");
+	hiZSizeLoc = glGetUniformLocation(cullProgramId, "hiZSize");
+	hiZLevelsLoc = glGetUniformLocation(cullProgramId, "hiZLevels");
+	copyDepthLoc = glGetUniformLocation(hiZProgramId, "ubCopyDepth");
+
+	// The samplers read texture unit 0
+	glUseProgram(cullProgramId);
+	glUniform1i(glGetUniformLocation(cullProgramId, "hiZ"), 0);
+	glUseProgram(hiZProgramId);
+	glUniform1i(glGetUniformLocation(hiZProgramId, "depthTexture"), 0);
+	glUseProgram(0);
+
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	Destroy()
+//
+//	Release the GPU buffers, offscreen targets, culling shaders and occluders
+///////////////////////////////////////////////////
+void Renderer::Destroy()
+{
+	streamBuffer.Destroy();
+	for (GLuint buffer : { indirectBuffer, drawCountBuffer, drawDataBuffer, drawIndexBuffer })
+		UGpuMemory().UntrackBuffer(buffer);
+	glDeleteBuffers(1, &indirectBuffer);
+	glDeleteBuffers(1, &drawCountBuffer);
+	glDeleteBuffers(1, &drawDataBuffer);
+	glDeleteBuffers(1, &drawIndexBuffer);
+	capacity = 0;
+
+	UDestroyTargets();
+
+	glDeleteProgram(cullProgramId);
+	glDeleteProgram(hiZProgramId);
+
+	occlusion.Clear();
+}
+
+///////////////////////////////////////////////////
+//	RequestPrograms(const Scene&)
+//
+//	scene: objects to draw
+//
+//	Submit the program variants the scene's materials need, so they can be
+//	compiled together and their uniforms set before the first draw. They
+//	are ready once ShaderLibrary::FinishPrograms() returns.
+///////////////////////////////////////////////////
+void Renderer::RequestPrograms(const Scene &scene)
+{
+	for (const SceneObject &object : scene.objects)
+		shaders->RequestProgram(UMaterialFeatures(object.material) | featureOverrides);
+}
+
+///////////////////////////////////////////////////
+//	RequestPrograms(const std::vector<SceneMaterial>&)
+//
+//	materials: materials objects will be drawn with
+//
+//	Submit the program variants of materials whose objects are not in the
+//	scene yet, such as those of streamed cells
+///////////////////////////////////////////////////
+void Renderer::RequestPrograms(const std::vector<SceneMaterial> &materials)
+{
+	for (const SceneMaterial &material : materials)
+		shaders->RequestProgram(UMaterialFeatures(material) | featureOverrides);
+}
+
+///////////////////////////////////////////////////
+//	BeginFrame(int, int)
+//
+//	width: framebuffer width in pixels
+//	height: framebuffer height in pixels
+//
+//	Bind the framebuffer the frame is drawn into. With GPU culling the frame
+//	goes to an offscreen target whose depth feeds next frame's Hi-Z pyramid.
+///////////////////////////////////////////////////
+void Renderer::BeginFrame(int width, int height)
+{
+	if (gpuCulling && width > 0 && height > 0)
+	{
+		if (width != targetWidth || height != targetHeight)
+			UCreateTargets(width, height);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	}
+	else
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	glViewport(0, 0, width, height);
+}
+
+///////////////////////////////////////////////////
+//	BuildPacket(const Scene&, const glm::mat4&, const glm::mat4&, RenderPacket&)
+//
+//	scene: objects to draw
+//	view: camera view matrix
+//	projection: camera projection matrix
+//	packet: receives the frame's draw lists
+//
+//	Compute the frustum planes and fill the command, culling and batch
+//	lists of the objects in the frustum and not hidden by the CPU occlusion
+//	test, sorted by program variant and texture so each pair needs a single
+//	multi-draw call. The draw data of the objects the
+//	scene reports as changed is copied for upload. Makes no GL calls, so it
+//	can run on any thread (or job) while the scene is left unchanged. The
+//	per-draw records are filled in parallel with jobs. With measureTextures,
+//	the largest screen size of each textured batch is recorded too.
+///////////////////////////////////////////////////
+void Renderer::BuildPacket(const Scene &scene, const glm::mat4 &view, const glm::mat4 &projection, RenderPacket &packet) const
+{
+	const std::vector<SceneObject> &objects = scene.objects;
+
+	packet.view = view;
+	packet.projection = projection;
+
+	// Frustum planes from the rows of the view projection matrix
+	glm::mat4 viewProjection = projection * view;
+	for (int i = 0; i < 3; i++)
+	{
+		glm::vec4 row(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+		glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+		packet.frustumPlanes[i * 2] = w + row;
+		packet.frustumPlanes[i * 2 + 1] = w - row;
+	}
+	for (glm::vec4 &plane : packet.frustumPlanes)
+		plane /= glm::length(glm::vec3(plane));
+
+	// Sort keys are computed once per object, in the packet's scratch arena
+	struct SortKey
+	{
+		GLuint features;
+		GLuint textureId;
+		GLuint object;
+	};
+	packet.scratch.Reset();
+	packet.objectCount = (GLuint)objects.size();
+
+	// Only the objects in the frustum are drawn, found a subtree at a time
+	// in the scene's hierarchy; the GPU culls the survivors again, per object
+	std::uint32_t *visible = packet.scratch.Allocate<std::uint32_t>(objects.size());
+	size_t nVisible = objects.size();
+	if (scene.bvh.ObjectCount() == objects.size())
+		nVisible = scene.bvh.CullFrustum(packet.frustumPlanes, visible, jobs);
+	else
+		std::iota(visible, visible + objects.size(), 0);
+
+	// Then those hidden behind the largest boxes and cylinders in view
+	packet.occludedCount = 0;
+	if (cpuOcclusion)
+	{
+		size_t nUnoccluded = occlusion.Cull(objects.data(), viewProjection, visible, nVisible, packet.scratch, jobs);
+		packet.occludedCount = (GLuint)(nVisible - nUnoccluded);
+		nVisible = nUnoccluded;
+	}
+
+	SortKey *keys = packet.scratch.Allocate<SortKey>(nVisible);
+	for (size_t i = 0; i < nVisible; i++)
+	{
+		const SceneMaterial &material = objects[visible[i]].material;
+		keys[i] = { UMaterialFeatures(material) | featureOverrides, material.textureId, visible[i] };
+	}
+	std::sort(keys, keys + nVisible, [](const SortKey &a, const SortKey &b)
+	{
+		if (a.features != b.features)
+			return a.features < b.features;
+		if (a.textureId != b.textureId)
+			return a.textureId < b.textureId;
+		return a.object < b.object;
+	});
+
+	// The batches first: each is a run of equal variants and textures in the sorted order.
+	// The program of each variant is looked up when the packet is drawn.
+	std::vector<GLuint> &order = packet.order;
+	std::vector<DrawBatch> &batches = packet.batches;
+	order.resize(nVisible);
+	batches.clear();
+	for (GLuint drawIndex = 0; drawIndex < order.size(); drawIndex++)
+	{
+		const SortKey &key = keys[drawIndex];
+		order[drawIndex] = key.object;
+		if (batches.empty() || batches.back().features != key.features || batches.back().textureId != key.textureId)
+			batches.push_back({ key.features, key.textureId, drawIndex, 0 });
+		batches.back().commandCount++;
+	}
+
+	// The draw data of the changed objects, in the order of their ranges
+	const std::vector<SceneRange> &changed = scene.ChangedObjects();
+	packet.drawDataRanges.assign(changed.begin(), changed.end());
+	packet.drawData.clear();
+	for (const SceneRange &range : changed)
+	{
+		for (GLuint i = range.first; i < range.first + range.count; i++)
+		{
+			const SceneObject &object = objects[i];
+			const SceneMaterial &material = object.material;
+
+			DrawData data;
+			data.model = object.model;
+			data.normalMatrix[0] = glm::vec4(object.normalMatrix[0], 0.0f);
+			data.normalMatrix[1] = glm::vec4(object.normalMatrix[1], 0.0f);
+			data.normalMatrix[2] = glm::vec4(object.normalMatrix[2], 0.0f);
+			data.color = material.color;
+			data.material = glm::vec4(material.textureId != 0 ? 1.0f : 0.0f, material.specularIntensity, material.highlightSize, 0.0f);
+			packet.drawData.push_back(data);
+		}
+	}
+
+	// Then the per-draw records, which are independent of each other. The
+	// screen size of a sphere is its radius over its clip space w, scaled by
+	// the projection's vertical focal length.
+	packet.commands.resize(order.size());
+	packet.cullData.resize(order.size());
+	float *screenSizes = measureTextures ? packet.scratch.Allocate<float>(order.size()) : nullptr;
+	const glm::vec4 clipW(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+	const float focalLength = projection[1][1];
+	auto buildDraws = [&objects, &packet, screenSizes, clipW, focalLength](size_t begin, size_t end)
+	{
+		// Batch of the first draw of the range, advanced as the draws pass batch ends
+		GLuint batch = (GLuint)(std::upper_bound(packet.batches.begin(), packet.batches.end(), (GLuint)begin,
+			[](GLuint drawIndex, const DrawBatch &batch) { return drawIndex < batch.firstCommand; }) - packet.batches.begin()) - 1;
+
+		for (GLuint drawIndex = (GLuint)begin; drawIndex < end; drawIndex++)
+		{
+			GLuint objectIndex = packet.order[drawIndex];
+			const SceneObject &object = objects[objectIndex];
+			const Meshes::GLMesh &mesh = *object.mesh;
+			while (drawIndex >= packet.batches[batch].firstCommand + packet.batches[batch].commandCount)
+				batch++;
+
+			DrawElementsIndirectCommand &command = packet.commands[drawIndex];
+			command.count = mesh.nIndices;
+			command.instanceCount = 1;
+			command.firstIndex = mesh.firstIndex;
+			command.baseVertex = mesh.baseVertex;
+			command.baseInstance = objectIndex;	// The draw data stays at the object's index
+
+			CullData &cull = packet.cullData[drawIndex];
+			cull.sphere = object.bounds;
+			cull.batch = batch;
+			cull.firstCommand = packet.batches[batch].firstCommand;
+			cull.padding[0] = 0;
+			cull.padding[1] = 0;
+
+			if (screenSizes)
+			{
+				float w = glm::dot(clipW, glm::vec4(glm::vec3(object.bounds), 1.0f));
+				screenSizes[drawIndex] = object.bounds.w * focalLength / std::max(w, 1e-3f);
+			}
+		}
+	};
+
+	if (jobs)
+		jobs->ParallelFor(order.size(), DRAWS_PER_JOB, buildDraws);
+	else
+		buildDraws(0, order.size());
+
+	packet.textureCoverage.clear();
+	if (!screenSizes)
+		return;
+	for (const DrawBatch &batch : batches)
+	{
+		if (batch.textureId == 0)
+			continue;
+		const float *sizes = screenSizes + batch.firstCommand;
+		packet.textureCoverage.push_back({ batch.textureId, *std::max_element(sizes, sizes + batch.commandCount) });
+	}
+}
+
+///////////////////////////////////////////////////
+//	Draw(const RenderPacket&)
+//
+//	packet: draw lists built by BuildPacket()
+//
+//	Write the packet's commands and the changed objects' draw data to this
+//	frame's region of the stream buffer, copy the draw data to the objects'
+//	records, cull the commands on the GPU, then draw the survivors with one
+//	multi-draw call per program variant and texture. The transform and
+//	light uniforms of the variants must be set.
+///////////////////////////////////////////////////
+void Renderer::Draw(const RenderPacket &packet)
+{
+	viewProjection = packet.projection * packet.view;
+
+	const std::vector<DrawElementsIndirectCommand> &commands = packet.commands;
+	const std::vector<DrawData> &drawData = packet.drawData;
+	const std::vector<DrawBatch> &batches = packet.batches;
+
+	// Every object has a draw data record, drawn or not
+	UReserve(packet.objectCount);
+
+	// Copy this frame's commands and changed draw data straight into mapped
+	// memory; the region was last read REGION_COUNT frames ago
+	const GLsizeiptr commandBytes = sizeof(DrawElementsIndirectCommand) * commands.size();
+	const GLsizeiptr drawDataBytes = sizeof(DrawData) * drawData.size();
+	const GLsizeiptr cullDataBytes = sizeof(CullData) * packet.cullData.size();
+	streamBuffer.BeginRegion();
+	commandOffset = streamBuffer.Write(commands.data(), commandBytes, streamAlignment);
+	cullDataOffset = streamBuffer.Write(packet.cullData.data(), cullDataBytes, streamAlignment);
+
+	// Only the changed ranges reach the objects' records; a static scene copies nothing
+	if (!drawData.empty())
+	{
+		GLintptr drawDataOffset = streamBuffer.Write(drawData.data(), drawDataBytes, streamAlignment);
+		glBindBuffer(GL_COPY_READ_BUFFER, streamBuffer.buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, drawDataBuffer);
+		for (const SceneRange &range : packet.drawDataRanges)
+		{
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, drawDataOffset,
+				sizeof(DrawData) * range.first, sizeof(DrawData) * range.count);
+			drawDataOffset += sizeof(DrawData) * range.count;
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+
+	if (commands.empty())
+	{
+		streamBuffer.EndRegion();
+		return;
+	}
+
+	// Without culling every command is drawn straight from the input buffer
+	bool culled = gpuCulling && framebuffer != 0;
+	if (culled)
+	{
+		UCullDraws(packet);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	}
+	else
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, streamBuffer.buffer);
+	}
+	// Offset of the commands in the bound indirect buffer
+	GLintptr indirectOffset = culled ? 0 : commandOffset;
+
+	// With ARB_indirect_parameters the GPU written counts bound the draws;
+	// otherwise the zeroed unused commands of each batch draw nothing
+	bool drawCount = culled && GLEW_ARB_indirect_parameters;
+	if (drawCount)
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, drawCountBuffer);
+
+	glBindVertexArray(arenaVao);
+	glActiveTexture(GL_TEXTURE0);
+
+	GLuint programId = 0;
+	for (GLuint i = 0; i < batches.size(); i++)
+	{
+		const DrawBatch &batch = batches[i];
+		const void *firstCommand = (void*)(indirectOffset + sizeof(DrawElementsIndirectCommand) * batch.firstCommand);
+
+		// Variants that failed to build are skipped
+		GLuint batchProgramId = shaders->GetProgram(batch.features);
+		if (batchProgramId == 0)
+			continue;
+		if (batchProgramId != programId)
+		{
+			programId = batchProgramId;
+			glUseProgram(programId);
+		}
+
+		glBindTexture(GL_TEXTURE_2D, batch.textureId);
+		UGpuMemory().TouchTexture(batch.textureId);
+		if (drawCount)
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, firstCommand,
+				(GLintptr)(sizeof(GLuint) * i), batch.commandCount, 0);
+		else
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, firstCommand, batch.commandCount, 0);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	if (drawCount)
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+
+	// The region is written again once the GPU passes this fence
+	streamBuffer.EndRegion();
+}
+
+///////////////////////////////////////////////////
+//	Draw(const Scene&, const glm::mat4&, const glm::mat4&)
+//
+//	scene: objects to draw
+//	view: camera view matrix
+//	projection: camera projection matrix
+//
+//	Build a packet for the scene on this thread and draw it
+///////////////////////////////////////////////////
+void Renderer::Draw(const Scene &scene, const glm::mat4 &view, const glm::mat4 &projection)
+{
+	BuildPacket(scene, view, projection, packet);
+	Draw(packet);
+}
+
+///////////////////////////////////////////////////
+//	EndFrame()
+//
+//	Build the Hi-Z pyramid from the frame's depth and copy the offscreen
+//	color to the window. Everything culled against the pyramid must have
+//	been drawn before this call.
+///////////////////////////////////////////////////
+void Renderer::EndFrame()
+{
+	if (!gpuCulling || framebuffer == 0)
+	{
+		hiZValid = false;
+		return;
+	}
+
+	UBuildHiZ();
+	previousViewProjection = viewProjection;
+	hiZValid = true;
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, targetWidth, targetHeight, 0, 0, targetWidth, targetHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+///////////////////////////////////////////////////
+//	UReserve(GLuint)
+//
+//	nObjects: number of objects the buffers must hold, each drawn at most once
+//
+//	Grow the GPU buffers when the scene has more objects than they can hold.
+//	Growing the stream buffer waits for the GPU to finish every frame in
+//	flight, which only happens while the scene grows. The objects' draw
+//	data is copied to the larger buffer, since unchanged objects are not
+//	uploaded again.
+///////////////////////////////////////////////////
+void Renderer::UReserve(GLuint nObjects)
+{
+	if (nObjects <= capacity)
+		return;
+
+	GLuint previousCapacity = capacity;
+	capacity = std::max(nObjects, capacity * 2);
+
+	GLuint previousDrawData = drawDataBuffer;
+	glGenBuffers(1, &drawDataBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, drawDataBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(DrawData) * capacity, nullptr, GL_DYNAMIC_DRAW);
+	UGpuMemory().TrackBuffer(drawDataBuffer, sizeof(DrawData) * capacity, "draw data");
+	if (previousCapacity > 0)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, previousDrawData);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(DrawData) * previousCapacity);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		UGpuMemory().UntrackBuffer(previousDrawData);
+		glDeleteBuffers(1, &previousDrawData);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	// Room for the three arrays of a frame, each starting aligned
+	streamBuffer.Reserve((sizeof(DrawElementsIndirectCommand) + sizeof(DrawData) + sizeof(CullData)) * capacity + 3 * streamAlignment);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, indirectBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawElementsIndirectCommand) * capacity, nullptr, GL_DYNAMIC_COPY);
+	UGpuMemory().TrackBuffer(indirectBuffer, sizeof(DrawElementsIndirectCommand) * capacity, "indirect commands");
+	// There are never more batches than draws
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCountBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * capacity, nullptr, GL_DYNAMIC_COPY);
+	UGpuMemory().TrackBuffer(drawCountBuffer, sizeof(GLuint) * capacity, "batch draw counts");
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	std::vector<GLuint> drawIndices(capacity);
+	std::iota(drawIndices.begin(), drawIndices.end(), 0);
+	glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * capacity, drawIndices.data(), GL_STATIC_DRAW);
+	UGpuMemory().TrackBuffer(drawIndexBuffer, sizeof(GLuint) * capacity, "draw indices");
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+///////////////////////////////////////////////////
+//	UCreateTargets(int, int)
+//
+//	width: target width in pixels
+//	height: target height in pixels
+//
+//	(Re)create the offscreen framebuffer and the Hi-Z pyramid. The old
+//	pyramid no longer matches the screen, so occlusion culling pauses
+//	for one frame.
+///////////////////////////////////////////////////
+void Renderer::UCreateTargets(int width, int height)
+{
+	UDestroyTargets();
+
+	targetWidth = width;
+	targetHeight = height;
+	hiZLevels = 1 + (int)std::floor(std::log2((float)std::max(width, height)));
+	hiZValid = false;
+
+	glGenRenderbuffers(1, &colorRenderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	UGpuMemory().TrackRenderbuffer(colorRenderbuffer, GL_RGBA8, width, height, "offscreen color");
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenTextures(1, &depthTexture);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+	UGpuMemory().TrackTexture(depthTexture, GL_DEPTH_COMPONENT32F, width, height, 1, "offscreen depth");
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenTextures(1, &hiZTexture);
+	glBindTexture(GL_TEXTURE_2D, hiZTexture);
+	glTexStorage2D(GL_TEXTURE_2D, hiZLevels, GL_R32F, width, height);
+	UGpuMemory().TrackTexture(hiZTexture, GL_R32F, width, height, hiZLevels, "Hi-Z pyramid");
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRenderbuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Offscreen framebuffer is incomplete, GPU culling disabled" << std::endl;
+		gpuCulling = false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+///////////////////////////////////////////////////
+//	UDestroyTargets()
+//
+//	Release the offscreen framebuffer and the Hi-Z pyramid
+///////////////////////////////////////////////////
+void Renderer::UDestroyTargets()
+{
+	UGpuMemory().UntrackRenderbuffer(colorRenderbuffer);
+	UGpuMemory().UntrackTexture(depthTexture);
+	UGpuMemory().UntrackTexture(hiZTexture);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(1, &colorRenderbuffer);
+	glDeleteTextures(1, &depthTexture);
+	glDeleteTextures(1, &hiZTexture);
+	framebuffer = 0;
+	colorRenderbuffer = 0;
+	depthTexture = 0;
+	hiZTexture = 0;
+	targetWidth = 0;
+	targetHeight = 0;
+	hiZValid = false;
+}
+
+///////////////////////////////////////////////////
+//	UCullDraws(const RenderPacket&)
+//
+//	packet: draw lists being drawn
+//
+//	Run the culling compute shader: every command that survives the frustum
+//	and Hi-Z tests is appended to its batch in the indirect buffer, counted
+//	by an atomic counter per batch
+///////////////////////////////////////////////////
+void Renderer::UCullDraws(const RenderPacket &packet)
+{
+	const GLsizeiptr nDraws = (GLsizeiptr)packet.commands.size();
+
+	// Start every batch empty; commands past a batch's count stay zero
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, indirectBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCountBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// Draw() wrote the inputs to this frame's region of the stream buffer
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, INPUT_COMMAND_BINDING, streamBuffer.buffer, commandOffset, sizeof(DrawElementsIndirectCommand) * nDraws);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, CULL_DATA_BINDING, streamBuffer.buffer, cullDataOffset, sizeof(CullData) * nDraws);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OUTPUT_COMMAND_BINDING, indirectBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COUNT_BINDING, drawCountBuffer);
+
+	// The caller's program is restored once the culling is dispatched
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+	glUseProgram(cullProgramId);
+	glUniform1ui(drawCountLoc, (GLuint)packet.commands.size());
+	glUniform4fv(frustumPlanesLoc, 6, &packet.frustumPlanes[0][0]);
+	glUniform1i(occlusionLoc, hiZValid);
+	glUniformMatrix4fv(previousViewProjectionLoc, 1, GL_FALSE, &previousViewProjection[0][0]);
+	glUniform2f(hiZSizeLoc, (GLfloat)targetWidth, (GLfloat)targetHeight);
+	glUniform1i(hiZLevelsLoc, hiZLevels);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, hiZTexture);
+
+	glDispatchCompute((GLuint)(packet.commands.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	// The draws read the commands and counts the shader wrote
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(previousProgram);
+}
+
+///////////////////////////////////////////////////
+//	UBuildHiZ()
+//
+//	Copy the frame's depth to level 0 of the Hi-Z pyramid, then reduce each
+//	level to the next one keeping the farthest depth of every 2x2 block
+///////////////////////////////////////////////////
+void Renderer::UBuildHiZ()
+{
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+	glUseProgram(hiZProgramId);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+
+	int width = targetWidth;
+	int height = targetHeight;
+	for (int level = 0; level < hiZLevels; level++)
+	{
+		glUniform1i(copyDepthLoc, level == 0);
+		glBindImageTexture(0, hiZTexture, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+		glDispatchCompute((width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+		// The next level reads this one
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		width = std::max(width / 2, 1);
+		height = std::max(height / 2, 1);
+	}
+
+	// Next frame's culling samples the pyramid
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(previousProgram);
+}
@@ -0,0 +1,171 @@
+///////////////////////////////////////////////////////////////////////////////
+// renderer.h
+// ========
+// submit the scene with multi-draw-indirect: one indirect command per object,
+// per-object data in a shader storage buffer. A compute pass culls the commands
+// against the view frustum and a hierarchical-Z pyramid of last frame's depth.
+// The per-object data stays on the GPU; only the objects that changed are
+// uploaded again.
+// The draw lists are built into a render packet, which can be done on a
+// worker thread while the GL thread submits the previous packet. The
+// packet reaches the GPU through a persistent-mapped ring buffer.
+// Objects hidden behind the largest ones can be dropped on the CPU first,
+// with a software depth buffer of simplified occluders.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "allocators.h"
+#include "jobs.h"
+#include "meshes.h"
+#include "occlusion.h"
+#include "scene.h"
+#include "shaders.h"
+#include "streambuffer.h"
+
+class Renderer
+{
+	// Layout of one record in the indirect buffer, as defined by OpenGL
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count;			// Number of indices to draw
+		GLuint instanceCount;	// Number of instances (1)
+		GLuint firstIndex;		// First index in the arena index buffer
+		GLint baseVertex;		// First vertex in the arena vertex buffer
+		GLuint baseInstance;	// Index of the draw data of the command's object
+	};
+
+	// Per-object draw data read by the shaders (std430 layout)
+	struct DrawData
+	{
+		glm::mat4 model;		// Model matrix
+		glm::vec4 normalMatrix[3];	// Columns of the normal matrix (std430 mat3)
+		glm::vec4 color;		// Object color used when untextured
+		glm::vec4 material;		// x: has texture, y: specular intensity, z: highlight size
+	};
+
+	// Per-draw culling input read by the culling compute shader (std430 layout)
+	struct CullData
+	{
+		glm::vec4 sphere;		// World space bounding sphere: center, radius
+		GLuint batch;			// Batch the draw belongs to
+		GLuint firstCommand;	// First output command of that batch
+		GLuint padding[2];
+	};
+
+	// Consecutive commands sharing a program variant and a texture, issued
+	// with one multi-draw call
+	struct DrawBatch
+	{
+		GLuint features;		// Feature key of the program variant
+		GLuint textureId;
+		GLuint firstCommand;
+		GLuint commandCount;
+	};
+
+public:
+	// Largest size the objects of a textured batch take on screen
+	struct TextureCoverage
+	{
+		GLuint textureId;
+		float screenSize;		// Bounding sphere diameter of the largest, as a fraction of the viewport height
+	};
+
+	// Everything the GL thread needs to submit one frame. Built from the
+	// scene without touching GL, then only read until the next build.
+	struct RenderPacket
+	{
+		glm::mat4 view;
+		glm::mat4 projection;
+		glm::vec4 frustumPlanes[6];	// Normalized, pointing inside the frustum
+		GLuint objectCount = 0;		// Objects in the scene, drawn or not
+		GLuint occludedCount = 0;	// Objects in the frustum dropped by the CPU occlusion test
+		std::vector<GLuint> order;	// Scene objects sorted by program variant and texture
+		std::vector<DrawElementsIndirectCommand> commands;
+		std::vector<DrawData> drawData;			// Draw data of the changed objects, range after range
+		std::vector<SceneRange> drawDataRanges;	// Objects the draw data is copied to
+		std::vector<CullData> cullData;
+		std::vector<DrawBatch> batches;
+		std::vector<TextureCoverage> textureCoverage;	// One entry per textured batch, when measureTextures is set
+		FrameArena scratch;			// Transient data of the build, reset when the packet is rebuilt
+	};
+
+public:
+	// Per-object draw data is bound to this shader storage buffer binding point
+	static const GLuint DRAW_DATA_BINDING = 0;
+	// Vertex attribute carrying the index of the per-draw data
+	static const GLuint DRAW_INDEX_ATTRIBUTE = 4;
+
+	// Cull the draws on the GPU before submitting them
+	bool gpuCulling = true;
+	// Drop the objects hidden by the scene's largest boxes and cylinders on the CPU
+	bool cpuOcclusion = true;
+	// Measure the screen size of each textured batch's objects, for texture streaming
+	bool measureTextures = false;
+	// Shader features added to the variant of every material (benchmarks)
+	GLuint featureOverrides = 0;
+	// Jobs BuildPacket() spreads the per-draw records over, null to fill them on the calling thread
+	JobSystem *jobs = nullptr;
+
+public:
+	bool Create(Meshes &meshes, ShaderLibrary &shaders);
+	void Destroy();
+	void RequestPrograms(const Scene &scene);
+	void RequestPrograms(const std::vector<SceneMaterial> &materials);
+	void BeginFrame(int width, int height);
+	void BuildPacket(const Scene &scene, const glm::mat4 &view, const glm::mat4 &projection, RenderPacket &packet) const;
+	void Draw(const RenderPacket &packet);
+	void Draw(const Scene &scene, const glm::mat4 &view, const glm::mat4 &projection);
+	void EndFrame();
+
+private:
+	void UReserve(GLuint nObjects);
+	void UCreateTargets(int width, int height);
+	void UDestroyTargets();
+	void UCullDraws(const RenderPacket &packet);
+	void UBuildHiZ();
+
+	GLuint arenaVao = 0;			// VAO of the mesh arena the commands refer to
+	ShaderLibrary *shaders = nullptr;	// Phong program variants the materials are drawn with
+	StreamBuffer streamBuffer;		// Commands, CullData and changed DrawData of the frames in flight
+	GLint streamAlignment = 16;		// Alignment of each array in the stream buffer
+	GLintptr commandOffset = 0;		// Where this frame's arrays were written in the stream buffer
+	GLintptr cullDataOffset = 0;
+	GLuint indirectBuffer = 0;		// Commands that are drawn (the visible ones when culling)
+	GLuint drawCountBuffer = 0;		// Number of visible commands of each batch
+	GLuint drawDataBuffer = 0;		// DrawData records, one per scene object
+	GLuint drawIndexBuffer = 0;		// 0, 1, 2, ... read through baseInstance
+	GLuint capacity = 0;			// Number of objects the GPU buffers can hold
+	OcclusionCuller occlusion;		// Occluder shapes of the meshes, for the CPU occlusion test
+
+	// Offscreen target, so last frame's depth can be read back as a texture
+	GLuint framebuffer = 0;
+	GLuint colorRenderbuffer = 0;
+	GLuint depthTexture = 0;
+	GLuint hiZTexture = 0;			// Max depth pyramid (R32F, full mip chain)
+	int targetWidth = 0;
+	int targetHeight = 0;
+	int hiZLevels = 0;
+	bool hiZValid = false;			// The pyramid holds depth drawn with previousViewProjection
+
+	GLuint cullProgramId = 0;
+	GLuint hiZProgramId = 0;
+	// Uniform locations of the culling shaders, looked up once they link
+	GLint drawCountLoc = -1;
+	GLint frustumPlanesLoc = -1;
+	GLint occlusionLoc = -1;
+	GLint previousViewProjectionLoc = -1;
+	GLint hiZSizeLoc = -1;
+	GLint hiZLevelsLoc = -1;
+	GLint copyDepthLoc = -1;
+	glm::mat4 viewProjection;
+	glm::mat4 previousViewProjection;
+
+	RenderPacket packet;			// Built and drawn by Draw(const Scene&, ...)
+};
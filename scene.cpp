@@ -0,0 +1,159 @@
+///////////////////////////////////////////////////////////////////////////////
+// scene.cpp
+// ========
+// objects placed in the 3D scene, the materials they are drawn with and
+// the lights.
+// Each object follows a node of the scene's transform hierarchy; only the
+// objects whose node moved are updated, and reported as changed ranges.
+// A bounding volume hierarchy over the objects is refit as they move.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "scene.h"
+
+///////////////////////////////////////////////////
+//	AddObject(const Meshes::GLMesh&, const SceneMaterial&, std::uint32_t)
+//
+//	mesh: mesh drawn by the object
+//	material: surface parameters of the object
+//	transform: node of the transforms placing the object
+//
+//	Place an object at an existing node. It moves there, and is reported
+//	as changed, on the next UpdateTransforms().
+///////////////////////////////////////////////////
+void Scene::AddObject(const Meshes::GLMesh &mesh, const SceneMaterial &material, std::uint32_t transform)
+{
+	objects.push_back({ &mesh, material, glm::mat4(1.0f), glm::mat3(1.0f), glm::vec4(0.0f), transform });
+	ULink((std::uint32_t)objects.size() - 1);
+}
+
+///////////////////////////////////////////////////
+//	AddObject(const Meshes::GLMesh&, const SceneMaterial&, const glm::mat4&)
+//
+//	mesh: mesh drawn by the object
+//	material: surface parameters of the object
+//	model: world matrix, a product translation * rotation * scale
+//
+//	Place an object at a new root node taken apart from its model matrix
+///////////////////////////////////////////////////
+void Scene::AddObject(const Meshes::GLMesh &mesh, const SceneMaterial &material, const glm::mat4 &model)
+{
+	std::uint32_t transform = transforms.AddNode(model);
+	objects.push_back({ &mesh, material, model, UNormalMatrix(model), UWorldBounds(mesh, model), transform });
+	ULink((std::uint32_t)objects.size() - 1);
+}
+
+///////////////////////////////////////////////////
+//	Reserve(size_t, size_t)
+//
+//	nObjects: number of objects the scene will hold
+//	nNodes: number of transform nodes the scene will hold
+//
+//	Allocate room for a scene of that size up front
+///////////////////////////////////////////////////
+void Scene::Reserve(size_t nObjects, size_t nNodes)
+{
+	objects.reserve(nObjects);
+	nextObjects.reserve(nObjects);
+	addedObjects.reserve(nObjects);
+	nodeObjects.reserve(nNodes);
+	transforms.Reserve(nNodes);
+}
+
+///////////////////////////////////////////////////
+//	UpdateTransforms(JobSystem*)
+//
+//	jobs: job system the changed objects are spread over, may be null
+//
+//	Recompute the moved nodes, then the model matrix, normal matrix and
+//	bounds of the objects placed at them or added since the last call, and
+//	list those objects as ranges for ChangedObjects(). The hierarchy is
+//	refit around the changed objects, or rebuilt when objects were added.
+//	Call once per frame, before the frame's packet is built; a static scene
+//	costs nothing.
+///////////////////////////////////////////////////
+void Scene::UpdateTransforms(JobSystem *jobs)
+{
+	transforms.Update();
+
+	changedObjects.swap(addedObjects);
+	addedObjects.clear();
+	for (std::uint32_t node : transforms.Changed())
+	{
+		if (node >= nodeObjects.size())
+			break;
+		for (std::uint32_t object = nodeObjects[node]; object != NO_OBJECT; object = nextObjects[object])
+			changedObjects.push_back(object);
+	}
+
+	// Nodes are visited in order, but several objects can share one
+	if (!std::is_sorted(changedObjects.begin(), changedObjects.end()))
+		std::sort(changedObjects.begin(), changedObjects.end());
+	changedObjects.erase(std::unique(changedObjects.begin(), changedObjects.end()), changedObjects.end());
+
+	changedRanges.clear();
+	for (std::uint32_t i : changedObjects)
+	{
+		if (!changedRanges.empty() && changedRanges.back().first + changedRanges.back().count == i)
+			changedRanges.back().count++;
+		else
+			changedRanges.push_back({ i, 1 });
+	}
+
+	// Each object only reads its own node, so the objects can be split freely
+	auto updateObjects = [this](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			SceneObject &object = objects[changedObjects[i]];
+			object.model = transforms.World(object.transform);
+			object.normalMatrix = UNormalMatrix(object.model);
+			object.bounds = UWorldBounds(*object.mesh, object.model);
+		}
+	};
+	if (jobs && changedObjects.size() > OBJECTS_PER_JOB)
+		jobs->ParallelFor(changedObjects.size(), OBJECTS_PER_JOB, updateObjects);
+	else
+		updateObjects(0, changedObjects.size());
+	changedObjects.clear();
+
+	if (bvh.ObjectCount() != objects.size())
+		bvh.Build(objects.data(), objects.size());
+	else
+		bvh.Refit(objects.data(), changedRanges);
+}
+
+///////////////////////////////////////////////////
+//	Clear()
+//
+//	Remove every object, light and transform node
+///////////////////////////////////////////////////
+void Scene::Clear()
+{
+	objects.clear();
+	lights.clear();
+	transforms.Clear();
+	nodeObjects.clear();
+	nextObjects.clear();
+	addedObjects.clear();
+	changedRanges.clear();
+	bvh.Clear();
+}
+
+///////////////////////////////////////////////////
+//	ULink(std::uint32_t)
+//
+//	object: object just added
+//
+//	Add the object to its node's list and to the objects reported by the
+//	next UpdateTransforms()
+///////////////////////////////////////////////////
+void Scene::ULink(std::uint32_t object)
+{
+	std::uint32_t node = objects[object].transform;
+	if (node >= nodeObjects.size())
+		nodeObjects.resize(transforms.Size(), NO_OBJECT);
+
+	nextObjects.push_back(nodeObjects[node]);
+	nodeObjects[node] = object;
+	addedObjects.push_back(object);
+}
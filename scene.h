@@ -0,0 +1,135 @@
+///////////////////////////////////////////////////////////////////////////////
+// scene.h
+// ========
+// objects placed in the 3D scene, the materials they are drawn with and
+// the lights.
+// Each object follows a node of the scene's transform hierarchy; only the
+// objects whose node moved are updated, and reported as changed ranges.
+// A bounding volume hierarchy over the objects is refit as they move.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "bvh.h"
+#include "meshes.h"
+#include "transforms.h"
+
+// Surface parameters used by the Phong shader
+struct SceneMaterial
+{
+	GLuint textureId;			// Texture sampled by the object, 0 when untextured
+	glm::vec4 color;			// Object color used when untextured
+	float specularIntensity;	// Strength of the specular highlight
+	float highlightSize;		// Specular exponent
+};
+
+// A mesh from the mesh arena placed in the scene with a material
+struct SceneObject
+{
+	const Meshes::GLMesh *mesh;
+	SceneMaterial material;
+	glm::mat4 model;			// World matrix of the transform node, copied by UpdateTransforms()
+	glm::mat3 normalMatrix;		// Transforms the mesh normals to world space
+	glm::vec4 bounds;			// World space bounding sphere: center, radius
+	std::uint32_t transform;	// Node of the scene's transforms placing the object
+};
+
+// Point light of the scene; the shaders light with the two nearest the camera
+struct SceneLight
+{
+	glm::vec3 position;
+	glm::vec3 color;
+};
+
+// Consecutive objects of a scene
+struct SceneRange
+{
+	std::uint32_t first;
+	std::uint32_t count;
+};
+
+///////////////////////////////////////////////////
+//	UNormalMatrix(const glm::mat4&)
+//
+//	model: model matrix of an object
+//
+//	Return the matrix that transforms the object's normals to world space.
+//	A rotation with a uniform scale keeps normals perpendicular to the
+//	surface, so its upper 3x3 is used as is (the shaders normalize the
+//	result); any other transform needs the inverse transpose.
+///////////////////////////////////////////////////
+inline glm::mat3 UNormalMatrix(const glm::mat4 &model)
+{
+	glm::mat3 linear(model);
+
+	float xx = glm::dot(linear[0], linear[0]);
+	float yy = glm::dot(linear[1], linear[1]);
+	float zz = glm::dot(linear[2], linear[2]);
+	float tolerance = 1e-4f * std::max(xx, std::max(yy, zz));
+
+	bool uniformScale = std::abs(xx - yy) <= tolerance && std::abs(xx - zz) <= tolerance
+		&& std::abs(glm::dot(linear[0], linear[1])) <= tolerance
+		&& std::abs(glm::dot(linear[0], linear[2])) <= tolerance
+		&& std::abs(glm::dot(linear[1], linear[2])) <= tolerance;
+	if (uniformScale)
+		return linear;
+
+	return glm::transpose(glm::inverse(linear));
+}
+
+///////////////////////////////////////////////////
+//	UWorldBounds(const Meshes::GLMesh&, const glm::mat4&)
+//
+//	mesh: mesh whose bounding sphere to place
+//	model: model matrix of the object
+//
+//	Return the mesh's bounding sphere in world space, grown by the largest
+//	axis scale so it still encloses the mesh under non-uniform scale
+///////////////////////////////////////////////////
+inline glm::vec4 UWorldBounds(const Meshes::GLMesh &mesh, const glm::mat4 &model)
+{
+	float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+	return glm::vec4(glm::vec3(model * glm::vec4(mesh.boundsCenter, 1.0f)), mesh.boundsRadius * scale);
+}
+
+class Scene
+{
+public:
+	// No object is placed at a node
+	static constexpr std::uint32_t NO_OBJECT = 0xFFFFFFFFu;
+	// Changed objects updated by each job of UpdateTransforms()
+	static constexpr size_t OBJECTS_PER_JOB = 1024;
+
+public:
+	std::vector<SceneObject> objects;
+	std::vector<SceneLight> lights;
+	TransformSystem transforms;
+	Bvh bvh;			// Over the objects' bounds, valid after UpdateTransforms()
+
+public:
+	void AddObject(const Meshes::GLMesh &mesh, const SceneMaterial &material, std::uint32_t transform);
+	void AddObject(const Meshes::GLMesh &mesh, const SceneMaterial &material, const glm::mat4 &model);
+	void Reserve(size_t nObjects, size_t nNodes);
+	void UpdateTransforms(JobSystem *jobs = nullptr);
+	void Clear();
+
+	// Objects added or moved before the last UpdateTransforms(), in increasing order
+	const std::vector<SceneRange> &ChangedObjects() const { return changedRanges; }
+
+private:
+	void ULink(std::uint32_t object);
+
+	std::vector<std::uint32_t> nodeObjects;		// First object placed at each node, or NO_OBJECT
+	std::vector<std::uint32_t> nextObjects;		// Next object placed at the same node as each object
+	std::vector<std::uint32_t> addedObjects;	// Objects added since the last UpdateTransforms()
+	std::vector<std::uint32_t> changedObjects;	// Scratch list of UpdateTransforms()
+	std::vector<SceneRange> changedRanges;
+};
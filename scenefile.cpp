@@ -0,0 +1,965 @@
+///////////////////////////////////////////////////////////////////////////////
+// scenefile.cpp
+// ========
+// scene description files: the transform nodes, the objects placed at them
+// with their meshes and materials, and the lights, as readable text or as
+// a compact binary form of the same records. Both are read in fixed size
+// chunks, a record at a time, without allocating; the records go to a
+// handler that builds a scene or writes the other form.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "scenefile.h"
+
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+	// Chunk the files are read through; also the longest line of the text form
+	const size_t BUFFER_SIZE = 1 << 16;
+	// Longest texture name
+	const std::uint32_t MAX_NAME_LENGTH = 1024;
+
+	// Binary form: this header, then each texture name as a 32 bit length and
+	// its bytes, then the material, node, object and light records. Numbers
+	// are little-endian, as on every platform the program runs on.
+	const char BINARY_MAGIC[4] = { 'S', 'C', 'N', 'B' };
+	struct BinaryHeader
+	{
+		char magic[4];
+		std::uint32_t version;
+		SceneFileCounts counts;
+	};
+
+	// The meshes named by SCENE_FILE_MESHES, in the same order
+	const Meshes::GLMesh Meshes::*const MESH_MEMBERS[] =
+	{
+		&Meshes::gBoxMesh, &Meshes::gConeMesh, &Meshes::gCylinderMesh, &Meshes::gTaperedCylinderMesh, &Meshes::gPlaneMesh,
+		&Meshes::gPrismMesh, &Meshes::gSphereMesh, &Meshes::gPyramid3Mesh, &Meshes::gPyramid4Mesh, &Meshes::gTorusMesh
+	};
+	static_assert(sizeof(MESH_MEMBERS) / sizeof(MESH_MEMBERS[0]) == SCENE_FILE_MESH_COUNT, "a member for each mesh name");
+
+	// Checks each record against the header and the records before it, so
+	// handlers can use the indices without checking them again: a record
+	// only refers to records already read
+	class RecordChecker
+	{
+	public:
+		void Begin(const SceneFileCounts &counts)
+		{
+			expected[KIND_TEXTURE] = counts.textures;
+			expected[KIND_MATERIAL] = counts.materials;
+			expected[KIND_NODE] = counts.nodes;
+			expected[KIND_OBJECT] = counts.objects;
+			expected[KIND_LIGHT] = counts.lights;
+		}
+
+		// Each returns the problem with the record, nullptr for none
+		const char *Texture(std::string_view name)
+		{
+			if (name.empty() || name.size() > MAX_NAME_LENGTH)
+				return "texture name is empty or too long";
+			return UNext(KIND_TEXTURE);
+		}
+		const char *Material(const SceneFileMaterial &material)
+		{
+			if (material.texture != SCENE_FILE_NONE && material.texture >= seen[KIND_TEXTURE])
+				return "material's texture does not exist";
+			return UNext(KIND_MATERIAL);
+		}
+		const char *Node(const SceneFileNode &node)
+		{
+			if (node.parent != SCENE_FILE_NONE && node.parent >= seen[KIND_NODE])
+				return "node's parent is not an earlier node";
+			return UNext(KIND_NODE);
+		}
+		const char *Object(const SceneFileObject &object)
+		{
+			if (object.node >= seen[KIND_NODE])
+				return "object's node does not exist";
+			if (object.mesh >= SCENE_FILE_MESH_COUNT)
+				return "object's mesh does not exist";
+			if (object.material >= seen[KIND_MATERIAL])
+				return "object's material does not exist";
+			return UNext(KIND_OBJECT);
+		}
+		const char *Light()
+		{
+			return UNext(KIND_LIGHT);
+		}
+		const char *End() const
+		{
+			for (int kind = 0; kind < KIND_COUNT; kind++)
+			{
+				if (seen[kind] != expected[kind])
+					return "fewer records than the header counts";
+			}
+			return nullptr;
+		}
+
+	private:
+		enum Kind
+		{
+			KIND_TEXTURE,
+			KIND_MATERIAL,
+			KIND_NODE,
+			KIND_OBJECT,
+			KIND_LIGHT,
+			KIND_COUNT
+		};
+
+		const char *UNext(Kind kind)
+		{
+			if (seen[kind] == expected[kind])
+				return "more records of a kind than the header counts";
+			for (int later = kind + 1; later < KIND_COUNT; later++)
+			{
+				if (seen[later] != 0)
+					return "records out of order: textures, materials, nodes, objects, then lights";
+			}
+			seen[kind]++;
+			return nullptr;
+		}
+
+		std::uint32_t expected[KIND_COUNT] = {};
+		std::uint32_t seen[KIND_COUNT] = {};
+	};
+
+	// Powers of ten a double holds exactly
+	const double EXACT_POWERS_OF_10[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	///////////////////////////////////////////////////
+	//	UParseFloat(const char*, const char*, float&)
+	//
+	//	begin: first character of the number
+	//	end: end of the line
+	//	value: receives the number
+	//
+	//	Read a decimal number and return the character after it, nullptr if
+	//	there is none. With at most 15 digits and a power of ten up to 22, as
+	//	written by the text writer, the number is exact in double arithmetic
+	//	(Clinger's fast path) and only rounded once to float, several times
+	//	faster than std::from_chars, which takes the other cases.
+	///////////////////////////////////////////////////
+	const char *UParseFloat(const char *begin, const char *end, float &value)
+	{
+		const char *p = begin;
+		bool negative = p < end && *p == '-';
+		p += negative;
+
+		std::uint64_t mantissa = 0;
+		int digits = 0;
+		int exponent = 0;
+		for (; p < end && (unsigned)(*p - '0') < 10; p++, digits++)
+			mantissa = mantissa * 10 + (*p - '0');
+		if (p < end && *p == '.')
+		{
+			for (p++; p < end && (unsigned)(*p - '0') < 10; p++, digits++, exponent--)
+				mantissa = mantissa * 10 + (*p - '0');
+		}
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			p++;
+			bool negativeExponent = p < end && *p == '-';
+			p += p < end && (*p == '-' || *p == '+');
+			int power = 0;
+			const char *powerDigits = p;
+			for (; p < end && (unsigned)(*p - '0') < 10 && power < 10000; p++)
+				power = power * 10 + (*p - '0');
+			if (p == powerDigits)
+				digits = 0;
+			exponent += negativeExponent ? -power : power;
+		}
+
+		if (digits > 0 && digits <= 15 && exponent >= -22 && exponent <= 22)
+		{
+			double exact = exponent < 0 ? (double)mantissa / EXACT_POWERS_OF_10[-exponent] : (double)mantissa * EXACT_POWERS_OF_10[exponent];
+			// Unless the double lies exactly halfway between two floats, it
+			// rounds to the float nearest the decimal number
+			std::uint64_t bits;
+			std::memcpy(&bits, &exact, sizeof(bits));
+			if ((bits & 0x1FFFFFFF) != 0x10000000)
+			{
+				value = (float)(negative ? -exact : exact);
+				return p;
+			}
+		}
+
+		std::from_chars_result result = std::from_chars(begin, end, value);
+		return result.ec == std::errc() ? result.ptr : nullptr;
+	}
+
+	// Whitespace separated fields of a line of the text form, read in place
+	struct Fields
+	{
+		const char *next;
+		const char *end;
+
+		static bool USpace(char c)
+		{
+			return c == ' ' || c == '\t' || c == '\r';
+		}
+		void USkipSpaces()
+		{
+			while (next < end && USpace(*next))
+				next++;
+		}
+
+		std::string_view Word()
+		{
+			USkipSpaces();
+			const char *start = next;
+			while (next < end && !USpace(*next))
+				next++;
+			return std::string_view(start, next - start);
+		}
+		bool Floats(float *values, int count)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				USkipSpaces();
+				const char *after = UParseFloat(next, end, values[i]);
+				if (after == nullptr || after == next || (after < end && !USpace(*after)))
+					return false;
+				next = after;
+			}
+			return true;
+		}
+		// -1 reads as SCENE_FILE_NONE
+		bool Index(std::uint32_t &value)
+		{
+			std::string_view word = Word();
+			if (word == "-1")
+			{
+				value = SCENE_FILE_NONE;
+				return true;
+			}
+			std::from_chars_result result = std::from_chars(word.data(), word.data() + word.size(), value);
+			return !word.empty() && result.ec == std::errc() && result.ptr == word.data() + word.size() && value != SCENE_FILE_NONE;
+		}
+		bool AtEnd()
+		{
+			return Word().empty();
+		}
+	};
+
+	// Parses the text form a line at a time
+	class TextReader
+	{
+	public:
+		TextReader(const char *path, SceneFileHandler &handler) : path(path), handler(handler) {}
+
+		bool Line(const char *begin, const char *end)
+		{
+			lineNumber++;
+			if (const char *comment = (const char*)std::memchr(begin, '#', end - begin))
+				end = comment;
+
+			Fields fields = { begin, end };
+			std::string_view keyword = fields.Word();
+			if (keyword.empty())
+				return true;
+
+			if (!started)
+			{
+				SceneFileCounts counts;
+				std::uint32_t version;
+				if (keyword != "scene" || !fields.Index(version) || !fields.Index(counts.textures) || !fields.Index(counts.materials)
+					|| !fields.Index(counts.nodes) || !fields.Index(counts.objects) || !fields.Index(counts.lights) || !fields.AtEnd())
+					return UFail("expected the header: scene <version> <textures> <materials> <nodes> <objects> <lights>");
+				if (version != SCENE_FILE_VERSION)
+					return UFail("unsupported version");
+				started = true;
+				checker.Begin(counts);
+				return handler.Begin(counts);
+			}
+
+			if (keyword == "node")
+			{
+				SceneFileNode node;
+				if (!fields.Index(node.parent) || !fields.Floats(node.translation, 3) || !fields.Floats(node.rotation, 4)
+					|| !fields.Floats(node.scale, 3) || !fields.AtEnd())
+					return UFail("expected: node <parent|-1> <translation x y z> <rotation x y z w> <scale x y z>");
+				return UCheck(checker.Node(node)) && handler.Node(node);
+			}
+			if (keyword == "object")
+			{
+				SceneFileObject object;
+				std::string_view mesh;
+				if (!fields.Index(object.node) || (mesh = fields.Word()).empty() || !fields.Index(object.material) || !fields.AtEnd())
+					return UFail("expected: object <node> <mesh> <material>");
+				object.mesh = (std::uint32_t)(std::find(SCENE_FILE_MESHES, SCENE_FILE_MESHES + SCENE_FILE_MESH_COUNT, mesh) - SCENE_FILE_MESHES);
+				return UCheck(checker.Object(object)) && handler.Object(object);
+			}
+			if (keyword == "material")
+			{
+				SceneFileMaterial material;
+				if (!fields.Index(material.texture) || !fields.Floats(material.color, 4) || !fields.Floats(&material.specularIntensity, 1)
+					|| !fields.Floats(&material.highlightSize, 1) || !fields.AtEnd())
+					return UFail("expected: material <texture|-1> <r g b a> <specular intensity> <highlight size>");
+				return UCheck(checker.Material(material)) && handler.Material(material);
+			}
+			if (keyword == "texture")
+			{
+				std::string_view name = fields.Word();
+				if (name.empty() || !fields.AtEnd())
+					return UFail("expected: texture <name>");
+				return UCheck(checker.Texture(name)) && handler.Texture(name);
+			}
+			if (keyword == "light")
+			{
+				SceneFileLight light;
+				if (!fields.Floats(light.position, 3) || !fields.Floats(light.color, 3) || !fields.AtEnd())
+					return UFail("expected: light <position x y z> <color r g b>");
+				return UCheck(checker.Light()) && handler.Light(light);
+			}
+			return UFail("unknown record");
+		}
+
+		bool End()
+		{
+			if (!started)
+				return UFail("no header");
+			return UCheck(checker.End()) && handler.End();
+		}
+
+	private:
+		bool UFail(const char *message) const
+		{
+			std::cout << path << ":" << lineNumber << ": " << message << std::endl;
+			return false;
+		}
+		bool UCheck(const char *problem) const
+		{
+			return problem == nullptr || UFail(problem);
+		}
+
+		const char *path;
+		SceneFileHandler &handler;
+		RecordChecker checker;
+		size_t lineNumber = 0;
+		bool started = false;
+	};
+
+	///////////////////////////////////////////////////
+	//	UReadText(std::FILE*, const char*, SceneFileHandler&)
+	//
+	//	file: open file of the text form
+	//	path: file name for the error messages
+	//	handler: receives the records
+	//
+	//	Read the file a chunk at a time into a buffer on the stack, handing
+	//	each complete line to the parser; the partial line left at the end of
+	//	a chunk moves to the front of the buffer before the next read
+	///////////////////////////////////////////////////
+	bool UReadText(std::FILE *file, const char *path, SceneFileHandler &handler)
+	{
+		char buffer[BUFFER_SIZE];
+		TextReader reader(path, handler);
+
+		size_t filled = 0;
+		bool atEnd = false;
+		while (!atEnd)
+		{
+			size_t wanted = BUFFER_SIZE - filled;
+			size_t read = std::fread(buffer + filled, 1, wanted, file);
+			filled += read;
+			atEnd = read < wanted;
+
+			const char *line = buffer;
+			const char *end = buffer + filled;
+			while (line < end)
+			{
+				const char *newline = (const char*)std::memchr(line, '\n', end - line);
+				if (newline == nullptr && !atEnd)
+					break;
+				const char *lineEnd = newline != nullptr ? newline : end;
+				if (!reader.Line(line, lineEnd))
+					return false;
+				line = lineEnd + (newline != nullptr ? 1 : 0);
+			}
+
+			filled = end - line;
+			if (filled == BUFFER_SIZE)
+			{
+				std::cout << path << ": line longer than " << BUFFER_SIZE << " bytes" << std::endl;
+				return false;
+			}
+			std::memmove(buffer, line, filled);
+		}
+		if (std::ferror(file))
+		{
+			std::cout << path << ": read error" << std::endl;
+			return false;
+		}
+		return reader.End();
+	}
+
+	///////////////////////////////////////////////////
+	//	UReadRecords(std::FILE*, const char*, std::uint32_t, unsigned char*, Visit)
+	//
+	//	file: open file, at the first record
+	//	path: file name for the error messages
+	//	count: number of records to read
+	//	buffer: BUFFER_SIZE bytes the records are read through
+	//	visit: called with each record, stops the read by returning false
+	//
+	//	Read an array of records of the binary form, as many per chunk as fit
+	///////////////////////////////////////////////////
+	template <typename Record, typename Visit>
+	bool UReadRecords(std::FILE *file, const char *path, std::uint32_t count, unsigned char *buffer, Visit visit)
+	{
+		const size_t perChunk = BUFFER_SIZE / sizeof(Record);
+		while (count > 0)
+		{
+			size_t n = std::min((size_t)count, perChunk);
+			if (std::fread(buffer, sizeof(Record), n, file) != n)
+			{
+				std::cout << path << ": file ends before its last record" << std::endl;
+				return false;
+			}
+			for (size_t i = 0; i < n; i++)
+			{
+				Record record;
+				std::memcpy(&record, buffer + i * sizeof(Record), sizeof(Record));
+				if (!visit(record))
+					return false;
+			}
+			count -= (std::uint32_t)n;
+		}
+		return true;
+	}
+
+	///////////////////////////////////////////////////
+	//	UReadBinary(std::FILE*, const char*, SceneFileHandler&)
+	//
+	//	file: open file of the binary form, after its magic bytes
+	//	path: file name for the error messages
+	//	handler: receives the records
+	//
+	//	Read the header, check the file is long enough for its counts, then
+	//	read each array of records in chunks, checking the records as the
+	//	text form's are
+	///////////////////////////////////////////////////
+	bool UReadBinary(std::FILE *file, const char *path, SceneFileHandler &handler)
+	{
+		alignas(16) unsigned char buffer[BUFFER_SIZE];
+		RecordChecker checker;
+		auto check = [path](const char *problem)
+		{
+			if (problem != nullptr)
+				std::cout << path << ": " << problem << std::endl;
+			return problem == nullptr;
+		};
+
+		BinaryHeader header;
+		std::memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+		if (std::fread(&header.version, sizeof(header) - sizeof(header.magic), 1, file) != 1)
+			return check("file ends inside its header");
+		if (header.version != SCENE_FILE_VERSION)
+			return check("unsupported version");
+
+		// The counts are untrusted: the rest of the file must have room for
+		// that many records before the handler sizes anything by them
+		long start = std::ftell(file);
+		if (start < 0 || std::fseek(file, 0, SEEK_END) != 0)
+			return check("cannot find the file's size");
+		long size = std::ftell(file);
+		if (size < start || std::fseek(file, start, SEEK_SET) != 0)
+			return check("cannot find the file's size");
+		const SceneFileCounts &counts = header.counts;
+		std::uint64_t needed = (std::uint64_t)counts.textures * sizeof(std::uint32_t)
+			+ (std::uint64_t)counts.materials * sizeof(SceneFileMaterial) + (std::uint64_t)counts.nodes * sizeof(SceneFileNode)
+			+ (std::uint64_t)counts.objects * sizeof(SceneFileObject) + (std::uint64_t)counts.lights * sizeof(SceneFileLight);
+		if (needed > (std::uint64_t)(size - start))
+			return check("file is shorter than the records its header counts");
+
+		checker.Begin(header.counts);
+		if (!handler.Begin(header.counts))
+			return false;
+
+		for (std::uint32_t i = 0; i < header.counts.textures; i++)
+		{
+			std::uint32_t length;
+			if (std::fread(&length, sizeof(length), 1, file) != 1 || length > MAX_NAME_LENGTH
+				|| std::fread(buffer, 1, length, file) != length)
+				return check("texture name is cut short or too long");
+			std::string_view name((const char*)buffer, length);
+			if (!check(checker.Texture(name)) || !handler.Texture(name))
+				return false;
+		}
+
+		return UReadRecords<SceneFileMaterial>(file, path, header.counts.materials, buffer,
+				[&](const SceneFileMaterial &material) { return check(checker.Material(material)) && handler.Material(material); })
+			&& UReadRecords<SceneFileNode>(file, path, header.counts.nodes, buffer,
+				[&](const SceneFileNode &node) { return check(checker.Node(node)) && handler.Node(node); })
+			&& UReadRecords<SceneFileObject>(file, path, header.counts.objects, buffer,
+				[&](const SceneFileObject &object) { return check(checker.Object(object)) && handler.Object(object); })
+			&& UReadRecords<SceneFileLight>(file, path, header.counts.lights, buffer,
+				[&](const SceneFileLight &light) { return check(checker.Light()) && handler.Light(light); })
+			&& check(checker.End()) && handler.End();
+	}
+
+	// Writes the records as the text form
+	class TextWriter : public SceneFileHandler
+	{
+	public:
+		explicit TextWriter(std::FILE *file) : file(file) {}
+
+		bool Begin(const SceneFileCounts &counts) override
+		{
+			return std::fprintf(file,
+				"# material <texture|-1> <r g b a> <specular intensity> <highlight size>\n"
+				"# node <parent|-1> <translation x y z> <rotation x y z w> <scale x y z>\n"
+				"# object <node> <mesh> <material>\n"
+				"# light <position x y z> <color r g b>\n"
+				"scene %u %u %u %u %u %u\n",
+				(unsigned)SCENE_FILE_VERSION, (unsigned)counts.textures, (unsigned)counts.materials,
+				(unsigned)counts.nodes, (unsigned)counts.objects, (unsigned)counts.lights) > 0;
+		}
+		bool Texture(std::string_view name) override
+		{
+			return std::fprintf(file, "texture %.*s\n", (int)name.size(), name.data()) > 0;
+		}
+		bool Material(const SceneFileMaterial &material) override
+		{
+			UStart("material");
+			UIndex(material.texture);
+			UFloats(material.color, 4);
+			UFloats(&material.specularIntensity, 1);
+			UFloats(&material.highlightSize, 1);
+			return UFinish();
+		}
+		bool Node(const SceneFileNode &node) override
+		{
+			UStart("node");
+			UIndex(node.parent);
+			UFloats(node.translation, 3);
+			UFloats(node.rotation, 4);
+			UFloats(node.scale, 3);
+			return UFinish();
+		}
+		bool Object(const SceneFileObject &object) override
+		{
+			UStart("object");
+			UIndex(object.node);
+			UWord(SCENE_FILE_MESHES[object.mesh]);
+			UIndex(object.material);
+			return UFinish();
+		}
+		bool Light(const SceneFileLight &light) override
+		{
+			UStart("light");
+			UFloats(light.position, 3);
+			UFloats(light.color, 3);
+			return UFinish();
+		}
+
+	private:
+		// A line is assembled in place; the longest holds 11 numbers of at most 15 characters
+		void UStart(const char *keyword)
+		{
+			length = std::strlen(keyword);
+			std::memcpy(line, keyword, length);
+		}
+		void UWord(const char *word)
+		{
+			line[length++] = ' ';
+			size_t wordLength = std::strlen(word);
+			std::memcpy(line + length, word, wordLength);
+			length += wordLength;
+		}
+		void UIndex(std::uint32_t value)
+		{
+			if (value == SCENE_FILE_NONE)
+				return UWord("-1");
+			line[length++] = ' ';
+			length = std::to_chars(line + length, line + sizeof(line), value).ptr - line;
+		}
+		// Shortest digits that read back as the same float
+		void UFloats(const float *values, int count)
+		{
+			for (int i = 0; i < count; i++)
+			{
+				line[length++] = ' ';
+				length = std::to_chars(line + length, line + sizeof(line), values[i]).ptr - line;
+			}
+		}
+		bool UFinish()
+		{
+			line[length++] = '\n';
+			return std::fwrite(line, 1, length, file) == length;
+		}
+
+		std::FILE *file;
+		char line[256];
+		size_t length = 0;
+	};
+
+	// Writes the records as the binary form
+	class BinaryWriter : public SceneFileHandler
+	{
+	public:
+		explicit BinaryWriter(std::FILE *file) : file(file) {}
+
+		bool Begin(const SceneFileCounts &counts) override
+		{
+			BinaryHeader header;
+			std::memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+			header.version = SCENE_FILE_VERSION;
+			header.counts = counts;
+			return UWrite(header);
+		}
+		bool Texture(std::string_view name) override
+		{
+			std::uint32_t length = (std::uint32_t)name.size();
+			return UWrite(length) && std::fwrite(name.data(), 1, length, file) == length;
+		}
+		bool Material(const SceneFileMaterial &material) override { return UWrite(material); }
+		bool Node(const SceneFileNode &node) override { return UWrite(node); }
+		bool Object(const SceneFileObject &object) override { return UWrite(object); }
+		bool Light(const SceneFileLight &light) override { return UWrite(light); }
+
+	private:
+		template <typename T> bool UWrite(const T &value) { return std::fwrite(&value, sizeof(T), 1, file) == 1; }
+
+		std::FILE *file;
+	};
+
+	// Places the records in a scene, resolving the names through the bindings
+	class SceneBuilder : public SceneFileHandler
+	{
+	public:
+		SceneBuilder(const char *path, Scene &scene, const SceneFileBindings &bindings) : path(path), scene(scene), bindings(bindings) {}
+
+		bool Begin(const SceneFileCounts &counts) override
+		{
+			scene.Clear();
+			scene.Reserve(std::min(counts.objects, SCENE_FILE_MAX_RESERVE), std::min(counts.nodes, SCENE_FILE_MAX_RESERVE));
+			scene.lights.reserve(std::min(counts.lights, SCENE_FILE_MAX_RESERVE));
+			textures.reserve(std::min(counts.textures, SCENE_FILE_MAX_RESERVE));
+			materials.reserve(std::min(counts.materials, SCENE_FILE_MAX_RESERVE));
+			return true;
+		}
+		bool Texture(std::string_view name) override
+		{
+			const char *const *names = bindings.textureNames;
+			size_t found = std::find(names, names + bindings.nTextures, name) - names;
+			if (found == bindings.nTextures)
+				std::cout << path << ": no texture named " << name << ", its materials are untextured" << std::endl;
+			textures.push_back(found < bindings.nTextures ? bindings.textures[found] : 0);
+			return true;
+		}
+		bool Material(const SceneFileMaterial &material) override
+		{
+			const float *color = material.color;
+			materials.push_back({ material.texture != SCENE_FILE_NONE ? textures[material.texture] : 0,
+				glm::vec4(color[0], color[1], color[2], color[3]), material.specularIntensity, material.highlightSize });
+			return true;
+		}
+		bool Node(const SceneFileNode &node) override
+		{
+			const float *t = node.translation;
+			const float *r = node.rotation;
+			const float *s = node.scale;
+			scene.transforms.AddNode(glm::vec3(t[0], t[1], t[2]), glm::quat(r[3], r[0], r[1], r[2]), glm::vec3(s[0], s[1], s[2]),
+				node.parent != SCENE_FILE_NONE ? node.parent : TransformSystem::NO_PARENT);
+			return true;
+		}
+		bool Object(const SceneFileObject &object) override
+		{
+			scene.AddObject(USceneFileMesh(*bindings.meshes, object.mesh), materials[object.material], object.node);
+			return true;
+		}
+		bool Light(const SceneFileLight &light) override
+		{
+			const float *p = light.position;
+			const float *c = light.color;
+			scene.lights.push_back({ glm::vec3(p[0], p[1], p[2]), glm::vec3(c[0], c[1], c[2]) });
+			return true;
+		}
+
+	private:
+		const char *path;
+		Scene &scene;
+		const SceneFileBindings &bindings;
+		std::vector<GLuint> textures;		// Texture of each texture record, 0 when its name is unknown
+		std::vector<SceneMaterial> materials;
+	};
+
+	// Orders materials so equal ones can be found in a map
+	struct MaterialLess
+	{
+		bool operator()(const SceneMaterial &a, const SceneMaterial &b) const
+		{
+			return std::tie(a.textureId, a.color.x, a.color.y, a.color.z, a.color.w, a.specularIntensity, a.highlightSize)
+				< std::tie(b.textureId, b.color.x, b.color.y, b.color.z, b.color.w, b.specularIntensity, b.highlightSize);
+		}
+	};
+
+	///////////////////////////////////////////////////
+	//	UOpenSceneFile(const char*, bool&)
+	//
+	//	path: file to read
+	//	binary: receives whether the file has the binary form
+	//
+	//	Open a scene file for reading, past the magic bytes of the binary
+	//	form or at the start of the text form; nullptr when it cannot be opened
+	///////////////////////////////////////////////////
+	std::FILE *UOpenSceneFile(const char *path, bool &binary)
+	{
+		std::FILE *file = std::fopen(path, "rb");
+		if (file == nullptr)
+		{
+			std::cout << "Failed to open scene file " << path << std::endl;
+			return nullptr;
+		}
+		// The chunks are read straight into the parsers' buffers
+		std::setvbuf(file, nullptr, _IONBF, 0);
+
+		char magic[sizeof(BINARY_MAGIC)];
+		binary = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) && std::memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0;
+		if (!binary)
+			std::rewind(file);
+		return file;
+	}
+
+	///////////////////////////////////////////////////
+	//	UCloseWritten(std::FILE*, const char*, bool)
+	//
+	//	file: file written
+	//	path: its name
+	//	complete: every record was handed to the writer
+	//
+	//	Close a file being written, deleting it when it was left incomplete
+	//	or could not be written
+	///////////////////////////////////////////////////
+	bool UCloseWritten(std::FILE *file, const char *path, bool complete)
+	{
+		bool failed = std::ferror(file) != 0;
+		failed = std::fclose(file) != 0 || failed;
+		if (failed)
+			std::cout << "Failed to write scene file " << path << std::endl;
+		if (failed || !complete)
+			std::remove(path);
+		return complete && !failed;
+	}
+}
+
+///////////////////////////////////////////////////
+//	UReadSceneFile(const char*, SceneFileHandler&)
+//
+//	path: scene file, in either form
+//	handler: receives the records
+//
+//	Read a scene file a record at a time, telling the forms apart by the
+//	binary form's magic bytes. Problems are printed with their line in the
+//	text form; returns false for them or when the handler stops the read.
+///////////////////////////////////////////////////
+bool UReadSceneFile(const char *path, SceneFileHandler &handler)
+{
+	bool binary;
+	std::FILE *file = UOpenSceneFile(path, binary);
+	if (file == nullptr)
+		return false;
+
+	bool read = binary ? UReadBinary(file, path, handler) : UReadText(file, path, handler);
+	std::fclose(file);
+	return read;
+}
+
+///////////////////////////////////////////////////
+//	USceneFileMesh(const Meshes&, std::uint32_t)
+//
+//	meshes: the program's meshes
+//	mesh: index of a name in SCENE_FILE_MESHES
+//
+//	Return the mesh a file's mesh index refers to
+///////////////////////////////////////////////////
+const Meshes::GLMesh &USceneFileMesh(const Meshes &meshes, std::uint32_t mesh)
+{
+	return meshes.*MESH_MEMBERS[mesh];
+}
+
+///////////////////////////////////////////////////
+//	UWriteSceneRecords(const Scene&, const SceneFileBindings&, SceneFileHandler&)
+//
+//	scene: scene to describe
+//	bindings: names of the meshes and textures
+//	handler: receives the records
+//
+//	Hand a scene to a handler as records: every bound texture, the
+//	distinct materials of the objects, every node, the objects and the
+//	lights. Returns false for a mesh that has no name.
+///////////////////////////////////////////////////
+bool UWriteSceneRecords(const Scene &scene, const SceneFileBindings &bindings, SceneFileHandler &handler)
+{
+	std::map<SceneMaterial, std::uint32_t, MaterialLess> materialIndices;
+	std::vector<const SceneMaterial*> materials;
+	std::vector<std::uint32_t> objectMaterials;
+	objectMaterials.reserve(scene.objects.size());
+	for (const SceneObject &object : scene.objects)
+	{
+		auto inserted = materialIndices.emplace(object.material, (std::uint32_t)materials.size());
+		if (inserted.second)
+			materials.push_back(&inserted.first->first);
+		objectMaterials.push_back(inserted.first->second);
+	}
+
+	SceneFileCounts counts;
+	counts.textures = (std::uint32_t)bindings.nTextures;
+	counts.materials = (std::uint32_t)materials.size();
+	counts.nodes = (std::uint32_t)scene.transforms.Size();
+	counts.objects = (std::uint32_t)scene.objects.size();
+	counts.lights = (std::uint32_t)scene.lights.size();
+	if (!handler.Begin(counts))
+		return false;
+
+	for (size_t i = 0; i < bindings.nTextures; i++)
+	{
+		if (!handler.Texture(bindings.textureNames[i]))
+			return false;
+	}
+
+	for (const SceneMaterial *material : materials)
+	{
+		SceneFileMaterial record;
+		size_t texture = std::find(bindings.textures, bindings.textures + bindings.nTextures, material->textureId) - bindings.textures;
+		record.texture = material->textureId != 0 && texture < bindings.nTextures ? (std::uint32_t)texture : SCENE_FILE_NONE;
+		std::memcpy(record.color, &material->color[0], sizeof(record.color));
+		record.specularIntensity = material->specularIntensity;
+		record.highlightSize = material->highlightSize;
+		if (!handler.Material(record))
+			return false;
+	}
+
+	for (std::uint32_t node = 0; node < counts.nodes; node++)
+	{
+		glm::vec3 translation, scale;
+		glm::quat rotation;
+		scene.transforms.GetLocal(node, translation, rotation, scale);
+
+		SceneFileNode record;
+		std::uint32_t parent = scene.transforms.Parent(node);
+		record.parent = parent != TransformSystem::NO_PARENT ? parent : SCENE_FILE_NONE;
+		std::memcpy(record.translation, &translation[0], sizeof(record.translation));
+		const float rotationXyzw[4] = { rotation.x, rotation.y, rotation.z, rotation.w };
+		std::memcpy(record.rotation, rotationXyzw, sizeof(record.rotation));
+		std::memcpy(record.scale, &scale[0], sizeof(record.scale));
+		if (!handler.Node(record))
+			return false;
+	}
+
+	for (size_t i = 0; i < scene.objects.size(); i++)
+	{
+		const SceneObject &object = scene.objects[i];
+		SceneFileObject record;
+		record.node = object.transform;
+		record.mesh = 0;
+		while (record.mesh < SCENE_FILE_MESH_COUNT && &(bindings.meshes->*MESH_MEMBERS[record.mesh]) != object.mesh)
+			record.mesh++;
+		if (record.mesh == SCENE_FILE_MESH_COUNT)
+		{
+			std::cout << "Object " << i << " is drawn with a mesh scene files cannot name" << std::endl;
+			return false;
+		}
+		record.material = objectMaterials[i];
+		if (!handler.Object(record))
+			return false;
+	}
+
+	for (const SceneLight &light : scene.lights)
+	{
+		SceneFileLight record;
+		std::memcpy(record.position, &light.position[0], sizeof(record.position));
+		std::memcpy(record.color, &light.color[0], sizeof(record.color));
+		if (!handler.Light(record))
+			return false;
+	}
+	return handler.End();
+}
+
+///////////////////////////////////////////////////
+//	ULoadSceneFile(const char*, Scene&, const SceneFileBindings&)
+//
+//	path: scene file, in either form
+//	scene: receives the nodes, objects and lights, replacing its contents
+//	bindings: meshes and textures the names refer to
+//
+//	Load a scene from a file. A texture with no binding leaves its
+//	materials untextured; any other problem fails the load, and the scene
+//	is then left partly filled.
+///////////////////////////////////////////////////
+bool ULoadSceneFile(const char *path, Scene &scene, const SceneFileBindings &bindings)
+{
+	SceneBuilder builder(path, scene, bindings);
+	return UReadSceneFile(path, builder);
+}
+
+///////////////////////////////////////////////////
+//	USaveSceneFile(const char*, const Scene&, const SceneFileBindings&, bool)
+//
+//	path: file to write
+//	scene: scene to describe
+//	bindings: names of the meshes and textures
+//	binary: write the binary form rather than the text form
+//
+//	Write a scene to a file. Objects sharing a material value share its
+//	record. Nothing is left at the path on failure.
+///////////////////////////////////////////////////
+bool USaveSceneFile(const char *path, const Scene &scene, const SceneFileBindings &bindings, bool binary)
+{
+	std::FILE *file = std::fopen(path, "wb");
+	if (file == nullptr)
+	{
+		std::cout << "Failed to create scene file " << path << std::endl;
+		return false;
+	}
+
+	TextWriter textWriter(file);
+	BinaryWriter binaryWriter(file);
+	bool written = UWriteSceneRecords(scene, bindings, binary ? (SceneFileHandler&)binaryWriter : textWriter);
+	return UCloseWritten(file, path, written);
+}
+
+///////////////////////////////////////////////////
+//	UConvertSceneFile(const char*, const char*)
+//
+//	inputPath: scene file, in either form
+//	outputPath: file to write in the other form
+//
+//	Convert a text scene file to the binary form, or a binary one back to
+//	text, a record at a time; no scene is built, so it needs no GL context
+///////////////////////////////////////////////////
+bool UConvertSceneFile(const char *inputPath, const char *outputPath)
+{
+	bool binary;
+	std::FILE *input = UOpenSceneFile(inputPath, binary);
+	if (input == nullptr)
+		return false;
+	std::FILE *output = std::fopen(outputPath, "wb");
+	if (output == nullptr)
+	{
+		std::cout << "Failed to create scene file " << outputPath << std::endl;
+		std::fclose(input);
+		return false;
+	}
+
+	TextWriter textWriter(output);
+	BinaryWriter binaryWriter(output);
+	bool converted = binary ? UReadBinary(input, inputPath, textWriter) : UReadText(input, inputPath, binaryWriter);
+	std::fclose(input);
+	return UCloseWritten(output, outputPath, converted);
+}
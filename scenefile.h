@@ -0,0 +1,118 @@
+///////////////////////////////////////////////////////////////////////////////
+// scenefile.h
+// ========
+// scene description files: the transform nodes, the objects placed at them
+// with their meshes and materials, and the lights, as readable text or as
+// a compact binary form of the same records. Both are read in fixed size
+// chunks, a record at a time, without allocating; the records go to a
+// handler that builds a scene or writes the other form.
+//
+// Text form, one record per line, '#' starting a comment:
+//	scene <version> <textures> <materials> <nodes> <objects> <lights>
+//	texture <name>
+//	material <texture|-1> <r g b a> <specular intensity> <highlight size>
+//	node <parent|-1> <translation x y z> <rotation x y z w> <scale x y z>
+//	object <node> <mesh> <material>
+//	light <position x y z> <color r g b>
+// The header line comes first, then the records grouped in that order, as
+// many of each as the header counts. Textures, materials and nodes are
+// numbered from 0 in the order they appear, and a node's parent is always
+// an earlier node. Meshes are named as in SCENE_FILE_MESHES.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <string_view>
+
+#include "meshes.h"
+#include "scene.h"
+
+// Version written to, and expected in, the files
+const std::uint32_t SCENE_FILE_VERSION = 1;
+// A record's texture or parent is none
+const std::uint32_t SCENE_FILE_NONE = 0xFFFFFFFFu;
+// Names of the meshes in the files, in the order of their indices in the binary form
+const char *const SCENE_FILE_MESHES[] =
+{
+	"box", "cone", "cylinder", "tapered_cylinder", "plane", "prism", "sphere", "pyramid3", "pyramid4", "torus"
+};
+const std::uint32_t SCENE_FILE_MESH_COUNT = sizeof(SCENE_FILE_MESHES) / sizeof(SCENE_FILE_MESHES[0]);
+// Records of a kind a handler reserves room for in Begin(); the header's
+// counts are only proven by the records read, so past this arrays grow
+const std::uint32_t SCENE_FILE_MAX_RESERVE = 1 << 16;
+
+// Number of records of each kind, from the header
+struct SceneFileCounts
+{
+	std::uint32_t textures;
+	std::uint32_t materials;
+	std::uint32_t nodes;
+	std::uint32_t objects;
+	std::uint32_t lights;
+};
+
+// Records of a file; the binary form stores them as they are laid out here
+struct SceneFileMaterial
+{
+	std::uint32_t texture;		// Index of the texture, SCENE_FILE_NONE when untextured
+	float color[4];
+	float specularIntensity;
+	float highlightSize;
+};
+
+struct SceneFileNode
+{
+	std::uint32_t parent;		// Index of an earlier node, SCENE_FILE_NONE for the world
+	float translation[3];
+	float rotation[4];			// Quaternion x, y, z, w
+	float scale[3];
+};
+
+struct SceneFileObject
+{
+	std::uint32_t node;
+	std::uint32_t mesh;			// Index into SCENE_FILE_MESHES
+	std::uint32_t material;
+};
+
+struct SceneFileLight
+{
+	float position[3];
+	float color[3];
+};
+
+// Receives the records of a file in order, already checked against the
+// header and each other: each index refers to a record received before.
+// Returning false stops the read, as a failure.
+class SceneFileHandler
+{
+public:
+	virtual ~SceneFileHandler() = default;
+
+	virtual bool Begin(const SceneFileCounts &counts) = 0;
+	virtual bool Texture(std::string_view name) = 0;
+	virtual bool Material(const SceneFileMaterial &material) = 0;
+	virtual bool Node(const SceneFileNode &node) = 0;
+	virtual bool Object(const SceneFileObject &object) = 0;
+	virtual bool Light(const SceneFileLight &light) = 0;
+	virtual bool End() { return true; }
+};
+
+// What the names of a file refer to in the program
+struct SceneFileBindings
+{
+	const Meshes *meshes;
+	const char *const *textureNames;	// Name the files give each texture
+	const GLuint *textures;				// Texture of each name
+	size_t nTextures;
+};
+
+const Meshes::GLMesh &USceneFileMesh(const Meshes &meshes, std::uint32_t mesh);
+bool UReadSceneFile(const char *path, SceneFileHandler &handler);
+bool UWriteSceneRecords(const Scene &scene, const SceneFileBindings &bindings, SceneFileHandler &handler);
+bool ULoadSceneFile(const char *path, Scene &scene, const SceneFileBindings &bindings);
+bool USaveSceneFile(const char *path, const Scene &scene, const SceneFileBindings &bindings, bool binary);
+bool UConvertSceneFile(const char *inputPath, const char *outputPath);
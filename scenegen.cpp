@@ -0,0 +1,172 @@
+///////////////////////////////////////////////////////////////////////////////
+// scenegen.cpp
+// ========
+// procedural scenes for testing at scale: groups of primitives spread over
+// a square of ground, like furniture with things on it, with materials and
+// lights drawn from a fixed pool. The same settings and seed always give
+// the same scene, on any compiler.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "scenegen.h"
+
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <vector>
+
+namespace
+{
+	const float TWO_PI = 6.2831853f;
+
+	// SplitMix64: the standard library's distributions may differ between
+	// implementations, so the numbers are made here to keep scenes identical
+	class Random
+	{
+	public:
+		explicit Random(std::uint64_t seed) : state(seed) {}
+
+		std::uint64_t Next()
+		{
+			std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
+		}
+		// Uniform in [0, 1)
+		float Float() { return (float)(Next() >> 40) * (1.0f / 16777216.0f); }
+		float Range(float low, float high) { return low + (high - low) * Float(); }
+		size_t Index(size_t count) { return (size_t)(Next() % count); }
+		// Components drawn in order: the order function arguments are evaluated in is unspecified
+		glm::vec3 Vector(float low, float high)
+		{
+			float x = Range(low, high);
+			float y = Range(low, high);
+			float z = Range(low, high);
+			return glm::vec3(x, y, z);
+		}
+		// Point on the ground in a square of the given side around the origin
+		glm::vec3 Ground(float side)
+		{
+			float x = Range(-0.5f, 0.5f) * side;
+			float z = Range(-0.5f, 0.5f) * side;
+			return glm::vec3(x, 0.0f, z);
+		}
+
+	private:
+		std::uint64_t state;
+	};
+
+	// Primitive placed by the generator, with how often it is picked
+	struct MeshChoice
+	{
+		const Meshes::GLMesh *mesh;
+		float weight;
+	};
+}
+
+///////////////////////////////////////////////////
+//	Generate(Scene&, const Meshes&, const GLuint*, size_t)
+//
+//	scene: receives the objects and lights, replacing its contents
+//	meshes: meshes the objects are drawn with
+//	textures: textures the materials may sample
+//	nTextures: number of textures
+//
+//	Fill the scene: a ground plane under groups of 1 to maxGroupSize
+//	objects, each group a parent node turned and placed at random over a
+//	square sized for the density, each object a child node sitting on the
+//	ground inside its group. Materials are skewed so a few are used by most
+//	objects, as in real content. Lights hang above the ground.
+///////////////////////////////////////////////////
+void SceneGenerator::Generate(Scene &scene, const Meshes &meshes, const GLuint *textures, size_t nTextures) const
+{
+	Random random(seed);
+
+	// The material pool
+	std::vector<SceneMaterial> materials(std::max(materialCount, (size_t)1));
+	for (SceneMaterial &material : materials)
+	{
+		bool textured = nTextures > 0 && random.Float() < texturedFraction;
+		material.textureId = textured ? textures[random.Index(nTextures)] : 0;
+		material.color = glm::vec4(random.Vector(0.2f, 1.0f), 1.0f);
+		material.specularIntensity = random.Range(0.0f, 1.0f);
+		material.highlightSize = std::pow(2.0f, random.Range(1.0f, 7.0f));
+	}
+
+	const MeshChoice choices[] =
+	{
+		{ &meshes.gBoxMesh, 4.0f },
+		{ &meshes.gCylinderMesh, 3.0f },
+		{ &meshes.gSphereMesh, 2.0f },
+		{ &meshes.gTorusMesh, 1.0f },
+		{ &meshes.gPyramid3Mesh, 1.0f },
+		{ &meshes.gPyramid4Mesh, 1.0f },
+		{ &meshes.gConeMesh, 1.0f },
+		{ &meshes.gPrismMesh, 1.0f },
+		{ &meshes.gTaperedCylinderMesh, 1.0f },
+	};
+	float totalWeight = 0.0f;
+	for (const MeshChoice &choice : choices)
+		totalWeight += choice.weight;
+
+	scene.Clear();
+	if (objectCount == 0)
+		return;
+	// A node per object, plus one per group of (maxGroupSize + 1) / 2 objects on average
+	scene.Reserve(objectCount, objectCount + 2 * objectCount / (std::max(maxGroupSize, (size_t)1) + 1) + 1);
+
+	// The ground, one material for all of it
+	const float side = std::sqrt(objectCount / std::max(density, 1e-6f));
+	const Meshes::GLMesh &plane = meshes.gPlaneMesh;
+	glm::vec2 planeSize(plane.boundsMax.x - plane.boundsMin.x, plane.boundsMax.z - plane.boundsMin.z);
+	std::uint32_t ground = scene.transforms.AddNode(glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+		glm::vec3(side / std::max(planeSize.x, 1e-6f), 1.0f, side / std::max(planeSize.y, 1e-6f)));
+	scene.AddObject(plane, materials[0], ground);
+
+	size_t placed = 1;
+	while (placed < objectCount)
+	{
+		size_t groupSize = std::min(1 + random.Index(std::max(maxGroupSize, (size_t)1)), objectCount - placed);
+		float groupRadius = 1.5f * std::sqrt((float)groupSize);
+		glm::vec3 groupPosition = random.Ground(side);
+		glm::quat groupRotation = glm::angleAxis(random.Range(0.0f, TWO_PI), glm::vec3(0.0f, 1.0f, 0.0f));
+		std::uint32_t group = scene.transforms.AddNode(groupPosition, groupRotation, glm::vec3(1.0f));
+
+		for (size_t i = 0; i < groupSize; i++)
+		{
+			float pick = random.Range(0.0f, totalWeight);
+			const MeshChoice *choice = choices;
+			while (pick >= choice->weight && choice + 1 < std::end(choices))
+				pick -= (choice++)->weight;
+			const Meshes::GLMesh &mesh = *choice->mesh;
+
+			// Squared so the first materials of the pool are the most common
+			float materialPick = random.Float();
+			const SceneMaterial &material = materials[(size_t)(materialPick * materialPick * materials.size())];
+
+			float size = random.Range(0.2f, 1.2f);
+			glm::vec3 scale = size * random.Vector(0.7f, 1.3f);
+			float angle = random.Range(0.0f, TWO_PI);
+			float distance = groupRadius * std::sqrt(random.Float());
+			// Resting on the ground: the mesh's lowest point at y = 0
+			glm::vec3 position(std::cos(angle) * distance, -mesh.boundsMin.y * scale.y, std::sin(angle) * distance);
+			glm::quat rotation = glm::angleAxis(random.Range(0.0f, TWO_PI), glm::vec3(0.0f, 1.0f, 0.0f));
+
+			scene.AddObject(mesh, material, scene.transforms.AddNode(position, rotation, scale, group));
+		}
+		placed += groupSize;
+	}
+
+	// Warm to cool lights between 4 and 10 units above the ground
+	for (size_t i = 0; i < lightCount; i++)
+	{
+		SceneLight light;
+		light.position = random.Ground(side);
+		light.position.y = random.Range(4.0f, 10.0f);
+		float warmth = random.Float();
+		light.color = glm::mix(glm::vec3(0.6f, 0.7f, 1.0f), glm::vec3(1.0f, 0.9f, 0.5f), warmth);
+		scene.lights.push_back(light);
+	}
+}
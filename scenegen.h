@@ -0,0 +1,32 @@
+///////////////////////////////////////////////////////////////////////////////
+// scenegen.h
+// ========
+// procedural scenes for testing at scale: groups of primitives spread over
+// a square of ground, like furniture with things on it, with materials and
+// lights drawn from a fixed pool. The same settings and seed always give
+// the same scene, on any compiler.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstdint>
+
+#include "meshes.h"
+#include "scene.h"
+
+class SceneGenerator
+{
+public:
+	std::uint64_t seed = 1;
+	size_t objectCount = 1000;		// Objects placed, the ground included
+	size_t materialCount = 32;		// Materials the objects share; a few are used far more than the rest
+	float texturedFraction = 0.5f;	// Share of the materials that sample a texture
+	size_t lightCount = 2;
+	float density = 0.05f;			// Objects per square unit of ground
+	size_t maxGroupSize = 12;		// Most objects under one parent node
+
+public:
+	void Generate(Scene &scene, const Meshes &meshes, const GLuint *textures, size_t nTextures) const;
+};
@@ -0,0 +1,609 @@
+///////////////////////////////////////////////////////////////////////////////
+// scenestream.cpp
+// ========
+// streaming of large scenes: the scene is split once into square cells of
+// the ground plane, each holding the subtrees of the transform hierarchy
+// whose root stands in it, and the cells are written to a temporary file.
+// Cells near the camera are read back by background jobs and placed in the
+// scene; cells the camera left stay cached until the memory budget needs
+// room. Objects too large for one cell, and the lights, are always resident.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "scenestream.h"
+
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+	// Memory of a resident node: its transform components, parent, world
+	// matrix and flags, plus the record kept to place it again
+	const size_t BYTES_PER_NODE = 10 * sizeof(float) + 2 * sizeof(std::uint32_t) + sizeof(glm::mat4) + 1 + sizeof(SceneFileNode);
+	// Memory of a resident object: the scene's copy and lists, plus its record
+	const size_t BYTES_PER_OBJECT = sizeof(SceneObject) + 3 * sizeof(std::uint32_t) + sizeof(SceneFileObject)
+		+ SceneStreamer::GPU_BYTES_PER_OBJECT;
+
+	// Keeps the records of a scene file, resolving the materials' textures
+	class SourceReader : public SceneFileHandler
+	{
+	public:
+		SourceReader(const SceneFileBindings &bindings, SceneStreamer::Source &source) : bindings(bindings), source(source) {}
+
+		bool Begin(const SceneFileCounts &counts) override
+		{
+			source.materials.reserve(std::min(counts.materials, SCENE_FILE_MAX_RESERVE));
+			source.nodes.reserve(std::min(counts.nodes, SCENE_FILE_MAX_RESERVE));
+			source.objects.reserve(std::min(counts.objects, SCENE_FILE_MAX_RESERVE));
+			source.lights.reserve(std::min(counts.lights, SCENE_FILE_MAX_RESERVE));
+			return true;
+		}
+		bool Texture(std::string_view name) override
+		{
+			const char *const *names = bindings.textureNames;
+			size_t found = std::find(names, names + bindings.nTextures, name) - names;
+			textures.push_back(found < bindings.nTextures ? bindings.textures[found] : 0);
+			return true;
+		}
+		bool Material(const SceneFileMaterial &material) override
+		{
+			const float *color = material.color;
+			source.materials.push_back({ material.texture != SCENE_FILE_NONE ? textures[material.texture] : 0,
+				glm::vec4(color[0], color[1], color[2], color[3]), material.specularIntensity, material.highlightSize });
+			return true;
+		}
+		bool Node(const SceneFileNode &node) override
+		{
+			source.nodes.push_back(node);
+			return true;
+		}
+		bool Object(const SceneFileObject &object) override
+		{
+			source.objects.push_back(object);
+			return true;
+		}
+		bool Light(const SceneFileLight &light) override
+		{
+			const float *p = light.position;
+			const float *c = light.color;
+			source.lights.push_back({ glm::vec3(p[0], p[1], p[2]), glm::vec3(c[0], c[1], c[2]) });
+			return true;
+		}
+
+	private:
+		const SceneFileBindings &bindings;
+		SceneStreamer::Source &source;
+		std::vector<GLuint> textures;
+	};
+
+	// Files of scenes with a million objects outgrow the 32 bit offsets of fseek() on Windows
+	int USeek(std::FILE *file, long long offset)
+	{
+#ifdef _WIN32
+		return _fseeki64(file, offset, SEEK_SET);
+#else
+		return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+	}
+
+	double UMilliseconds(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+SceneStreamer::~SceneStreamer()
+{
+	Stop();
+	if (file)
+		std::fclose(file);
+}
+
+///////////////////////////////////////////////////
+//	Partition(const char*, const SceneFileBindings&)
+//
+//	path: scene file, in either form
+//	bindings: meshes and textures the file's names refer to
+//
+//	Split the scene of a file into cells without placing it in a scene,
+//	so a scene too large to be resident can be streamed
+///////////////////////////////////////////////////
+bool SceneStreamer::Partition(const char *path, const SceneFileBindings &bindings)
+{
+	meshes = bindings.meshes;
+	Source source;
+	SourceReader reader(bindings, source);
+	return UReadSceneFile(path, reader) && UPartition(source);
+}
+
+///////////////////////////////////////////////////
+//	Partition(const Scene&, const SceneFileBindings&)
+//
+//	scene: scene to split, which can then be cleared
+//	bindings: names of its meshes and textures
+//
+//	Split a scene already placed, a generated one for instance, into cells
+///////////////////////////////////////////////////
+bool SceneStreamer::Partition(const Scene &scene, const SceneFileBindings &bindings)
+{
+	meshes = bindings.meshes;
+	Source source;
+	SourceReader reader(bindings, source);
+	return UWriteSceneRecords(scene, bindings, reader) && UPartition(source);
+}
+
+///////////////////////////////////////////////////
+//	UPartition(Source&)
+//
+//	source: records of the scene, emptied
+//
+//	Give each root node a cell from its position on the ground plane, or
+//	the always resident cell when one of its subtree's objects is wider
+//	than half a cell; descendants follow their root. The records of each
+//	grid cell are renumbered within the cell and written to a temporary
+//	file, those of the always resident cell are kept.
+///////////////////////////////////////////////////
+bool SceneStreamer::UPartition(Source &source)
+{
+	Stop();
+	cells.clear();
+	wanted.clear();
+	resident.clear();
+	residentBytes = 0;
+	chosen = false;
+	if (file)
+		std::fclose(file);
+	file = std::tmpfile();
+	if (file == nullptr)
+	{
+		std::cout << "Failed to create the temporary file of the scene cells" << std::endl;
+		return false;
+	}
+
+	const std::vector<SceneFileNode> &nodes = source.nodes;
+	const std::vector<SceneFileObject> &objects = source.objects;
+	materials.swap(source.materials);
+	lights.swap(source.lights);
+
+	// World matrices, to size the objects, and the root of every node
+	std::vector<glm::mat4> world(nodes.size());
+	std::vector<std::uint32_t> roots(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		const SceneFileNode &node = nodes[i];
+		const float *t = node.translation;
+		const float *r = node.rotation;
+		const float *s = node.scale;
+		glm::mat4 local = glm::translate(glm::vec3(t[0], t[1], t[2]))
+			* glm::mat4_cast(glm::normalize(glm::quat(r[3], r[0], r[1], r[2]))) * glm::scale(glm::vec3(s[0], s[1], s[2]));
+		bool root = node.parent == SCENE_FILE_NONE;
+		world[i] = root ? local : world[node.parent] * local;
+		roots[i] = root ? (std::uint32_t)i : roots[node.parent];
+	}
+
+	std::vector<std::uint8_t> alwaysResident(nodes.size(), 0);
+	for (const SceneFileObject &object : objects)
+	{
+		if (UWorldBounds(USceneFileMesh(*meshes, object.mesh), world[object.node]).w > 0.5f * cellSize)
+			alwaysResident[roots[object.node]] = 1;
+	}
+	world = std::vector<glm::mat4>();
+
+	// The grid spans the streamed roots
+	int minX = 0, minZ = 0, maxX = -1, maxZ = -1;
+	auto cellCoordinate = [this](float position) { return (int)std::floor(position / cellSize); };
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		if (roots[i] != i || alwaysResident[i])
+			continue;
+		int x = cellCoordinate(nodes[i].translation[0]);
+		int z = cellCoordinate(nodes[i].translation[2]);
+		bool first = maxX < minX;
+		minX = first ? x : std::min(minX, x);
+		maxX = first ? x : std::max(maxX, x);
+		minZ = first ? z : std::min(minZ, z);
+		maxZ = first ? z : std::max(maxZ, z);
+	}
+	if ((long long)(maxX - minX + 1) * (maxZ - minZ + 1) > (long long)MAX_CELLS)
+	{
+		std::cout << "The scene spreads over more than " << MAX_CELLS << " cells of " << cellSize << " units" << std::endl;
+		return false;
+	}
+	gridX = minX;
+	gridZ = minZ;
+	gridWidth = maxX - minX + 1;
+	gridDepth = maxZ - minZ + 1;
+	const std::uint32_t globalCell = (std::uint32_t)(gridWidth * gridDepth);
+	cells = std::vector<Cell>(globalCell + 1);
+
+	// Cell of each node and its index there
+	std::vector<std::uint32_t> nodeCells(nodes.size());
+	std::vector<std::uint32_t> cellIndices(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		std::uint32_t root = roots[i];
+		std::uint32_t cell = globalCell;
+		if (!alwaysResident[root])
+			cell = (std::uint32_t)((cellCoordinate(nodes[root].translation[2]) - gridZ) * gridWidth + cellCoordinate(nodes[root].translation[0]) - gridX);
+		nodeCells[i] = cell;
+		cellIndices[i] = cells[cell].nodeCount++;
+	}
+	for (const SceneFileObject &object : objects)
+		cells[nodeCells[object.node]].objectCount++;
+
+	// Records grouped by cell, renumbered within it
+	std::vector<size_t> firstNodes(cells.size() + 1, 0);
+	std::vector<size_t> firstObjects(cells.size() + 1, 0);
+	for (size_t cell = 0; cell < cells.size(); cell++)
+	{
+		firstNodes[cell + 1] = firstNodes[cell] + cells[cell].nodeCount;
+		firstObjects[cell + 1] = firstObjects[cell] + cells[cell].objectCount;
+	}
+	std::vector<SceneFileNode> cellNodes(nodes.size());
+	std::vector<SceneFileObject> cellObjects(objects.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		SceneFileNode node = nodes[i];
+		if (node.parent != SCENE_FILE_NONE)
+			node.parent = cellIndices[node.parent];
+		cellNodes[firstNodes[nodeCells[i]] + cellIndices[i]] = node;
+	}
+	std::vector<size_t> placedObjects(firstObjects.begin(), firstObjects.end() - 1);
+	for (const SceneFileObject &object : objects)
+	{
+		std::uint32_t cell = nodeCells[object.node];
+		SceneFileObject record = object;
+		record.node = cellIndices[object.node];
+		cellObjects[placedObjects[cell]++] = record;
+	}
+
+	// The grid cells go to the file, the always resident cell stays
+	long long offset = 0;
+	for (size_t i = 0; i < cells.size(); i++)
+	{
+		Cell &cell = cells[i];
+		cell.bytes = cell.nodeCount * BYTES_PER_NODE + cell.objectCount * BYTES_PER_OBJECT;
+		if (i == globalCell)
+		{
+			cell.nodes.assign(cellNodes.begin() + firstNodes[i], cellNodes.begin() + firstNodes[i + 1]);
+			cell.objects.assign(cellObjects.begin() + firstObjects[i], cellObjects.begin() + firstObjects[i + 1]);
+			cell.state = CELL_LOADED;
+			continue;
+		}
+
+		cell.offset = offset;
+		if (std::fwrite(cellNodes.data() + firstNodes[i], sizeof(SceneFileNode), cell.nodeCount, file) != cell.nodeCount
+			|| std::fwrite(cellObjects.data() + firstObjects[i], sizeof(SceneFileObject), cell.objectCount, file) != cell.objectCount)
+		{
+			std::cout << "Failed to write the temporary file of the scene cells" << std::endl;
+			return false;
+		}
+		offset += cell.nodeCount * (long long)sizeof(SceneFileNode) + cell.objectCount * (long long)sizeof(SceneFileObject);
+	}
+	std::fflush(file);
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	Begin(Scene&)
+//
+//	scene: receives the always resident objects and the lights, replacing
+//		its contents
+//
+//	Start streaming into a scene; Update() then adds the cells around the
+//	camera
+///////////////////////////////////////////////////
+void SceneStreamer::Begin(Scene &scene)
+{
+	scene.Clear();
+	if (cells.empty())
+		return;
+
+	Cell &global = cells.back();
+	global.state = CELL_RESIDENT;
+	residentBytes = global.bytes;
+	scene.lights = lights;
+	UPlace(scene, global);
+}
+
+///////////////////////////////////////////////////
+//	Update(Scene&, const glm::vec3&, JobSystem&)
+//
+//	scene: scene the cells are placed in, started by Begin()
+//	position: camera position
+//	jobs: runs the loads as background jobs
+//
+//	Call once per frame, before the scene's transforms are updated. When
+//	the camera enters another cell, choose the cells to keep: those within
+//	loadRadius, nearest first, while they fit in the budget. Start loading
+//	the nearest missing ones, and place the cells whose records arrived.
+//	A cell placed when the budget is full evicts the farthest cells no
+//	longer wanted, which rebuilds the scene from the resident cells.
+//	Returns true when the scene was rebuilt, so its object indices changed.
+///////////////////////////////////////////////////
+bool SceneStreamer::Update(Scene &scene, const glm::vec3 &position, JobSystem &jobs)
+{
+	if (cells.empty())
+		return false;
+	this->jobs = &jobs;
+
+	int cellX = (int)std::floor(position.x / cellSize);
+	int cellZ = (int)std::floor(position.z / cellSize);
+	if (!chosen || cellX != cameraCellX || cellZ != cameraCellZ)
+	{
+		cameraCellX = cellX;
+		cameraCellZ = cellZ;
+		chosen = true;
+		UChooseCells(position);
+	}
+
+	for (std::uint32_t i : wanted)
+	{
+		if (loadCount == MAX_LOADS)
+			break;
+		Cell &cell = cells[i];
+		if (cell.state == CELL_UNLOADED)
+		{
+			cell.state = CELL_LOADING;
+			loadCount++;
+			jobs.RunBackground([this, &cell]() { ULoad(cell); }, &cell.loading);
+		}
+	}
+
+	// Loads that finished: place the cells still wanted, nearest first
+	bool rebuild = false;
+	size_t placedBegin = resident.size();
+	const size_t globalCell = cells.size() - 1;
+	for (size_t i = 0; i < globalCell; i++)
+	{
+		Cell &cell = cells[i];
+		if (cell.state != CELL_LOADING || !cell.loading.Done())
+			continue;
+		loadCount--;
+		cell.state = CELL_LOADED;
+		if (cell.readFailed)
+		{
+			std::cout << "Failed to read scene cell (" << gridX + (int)i % gridWidth << ", " << gridZ + (int)i / gridWidth << ")" << std::endl;
+			UDrop(cell);
+			cell.state = CELL_FAILED;
+		}
+		else if (!cell.wanted)
+		{
+			UDrop(cell);
+		}
+	}
+	for (std::uint32_t i : wanted)
+	{
+		Cell &cell = cells[i];
+		if (cell.state != CELL_LOADED)
+			continue;
+
+		// Room is made by evicting the farthest cells the camera left, down
+		// to a quarter under the budget so the next cells fit without
+		// rebuilding the scene again
+		size_t limit = residentBytes + cell.bytes > budgetBytes ? budgetBytes / 4 * 3 : budgetBytes;
+		while (residentBytes + cell.bytes > limit)
+		{
+			size_t farthest = resident.size();
+			float farthestDistance = -1.0f;
+			for (size_t r = 0; r < placedBegin; r++)
+			{
+				float distance = UDistance(resident[r], position);
+				if (!cells[resident[r]].wanted && distance > farthestDistance)
+				{
+					farthest = r;
+					farthestDistance = distance;
+				}
+			}
+			if (farthest == resident.size())
+				break;
+
+			std::uint32_t evicted = resident[farthest];
+			if (report)
+				std::cout << "Evicted scene cell (" << gridX + (int)evicted % gridWidth << ", " << gridZ + (int)evicted / gridWidth << ")" << std::endl;
+			residentBytes -= cells[evicted].bytes;
+			UDrop(cells[evicted]);
+			resident.erase(resident.begin() + farthest);
+			placedBegin--;
+			rebuild = true;
+		}
+
+		cell.state = CELL_RESIDENT;
+		residentBytes += cell.bytes;
+		resident.push_back(i);
+	}
+
+	if (rebuild)
+	{
+		scene.Clear();
+		scene.lights = lights;
+		UPlace(scene, cells.back());
+		for (size_t r = 0; r < placedBegin; r++)
+			UPlace(scene, cells[resident[r]]);
+	}
+	for (size_t r = placedBegin; r < resident.size(); r++)
+	{
+		const Cell &cell = cells[resident[r]];
+		auto start = std::chrono::steady_clock::now();
+		UPlace(scene, cell);
+		if (report)
+		{
+			Stats stats = GetStats();
+			std::cout << "Scene cell (" << gridX + (int)resident[r] % gridWidth << ", " << gridZ + (int)resident[r] / gridWidth << "): "
+				<< cell.objectCount << " objects read in " << cell.readMs << " ms, placed in " << UMilliseconds(start) << " ms; resident: "
+				<< stats.residentCells << " cells, " << stats.residentObjects << " objects, " << (stats.residentBytes >> 20)
+				<< " of " << (budgetBytes >> 20) << " MB" << std::endl;
+		}
+	}
+	return rebuild;
+}
+
+///////////////////////////////////////////////////
+//	Stop()
+//
+//	Wait for the loads in flight; call before the job system stops
+///////////////////////////////////////////////////
+void SceneStreamer::Stop()
+{
+	for (Cell &cell : cells)
+	{
+		if (cell.state != CELL_LOADING)
+			continue;
+		if (jobs)
+			jobs->Wait(cell.loading);
+		loadCount--;
+		UDrop(cell);
+	}
+}
+
+///////////////////////////////////////////////////
+//	GetStats() const
+//
+//	Return the number of cells, resident and loading, and the objects and
+//	estimated memory of the resident set
+///////////////////////////////////////////////////
+SceneStreamer::Stats SceneStreamer::GetStats() const
+{
+	Stats stats = {};
+	if (cells.empty())
+		return stats;
+
+	stats.residentObjects = cells.back().objectCount;
+	for (size_t i = 0; i + 1 < cells.size(); i++)
+	{
+		const Cell &cell = cells[i];
+		stats.cells += cell.objectCount > 0;
+		stats.loadingCells += cell.state == CELL_LOADING;
+		if (cell.state == CELL_RESIDENT)
+		{
+			stats.residentCells++;
+			stats.residentObjects += cell.objectCount;
+		}
+	}
+	stats.residentBytes = residentBytes;
+	return stats;
+}
+
+///////////////////////////////////////////////////
+//	ULoad(Cell&)
+//
+//	cell: cell to read, in CELL_LOADING
+//
+//	Read a cell's records from the file; runs as a background job, so
+//	the GL thread never waits on the file
+///////////////////////////////////////////////////
+void SceneStreamer::ULoad(Cell &cell)
+{
+	auto start = std::chrono::steady_clock::now();
+	cell.nodes.resize(cell.nodeCount);
+	cell.objects.resize(cell.objectCount);
+	{
+		std::lock_guard<std::mutex> lock(fileMutex);
+		cell.readFailed = USeek(file, cell.offset) != 0
+			|| std::fread(cell.nodes.data(), sizeof(SceneFileNode), cell.nodeCount, file) != cell.nodeCount
+			|| std::fread(cell.objects.data(), sizeof(SceneFileObject), cell.objectCount, file) != cell.objectCount;
+	}
+	cell.readMs = UMilliseconds(start);
+}
+
+///////////////////////////////////////////////////
+//	UPlace(Scene&, const Cell&) const
+//
+//	scene: scene to add to
+//	cell: cell whose records were read
+//
+//	Add a cell's nodes and objects after those already in the scene
+///////////////////////////////////////////////////
+void SceneStreamer::UPlace(Scene &scene, const Cell &cell) const
+{
+	const std::uint32_t firstNode = (std::uint32_t)scene.transforms.Size();
+	scene.Reserve(scene.objects.size() + cell.objects.size(), firstNode + cell.nodes.size());
+	for (const SceneFileNode &node : cell.nodes)
+	{
+		const float *t = node.translation;
+		const float *r = node.rotation;
+		const float *s = node.scale;
+		scene.transforms.AddNode(glm::vec3(t[0], t[1], t[2]), glm::quat(r[3], r[0], r[1], r[2]), glm::vec3(s[0], s[1], s[2]),
+			node.parent != SCENE_FILE_NONE ? firstNode + node.parent : TransformSystem::NO_PARENT);
+	}
+	for (const SceneFileObject &object : cell.objects)
+		scene.AddObject(USceneFileMesh(*meshes, object.mesh), materials[object.material], firstNode + object.node);
+}
+
+///////////////////////////////////////////////////
+//	UDrop(Cell&)
+//
+//	cell: cell to unload
+//
+//	Free a cell's records; it is read again when wanted
+///////////////////////////////////////////////////
+void SceneStreamer::UDrop(Cell &cell)
+{
+	cell.state = CELL_UNLOADED;
+	cell.nodes = std::vector<SceneFileNode>();
+	cell.objects = std::vector<SceneFileObject>();
+}
+
+///////////////////////////////////////////////////
+//	UDistance(size_t, const glm::vec3&) const
+//
+//	cell: grid cell
+//	position: camera position
+//
+//	Return the distance on the ground plane from the camera to the cell's
+//	square, 0 inside it
+///////////////////////////////////////////////////
+float SceneStreamer::UDistance(size_t cell, const glm::vec3 &position) const
+{
+	float x0 = (gridX + (int)cell % gridWidth) * cellSize;
+	float z0 = (gridZ + (int)cell / gridWidth) * cellSize;
+	float dx = std::max(std::max(x0 - position.x, position.x - (x0 + cellSize)), 0.0f);
+	float dz = std::max(std::max(z0 - position.z, position.z - (z0 + cellSize)), 0.0f);
+	return std::sqrt(dx * dx + dz * dz);
+}
+
+///////////////////////////////////////////////////
+//	UChooseCells(const glm::vec3&)
+//
+//	position: camera position
+//
+//	List the cells with objects within loadRadius of the camera, nearest
+//	first, as long as they fit in the budget with the always resident cell
+///////////////////////////////////////////////////
+void SceneStreamer::UChooseCells(const glm::vec3 &position)
+{
+	for (std::uint32_t i : wanted)
+		cells[i].wanted = false;
+	wanted.clear();
+
+	int reach = (int)std::ceil(loadRadius / cellSize);
+	int firstX = std::max(cameraCellX - reach - gridX, 0);
+	int endX = std::min(cameraCellX + reach + 1 - gridX, gridWidth);
+	int firstZ = std::max(cameraCellZ - reach - gridZ, 0);
+	int endZ = std::min(cameraCellZ + reach + 1 - gridZ, gridDepth);
+	for (int z = firstZ; z < endZ; z++)
+	{
+		for (int x = firstX; x < endX; x++)
+		{
+			std::uint32_t i = (std::uint32_t)(z * gridWidth + x);
+			if (cells[i].objectCount > 0 && cells[i].state != CELL_FAILED && UDistance(i, position) <= loadRadius)
+				wanted.push_back(i);
+		}
+	}
+	std::sort(wanted.begin(), wanted.end(), [this, &position](std::uint32_t a, std::uint32_t b)
+	{
+		return UDistance(a, position) < UDistance(b, position);
+	});
+
+	size_t bytes = cells.back().bytes;
+	size_t count = 0;
+	while (count < wanted.size() && bytes + cells[wanted[count]].bytes <= budgetBytes)
+		bytes += cells[wanted[count++]].bytes;
+	wanted.resize(count);
+	for (std::uint32_t i : wanted)
+		cells[i].wanted = true;
+}
@@ -0,0 +1,126 @@
+///////////////////////////////////////////////////////////////////////////////
+// scenestream.h
+// ========
+// streaming of large scenes: the scene is split once into square cells of
+// the ground plane, each holding the subtrees of the transform hierarchy
+// whose root stands in it, and the cells are written to a temporary file.
+// Cells near the camera are read back by background jobs and placed in the
+// scene; cells the camera left stay cached until the memory budget needs
+// room. Objects too large for one cell, and the lights, are always resident.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "jobs.h"
+#include "scene.h"
+#include "scenefile.h"
+
+class SceneStreamer
+{
+public:
+	struct Stats
+	{
+		size_t cells;				// Cells holding objects, the always resident set aside
+		size_t residentCells;
+		size_t loadingCells;
+		size_t residentObjects;		// The always resident objects included
+		size_t residentBytes;		// Estimated memory of the resident objects and nodes, CPU and GPU
+	};
+
+	// Estimated memory of an object on the GPU: its draw data, cull data and indirect command
+	static constexpr size_t GPU_BYTES_PER_OBJECT = 128 + 32 + 20;
+	// Cells read at the same time
+	static constexpr size_t MAX_LOADS = 4;
+	// Most cells of the grid, which spans the streamed part of the scene
+	static constexpr size_t MAX_CELLS = 1 << 20;
+
+	float cellSize = 32.0f;				// Side of a cell; objects whose bounds are wider than half of it are always resident
+	float loadRadius = 160.0f;			// Cells closer to the camera on the ground plane are loaded
+	size_t budgetBytes = 256u << 20;	// Estimated memory the resident cells may take
+	bool report = true;					// Print each cell placed or evicted
+
+public:
+	SceneStreamer() = default;
+	SceneStreamer(const SceneStreamer&) = delete;
+	SceneStreamer& operator=(const SceneStreamer&) = delete;
+	~SceneStreamer();
+
+	bool Partition(const char *path, const SceneFileBindings &bindings);
+	bool Partition(const Scene &scene, const SceneFileBindings &bindings);
+	void Begin(Scene &scene);
+	bool Update(Scene &scene, const glm::vec3 &position, JobSystem &jobs);
+	void Stop();
+	Stats GetStats() const;
+
+	// Materials of every cell, to compile their program variants up front
+	const std::vector<SceneMaterial> &Materials() const { return materials; }
+
+	// Records of a scene kept by the partition, materials resolved
+	struct Source
+	{
+		std::vector<SceneMaterial> materials;
+		std::vector<SceneFileNode> nodes;
+		std::vector<SceneFileObject> objects;
+		std::vector<SceneLight> lights;
+	};
+
+private:
+	enum CellState
+	{
+		CELL_UNLOADED,
+		CELL_LOADING,		// A job is reading the cell's records
+		CELL_LOADED,		// Records read, not placed yet
+		CELL_RESIDENT,		// Placed in the scene; the records are kept to place it again
+		CELL_FAILED			// Could not be read, not tried again
+	};
+
+	struct Cell
+	{
+		long long offset = 0;		// Where the cell's nodes, then its objects, are in the file
+		std::uint32_t nodeCount = 0;
+		std::uint32_t objectCount = 0;
+		size_t bytes = 0;			// Estimated memory once resident
+		CellState state = CELL_UNLOADED;
+		bool wanted = false;		// Near enough to the camera, and within the budget
+		bool readFailed = false;	// Set by the loading job
+		double readMs = 0.0;		// Time the loading job took
+		JobCounter loading;
+		std::vector<SceneFileNode> nodes;		// Parents are indices in the cell
+		std::vector<SceneFileObject> objects;	// Nodes are indices in the cell
+	};
+
+	bool UPartition(Source &source);
+	void ULoad(Cell &cell);
+	void UPlace(Scene &scene, const Cell &cell) const;
+	void UDrop(Cell &cell);
+	float UDistance(size_t cell, const glm::vec3 &position) const;
+	void UChooseCells(const glm::vec3 &position);
+
+	const Meshes *meshes = nullptr;
+	std::vector<SceneMaterial> materials;
+	std::vector<SceneLight> lights;
+
+	std::vector<Cell> cells;				// Grid cells row by row, then the always resident cell
+	int gridX = 0;							// Coordinates of the first cell, in cells
+	int gridZ = 0;
+	int gridWidth = 0;
+	int gridDepth = 0;
+	std::vector<std::uint32_t> wanted;		// Wanted cells, nearest first
+	std::vector<std::uint32_t> resident;	// Resident grid cells, in the order they are placed
+	size_t loadCount = 0;					// Cells in CELL_LOADING
+	size_t residentBytes = 0;
+	int cameraCellX = 0;					// Cell of the camera when the wanted cells were chosen
+	int cameraCellZ = 0;
+	bool chosen = false;
+
+	std::FILE *file = nullptr;				// Temporary file of the cells' records
+	std::mutex fileMutex;					// A job seeks and reads the file at a time
+	JobSystem *jobs = nullptr;				// Runs the loads, set by Update()
+};
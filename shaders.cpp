@@ -0,0 +1,613 @@
+///////////////////////////////////////////////////////////////////////////////
+// shaders.cpp
+// ========
+// compile GLSL programs and cache specializations of the Phong program,
+// one per combination of feature defines. Linked programs are also cached
+// on disk as driver binaries so later launches skip compilation.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "shaders.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// First bytes of a program binary cache file
+	const char CACHE_MAGIC[4] = { 'U', 'P', 'B', '1' };
+
+	const std::uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+	const std::uint64_t FNV_PRIME = 1099511628211ull;
+
+	///////////////////////////////////////////////////
+	//	UReadFile(const std::string&, std::string&)
+	//
+	//	path: file to read
+	//	text: receives the file contents
+	//
+	//	Read a whole text file. Return false if it cannot be opened.
+	///////////////////////////////////////////////////
+	bool UReadFile(const std::string& path, std::string& text)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+
+		std::ostringstream contents;
+		contents << file.rdbuf();
+		text = contents.str();
+		return true;
+	}
+
+	///////////////////////////////////////////////////
+	//	UHashFnv1a(const std::string&, std::uint64_t)
+	//
+	//	text: bytes to hash
+	//	hash: hash of the preceding bytes
+	//
+	//	Continue a 64 bit FNV-1a hash over text
+	///////////////////////////////////////////////////
+	std::uint64_t UHashFnv1a(const std::string& text, std::uint64_t hash = FNV_OFFSET_BASIS)
+	{
+		for (unsigned char c : text)
+		{
+			hash ^= c;
+			hash *= FNV_PRIME;
+		}
+		return hash;
+	}
+}
+
+///////////////////////////////////////////////////
+//	Create(const std::string&, const std::string&)
+//
+//	vertexPath: file of the vertex shader the variants are specialized from
+//	fragmentPath: file of the fragment shader the variants are specialized from
+//
+//	Read the sources; variants are compiled on first request. Let the driver
+//	compile on its own threads when it supports parallel compilation.
+//	Return false if a source file cannot be read.
+///////////////////////////////////////////////////
+bool ShaderLibrary::Create(const std::string& vertexPath, const std::string& fragmentPath)
+{
+	this->vertexPath = vertexPath;
+	this->fragmentPath = fragmentPath;
+
+	// 0xFFFFFFFF leaves the number of compiler threads to the driver
+	if (GLEW_KHR_parallel_shader_compile)
+	{
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		parallelCompile = true;
+	}
+	else if (GLEW_ARB_parallel_shader_compile)
+	{
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+		parallelCompile = true;
+	}
+
+	if (!UReadFile(vertexPath, vertexSource) || !UReadFile(fragmentPath, fragmentSource))
+	{
+		std::cout << "Failed to read shader " << vertexPath << " or " << fragmentPath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	Destroy()
+//
+//	Delete every variant, including the ones still compiling
+///////////////////////////////////////////////////
+void ShaderLibrary::Destroy()
+{
+	for (const PendingProgram &program : pending)
+	{
+		glDeleteShader(program.vertexShaderId);
+		glDeleteShader(program.fragmentShaderId);
+	}
+	pending.clear();
+
+	for (const auto &entry : programs)
+		UDestroyProgram(entry.second);
+	programs.clear();
+}
+
+///////////////////////////////////////////////////
+//	Reload()
+//
+//	Read the sources again and rebuild every variant from them. The
+//	running programs are replaced only if all variants build; otherwise
+//	they and their sources are kept. Return false in that case.
+///////////////////////////////////////////////////
+bool ShaderLibrary::Reload()
+{
+	std::string newVertexSource;
+	std::string newFragmentSource;
+	if (!UReadFile(vertexPath, newVertexSource) || !UReadFile(fragmentPath, newFragmentSource))
+	{
+		std::cout << "Failed to read shader " << vertexPath << " or " << fragmentPath << std::endl;
+		return false;
+	}
+
+	FinishPrograms();
+	std::swap(vertexSource, newVertexSource);
+	std::swap(fragmentSource, newFragmentSource);
+
+	// Build the new variants next to the running ones
+	std::unordered_map<GLuint, GLuint> rebuilt;
+	for (const auto &entry : programs)
+		rebuilt[entry.first] = 0;
+	for (auto &entry : rebuilt)
+	{
+		std::string defines = Defines(entry.first);
+		std::string vertex = UWithDefines(vertexSource.c_str(), defines);
+		std::string fragment = UWithDefines(fragmentSource.c_str(), defines);
+		SubmitProgram(vertex.c_str(), fragment.c_str(), entry.second);
+	}
+
+	if (!FinishPrograms())
+	{
+		// Variants requested later must match the running ones
+		for (const auto &entry : rebuilt)
+			UDestroyProgram(entry.second);
+		std::swap(vertexSource, newVertexSource);
+		std::swap(fragmentSource, newFragmentSource);
+		std::cout << "Keeping the previous programs of " << vertexPath << " and " << fragmentPath << std::endl;
+		return false;
+	}
+
+	for (const auto &entry : rebuilt)
+	{
+		UDestroyProgram(programs[entry.first]);
+		programs[entry.first] = entry.second;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	RequestProgram(GLuint)
+//
+//	features: ShaderFeature bits and light count of the variant
+//
+//	Submit the variant with these features plus the base features for
+//	compilation, unless it was requested before. It is usable once
+//	FinishPrograms() returns.
+///////////////////////////////////////////////////
+void ShaderLibrary::RequestProgram(GLuint features)
+{
+	features |= baseFeatures;
+
+	if (programs.find(features) != programs.end())
+		return;
+
+	std::string defines = Defines(features);
+	std::string vertex = UWithDefines(vertexSource.c_str(), defines);
+	std::string fragment = UWithDefines(fragmentSource.c_str(), defines);
+
+	// Failed variants stay in the map as 0, so they are reported only once
+	SubmitProgram(vertex.c_str(), fragment.c_str(), programs[features]);
+}
+
+///////////////////////////////////////////////////
+//	GetProgram(GLuint)
+//
+//	features: ShaderFeature bits and light count of the variant
+//
+//	Return the program of the variant with these features plus the base
+//	features, building it the first time it is requested. Return 0 if
+//	the variant fails to build.
+///////////////////////////////////////////////////
+GLuint ShaderLibrary::GetProgram(GLuint features)
+{
+	RequestProgram(features);
+
+	GLuint programId = programs[features | baseFeatures];
+	if (UIsPending(programId))
+	{
+		FinishPrograms();
+		programId = programs[features | baseFeatures];
+	}
+	return programId;
+}
+
+///////////////////////////////////////////////////
+//	GetUniforms(GLuint)
+//
+//	programId: program built by the library
+//
+//	Return the locations of uniformNames in the program, in the same
+//	order, or nullptr if the program is not built yet. They are looked up
+//	once, when the program links, so drawing never queries them.
+///////////////////////////////////////////////////
+const GLint* ShaderLibrary::GetUniforms(GLuint programId) const
+{
+	auto found = uniformLocations.find(programId);
+	return found == uniformLocations.end() ? nullptr : found->second.data();
+}
+
+///////////////////////////////////////////////////
+//	CreateProgram(const char*, const char*, GLuint&)
+//
+//	vtxShaderSource: vertex shader source code
+//	fragShaderSource: fragment shader source code
+//	programId: receives the linked program
+//
+//	Build a program right away, waiting for it (and for any program
+//	submitted before it) to finish
+///////////////////////////////////////////////////
+bool ShaderLibrary::CreateProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+{
+	SubmitProgram(vtxShaderSource, fragShaderSource, programId);
+	return FinishPrograms() && programId != 0;
+}
+
+///////////////////////////////////////////////////
+//	SubmitProgram(const char*, const char*, GLuint&)
+//
+//	vtxShaderSource: vertex shader source code
+//	fragShaderSource: fragment shader source code
+//	programId: receives the program, set to 0 by FinishPrograms() if it fails
+//
+//	Load the program from its cached binary, or start compiling and linking
+//	it from source without waiting for the driver. A binary the driver
+//	rejects (other GPU, updated driver) falls back to compiling and is
+//	overwritten once the program links.
+///////////////////////////////////////////////////
+void ShaderLibrary::SubmitProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+{
+	PendingProgram program;
+	program.result = &programId;
+	program.cachePath = UCachePath(vtxShaderSource, fragShaderSource);
+
+	if (!program.cachePath.empty() && ULoadBinary(program.cachePath, programId))
+	{
+		ULookUpUniforms(programId);
+		return;
+	}
+
+	// Create a Shader program object.
+	programId = glCreateProgram();
+	program.programId = programId;
+
+	// Create the vertex and fragment shader objects
+	program.vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
+	program.fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+
+	// Retrive the shader source
+	glShaderSource(program.vertexShaderId, 1, &vtxShaderSource, NULL);
+	glShaderSource(program.fragmentShaderId, 1, &fragShaderSource, NULL);
+
+	// Compile both shaders; their status is only queried in FinishPrograms()
+	glCompileShader(program.vertexShaderId);
+	glCompileShader(program.fragmentShaderId);
+
+	// Attached compiled shaders to the shader program
+	glAttachShader(programId, program.vertexShaderId);
+	glAttachShader(programId, program.fragmentShaderId);
+
+	// Ask the driver to keep the binary, so it can be cached
+	glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	glLinkProgram(programId);   // links the shader program
+
+	pending.push_back(program);
+}
+
+///////////////////////////////////////////////////
+//	FinishPrograms()
+//
+//	Wait for every submitted program and report compile and link errors.
+//	With parallel compilation the programs are finished in the order the
+//	driver completes them. Return false if any program failed.
+///////////////////////////////////////////////////
+bool ShaderLibrary::FinishPrograms()
+{
+	bool success = true;
+
+	while (!pending.empty())
+	{
+		size_t next = 0;
+		if (parallelCompile)
+		{
+			GLint completed = GL_FALSE;
+			for (next = 0; next < pending.size(); next++)
+			{
+				glGetProgramiv(pending[next].programId, GL_COMPLETION_STATUS_KHR, &completed);
+				if (completed)
+					break;
+			}
+
+			if (next == pending.size())
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+		}
+
+		if (!UFinishProgram(pending[next]))
+			success = false;
+		pending.erase(pending.begin() + next);
+	}
+
+	return success;
+}
+
+///////////////////////////////////////////////////
+//	Defines(GLuint)
+//
+//	features: ShaderFeature bits and light count of a variant
+//
+//	Return the #define lines of the variant. Every define is always
+//	present, set to 0 or 1, and the shaders test them in plain if
+//	statements the compiler folds away.
+///////////////////////////////////////////////////
+std::string ShaderLibrary::Defines(GLuint features)
+{
+	std::string defines;
+	defines += "#define TEXTURED " + std::to_string((features & SHADER_TEXTURED) != 0) + "\n";
+	defines += "#define SPECULAR " + std::to_string((features & SHADER_SPECULAR) != 0) + "\n";
+	defines += "#define PACKED_VERTICES " + std::to_string((features & SHADER_PACKED_VERTICES) != 0) + "\n";
+	defines += "#define REFERENCE_NORMAL_MATRIX " + std::to_string((features & SHADER_REFERENCE_NORMALS) != 0) + "\n";
+	defines += "#define LIGHT_COUNT " + std::to_string((features & SHADER_LIGHT_COUNT_MASK) >> SHADER_LIGHT_COUNT_SHIFT) + "\n";
+	return defines;
+}
+
+///////////////////////////////////////////////////
+//	UDestroyShaderProgram(GLuint)
+//
+//	programId: program to delete, or 0
+//
+//	Delete a linked program; its shaders were deleted once it linked
+///////////////////////////////////////////////////
+void UDestroyShaderProgram(GLuint programId)
+{
+	glDeleteProgram(programId);
+}
+
+///////////////////////////////////////////////////
+//	UWithDefines(const char*, const std::string&)
+//
+//	source: shader source code, starting with its #version line
+//	defines: #define lines to insert
+//
+//	Return the source with the defines inserted right after the #version
+//	line, which must stay first. A source of a single line gets them
+//	appended.
+///////////////////////////////////////////////////
+std::string UWithDefines(const char* source, const std::string& defines)
+{
+	std::string result(source);
+	std::string::size_type versionEnd = result.find('\n');
+	result.insert(versionEnd == std::string::npos ? result.size() : versionEnd + 1, defines);
+	return result;
+}
+
+///////////////////////////////////////////////////
+//	UCachePath(const char*, const char*)
+//
+//	vtxShaderSource: vertex shader source code, defines included
+//	fragShaderSource: fragment shader source code, defines included
+//
+//	Return the cache file of the program: a hash of both sources and of the
+//	driver strings. Return an empty path when the cache is disabled or the
+//	driver has no binary formats.
+///////////////////////////////////////////////////
+std::string ShaderLibrary::UCachePath(const char* vtxShaderSource, const char* fragShaderSource)
+{
+	if (cacheDirectory.empty())
+		return std::string();
+
+	if (driverId.empty())
+	{
+		GLint formatCount = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+		if (formatCount == 0)
+		{
+			cacheDirectory.clear();
+			return std::string();
+		}
+
+		driverId = std::string((const char*)glGetString(GL_VENDOR)) + "|"
+			+ (const char*)glGetString(GL_RENDERER) + "|"
+			+ (const char*)glGetString(GL_VERSION);
+	}
+
+	// Hash each part with a separator so moving text between them changes the key
+	std::uint64_t hash = UHashFnv1a(driverId);
+	hash = UHashFnv1a(std::string("\0", 1), hash);
+	hash = UHashFnv1a(vtxShaderSource, hash);
+	hash = UHashFnv1a(std::string("\0", 1), hash);
+	hash = UHashFnv1a(fragShaderSource, hash);
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)hash);
+	return (std::filesystem::path(cacheDirectory) / name).string();
+}
+
+///////////////////////////////////////////////////
+//	ULoadBinary(const std::string&, GLuint&)
+//
+//	path: cache file of the program
+//	programId: receives the program
+//
+//	Create the program from a cached binary. Return false if the file is
+//	missing or damaged, or the driver does not accept the binary.
+///////////////////////////////////////////////////
+bool ShaderLibrary::ULoadBinary(const std::string& path, GLuint& programId)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	char magic[sizeof(CACHE_MAGIC)];
+	GLenum format = 0;
+	GLint length = 0;
+	file.read(magic, sizeof(magic));
+	file.read((char*)&format, sizeof(format));
+	file.read((char*)&length, sizeof(length));
+	if (!file || std::char_traits<char>::compare(magic, CACHE_MAGIC, sizeof(magic)) != 0 || length <= 0)
+		return false;
+
+	std::vector<char> binary(length);
+	file.read(binary.data(), length);
+	if (!file)
+		return false;
+
+	programId = glCreateProgram();
+	glProgramBinary(programId, format, binary.data(), length);
+
+	int success = 0;
+	glGetProgramiv(programId, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glDeleteProgram(programId);
+		programId = 0;
+		return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	USaveBinary(const std::string&, GLuint)
+//
+//	path: cache file of the program
+//	programId: linked program
+//
+//	Write the program's driver binary to the cache. Failures only cost the
+//	next launch a compilation, so they are ignored.
+///////////////////////////////////////////////////
+void ShaderLibrary::USaveBinary(const std::string& path, GLuint programId)
+{
+	GLint length = 0;
+	glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(programId, length, &length, &format, binary.data());
+
+	std::error_code error;
+	std::filesystem::create_directories(cacheDirectory, error);
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return;
+	file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	file.write((const char*)&format, sizeof(format));
+	file.write((const char*)&length, sizeof(length));
+	file.write(binary.data(), length);
+}
+
+///////////////////////////////////////////////////
+//	UFinishProgram(PendingProgram&)
+//
+//	program: submitted program
+//
+//	Check the compile and link status of a submitted program, printing
+//	errors (if any), and cache its binary once it links
+///////////////////////////////////////////////////
+bool ShaderLibrary::UFinishProgram(PendingProgram& program)
+{
+	// Compilation and linkage error reporting
+	int success = 0;
+	char infoLog[512];
+
+	// check for shader compile errors
+	glGetShaderiv(program.vertexShaderId, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(program.vertexShaderId, sizeof(infoLog), NULL, infoLog);
+		std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+	}
+	else
+	{
+		glGetShaderiv(program.fragmentShaderId, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(program.fragmentShaderId, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+		}
+		else
+		{
+			// check for linking errors
+			glGetProgramiv(program.programId, GL_LINK_STATUS, &success);
+			if (!success)
+			{
+				glGetProgramInfoLog(program.programId, sizeof(infoLog), NULL, infoLog);
+				std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+			}
+		}
+	}
+
+	// The linked program keeps its code, the shader objects are no longer needed
+	glDeleteShader(program.vertexShaderId);
+	glDeleteShader(program.fragmentShaderId);
+
+	if (!success)
+	{
+		glDeleteProgram(program.programId);
+		*program.result = 0;
+		return false;
+	}
+
+	if (!program.cachePath.empty())
+		USaveBinary(program.cachePath, program.programId);
+	ULookUpUniforms(program.programId);
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	UIsPending(GLuint)
+//
+//	programId: program returned by SubmitProgram()
+//
+//	Return true if the program was submitted but not finished yet
+///////////////////////////////////////////////////
+bool ShaderLibrary::UIsPending(GLuint programId) const
+{
+	for (const PendingProgram &program : pending)
+	{
+		if (program.programId == programId)
+			return true;
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////
+//	ULookUpUniforms(GLuint)
+//
+//	programId: linked program
+//
+//	Store the locations of uniformNames in the program; a uniform the
+//	variant does not use gets -1, which glUniform calls ignore
+///////////////////////////////////////////////////
+void ShaderLibrary::ULookUpUniforms(GLuint programId)
+{
+	std::vector<GLint> &locations = uniformLocations[programId];
+	locations.clear();
+	for (const std::string &name : uniformNames)
+		locations.push_back(glGetUniformLocation(programId, name.c_str()));
+}
+
+///////////////////////////////////////////////////
+//	UDestroyProgram(GLuint)
+//
+//	programId: program built by the library, or 0
+//
+//	Delete the program and forget its uniform locations, since the driver
+//	may give its name to a later program
+///////////////////////////////////////////////////
+void ShaderLibrary::UDestroyProgram(GLuint programId)
+{
+	uniformLocations.erase(programId);
+	UDestroyShaderProgram(programId);
+}
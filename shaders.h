@@ -0,0 +1,90 @@
+///////////////////////////////////////////////////////////////////////////////
+// shaders.h
+// ========
+// compile GLSL programs and cache specializations of the Phong program,
+// one per combination of feature defines. Linked programs are also cached
+// on disk as driver binaries so later launches skip compilation. Programs
+// are submitted first and checked later, so the driver can build them in
+// parallel. Sources are read from files and can be reloaded while running.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Feature bits of a Phong program variant. Each one becomes a #define
+// inserted after the #version line, which the shaders test in constant
+// conditions the compiler folds away.
+enum ShaderFeature : GLuint
+{
+	SHADER_TEXTURED = 1 << 0,			// TEXTURED: sample uTexture instead of the object color
+	SHADER_SPECULAR = 1 << 1,			// SPECULAR: evaluate the specular term
+	SHADER_PACKED_VERTICES = 1 << 2,	// PACKED_VERTICES: normals arrive octahedral encoded
+	SHADER_REFERENCE_NORMALS = 1 << 3,	// REFERENCE_NORMAL_MATRIX: invert the model matrix per vertex
+};
+
+// LIGHT_COUNT (0 to 2) is stored in these bits of a feature key
+const GLuint SHADER_LIGHT_COUNT_SHIFT = 4;
+const GLuint SHADER_LIGHT_COUNT_MASK = 3 << SHADER_LIGHT_COUNT_SHIFT;
+
+class ShaderLibrary
+{
+	// Program whose shaders were submitted but whose status is not checked yet
+	struct PendingProgram
+	{
+		GLuint programId = 0;
+		GLuint vertexShaderId = 0;
+		GLuint fragmentShaderId = 0;
+		std::string cachePath;		// Where the binary is saved once linked, empty when not cached
+		GLuint *result = nullptr;	// Set to 0 when the program fails
+	};
+
+public:
+	// Features added to every requested variant (vertex layout, light count)
+	GLuint baseFeatures = 0;
+	// Compiled variants by feature key
+	std::unordered_map<GLuint, GLuint> programs;
+	// Directory the program binaries are cached in, empty to always compile
+	std::string cacheDirectory;
+	// Uniforms whose locations are looked up once per program, when it is built
+	std::vector<std::string> uniformNames;
+
+public:
+	bool Create(const std::string& vertexPath, const std::string& fragmentPath);
+	void Destroy();
+	bool Reload();
+	void RequestProgram(GLuint features);
+	GLuint GetProgram(GLuint features);
+	const GLint* GetUniforms(GLuint programId) const;
+	bool CreateProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+	void SubmitProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+	bool FinishPrograms();
+
+	static std::string Defines(GLuint features);
+
+private:
+	std::string UCachePath(const char* vtxShaderSource, const char* fragShaderSource);
+	bool ULoadBinary(const std::string& path, GLuint& programId);
+	void USaveBinary(const std::string& path, GLuint programId);
+	bool UFinishProgram(PendingProgram& program);
+	bool UIsPending(GLuint programId) const;
+	void ULookUpUniforms(GLuint programId);
+	void UDestroyProgram(GLuint programId);
+
+	std::string vertexPath;			// Files the sources are read from
+	std::string fragmentPath;
+	std::string vertexSource;		// Sources the variants are specialized from
+	std::string fragmentSource;
+	std::string driverId;	// Vendor, renderer and version of the driver the binaries come from
+	std::vector<PendingProgram> pending;
+	// Locations of uniformNames in each built program, by program
+	std::unordered_map<GLuint, std::vector<GLint>> uniformLocations;
+	bool parallelCompile = false;	// KHR/ARB_parallel_shader_compile is available
+};
+
+void UDestroyShaderProgram(GLuint programId);
+std::string UWithDefines(const char* source, const std::string& defines);
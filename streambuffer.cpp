@@ -0,0 +1,144 @@
+///////////////////////////////////////////////////////////////////////////////
+// streambuffer.cpp
+// ========
+// ring buffer for data the CPU writes every frame: one buffer created with
+// glBufferStorage and mapped persistently, split into one region per frame
+// in flight. A fence per region keeps the CPU from overwriting data the
+// GPU still reads, without synchronizing on every upload.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "streambuffer.h"
+
+#include "gpumemory.h"
+
+#include <cstring>
+
+///////////////////////////////////////////////////
+//	Create(GLsizeiptr)
+//
+//	regionSize: bytes each frame can write
+//
+//	Create the buffer with room for every region and map it. Coherent
+//	mapping makes the writes visible to the GPU without flushing.
+///////////////////////////////////////////////////
+void StreamBuffer::Create(GLsizeiptr regionSize)
+{
+	Destroy();
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	this->regionSize = regionSize;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, regionSize * REGION_COUNT, nullptr, flags);
+	mapping = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionSize * REGION_COUNT, flags);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	UGpuMemory().TrackBuffer(buffer, (size_t)regionSize * REGION_COUNT, "stream buffer");
+
+	region = 0;
+	regionOffset = 0;
+}
+
+///////////////////////////////////////////////////
+//	Destroy()
+//
+//	Wait for the GPU to finish with every region, then unmap and delete
+//	the buffer
+///////////////////////////////////////////////////
+void StreamBuffer::Destroy()
+{
+	for (int i = 0; i < REGION_COUNT; i++)
+		UWaitFence(i);
+
+	if (buffer != 0)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		UGpuMemory().UntrackBuffer(buffer);
+		glDeleteBuffers(1, &buffer);
+	}
+	buffer = 0;
+	mapping = nullptr;
+	regionSize = 0;
+}
+
+///////////////////////////////////////////////////
+//	Reserve(GLsizeiptr)
+//
+//	regionSize: bytes the next frame writes
+//
+//	Recreate the buffer with larger regions when the next frame does not
+//	fit. Must be called outside BeginRegion() / EndRegion().
+///////////////////////////////////////////////////
+void StreamBuffer::Reserve(GLsizeiptr regionSize)
+{
+	if (regionSize <= this->regionSize)
+		return;
+
+	Create(regionSize > this->regionSize * 2 ? regionSize : this->regionSize * 2);
+}
+
+///////////////////////////////////////////////////
+//	BeginRegion()
+//
+//	Start writing the next region, waiting first for the GPU to finish
+//	reading it (REGION_COUNT frames ago)
+///////////////////////////////////////////////////
+void StreamBuffer::BeginRegion()
+{
+	region = (region + 1) % REGION_COUNT;
+	regionOffset = 0;
+	UWaitFence(region);
+}
+
+///////////////////////////////////////////////////
+//	Write(const void*, GLsizeiptr, GLsizeiptr)
+//
+//	data: bytes to copy
+//	size: number of bytes
+//	alignment: the offset is rounded up to a multiple of this
+//
+//	Copy data into the current region and return its offset in the
+//	buffer. The region must have room (see Reserve()).
+///////////////////////////////////////////////////
+GLintptr StreamBuffer::Write(const void *data, GLsizeiptr size, GLsizeiptr alignment)
+{
+	regionOffset = (regionOffset + alignment - 1) / alignment * alignment;
+	GLintptr offset = region * regionSize + regionOffset;
+
+	std::memcpy(mapping + offset, data, size);
+	regionOffset += size;
+	return offset;
+}
+
+///////////////////////////////////////////////////
+//	EndRegion()
+//
+//	Fence the commands that read the current region; call once they have
+//	all been issued
+///////////////////////////////////////////////////
+void StreamBuffer::EndRegion()
+{
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+///////////////////////////////////////////////////
+//	UWaitFence(int)
+//
+//	region: region whose fence to wait for
+//
+//	Block until the GPU has passed the region's fence, then delete it
+///////////////////////////////////////////////////
+void StreamBuffer::UWaitFence(int region)
+{
+	if (fences[region] == nullptr)
+		return;
+
+	// The first wait flushes, so the fence is sure to be signaled eventually
+	GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	while (glClientWaitSync(fences[region], flags, 1000000) == GL_TIMEOUT_EXPIRED)
+		flags = 0;
+
+	glDeleteSync(fences[region]);
+	fences[region] = nullptr;
+}
@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////////////////////////////
+// streambuffer.h
+// ========
+// ring buffer for data the CPU writes every frame: one buffer created with
+// glBufferStorage and mapped persistently, split into one region per frame
+// in flight. A fence per region keeps the CPU from overwriting data the
+// GPU still reads, without synchronizing on every upload.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+class StreamBuffer
+{
+public:
+	// Frames the CPU can write ahead of the GPU
+	static const int REGION_COUNT = 3;
+
+public:
+	void Create(GLsizeiptr regionSize);
+	void Destroy();
+	void Reserve(GLsizeiptr regionSize);
+	void BeginRegion();
+	GLintptr Write(const void *data, GLsizeiptr size, GLsizeiptr alignment);
+	void EndRegion();
+
+	GLuint buffer = 0;
+
+private:
+	void UWaitFence(int region);
+
+	unsigned char *mapping = nullptr;	// Whole buffer, mapped for as long as it exists
+	GLsizeiptr regionSize = 0;
+	int region = 0;						// Region being written
+	GLsizeiptr regionOffset = 0;		// Next free byte of the region being written
+	GLsync fences[REGION_COUNT] = {};	// Signaled once the GPU is done with each region
+};
@@ -0,0 +1,491 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturestream.cpp
+// ========
+// progressive loading of the image textures. The textures keep mutable
+// storage whose level 0 is the largest resident level of the full chain:
+// finer levels are added by specifying the chain again from the decoded
+// pixels, coarser ones by GpuMemory copying the kept levels down on the GPU.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "texturestream.h"
+
+#include "gpumemory.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	double UMilliseconds(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void UReleasePixels(std::vector<unsigned char> &pixels)
+	{
+		std::vector<unsigned char>().swap(pixels);
+	}
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	Stop();
+}
+
+///////////////////////////////////////////////////
+//	Add(const char*, GLuint)
+//
+//	path: image file, 3 or 4 channels; must outlive the streamer
+//	texture: texture generated for it
+//
+//	Give a texture its placeholder, a gray texel, and stream the file
+//	into it once Start() is called
+///////////////////////////////////////////////////
+void TextureStreamer::Add(const char *path, GLuint texture)
+{
+	static const unsigned char GRAY[4] = { 128, 128, 128, 255 };
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, GRAY);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	UGpuMemory().TrackTexture(texture, GL_RGBA8, 1, 1, 1, path);
+
+	std::unique_ptr<Texture> streamed(new Texture);
+	streamed->path = path;
+	streamed->name = texture;
+	textures.push_back(std::move(streamed));
+}
+
+///////////////////////////////////////////////////
+//	Start(JobSystem&)
+//
+//	jobs: runs the decodes as background jobs, until Stop()
+//
+//	Start decoding the files, the frames going on meanwhile
+///////////////////////////////////////////////////
+void TextureStreamer::Start(JobSystem &jobs)
+{
+	this->jobs = &jobs;
+	ULaunchDecodes();
+}
+
+///////////////////////////////////////////////////
+//	Reload(const char*)
+//
+//	path: file that changed on disk
+//
+//	Decode a texture's file again; its resident levels are replaced once
+//	it is. Returns false when no texture streams from the file.
+///////////////////////////////////////////////////
+bool TextureStreamer::Reload(const char *path)
+{
+	for (std::unique_ptr<Texture> &texture : textures)
+	{
+		if (std::strcmp(texture->path, path) != 0)
+			continue;
+		texture->reload = true;
+		texture->failed = false;
+		return true;
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////
+//	Update(const std::vector<Renderer::TextureCoverage>&, int)
+//
+//	coverage: screen size of the textured batches drawn this frame
+//	viewportHeight: height of the viewport in pixels
+//
+//	Call once per frame on the GL thread. Take the finished decodes,
+//	choose the level each texture is wanted from, drop the levels no
+//	longer wanted, and upload finer ones: a texture's small levels as soon
+//	as it is decoded, the levels it is wanted with from the next frame,
+//	up to UPLOAD_BYTES_PER_FRAME. Then start the decodes that are needed.
+///////////////////////////////////////////////////
+void TextureStreamer::Update(const std::vector<Renderer::TextureCoverage> &coverage, int viewportHeight)
+{
+	frame++;
+
+	for (std::unique_ptr<Texture> &texture : textures)
+	{
+		if (texture->decoding && texture->decoded.Done())
+			UFinishDecode(*texture);
+		texture->screenSize = 0.0f;
+	}
+	for (const Renderer::TextureCoverage &batch : coverage)
+	{
+		for (std::unique_ptr<Texture> &texture : textures)
+		{
+			if (texture->name == batch.textureId)
+				texture->screenSize = std::max(texture->screenSize, batch.screenSize);
+		}
+	}
+	UChooseLevels(viewportHeight);
+
+	// Drops first, to make room for the uploads
+	GpuMemory &memory = UGpuMemory();
+	for (std::unique_ptr<Texture> &texture : textures)
+	{
+		if (texture->firstLevel < texture->targetLevel)
+		{
+			memory.DropLevels(texture->name, texture->targetLevel - texture->firstLevel);
+			texture->specifiedLevels = texture->levels - texture->targetLevel;
+			texture->firstLevel = texture->targetLevel;
+		}
+	}
+
+	size_t uploaded = 0;
+	for (std::unique_ptr<Texture> &texture : textures)
+	{
+		if (texture->decoding || texture->decode.pixels.empty())
+			continue;
+
+		if (texture->firstLevel > texture->baseLevel)
+			UUpload(*texture, texture->baseLevel);
+		else if (texture->stale)
+			uploaded += UUpload(*texture, std::min(texture->targetLevel, texture->firstLevel));
+		else if (texture->targetLevel < texture->firstLevel && uploaded < UPLOAD_BYTES_PER_FRAME)
+			uploaded += UUpload(*texture, texture->targetLevel);
+
+		if (texture->firstLevel <= texture->targetLevel)
+			UReleasePixels(texture->decode.pixels);
+	}
+
+	ULaunchDecodes();
+}
+
+///////////////////////////////////////////////////
+//	Stop()
+//
+//	Wait for the decodes in flight and free the decoded pixels; call
+//	before the job system stops
+///////////////////////////////////////////////////
+void TextureStreamer::Stop()
+{
+	for (std::unique_ptr<Texture> &texture : textures)
+	{
+		if (texture->decoding)
+		{
+			jobs->Wait(texture->decoded);
+			texture->decoding = false;
+			decodeCount--;
+		}
+		UReleasePixels(texture->decode.pixels);
+	}
+}
+
+///////////////////////////////////////////////////
+//	GetStats() const
+//
+//	Return the number of textures, decoding and missing levels, and the
+//	GPU memory of their resident and wanted levels
+///////////////////////////////////////////////////
+TextureStreamer::Stats TextureStreamer::GetStats() const
+{
+	Stats stats = {};
+	stats.textures = textures.size();
+	stats.decoding = decodeCount;
+	for (const std::unique_ptr<Texture> &texture : textures)
+	{
+		stats.pendingTextures += texture->levels == 0 || texture->firstLevel > texture->targetLevel;
+		stats.residentBytes += UChainBytes(*texture, texture->firstLevel);
+		stats.wantedBytes += UChainBytes(*texture, texture->targetLevel);
+	}
+	return stats;
+}
+
+///////////////////////////////////////////////////
+//	UDecode(const char*, Decode&)
+//
+//	path: image file
+//	decode: receives the pixels
+//
+//	Decode a file, flipped to OpenGL's row order, and build its whole mip
+//	chain with a 2x2 box filter, as glGenerateMipmap would. Runs as a
+//	background job.
+///////////////////////////////////////////////////
+void TextureStreamer::UDecode(const char *path, Decode &decode)
+{
+	auto start = std::chrono::steady_clock::now();
+	decode.failed = true;
+
+	int width, height, channels;
+	unsigned char *image = stbi_load(path, &width, &height, &channels, 0);
+	if (!image)
+		return;
+	if (channels != 3 && channels != 4)
+	{
+		stbi_image_free(image);
+		return;
+	}
+
+	int levels = 1;
+	while ((width >> levels) > 0 || (height >> levels) > 0)
+		levels++;
+	decode.levelOffsets.resize(levels);
+	size_t bytes = 0;
+	for (int level = 0; level < levels; level++)
+	{
+		decode.levelOffsets[level] = bytes;
+		bytes += (size_t)std::max(width >> level, 1) * std::max(height >> level, 1) * channels;
+	}
+	decode.pixels.resize(bytes);
+
+	// Level 0, its rows bottom up
+	const size_t rowBytes = (size_t)width * channels;
+	for (int y = 0; y < height; y++)
+		std::memcpy(&decode.pixels[rowBytes * y], image + rowBytes * (height - 1 - y), rowBytes);
+	stbi_image_free(image);
+
+	for (int level = 1; level < levels; level++)
+	{
+		const int sourceWidth = std::max(width >> (level - 1), 1);
+		const int sourceHeight = std::max(height >> (level - 1), 1);
+		const int levelWidth = std::max(width >> level, 1);
+		const int levelHeight = std::max(height >> level, 1);
+		const unsigned char *source = &decode.pixels[decode.levelOffsets[level - 1]];
+		unsigned char *target = &decode.pixels[decode.levelOffsets[level]];
+		for (int y = 0; y < levelHeight; y++)
+		{
+			const unsigned char *row0 = source + (size_t)std::min(2 * y, sourceHeight - 1) * sourceWidth * channels;
+			const unsigned char *row1 = source + (size_t)std::min(2 * y + 1, sourceHeight - 1) * sourceWidth * channels;
+			for (int x = 0; x < levelWidth; x++)
+			{
+				const int x0 = std::min(2 * x, sourceWidth - 1) * channels;
+				const int x1 = std::min(2 * x + 1, sourceWidth - 1) * channels;
+				for (int c = 0; c < channels; c++)
+					*target++ = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+			}
+		}
+	}
+
+	decode.width = width;
+	decode.height = height;
+	decode.channels = channels;
+	decode.failed = false;
+	decode.milliseconds = UMilliseconds(start);
+}
+
+///////////////////////////////////////////////////
+//	ULevelBytes(const Texture&, int)
+//
+//	texture: decoded texture
+//	level: level of the full chain
+//
+//	Returns the GPU memory of one level; RGB texels are padded to 4 bytes,
+//	as GpuMemory counts them
+///////////////////////////////////////////////////
+size_t TextureStreamer::ULevelBytes(const Texture &texture, int level)
+{
+	return (size_t)std::max(texture.width >> level, 1) * std::max(texture.height >> level, 1) * 4;
+}
+
+///////////////////////////////////////////////////
+//	UChainBytes(const Texture&, int)
+//
+//	texture: texture, decoded or not
+//	firstLevel: largest level of the chain
+//
+//	Returns the GPU memory of the levels from firstLevel on; none before
+//	the texture is decoded
+///////////////////////////////////////////////////
+size_t TextureStreamer::UChainBytes(const Texture &texture, int firstLevel)
+{
+	size_t bytes = 0;
+	for (int level = firstLevel; level < texture.levels; level++)
+		bytes += ULevelBytes(texture, level);
+	return bytes;
+}
+
+///////////////////////////////////////////////////
+//	ULaunchDecodes()
+//
+//	Start decoding the files of the textures not decoded yet, reloaded,
+//	or wanted finer than resident once their pixels were released, up to
+//	MAX_DECODES at a time
+///////////////////////////////////////////////////
+void TextureStreamer::ULaunchDecodes()
+{
+	if (!jobs)
+		return;
+
+	for (std::unique_ptr<Texture> &streamed : textures)
+	{
+		if (decodeCount == MAX_DECODES)
+			break;
+
+		Texture &texture = *streamed;
+		bool wanted = texture.reload
+			|| (!texture.failed && (texture.levels == 0 || (texture.targetLevel < texture.firstLevel && texture.decode.pixels.empty())));
+		if (texture.decoding || !wanted)
+			continue;
+
+		UReleasePixels(texture.decode.pixels); // Pixels of the previous decode, replaced by the job
+		texture.stale = texture.reload && texture.levels > 0;
+		texture.reload = false;
+		texture.decoding = true;
+		decodeCount++;
+		jobs->RunBackground([&texture]() { UDecode(texture.path, texture.decode); }, &texture.decoded);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UFinishDecode(Texture&)
+//
+//	texture: texture whose decode job finished
+//
+//	Take a decode's result. A file whose size changed starts over from
+//	its small levels; a decode outdated by a reload is thrown away.
+///////////////////////////////////////////////////
+void TextureStreamer::UFinishDecode(Texture &texture)
+{
+	texture.decoding = false;
+	decodeCount--;
+
+	const Decode &decode = texture.decode;
+	if (texture.reload)
+	{
+		UReleasePixels(texture.decode.pixels);
+		return;
+	}
+	if (decode.failed)
+	{
+		std::cout << "Failed to decode texture " << texture.path << std::endl;
+		texture.failed = true;
+		texture.stale = false;
+		UReleasePixels(texture.decode.pixels);
+		return;
+	}
+
+	if (decode.width != texture.width || decode.height != texture.height || decode.channels != texture.channels)
+	{
+		texture.width = decode.width;
+		texture.height = decode.height;
+		texture.channels = decode.channels;
+		texture.levels = (int)decode.levelOffsets.size();
+		texture.baseLevel = 0;
+		while (texture.baseLevel + 1 < texture.levels
+			&& ((texture.width >> texture.baseLevel) > BASE_SIZE || (texture.height >> texture.baseLevel) > BASE_SIZE))
+			texture.baseLevel++;
+		texture.firstLevel = texture.levels;
+		texture.neededLevel = texture.baseLevel;
+		texture.neededFrame = frame;
+		texture.targetLevel = texture.baseLevel;
+		texture.stale = false;
+	}
+	if (report)
+		std::cout << "Decoded texture " << texture.path << ", " << texture.width << "x" << texture.height
+			<< ", in " << decode.milliseconds << " ms" << std::endl;
+}
+
+///////////////////////////////////////////////////
+//	UChooseLevels(int)
+//
+//	viewportHeight: height of the viewport in pixels
+//
+//	Choose each texture's level: the smallest still as wide as its largest
+//	object on screen, times texelsPerPixel, and no coarser than its base
+//	level. A finer level is wanted at once, a coarser one only after
+//	GpuMemory::IDLE_FRAMES frames without a need for the finer. Then, over
+//	the budget of UGpuMemory(), less the memory the rest of the program
+//	holds, the textures with the largest levels are coarsened first.
+///////////////////////////////////////////////////
+void TextureStreamer::UChooseLevels(int viewportHeight)
+{
+	size_t resident = 0;
+	size_t wanted = 0;
+	for (std::unique_ptr<Texture> &streamed : textures)
+	{
+		Texture &texture = *streamed;
+		if (texture.levels == 0)
+			continue;
+
+		int level = texture.baseLevel;
+		float pixels = texture.screenSize * viewportHeight * texelsPerPixel;
+		if (pixels > 0.0f)
+		{
+			float texels = (float)std::max(texture.width, texture.height);
+			level = std::min(std::max((int)std::floor(std::log2(texels / pixels)), 0), texture.baseLevel);
+		}
+		if (level <= texture.neededLevel || frame - texture.neededFrame >= GpuMemory::IDLE_FRAMES)
+		{
+			texture.neededLevel = level;
+			texture.neededFrame = frame;
+		}
+
+		texture.targetLevel = texture.neededLevel;
+		resident += UChainBytes(texture, texture.firstLevel);
+		wanted += UChainBytes(texture, texture.targetLevel);
+	}
+
+	GpuMemory &memory = UGpuMemory();
+	if (memory.budgetBytes == 0)
+		return;
+
+	size_t total = memory.GetStats().totalBytes;
+	size_t others = total > resident ? total - resident : 0;
+	size_t allowance = memory.budgetBytes > others ? memory.budgetBytes - others : 0;
+	while (wanted > allowance)
+	{
+		Texture *largest = nullptr;
+		for (std::unique_ptr<Texture> &texture : textures)
+		{
+			if (texture->levels > 0 && texture->targetLevel < texture->baseLevel
+				&& (!largest || ULevelBytes(*texture, texture->targetLevel) > ULevelBytes(*largest, largest->targetLevel)))
+				largest = texture.get();
+		}
+		if (!largest)
+			break;
+		wanted -= ULevelBytes(*largest, largest->targetLevel);
+		largest->targetLevel++;
+	}
+}
+
+///////////////////////////////////////////////////
+//	UUpload(Texture&, int)
+//
+//	texture: texture whose pixels are decoded
+//	firstLevel: largest level of the chain to specify, the texture's level 0
+//
+//	Specify the chain from firstLevel on, from the decoded pixels, and
+//	release the GL levels past it. Returns the bytes uploaded.
+///////////////////////////////////////////////////
+size_t TextureStreamer::UUpload(Texture &texture, int firstLevel)
+{
+	const Decode &decode = texture.decode;
+	const GLenum internalFormat = texture.channels == 3 ? GL_RGB8 : GL_RGBA8;
+	const GLenum format = texture.channels == 3 ? GL_RGB : GL_RGBA;
+	const int specifiedLevels = texture.levels - firstLevel;
+
+	glBindTexture(GL_TEXTURE_2D, texture.name);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // The small levels' RGB rows are not 4 byte aligned
+	for (int level = firstLevel; level < texture.levels; level++)
+	{
+		glTexImage2D(GL_TEXTURE_2D, level - firstLevel, internalFormat, std::max(texture.width >> level, 1), std::max(texture.height >> level, 1),
+			0, format, GL_UNSIGNED_BYTE, &decode.pixels[decode.levelOffsets[level]]);
+	}
+	for (int level = specifiedLevels; level < texture.specifiedLevels; level++)
+		glTexImage2D(GL_TEXTURE_2D, level, internalFormat, 0, 0, 0, format, GL_UNSIGNED_BYTE, nullptr);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, specifiedLevels - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	UGpuMemory().TrackTexture(texture.name, internalFormat, texture.width, texture.height, texture.levels, texture.path, false, firstLevel);
+	texture.firstLevel = firstLevel;
+	texture.specifiedLevels = specifiedLevels;
+	texture.stale = false;
+
+	if (report)
+		std::cout << "Texture " << texture.path << " at " << std::max(texture.width >> firstLevel, 1) << "x"
+			<< std::max(texture.height >> firstLevel, 1) << " (level " << firstLevel << ")" << std::endl;
+	return UChainBytes(texture, firstLevel);
+}
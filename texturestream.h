@@ -0,0 +1,108 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturestream.h
+// ========
+// progressive loading of the image textures: each starts as a one texel
+// placeholder, background jobs decode its file and build the mip chain,
+// and the small levels are uploaded first. Finer levels follow as the
+// objects drawn with the texture grow on screen, within an upload limit
+// per frame, and are dropped again once no object needs them for a while
+// or the GPU memory budget needs room. The decoded pixels are only kept
+// while levels wait to be uploaded; a texture wanted finer later is
+// decoded again.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "jobs.h"
+#include "renderer.h"
+
+class TextureStreamer
+{
+public:
+	struct Stats
+	{
+		size_t textures;
+		size_t decoding;			// Files being decoded by jobs
+		size_t pendingTextures;		// Textures missing levels they are wanted with
+		size_t residentBytes;		// GPU memory of the resident levels
+		size_t wantedBytes;			// GPU memory of the levels wanted, within the budget
+	};
+
+	// Levels this wide and high, and smaller, are uploaded first and always stay resident
+	static constexpr int BASE_SIZE = 64;
+	// Bytes uploaded in a frame before further textures wait for the next; a texture is never split
+	static constexpr size_t UPLOAD_BYTES_PER_FRAME = 16u << 20;
+	// Files decoded at the same time
+	static constexpr size_t MAX_DECODES = 4;
+
+	float texelsPerPixel = 1.0f;	// Texels wanted across each pixel of an object; lower trades detail for memory
+	bool report = true;				// Print each texture's uploads
+
+public:
+	TextureStreamer() = default;
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+	~TextureStreamer();
+
+	void Add(const char *path, GLuint texture);
+	void Start(JobSystem &jobs);
+	bool Reload(const char *path);
+	void Update(const std::vector<Renderer::TextureCoverage> &coverage, int viewportHeight);
+	void Stop();
+	Stats GetStats() const;
+
+private:
+	// Pixels of a file and the mip chain built from them, filled by a job
+	struct Decode
+	{
+		int width = 0;
+		int height = 0;
+		int channels = 0;
+		bool failed = false;
+		double milliseconds = 0.0;
+		std::vector<unsigned char> pixels;		// Level after level, rows bottom up
+		std::vector<size_t> levelOffsets;
+	};
+
+	struct Texture
+	{
+		const char *path;
+		GLuint name;
+		int width = 0;				// Size of the full chain's level 0, once decoded
+		int height = 0;
+		int channels = 0;
+		int levels = 0;				// Levels of the full chain, 0 until decoded
+		int baseLevel = 0;			// First level no larger than BASE_SIZE
+		int firstLevel = 0;			// Largest resident level, levels while the placeholder is
+		int specifiedLevels = 1;	// Levels of the GL texture, the placeholder's included
+		int neededLevel = 0;		// Finest level the objects needed lately
+		std::uint64_t neededFrame = 0;
+		int targetLevel = 0;		// Needed level, coarsened to fit the budget
+		float screenSize = 0.0f;	// Largest coverage this frame
+		bool decoding = false;
+		bool failed = false;		// Decoding failed, not tried again until reloaded
+		bool reload = false;		// The file changed: decode it again
+		bool stale = false;			// The resident levels are of an older file
+		JobCounter decoded;
+		Decode decode;				// Written by the job while decoding
+	};
+
+	static void UDecode(const char *path, Decode &decode);
+	static size_t ULevelBytes(const Texture &texture, int level);
+	static size_t UChainBytes(const Texture &texture, int firstLevel);
+	void ULaunchDecodes();
+	void UFinishDecode(Texture &texture);
+	void UChooseLevels(int viewportHeight);
+	size_t UUpload(Texture &texture, int firstLevel);
+
+	std::vector<std::unique_ptr<Texture>> textures;		// Kept in place while jobs write to them
+	size_t decodeCount = 0;
+	std::uint64_t frame = 0;
+	JobSystem *jobs = nullptr;		// Runs the decodes, set by Start()
+};
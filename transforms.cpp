@@ -0,0 +1,453 @@
+///////////////////////////////////////////////////////////////////////////////
+// transforms.cpp
+// ========
+// transform hierarchy: the local translation, rotation and scale of every
+// node are stored as separate arrays (structure of arrays), so the world
+// matrices can be composed several nodes at a time with SSE or AVX. Nodes
+// are stored parents first, so one pass in index order resolves the
+// hierarchy. Only nodes moved since the last update, and their descendants,
+// are recomputed.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "transforms.h"
+
+#include <glm/gtx/transform.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// Widest instruction set the compiler targets: AVX composes 8 nodes per
+// iteration, SSE 4 (always there on x86-64), other CPUs use the scalar path
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRANSFORMS_AVX 1
+#define TRANSFORMS_SSE 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORMS_SSE 1
+#endif
+
+namespace
+{
+#ifdef TRANSFORMS_SSE
+	///////////////////////////////////////////////////
+	//	UStoreColumn(__m128, __m128, __m128, __m128, float*, int)
+	//
+	//	x, y, z, w: components of one column, one node per lane
+	//	matrices: first of 4 consecutive column-major 4x4 matrices
+	//	column: column of the matrices to write
+	//
+	//	Transpose the lanes so each node's column is stored whole
+	///////////////////////////////////////////////////
+	inline void UStoreColumn(__m128 x, __m128 y, __m128 z, __m128 w, float *matrices, int column)
+	{
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		_mm_storeu_ps(matrices + column * 4, x);
+		_mm_storeu_ps(matrices + 16 + column * 4, y);
+		_mm_storeu_ps(matrices + 32 + column * 4, z);
+		_mm_storeu_ps(matrices + 48 + column * 4, w);
+	}
+#endif
+
+#ifdef TRANSFORMS_AVX
+	///////////////////////////////////////////////////
+	//	UMultiply(const float*, float*)
+	//
+	//	parent: column-major 4x4 matrix
+	//	child: column-major 4x4 matrix, replaced by parent * child
+	//
+	//	Two columns of the product per instruction: each 128 bit half
+	//	holds one column of the child, splatted element by element
+	///////////////////////////////////////////////////
+	inline void UMultiply(const float *parent, float *child)
+	{
+		__m256 p0 = _mm256_broadcast_ps((const __m128*)(parent + 0));
+		__m256 p1 = _mm256_broadcast_ps((const __m128*)(parent + 4));
+		__m256 p2 = _mm256_broadcast_ps((const __m128*)(parent + 8));
+		__m256 p3 = _mm256_broadcast_ps((const __m128*)(parent + 12));
+
+		for (int column = 0; column < 4; column += 2)
+		{
+			__m256 c = _mm256_loadu_ps(child + column * 4);
+			__m256 r = _mm256_mul_ps(p0, _mm256_permute_ps(c, 0x00));
+			r = _mm256_add_ps(r, _mm256_mul_ps(p1, _mm256_permute_ps(c, 0x55)));
+			r = _mm256_add_ps(r, _mm256_mul_ps(p2, _mm256_permute_ps(c, 0xAA)));
+			r = _mm256_add_ps(r, _mm256_mul_ps(p3, _mm256_permute_ps(c, 0xFF)));
+			_mm256_storeu_ps(child + column * 4, r);
+		}
+	}
+#elif defined(TRANSFORMS_SSE)
+	///////////////////////////////////////////////////
+	//	UMultiply(const float*, float*)
+	//
+	//	parent: column-major 4x4 matrix
+	//	child: column-major 4x4 matrix, replaced by parent * child
+	//
+	//	One column of the product per iteration: the parent's columns are
+	//	weighted by the child column's elements, splatted one at a time
+	///////////////////////////////////////////////////
+	inline void UMultiply(const float *parent, float *child)
+	{
+		__m128 p0 = _mm_loadu_ps(parent + 0);
+		__m128 p1 = _mm_loadu_ps(parent + 4);
+		__m128 p2 = _mm_loadu_ps(parent + 8);
+		__m128 p3 = _mm_loadu_ps(parent + 12);
+
+		for (int column = 0; column < 4; column++)
+		{
+			__m128 c = _mm_loadu_ps(child + column * 4);
+			__m128 r = _mm_mul_ps(p0, _mm_shuffle_ps(c, c, 0x00));
+			r = _mm_add_ps(r, _mm_mul_ps(p1, _mm_shuffle_ps(c, c, 0x55)));
+			r = _mm_add_ps(r, _mm_mul_ps(p2, _mm_shuffle_ps(c, c, 0xAA)));
+			r = _mm_add_ps(r, _mm_mul_ps(p3, _mm_shuffle_ps(c, c, 0xFF)));
+			_mm_storeu_ps(child + column * 4, r);
+		}
+	}
+#endif
+}
+
+///////////////////////////////////////////////////
+//	AddNode(const glm::vec3&, const glm::quat&, const glm::vec3&, std::uint32_t)
+//
+//	translation: position relative to the parent
+//	rotation: orientation relative to the parent
+//	scale: scale along the node's own axes
+//	parent: node the transform is relative to, NO_PARENT for the world
+//
+//	Append a node and return its index. The parent must already exist, which
+//	keeps the nodes in an order where parents come first.
+///////////////////////////////////////////////////
+std::uint32_t TransformSystem::AddNode(const glm::vec3 &translation, const glm::quat &rotation, const glm::vec3 &scale, std::uint32_t parent)
+{
+	assert(parent == NO_PARENT || parent < parents.size());
+
+	std::uint32_t node = (std::uint32_t)parents.size();
+	translationX.push_back(0.0f);
+	translationY.push_back(0.0f);
+	translationZ.push_back(0.0f);
+	rotationX.push_back(0.0f);
+	rotationY.push_back(0.0f);
+	rotationZ.push_back(0.0f);
+	rotationW.push_back(1.0f);
+	scaleX.push_back(1.0f);
+	scaleY.push_back(1.0f);
+	scaleZ.push_back(1.0f);
+	parents.push_back(parent);
+	world.push_back(glm::mat4(1.0f));
+	dirty.push_back(0);
+
+	SetLocal(node, translation, rotation, scale);
+	return node;
+}
+
+///////////////////////////////////////////////////
+//	AddNode(const glm::mat4&, std::uint32_t)
+//
+//	matrix: local matrix, a product translation * rotation * scale
+//	parent: node the transform is relative to, NO_PARENT for the world
+//
+//	Append a node whose local transform is taken apart from a matrix and
+//	return its index. Shear, which TRS cannot hold, is lost.
+///////////////////////////////////////////////////
+std::uint32_t TransformSystem::AddNode(const glm::mat4 &matrix, std::uint32_t parent)
+{
+	glm::vec3 axes[3] = { glm::vec3(matrix[0]), glm::vec3(matrix[1]), glm::vec3(matrix[2]) };
+	glm::vec3 scale(glm::length(axes[0]), glm::length(axes[1]), glm::length(axes[2]));
+
+	// A mirroring matrix is a rotation with one negative scale
+	if (glm::dot(glm::cross(axes[0], axes[1]), axes[2]) < 0.0f)
+		scale.x = -scale.x;
+
+	glm::mat3 rotation(axes[0] / scale.x, axes[1] / scale.y, axes[2] / scale.z);
+	return AddNode(glm::vec3(matrix[3]), glm::quat_cast(rotation), scale, parent);
+}
+
+///////////////////////////////////////////////////
+//	SetLocal(std::uint32_t, const glm::vec3&, const glm::quat&, const glm::vec3&)
+//
+//	node: node to move
+//	translation: position relative to the parent
+//	rotation: orientation relative to the parent, normalized here
+//	scale: scale along the node's own axes
+//
+//	Replace a node's local transform; its world matrix and its descendants'
+//	change on the next Update()
+///////////////////////////////////////////////////
+void TransformSystem::SetLocal(std::uint32_t node, const glm::vec3 &translation, const glm::quat &rotation, const glm::vec3 &scale)
+{
+	glm::quat unit = glm::normalize(rotation);
+
+	translationX[node] = translation.x;
+	translationY[node] = translation.y;
+	translationZ[node] = translation.z;
+	rotationX[node] = unit.x;
+	rotationY[node] = unit.y;
+	rotationZ[node] = unit.z;
+	rotationW[node] = unit.w;
+	scaleX[node] = scale.x;
+	scaleY[node] = scale.y;
+	scaleZ[node] = scale.z;
+
+	dirty[node] = 1;
+	firstDirty = std::min(firstDirty, (size_t)node);
+}
+
+///////////////////////////////////////////////////
+//	GetLocal(std::uint32_t, glm::vec3&, glm::quat&, glm::vec3&) const
+//
+//	node: node to read
+//	translation: receives the position relative to the parent
+//	rotation: receives the unit orientation relative to the parent
+//	scale: receives the scale along the node's own axes
+//
+//	Read back a node's local transform as SetLocal() stored it
+///////////////////////////////////////////////////
+void TransformSystem::GetLocal(std::uint32_t node, glm::vec3 &translation, glm::quat &rotation, glm::vec3 &scale) const
+{
+	translation = glm::vec3(translationX[node], translationY[node], translationZ[node]);
+	rotation = glm::quat(rotationW[node], rotationX[node], rotationY[node], rotationZ[node]);
+	scale = glm::vec3(scaleX[node], scaleY[node], scaleZ[node]);
+}
+
+///////////////////////////////////////////////////
+//	Reserve(size_t)
+//
+//	nNodes: number of nodes about to be held
+//
+//	Allocate every array once before adding many nodes
+///////////////////////////////////////////////////
+void TransformSystem::Reserve(size_t nNodes)
+{
+	for (std::vector<float> *component : { &translationX, &translationY, &translationZ,
+		&rotationX, &rotationY, &rotationZ, &rotationW, &scaleX, &scaleY, &scaleZ })
+		component->reserve(nNodes);
+	parents.reserve(nNodes);
+	world.reserve(nNodes);
+	dirty.reserve(nNodes);
+	changed.reserve(nNodes);
+}
+
+///////////////////////////////////////////////////
+//	Clear()
+//
+//	Remove every node
+///////////////////////////////////////////////////
+void TransformSystem::Clear()
+{
+	for (std::vector<float> *component : { &translationX, &translationY, &translationZ,
+		&rotationX, &rotationY, &rotationZ, &rotationW, &scaleX, &scaleY, &scaleZ })
+		component->clear();
+	parents.clear();
+	world.clear();
+	dirty.clear();
+	changed.clear();
+	firstDirty = 0;
+}
+
+///////////////////////////////////////////////////
+//	Invalidate()
+//
+//	Mark every node dirty, so the next Update() recomputes them all
+///////////////////////////////////////////////////
+void TransformSystem::Invalidate()
+{
+	std::fill(dirty.begin(), dirty.end(), (std::uint8_t)1);
+	firstDirty = 0;
+}
+
+///////////////////////////////////////////////////
+//	Update()
+//
+//	Recompute the world matrices of the dirty nodes and of their
+//	descendants: the local matrices are composed from TRS in SIMD batches,
+//	one run of consecutive dirty nodes at a time, then each node is
+//	multiplied by its parent's world matrix, parents first. Returns at once
+//	when nothing moved.
+///////////////////////////////////////////////////
+void TransformSystem::Update()
+{
+	changed.clear();
+	const size_t nNodes = parents.size();
+	if (firstDirty >= nNodes)
+		return;
+
+	// A parent has a lower index, so its flag is final before its children are reached
+	for (size_t i = firstDirty; i < nNodes; i++)
+	{
+		if (!dirty[i] && parents[i] != NO_PARENT && dirty[parents[i]])
+			dirty[i] = 1;
+		if (dirty[i])
+			changed.push_back((std::uint32_t)i);
+	}
+
+	for (size_t run = 0; run < changed.size(); )
+	{
+		size_t end = run + 1;
+		while (end < changed.size() && changed[end] == changed[end - 1] + 1)
+			end++;
+		UComposeLocal(changed[run], changed[end - 1] + 1);
+		run = end;
+	}
+	UApplyParents();
+
+	for (std::uint32_t node : changed)
+		dirty[node] = 0;
+	firstDirty = nNodes;
+}
+
+///////////////////////////////////////////////////
+//	UpdateReference()
+//
+//	Compute every world matrix as a full Update() would, with plain glm
+//	matrix products, one node at a time. Kept to check and benchmark
+//	Update(); the dirty flags are left alone.
+///////////////////////////////////////////////////
+void TransformSystem::UpdateReference()
+{
+	for (size_t i = 0; i < parents.size(); i++)
+	{
+		glm::quat rotation(rotationW[i], rotationX[i], rotationY[i], rotationZ[i]);
+		glm::mat4 local = glm::translate(glm::vec3(translationX[i], translationY[i], translationZ[i]))
+			* glm::mat4_cast(rotation)
+			* glm::scale(glm::vec3(scaleX[i], scaleY[i], scaleZ[i]));
+
+		world[i] = parents[i] == NO_PARENT ? local : world[parents[i]] * local;
+	}
+}
+
+///////////////////////////////////////////////////
+//	UComposeLocal(size_t, size_t)
+//
+//	begin: first node
+//	end: node after the last one
+//
+//	Write the local matrix translation * rotation * scale of each node to
+//	its world matrix. The rotation matrix of a unit quaternion is expanded
+//	directly, scaled per column.
+///////////////////////////////////////////////////
+void TransformSystem::UComposeLocal(size_t begin, size_t end)
+{
+	size_t i = begin;
+
+#ifdef TRANSFORMS_AVX
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(&rotationX[i]);
+		__m256 y = _mm256_loadu_ps(&rotationY[i]);
+		__m256 z = _mm256_loadu_ps(&rotationZ[i]);
+		__m256 w = _mm256_loadu_ps(&rotationW[i]);
+		__m256 sx = _mm256_loadu_ps(&scaleX[i]);
+		__m256 sy = _mm256_loadu_ps(&scaleY[i]);
+		__m256 sz = _mm256_loadu_ps(&scaleZ[i]);
+
+		__m256 x2 = _mm256_add_ps(x, x);
+		__m256 y2 = _mm256_add_ps(y, y);
+		__m256 z2 = _mm256_add_ps(z, z);
+		__m256 xx = _mm256_mul_ps(x, x2);
+		__m256 yy = _mm256_mul_ps(y, y2);
+		__m256 zz = _mm256_mul_ps(z, z2);
+		__m256 xy = _mm256_mul_ps(x, y2);
+		__m256 xz = _mm256_mul_ps(x, z2);
+		__m256 yz = _mm256_mul_ps(y, z2);
+		__m256 wx = _mm256_mul_ps(w, x2);
+		__m256 wy = _mm256_mul_ps(w, y2);
+		__m256 wz = _mm256_mul_ps(w, z2);
+
+		__m256 columns[4][4] =
+		{
+			{ _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), sx), _mm256_mul_ps(_mm256_add_ps(xy, wz), sx), _mm256_mul_ps(_mm256_sub_ps(xz, wy), sx), zero },
+			{ _mm256_mul_ps(_mm256_sub_ps(xy, wz), sy), _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, zz)), sy), _mm256_mul_ps(_mm256_add_ps(yz, wx), sy), zero },
+			{ _mm256_mul_ps(_mm256_add_ps(xz, wy), sz), _mm256_mul_ps(_mm256_sub_ps(yz, wx), sz), _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, yy)), sz), zero },
+			{ _mm256_loadu_ps(&translationX[i]), _mm256_loadu_ps(&translationY[i]), _mm256_loadu_ps(&translationZ[i]), one },
+		};
+
+		// The transposes work on 4 lanes: the low half is nodes i to i + 3, the high half the next 4
+		float *matrices = &world[i][0][0];
+		for (int column = 0; column < 4; column++)
+		{
+			const __m256 *c = columns[column];
+			UStoreColumn(_mm256_castps256_ps128(c[0]), _mm256_castps256_ps128(c[1]),
+				_mm256_castps256_ps128(c[2]), _mm256_castps256_ps128(c[3]), matrices, column);
+			UStoreColumn(_mm256_extractf128_ps(c[0], 1), _mm256_extractf128_ps(c[1], 1),
+				_mm256_extractf128_ps(c[2], 1), _mm256_extractf128_ps(c[3], 1), matrices + 64, column);
+		}
+	}
+#elif defined(TRANSFORMS_SSE)
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= end; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&rotationX[i]);
+		__m128 y = _mm_loadu_ps(&rotationY[i]);
+		__m128 z = _mm_loadu_ps(&rotationZ[i]);
+		__m128 w = _mm_loadu_ps(&rotationW[i]);
+		__m128 sx = _mm_loadu_ps(&scaleX[i]);
+		__m128 sy = _mm_loadu_ps(&scaleY[i]);
+		__m128 sz = _mm_loadu_ps(&scaleZ[i]);
+
+		__m128 x2 = _mm_add_ps(x, x);
+		__m128 y2 = _mm_add_ps(y, y);
+		__m128 z2 = _mm_add_ps(z, z);
+		__m128 xx = _mm_mul_ps(x, x2);
+		__m128 yy = _mm_mul_ps(y, y2);
+		__m128 zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2);
+		__m128 xz = _mm_mul_ps(x, z2);
+		__m128 yz = _mm_mul_ps(y, z2);
+		__m128 wx = _mm_mul_ps(w, x2);
+		__m128 wy = _mm_mul_ps(w, y2);
+		__m128 wz = _mm_mul_ps(w, z2);
+
+		float *matrices = &world[i][0][0];
+		UStoreColumn(_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx), _mm_mul_ps(_mm_add_ps(xy, wz), sx),
+			_mm_mul_ps(_mm_sub_ps(xz, wy), sx), zero, matrices, 0);
+		UStoreColumn(_mm_mul_ps(_mm_sub_ps(xy, wz), sy), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy),
+			_mm_mul_ps(_mm_add_ps(yz, wx), sy), zero, matrices, 1);
+		UStoreColumn(_mm_mul_ps(_mm_add_ps(xz, wy), sz), _mm_mul_ps(_mm_sub_ps(yz, wx), sz),
+			_mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz), zero, matrices, 2);
+		UStoreColumn(_mm_loadu_ps(&translationX[i]), _mm_loadu_ps(&translationY[i]),
+			_mm_loadu_ps(&translationZ[i]), one, matrices, 3);
+	}
+#endif
+
+	// The nodes left over by the SIMD batches, or all of them without SIMD
+	for (; i < end; i++)
+	{
+		float x = rotationX[i], y = rotationY[i], z = rotationZ[i], w = rotationW[i];
+		float xx = 2.0f * x * x, yy = 2.0f * y * y, zz = 2.0f * z * z;
+		float xy = 2.0f * x * y, xz = 2.0f * x * z, yz = 2.0f * y * z;
+		float wx = 2.0f * w * x, wy = 2.0f * w * y, wz = 2.0f * w * z;
+
+		glm::mat4 &matrix = world[i];
+		matrix[0] = glm::vec4(1.0f - yy - zz, xy + wz, xz - wy, 0.0f) * scaleX[i];
+		matrix[1] = glm::vec4(xy - wz, 1.0f - xx - zz, yz + wx, 0.0f) * scaleY[i];
+		matrix[2] = glm::vec4(xz + wy, yz - wx, 1.0f - xx - yy, 0.0f) * scaleZ[i];
+		matrix[3] = glm::vec4(translationX[i], translationY[i], translationZ[i], 1.0f);
+	}
+}
+
+///////////////////////////////////////////////////
+//	UApplyParents()
+//
+//	Turn the local matrices of the changed nodes into world matrices.
+//	Parents come before their children, so each parent is final by the
+//	time its children read it.
+///////////////////////////////////////////////////
+void TransformSystem::UApplyParents()
+{
+	for (std::uint32_t i : changed)
+	{
+		std::uint32_t parent = parents[i];
+		if (parent == NO_PARENT)
+			continue;
+
+#ifdef TRANSFORMS_SSE
+		UMultiply(&world[parent][0][0], &world[i][0][0]);
+#else
+		world[i] = world[parent] * world[i];
+#endif
+	}
+}
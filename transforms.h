@@ -0,0 +1,57 @@
+///////////////////////////////////////////////////////////////////////////////
+// transforms.h
+// ========
+// transform hierarchy: the local translation, rotation and scale of every
+// node are stored as separate arrays (structure of arrays), so the world
+// matrices can be composed several nodes at a time with SSE or AVX. Nodes
+// are stored parents first, so one pass in index order resolves the
+// hierarchy. Only nodes moved since the last update, and their descendants,
+// are recomputed.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class TransformSystem
+{
+public:
+	// Parent of the nodes placed directly in the world
+	static constexpr std::uint32_t NO_PARENT = 0xFFFFFFFFu;
+
+public:
+	std::uint32_t AddNode(const glm::vec3 &translation, const glm::quat &rotation, const glm::vec3 &scale, std::uint32_t parent = NO_PARENT);
+	std::uint32_t AddNode(const glm::mat4 &matrix, std::uint32_t parent = NO_PARENT);
+	void SetLocal(std::uint32_t node, const glm::vec3 &translation, const glm::quat &rotation, const glm::vec3 &scale);
+	void GetLocal(std::uint32_t node, glm::vec3 &translation, glm::quat &rotation, glm::vec3 &scale) const;
+	void Reserve(size_t nNodes);
+	void Clear();
+	void Invalidate();
+	void Update();
+	void UpdateReference();
+
+	size_t Size() const { return parents.size(); }
+	std::uint32_t Parent(std::uint32_t node) const { return parents[node]; }
+	const glm::mat4 &World(std::uint32_t node) const { return world[node]; }
+	// Nodes whose world matrix the last Update() recomputed, in increasing order
+	const std::vector<std::uint32_t> &Changed() const { return changed; }
+
+private:
+	void UComposeLocal(size_t begin, size_t end);
+	void UApplyParents();
+
+	// Local transform of each node, one array per component
+	std::vector<float> translationX, translationY, translationZ;
+	std::vector<float> rotationX, rotationY, rotationZ, rotationW;	// Unit quaternion
+	std::vector<float> scaleX, scaleY, scaleZ;
+	std::vector<std::uint32_t> parents;		// Always a lower index than the node, or NO_PARENT
+	std::vector<glm::mat4> world;			// World matrix of each node, valid after Update()
+
+	std::vector<std::uint8_t> dirty;		// The node's local transform changed since the last Update()
+	size_t firstDirty = 0;					// No node before this one is dirty
+	std::vector<std::uint32_t> changed;
+};
@@ -0,0 +1,236 @@
+///////////////////////////////////////////////////////////////////////////////
+// triangles.cpp
+// ========
+// CPU copy of a mesh's triangles for ray queries. The corner and the two
+// edges of every triangle are stored as separate arrays (structure of
+// arrays), so a ray is tested against 8 triangles at a time with AVX or
+// 4 with SSE.
+///////////////////////////////////////////////////////////////////////////////
+
+#include "triangles.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Widest instruction set the compiler targets: AVX tests 8 triangles per
+// iteration, SSE 4 (always there on x86-64), other CPUs use the scalar path
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRIANGLES_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRIANGLES_SSE 1
+#endif
+
+namespace
+{
+	// Rays closer than this to the plane of a triangle miss it, which also
+	// rejects the degenerate padding triangles
+	const float MIN_DETERMINANT = 1e-12f;
+}
+
+///////////////////////////////////////////////////
+//	Assign(const float*, size_t, const std::uint32_t*, size_t)
+//
+//	positions: x, y, z of the first vertex, the next vertex stride floats later
+//	stride: floats from one vertex to the next
+//	indices: three vertices per triangle
+//	nIndices: number of indices
+//
+//	Replace the triangles with those of an indexed triangle list
+///////////////////////////////////////////////////
+void TriangleSet::Assign(const float *positions, size_t stride, const std::uint32_t *indices, size_t nIndices)
+{
+	nTriangles = nIndices / 3;
+	size_t padded = (nTriangles + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+	for (std::vector<float> *component : { &cornerX, &cornerY, &cornerZ, &edge1X, &edge1Y, &edge1Z, &edge2X, &edge2Y, &edge2Z })
+		component->assign(padded, 0.0f);
+
+	for (size_t i = 0; i < nTriangles; i++)
+	{
+		const float *a = positions + indices[i * 3] * stride;
+		const float *b = positions + indices[i * 3 + 1] * stride;
+		const float *c = positions + indices[i * 3 + 2] * stride;
+
+		cornerX[i] = a[0];
+		cornerY[i] = a[1];
+		cornerZ[i] = a[2];
+		edge1X[i] = b[0] - a[0];
+		edge1Y[i] = b[1] - a[1];
+		edge1Z[i] = b[2] - a[2];
+		edge2X[i] = c[0] - a[0];
+		edge2Y[i] = c[1] - a[1];
+		edge2Z[i] = c[2] - a[2];
+	}
+}
+
+///////////////////////////////////////////////////
+//	Clear()
+//
+//	Remove every triangle and release the arrays
+///////////////////////////////////////////////////
+void TriangleSet::Clear()
+{
+	for (std::vector<float> *component : { &cornerX, &cornerY, &cornerZ, &edge1X, &edge1Y, &edge1Z, &edge2X, &edge2Y, &edge2Z })
+		std::vector<float>().swap(*component);
+	nTriangles = 0;
+}
+
+///////////////////////////////////////////////////
+//	Raycast(const glm::vec3&, const glm::vec3&, float)
+//
+//	origin: start of the ray
+//	direction: direction of the ray; distances are in multiples of its length
+//	maxDistance: farthest distance to search
+//
+//	Return the distance along the ray to the nearest triangle it hits
+//	(either side), or a negative value when it hits none within maxDistance.
+//	Moller-Trumbore on a block of triangles at a time, with the vector width
+//	of the CPU.
+///////////////////////////////////////////////////
+float TriangleSet::Raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const
+{
+	const size_t padded = cornerX.size();
+
+#if defined(TRIANGLES_AVX)
+	const __m256 originX = _mm256_set1_ps(origin.x), originY = _mm256_set1_ps(origin.y), originZ = _mm256_set1_ps(origin.z);
+	const __m256 directionX = _mm256_set1_ps(direction.x), directionY = _mm256_set1_ps(direction.y), directionZ = _mm256_set1_ps(direction.z);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 minDeterminant = _mm256_set1_ps(MIN_DETERMINANT);
+	const __m256 signBit = _mm256_set1_ps(-0.0f);
+	__m256 nearest = _mm256_set1_ps(maxDistance);
+	__m256 anyHit = zero;
+
+	for (size_t i = 0; i < padded; i += 8)
+	{
+		__m256 e1x = _mm256_loadu_ps(&edge1X[i]), e1y = _mm256_loadu_ps(&edge1Y[i]), e1z = _mm256_loadu_ps(&edge1Z[i]);
+		__m256 e2x = _mm256_loadu_ps(&edge2X[i]), e2y = _mm256_loadu_ps(&edge2Y[i]), e2z = _mm256_loadu_ps(&edge2Z[i]);
+
+		// p = direction x edge2, determinant = edge1 . p
+		__m256 px = _mm256_sub_ps(_mm256_mul_ps(directionY, e2z), _mm256_mul_ps(directionZ, e2y));
+		__m256 py = _mm256_sub_ps(_mm256_mul_ps(directionZ, e2x), _mm256_mul_ps(directionX, e2z));
+		__m256 pz = _mm256_sub_ps(_mm256_mul_ps(directionX, e2y), _mm256_mul_ps(directionY, e2x));
+		__m256 determinant = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+		__m256 inverseDeterminant = _mm256_div_ps(one, determinant);
+
+		// Barycentric u from the origin's offset to the corner
+		__m256 sx = _mm256_sub_ps(originX, _mm256_loadu_ps(&cornerX[i]));
+		__m256 sy = _mm256_sub_ps(originY, _mm256_loadu_ps(&cornerY[i]));
+		__m256 sz = _mm256_sub_ps(originZ, _mm256_loadu_ps(&cornerZ[i]));
+		__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inverseDeterminant);
+
+		// q = offset x edge1 gives v and the distance
+		__m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+		__m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+		__m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+		__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(directionX, qx), _mm256_mul_ps(directionY, qy)), _mm256_mul_ps(directionZ, qz)), inverseDeterminant);
+		__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inverseDeterminant);
+
+		__m256 hit = _mm256_cmp_ps(_mm256_andnot_ps(signBit, determinant), minDeterminant, _CMP_GT_OQ);
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, nearest, _CMP_LT_OQ));
+		nearest = _mm256_blendv_ps(nearest, t, hit);
+		anyHit = _mm256_or_ps(anyHit, hit);
+	}
+
+	if (_mm256_movemask_ps(anyHit) == 0)
+		return -1.0f;
+	alignas(32) float lanes[8];
+	_mm256_store_ps(lanes, nearest);
+	return *std::min_element(lanes, lanes + 8);
+#elif defined(TRIANGLES_SSE)
+	const __m128 originX = _mm_set1_ps(origin.x), originY = _mm_set1_ps(origin.y), originZ = _mm_set1_ps(origin.z);
+	const __m128 directionX = _mm_set1_ps(direction.x), directionY = _mm_set1_ps(direction.y), directionZ = _mm_set1_ps(direction.z);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minDeterminant = _mm_set1_ps(MIN_DETERMINANT);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	__m128 nearest = _mm_set1_ps(maxDistance);
+	__m128 anyHit = zero;
+
+	for (size_t i = 0; i < padded; i += 4)
+	{
+		__m128 e1x = _mm_loadu_ps(&edge1X[i]), e1y = _mm_loadu_ps(&edge1Y[i]), e1z = _mm_loadu_ps(&edge1Z[i]);
+		__m128 e2x = _mm_loadu_ps(&edge2X[i]), e2y = _mm_loadu_ps(&edge2Y[i]), e2z = _mm_loadu_ps(&edge2Z[i]);
+
+		// p = direction x edge2, determinant = edge1 . p
+		__m128 px = _mm_sub_ps(_mm_mul_ps(directionY, e2z), _mm_mul_ps(directionZ, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(directionZ, e2x), _mm_mul_ps(directionX, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(directionX, e2y), _mm_mul_ps(directionY, e2x));
+		__m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 inverseDeterminant = _mm_div_ps(one, determinant);
+
+		// Barycentric u from the origin's offset to the corner
+		__m128 sx = _mm_sub_ps(originX, _mm_loadu_ps(&cornerX[i]));
+		__m128 sy = _mm_sub_ps(originY, _mm_loadu_ps(&cornerY[i]));
+		__m128 sz = _mm_sub_ps(originZ, _mm_loadu_ps(&cornerZ[i]));
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverseDeterminant);
+
+		// q = offset x edge1 gives v and the distance
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, qx), _mm_mul_ps(directionY, qy)), _mm_mul_ps(directionZ, qz)), inverseDeterminant);
+		__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDeterminant);
+
+		__m128 hit = _mm_cmpgt_ps(_mm_andnot_ps(signBit, determinant), minDeterminant);
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+		hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(t, zero));
+		hit = _mm_and_ps(hit, _mm_cmplt_ps(t, nearest));
+		nearest = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, nearest));
+		anyHit = _mm_or_ps(anyHit, hit);
+	}
+
+	if (_mm_movemask_ps(anyHit) == 0)
+		return -1.0f;
+	alignas(16) float lanes[4];
+	_mm_store_ps(lanes, nearest);
+	return *std::min_element(lanes, lanes + 4);
+#else
+	(void)padded;
+	return RaycastReference(origin, direction, maxDistance);
+#endif
+}
+
+///////////////////////////////////////////////////
+//	RaycastReference(const glm::vec3&, const glm::vec3&, float)
+//
+//	origin: start of the ray
+//	direction: direction of the ray; distances are in multiples of its length
+//	maxDistance: farthest distance to search
+//
+//	Same as Raycast(), one triangle at a time with glm. Used where there is
+//	no SIMD and to check the vector kernels.
+///////////////////////////////////////////////////
+float TriangleSet::RaycastReference(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const
+{
+	float nearest = -1.0f;
+	for (size_t i = 0; i < nTriangles; i++)
+	{
+		glm::vec3 edge1(edge1X[i], edge1Y[i], edge1Z[i]);
+		glm::vec3 edge2(edge2X[i], edge2Y[i], edge2Z[i]);
+		glm::vec3 p = glm::cross(direction, edge2);
+		float determinant = glm::dot(edge1, p);
+		if (std::abs(determinant) <= MIN_DETERMINANT)
+			continue;
+		float inverseDeterminant = 1.0f / determinant;
+
+		glm::vec3 offset = origin - glm::vec3(cornerX[i], cornerY[i], cornerZ[i]);
+		float u = glm::dot(offset, p) * inverseDeterminant;
+		glm::vec3 q = glm::cross(offset, edge1);
+		float v = glm::dot(direction, q) * inverseDeterminant;
+		float t = glm::dot(edge2, q) * inverseDeterminant;
+		if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t < maxDistance)
+		{
+			maxDistance = t;
+			nearest = t;
+		}
+	}
+	return nearest;
+}
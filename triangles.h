@@ -0,0 +1,37 @@
+///////////////////////////////////////////////////////////////////////////////
+// triangles.h
+// ========
+// CPU copy of a mesh's triangles for ray queries. The corner and the two
+// edges of every triangle are stored as separate arrays (structure of
+// arrays), so a ray is tested against 8 triangles at a time with AVX or
+// 4 with SSE.
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class TriangleSet
+{
+public:
+	// The arrays are padded to a multiple of this many triangles, the widest
+	// kernel's lane count, with degenerate triangles no ray hits
+	static constexpr size_t BLOCK_SIZE = 8;
+
+public:
+	void Assign(const float *positions, size_t stride, const std::uint32_t *indices, size_t nIndices);
+	void Clear();
+	float Raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const;
+	float RaycastReference(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance) const;
+
+	size_t Size() const { return nTriangles; }
+
+private:
+	std::vector<float> cornerX, cornerY, cornerZ;	// First vertex of each triangle
+	std::vector<float> edge1X, edge1Y, edge1Z;		// Second vertex minus the first
+	std::vector<float> edge2X, edge2Y, edge2Z;		// Third vertex minus the first
+	size_t nTriangles = 0;
+};